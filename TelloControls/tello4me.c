@@ -6,6 +6,9 @@
 
 #include "tellopy/telloc/telloc.h"
 
+// stick deflection for movement keys, out of 100
+#define STICK 50
+
 int controls()
 {
     struct termios oldattr, newattr;
@@ -58,6 +61,8 @@ int main()
         {
             break;
         }
+        // movement keys steer with the rc sticks; a held key repeats, and the library stops the drone once it is let go
+        int lr = 0, fb = 0, ud = 0, yaw = 0;
         switch (ch) 
         {
             case 'g':
@@ -68,28 +73,28 @@ int main()
                 sprintf(command, "land");
                 break;
             case 'w':
-                sprintf(command, "forward 40");
+                fb = STICK;
                 break;
             case 'a':
-                sprintf(command, "left 40");
+                lr = -STICK;
                 break;
             case 's':
-                sprintf(command, "back 40");
+                fb = -STICK;
                 break;
             case 'd':
-                sprintf(command, "right 40");
+                lr = STICK;
                 break;
             case 'r':
-                sprintf(command, "up 40");
+                ud = STICK;
                 break;
             case 'f': // ASCII code for [shift]
-                sprintf(command, "down 40");
+                ud = -STICK;
                 break;
             case ',': // ASCII code for [<-]
-                sprintf(command, "cw 150");
+                yaw = STICK;
                 break;
             case '.': // ASCII code for [->]
-                sprintf(command, "ccw 150");
+                yaw = -STICK;
                 break;
             case ' ': // emergency land
                 sprintf(command, "emergency");
@@ -97,6 +102,11 @@ int main()
             default:
                 continue;
         }
+        if (lr != 0 || fb != 0 || ud != 0 || yaw != 0) {
+            // never blocks, so the next key is read straight away
+            telloc_set_rc(connection, lr, fb, ud, yaw);
+            continue;
+        }
         // send command here
         printf("command: %s\n", command);
         ret_command = telloc_send_command(connection, command, strlen(command), response, TELLOC_STATE_SIZE);
@@ -12,13 +12,13 @@ set build_python="true"
 set python_dir="%userprofile%\AppData\Local\Programs\Python\Python311"
 
 rem :: compile telloc ::
-set SOURCES=telloc\video.c telloc\telloc_windows.c
+set SOURCES=telloc\video.c telloc\state.c telloc\command.c telloc\schedule.c telloc\record.c telloc\replay.c telloc\convert.c telloc\stats.c telloc\trace.c telloc\telloc_windows.c
 set avcodec=%ffmpeg_lib_dir%\avcodec.lib
 set avformat=%ffmpeg_lib_dir%\avformat.lib
 set avutil=%ffmpeg_lib_dir%\avutil.lib
 set swscale=%ffmpeg_lib_dir%\swscale.lib
-cl /c /MT /Itelloc\ /I%ffmpeg_include_dir% %SOURCES% 
-lib /OUT:telloc.lib /MACHINE:X64  video.obj telloc_windows.obj %avcodec% %avformat% %avutil% %swscale% ws2_32.lib
+cl /c /MT /O2 /Itelloc\ /I%ffmpeg_include_dir% %SOURCES% 
+lib /OUT:telloc.lib /MACHINE:X64  video.obj state.obj command.obj schedule.obj record.obj replay.obj convert.obj stats.obj trace.obj telloc_windows.obj %avcodec% %avformat% %avutil% %swscale% ws2_32.lib
 pause
 rem :: compile test program ::
 cl /c telloc/main_windows.c /Itelloc 
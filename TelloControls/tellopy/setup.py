@@ -9,6 +9,7 @@ setup(
     long_description_content_type='text/markdown',
     url='https://github.com/alecGraves/tellopy',
     packages=find_packages(),
+    install_requires=['numpy'],
     package_data={'telloc': ['libtellopy.so', 'libtellopy.pyd', "*.dll"]},
     include_package_data=True,
     classifiers=[
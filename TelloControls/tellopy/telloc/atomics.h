@@ -0,0 +1,109 @@
+// Contains the few atomic operations the telloc library's lock-free structures use
+//
+#ifndef TELLOC_ATOMICS_H
+#define TELLOC_ATOMICS_H
+
+#ifdef _MSC_VER
+
+#include <windows.h>
+#include <intrin.h>
+
+// aligned loads and stores up to the word size are atomic on the targets we build for. x86 keeps loads and stores
+// in order, so only the compiler needs a barrier there; other targets get a full fence
+#if defined(_M_X64) || defined(_M_IX86)
+#define telloc_atomic_fence_acquire() _ReadWriteBarrier()
+#define telloc_atomic_fence_release() _ReadWriteBarrier()
+#else
+#define telloc_atomic_fence_acquire() MemoryBarrier()
+#define telloc_atomic_fence_release() MemoryBarrier()
+#endif
+
+// function to load a counter, ordering later reads after it
+static __inline unsigned int telloc_atomic_load_acquire(volatile unsigned int* value) {
+    unsigned int result = *value;
+    telloc_atomic_fence_acquire();
+    return result;
+}
+
+// function to store a counter, ordering earlier writes before it
+static __inline void telloc_atomic_store_release(volatile unsigned int* value, unsigned int store) {
+    telloc_atomic_fence_release();
+    *value = store;
+}
+
+#if defined(_M_IX86) || defined(_M_ARM)
+// 32-bit targets load and store 64 bits in two halves, which another thread can see torn, so 64-bit counters
+// go through the interlocked functions there; they are full fences
+
+// function to load a 64-bit counter, ordering later reads after it
+static __inline unsigned long long telloc_atomic_load64_acquire(volatile unsigned long long* value) {
+    return (unsigned long long) InterlockedCompareExchange64((volatile LONG64*) value, 0, 0);
+}
+
+// function to store a 64-bit counter, ordering earlier writes before it
+static __inline void telloc_atomic_store64_release(volatile unsigned long long* value, unsigned long long store) {
+    InterlockedExchange64((volatile LONG64*) value, (LONG64) store);
+}
+#else
+// function to load a 64-bit counter, ordering later reads after it
+static __inline unsigned long long telloc_atomic_load64_acquire(volatile unsigned long long* value) {
+    unsigned long long result = *value;
+    telloc_atomic_fence_acquire();
+    return result;
+}
+
+// function to store a 64-bit counter, ordering earlier writes before it
+static __inline void telloc_atomic_store64_release(volatile unsigned long long* value, unsigned long long store) {
+    telloc_atomic_fence_release();
+    *value = store;
+}
+#endif
+
+// function to add to a 64-bit counter shared between threads; returns the value before the add
+static __inline unsigned long long telloc_atomic_add64(volatile unsigned long long* value, unsigned long long add) {
+    return (unsigned long long) InterlockedExchangeAdd64((volatile LONG64*) value, (LONG64) add);
+}
+
+// function to replace a pointer if it still is expected; returns 1 if it was replaced
+static __inline int telloc_atomic_swap_pointer(void* volatile* pointer, void* expected, void* desired) {
+    return InterlockedCompareExchangePointer((volatile PVOID*) pointer, desired, expected) == expected;
+}
+
+#else
+
+#define telloc_atomic_fence_acquire() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define telloc_atomic_fence_release() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+// function to load a counter, ordering later reads after it
+static __inline unsigned int telloc_atomic_load_acquire(volatile unsigned int* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+// function to store a counter, ordering earlier writes before it
+static __inline void telloc_atomic_store_release(volatile unsigned int* value, unsigned int store) {
+    __atomic_store_n(value, store, __ATOMIC_RELEASE);
+}
+
+// function to load a 64-bit counter, ordering later reads after it
+static __inline unsigned long long telloc_atomic_load64_acquire(volatile unsigned long long* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+// function to store a 64-bit counter, ordering earlier writes before it
+static __inline void telloc_atomic_store64_release(volatile unsigned long long* value, unsigned long long store) {
+    __atomic_store_n(value, store, __ATOMIC_RELEASE);
+}
+
+// function to add to a 64-bit counter shared between threads; returns the value before the add
+static __inline unsigned long long telloc_atomic_add64(volatile unsigned long long* value, unsigned long long add) {
+    return __atomic_fetch_add(value, add, __ATOMIC_RELAXED);
+}
+
+// function to replace a pointer if it still is expected; returns 1 if it was replaced
+static __inline int telloc_atomic_swap_pointer(void* volatile* pointer, void* expected, void* desired) {
+    return __atomic_compare_exchange_n(pointer, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+#endif
+
+#endif //TELLOC_ATOMICS_H
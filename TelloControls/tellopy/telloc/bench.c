@@ -0,0 +1,621 @@
+// This program benchmarks the hot paths of the telloc library on a generated Tello-like stream, so regressions show up
+// before they reach a drone. Each benchmark runs repeats times on the same data and the fastest run is kept:
+//
+//   reassemble     cutting 1460 byte datagrams back into access units, per datagram
+//   decode         decoding the access units, per unit
+//   convert        converting a decoded 960x720 picture to RGB24 with the best kernel, per frame
+//   state_parse    parsing a state string into a telloc_state, per datagram
+//   frame_handoff  a recording replayed as fast as it decodes, from decoded picture to RGB frame in the reader's hands
+//   command_rtt    telloc_send_command against a responder on loopback, per command
+//
+// Every benchmark reports its throughput, p50/p99/max latency per operation and the allocations made while it ran
+// (the whole process, library threads included; counted on glibc only, -1 elsewhere). A table goes to stdout
+// and the results to a json file.
+//
+//   telloc_bench [-o results.json] [-f frames] [-c commands] [-r repeats] [benchmark ...]
+//
+#include "telloc.h"
+#include "video.h"
+#include "state.h"
+#include "record.h"
+#include "sample.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the Tello splits video into datagrams of this size
+#define BENCH_FRAGMENT_SIZE 1460
+// the Tello streams 30 frames a second
+#define BENCH_FRAME_PERIOD_NS 33333333ULL
+// state strings parsed per run
+#define BENCH_STATES 100000
+// where the command benchmark's responder listens; the connection binds free ports next to it
+#define BENCH_ADDRESS "127.0.0.1"
+#define BENCH_COMMAND_PORT 8889
+
+// a state string as the drone sends it
+static const char bench_state[] = "mid:-1;x:0;y:0;z:0;mpry:0,0,0;pitch:1;roll:-2;yaw:37;vgx:0;vgy:0;vgz:0;templ:83;temph:85;"
+                                  "tof:10;h:0;bat:87;baro:-2.47;time:0;agx:-5.00;agy:0.00;agz:-998.00;\r\n";
+
+
+#ifdef __GLIBC__
+// glibc's own allocator, which the wrappers below count calls to. the program's definitions take the place of
+// libc's for the library and ffmpeg too
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* pointer, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+
+static unsigned long long bench_allocations;
+
+void* malloc(size_t size) {
+    __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(pointer, size);
+}
+
+// ffmpeg allocates its buffers aligned
+int posix_memalign(void** pointer, size_t alignment, size_t size) {
+    __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+    void* allocated = __libc_memalign(alignment, size);
+    if (allocated == NULL) {
+        return ENOMEM;
+    }
+    *pointer = allocated;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_memalign(alignment, size);
+}
+
+// function to read the allocation counter
+static long long bench_allocation_count(void) {
+    return (long long) __atomic_load_n(&bench_allocations, __ATOMIC_RELAXED);
+}
+#else
+static long long bench_allocation_count(void) {
+    return -1;
+}
+#endif
+
+
+// the datagrams and access units of the generated stream, shared by every benchmark
+typedef struct {
+    unsigned char* stream;
+    unsigned int stream_size;
+    // every datagram points into the stream
+    unsigned int* datagram_offsets;
+    unsigned int* datagram_lengths;
+    unsigned int datagram_count;
+    // copies of the access units the reassembler found, with their keyframe flags
+    telloc_video_unit* units;
+    unsigned int unit_count;
+    unsigned int commands;
+} bench_data;
+
+// one run of a benchmark: a latency sample per operation, and totals between bench_start and bench_stop
+typedef struct {
+    const char* name;
+    // what one operation is, e.g. "datagram"
+    const char* unit;
+    unsigned long long* samples;
+    unsigned int capacity;
+    unsigned int count;
+    unsigned long long bytes;
+    unsigned long long start;
+    unsigned long long elapsed;
+    long long allocations;
+    int failed;
+} bench_run;
+
+typedef int (*bench_function)(const bench_data* data, bench_run* run);
+
+
+// function to start timing a run, once its setup is done
+static void bench_start(bench_run* run) {
+    run->count = 0;
+    run->bytes = 0;
+    run->allocations = bench_allocation_count();
+    run->start = telloc_time();
+}
+
+// function to stop timing a run, before its teardown
+static void bench_stop(bench_run* run) {
+    run->elapsed = telloc_time() - run->start;
+    long long allocations = bench_allocation_count();
+    run->allocations = allocations < 0 ? -1 : allocations - run->allocations;
+}
+
+// function to note how long one operation took
+static void bench_sample(bench_run* run, unsigned long long nanoseconds, unsigned long long bytes) {
+    if (run->count < run->capacity) {
+        run->samples[run->count++] = nanoseconds;
+    }
+    run->bytes += bytes;
+}
+
+static int bench_compare_samples(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*) a;
+    unsigned long long y = *(const unsigned long long*) b;
+    return x < y ? -1 : x > y;
+}
+
+// function to get a percentile of sorted samples, by nearest rank
+static double bench_percentile_us(const bench_run* run, double percentile) {
+    if (run->count == 0) {
+        return 0.0;
+    }
+    unsigned int rank = (unsigned int) (percentile / 100.0 * run->count + 0.5);
+    rank = rank < 1 ? 1 : rank > run->count ? run->count : rank;
+    return (double) run->samples[rank - 1] / 1000.0;
+}
+
+static double bench_ops_per_second(const bench_run* run) {
+    return run->elapsed == 0 ? 0.0 : (double) run->count * 1e9 / (double) run->elapsed;
+}
+
+
+// benchmark of the reassembler, fed the stream in Tello sized datagrams
+static int bench_reassemble(const bench_data* data, bench_run* run) {
+    telloc_video_reassembler reassembler;
+    if (telloc_video_reassembler_init(&reassembler) != 0) {
+        return 1;
+    }
+    telloc_video_unit unit;
+    unsigned int units = 0;
+
+    bench_start(run);
+    for (unsigned int i = 0; i < data->datagram_count; i++) {
+        unsigned long long start = telloc_time();
+        telloc_video_reassembler_push(&reassembler, data->stream + data->datagram_offsets[i], data->datagram_lengths[i], start);
+        while (telloc_video_reassembler_next(&reassembler, &unit) == 0) {
+            units++;
+        }
+        bench_sample(run, telloc_time() - start, data->datagram_lengths[i]);
+    }
+    bench_stop(run);
+
+    telloc_video_reassembler_free(&reassembler);
+    // the last unit only completes once the next one starts
+    return units + 1 < data->unit_count;
+}
+
+// function to open a decoder with the options telloc_connect uses
+static int bench_decoder_init(telloc_video_decoder* decoder) {
+    telloc_config config;
+    telloc_config_default(&config);
+    if (telloc_video_decoder_init(decoder, &config.video) != 0) {
+        telloc_video_decoder_free(decoder);
+        return 1;
+    }
+    return 0;
+}
+
+// benchmark of the decoder, fed the reassembled access units
+static int bench_decode(const bench_data* data, bench_run* run) {
+    telloc_video_decoder decoder;
+    if (bench_decoder_init(&decoder) != 0) {
+        return 1;
+    }
+    unsigned long long frames = 0;
+
+    bench_start(run);
+    for (unsigned int i = 0; i < data->unit_count; i++) {
+        unsigned long long start = telloc_time();
+        int ready = telloc_video_decoder_decode(&decoder, &data->units[i]) == 0;
+        while (ready) {
+            frames++;
+            ready = telloc_video_decoder_receive(&decoder) == 0;
+        }
+        bench_sample(run, telloc_time() - start, data->units[i].length);
+    }
+    bench_stop(run);
+
+    telloc_video_decoder_free(&decoder);
+    return frames == 0;
+}
+
+// benchmark of the conversion kernels on a decoded picture, converted once per frame of the stream
+static int bench_convert(const bench_data* data, bench_run* run) {
+    telloc_video_decoder decoder;
+    if (bench_decoder_init(&decoder) != 0) {
+        return 1;
+    }
+    int ready = 0;
+    for (unsigned int i = 0; i < data->unit_count && !ready; i++) {
+        ready = telloc_video_decoder_decode(&decoder, &data->units[i]) == 0;
+    }
+    unsigned int width = (unsigned int) decoder.frame->width;
+    unsigned int height = (unsigned int) decoder.frame->height;
+    unsigned char* output = malloc((size_t) width * height * 3);
+    if (!ready || output == NULL) {
+        free(output);
+        telloc_video_decoder_free(&decoder);
+        return 1;
+    }
+    telloc_convert_job job = {
+        {decoder.frame->data[0], decoder.frame->data[1], decoder.frame->data[2]},
+        {(unsigned int) decoder.frame->linesize[0], (unsigned int) decoder.frame->linesize[1], (unsigned int) decoder.frame->linesize[2]},
+        output, width * 3, width, height, TELLOC_FORMAT_RGB24, telloc_convert_best_isa()
+    };
+
+    bench_start(run);
+    for (unsigned int i = 0; i < data->unit_count; i++) {
+        unsigned long long start = telloc_time();
+        telloc_convert_rows(&job, 0, height);
+        bench_sample(run, telloc_time() - start, (unsigned long long) width * height * 3);
+    }
+    bench_stop(run);
+
+    free(output);
+    telloc_video_decoder_free(&decoder);
+    return 0;
+}
+
+// benchmark of the state parser
+static int bench_state_parse(const bench_data* data, bench_run* run) {
+    telloc_state state;
+    unsigned int length = (unsigned int) strlen(bench_state);
+    int failed = 0;
+
+    bench_start(run);
+    for (unsigned int i = 0; i < BENCH_STATES; i++) {
+        unsigned long long start = telloc_time();
+        failed |= telloc_state_parse(bench_state, length, &state);
+        bench_sample(run, telloc_time() - start, length);
+    }
+    bench_stop(run);
+
+    return failed || state.bat != 87;
+}
+
+// function to write the stream as a recording the replay can read, timed like a live 30 fps stream
+static int bench_write_recording(const bench_data* data, const char* path) {
+    telloc_recorder recorder;
+    memset(&recorder, 0, sizeof(recorder));
+    if (telloc_recorder_open(&recorder, path, TELLOC_RECORD_H264) != 0) {
+        return 1;
+    }
+    int failed = 0;
+    for (unsigned int i = 0; i < data->unit_count; i++) {
+        telloc_video_unit unit = data->units[i];
+        unit.received_time = (i + 1) * BENCH_FRAME_PERIOD_NS;
+        unit.assembled_time = unit.received_time;
+        failed |= telloc_recorder_write(&recorder, &unit);
+    }
+    return telloc_recorder_close(&recorder) || failed;
+}
+
+// function to remove a recording and the logs next to it
+static void bench_remove_recording(const char* path) {
+    char log[256];
+    remove(path);
+    snprintf(log, sizeof(log), "%s.idx", path);
+    remove(log);
+    snprintf(log, sizeof(log), "%s.state", path);
+    remove(log);
+}
+
+// benchmark of the whole pipeline behind a reader: a recording replayed as fast as it decodes through the decoder
+// workers, timed from the decoder returning each picture to the reader holding it in RGB
+static int bench_frame_handoff(const bench_data* data, bench_run* run) {
+    const char* path = "telloc_bench.h264";
+    if (bench_write_recording(data, path) != 0) {
+        bench_remove_recording(path);
+        return 1;
+    }
+    telloc_connection* connection = telloc_connect_replay(path, TELLOC_REPLAY_FAST);
+    if (connection == NULL) {
+        bench_remove_recording(path);
+        return 1;
+    }
+
+    bench_start(run);
+    while (1) {
+        const telloc_frame* frame;
+        if (telloc_wait_frame(connection, 100, &frame) == 0) {
+            bench_sample(run, telloc_time() - frame->info.decoded_time, frame->bytes);
+            telloc_release_frame(connection, frame);
+            continue;
+        }
+        telloc_replay_stats stats;
+        if (telloc_get_replay_stats(connection, &stats) != 0 || stats.finished) {
+            break;
+        }
+    }
+    bench_stop(run);
+
+    telloc_disconnect(connection);
+    bench_remove_recording(path);
+    return run->count == 0;
+}
+
+// thread to answer every command on loopback like the drone does, until the socket is shut down
+static void* bench_responder(void* arg) {
+    int sock = *(int*) arg;
+    char buffer[256];
+    struct sockaddr_in from;
+    socklen_t from_length = sizeof(from);
+    ssize_t received;
+    while ((received = recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr*) &from, &from_length)) > 0) {
+        const char* reply = received >= 8 && memcmp(buffer, "battery?", 8) == 0 ? "87" : "ok";
+        sendto(sock, reply, strlen(reply), 0, (struct sockaddr*) &from, from_length);
+        from_length = sizeof(from);
+    }
+    return NULL;
+}
+
+// benchmark of a command's round trip through the queue, the reactor and a responder on loopback
+static int bench_command_rtt(const bench_data* data, bench_run* run) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(BENCH_COMMAND_PORT);
+    address.sin_addr.s_addr = inet_addr(BENCH_ADDRESS);
+    if (sock == -1 || bind(sock, (struct sockaddr*) &address, sizeof(address)) == -1) {
+        printf("Error binding the responder to %s:%d: %d\n", BENCH_ADDRESS, BENCH_COMMAND_PORT, errno);
+        if (sock != -1) {
+            close(sock);
+        }
+        return 1;
+    }
+    pthread_t responder;
+    pthread_create(&responder, NULL, bench_responder, &sock);
+
+    // free ports, so nothing else on the machine is in the way
+    telloc_config config;
+    telloc_config_default(&config);
+    config.interface_address = BENCH_ADDRESS;
+    config.drone_address = BENCH_ADDRESS;
+    config.ports.command = 0;
+    config.ports.state = 0;
+    config.ports.video = 0;
+    telloc_connection* connection = telloc_connect_config(&config);
+    int failed = connection == NULL;
+
+    char response[64];
+    if (connection != NULL) {
+        bench_start(run);
+        for (unsigned int i = 0; i < data->commands && !failed; i++) {
+            unsigned long long start = telloc_time();
+            failed |= telloc_send_command(connection, "battery?", 8, response, sizeof(response));
+            bench_sample(run, telloc_time() - start, 8);
+        }
+        bench_stop(run);
+        telloc_disconnect(connection);
+    }
+
+    shutdown(sock, SHUT_RDWR);
+    close(sock);
+    pthread_join(responder, NULL);
+    return failed;
+}
+
+
+// function to cut the stream into datagrams the way the drone does, and into access units with the reassembler
+static int bench_prepare(bench_data* data, unsigned int frames) {
+    if (telloc_sample_stream(frames, &data->stream, &data->stream_size) != 0) {
+        printf("Error generating the sample stream\n");
+        return 1;
+    }
+
+    // every nal unit is split into BENCH_FRAGMENT_SIZE datagrams, so its last one is short
+    unsigned int capacity = data->stream_size / BENCH_FRAGMENT_SIZE + data->stream_size / 4 + 1;
+    data->datagram_offsets = malloc(sizeof(unsigned int) * capacity);
+    data->datagram_lengths = malloc(sizeof(unsigned int) * capacity);
+    data->units = malloc(sizeof(telloc_video_unit) * (frames * 3 + 1));
+    if (data->datagram_offsets == NULL || data->datagram_lengths == NULL || data->units == NULL) {
+        printf("Error allocating datagram memory\n");
+        return 1;
+    }
+    data->datagram_count = 0;
+    unsigned int begin = 0;
+    while (begin < data->stream_size) {
+        unsigned int end = telloc_video_find_start_code(data->stream, begin + 4, data->stream_size);
+        if (end < data->stream_size && data->stream[end - 1] == 0) {
+            end--;
+        }
+        for (unsigned int offset = begin; offset < end && data->datagram_count < capacity; offset += BENCH_FRAGMENT_SIZE) {
+            data->datagram_offsets[data->datagram_count] = offset;
+            data->datagram_lengths[data->datagram_count] = end - offset < BENCH_FRAGMENT_SIZE ? end - offset : BENCH_FRAGMENT_SIZE;
+            data->datagram_count++;
+        }
+        begin = end;
+    }
+
+    telloc_video_reassembler reassembler;
+    if (telloc_video_reassembler_init(&reassembler) != 0) {
+        return 1;
+    }
+    telloc_video_unit unit;
+    data->unit_count = 0;
+    for (unsigned int i = 0; i < data->datagram_count; i++) {
+        telloc_video_reassembler_push(&reassembler, data->stream + data->datagram_offsets[i], data->datagram_lengths[i], 0);
+        while (telloc_video_reassembler_next(&reassembler, &unit) == 0 && data->unit_count < frames * 3) {
+            unsigned char* copy = malloc(unit.length);
+            if (copy == NULL) {
+                telloc_video_reassembler_free(&reassembler);
+                return 1;
+            }
+            memcpy(copy, unit.data, unit.length);
+            unit.data = copy;
+            data->units[data->unit_count++] = unit;
+        }
+    }
+    telloc_video_reassembler_free(&reassembler);
+    return data->unit_count == 0;
+}
+
+// function to free the stream, datagrams and units
+static void bench_free(bench_data* data) {
+    for (unsigned int i = 0; i < data->unit_count; i++) {
+        free((void*) data->units[i].data);
+    }
+    free(data->units);
+    free(data->datagram_offsets);
+    free(data->datagram_lengths);
+    free(data->stream);
+}
+
+// function to print a run as a table row
+static void bench_print(const bench_run* run) {
+    if (run->failed) {
+        printf("%-14s FAILED\n", run->name);
+        return;
+    }
+    printf("%-14s %9u %-9s %12.0f/s %9.1f MB/s %10.2f %10.2f %10.2f %10.2f\n", run->name, run->count, run->unit,
+           bench_ops_per_second(run), run->elapsed == 0 ? 0.0 : (double) run->bytes * 1e3 / (double) run->elapsed,
+           bench_percentile_us(run, 50), bench_percentile_us(run, 99), bench_percentile_us(run, 100),
+           run->allocations < 0 || run->count == 0 ? -1.0 : (double) run->allocations / run->count);
+}
+
+// function to write a run as a json object
+static void bench_write_json(FILE* file, const bench_run* run, int last) {
+    fprintf(file, "    {\"name\": \"%s\", \"unit\": \"%s\", \"ok\": %s, \"ops\": %u, \"seconds\": %.6f, \"ops_per_second\": %.1f, "
+                  "\"megabytes_per_second\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, \"allocations\": %lld}%s\n",
+            run->name, run->unit, run->failed ? "false" : "true", run->count, (double) run->elapsed / 1e9, bench_ops_per_second(run),
+            run->elapsed == 0 ? 0.0 : (double) run->bytes * 1e3 / (double) run->elapsed, bench_percentile_us(run, 50),
+            bench_percentile_us(run, 99), bench_percentile_us(run, 100), run->allocations, last ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+    const char* output_path = "telloc_bench.json";
+    unsigned int frames = 300;
+    unsigned int commands = 1000;
+    int repeats = 3;
+    int option;
+    while ((option = getopt(argc, argv, "o:f:c:r:")) != -1) {
+        switch (option) {
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'f':
+                frames = (unsigned int) atoi(optarg);
+                break;
+            case 'c':
+                commands = (unsigned int) atoi(optarg);
+                break;
+            case 'r':
+                repeats = atoi(optarg);
+                break;
+            default:
+                printf("usage: %s [-o results.json] [-f frames] [-c commands] [-r repeats] [benchmark ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    frames = frames < TELLOC_SAMPLE_GOP ? TELLOC_SAMPLE_GOP : frames;
+    commands = commands < 1 ? 1 : commands;
+    repeats = repeats < 1 ? 1 : repeats;
+
+    const char* names[] = {"reassemble", "decode", "convert", "state_parse", "frame_handoff", "command_rtt"};
+    const char* units[] = {"datagram", "unit", "frame", "datagram", "frame", "command"};
+    const bench_function functions[] = {bench_reassemble, bench_decode, bench_convert, bench_state_parse, bench_frame_handoff, bench_command_rtt};
+    const int count = (int) (sizeof(names) / sizeof(names[0]));
+
+    bench_data data;
+    memset(&data, 0, sizeof(data));
+    data.commands = commands;
+    if (bench_prepare(&data, frames) != 0) {
+        bench_free(&data);
+        return 1;
+    }
+    unsigned int capacity = data.datagram_count > BENCH_STATES ? data.datagram_count : BENCH_STATES;
+    capacity = capacity > commands ? capacity : commands;
+
+    // the library prints as it connects, so collect the results and print the table at the end
+    bench_run results[sizeof(names) / sizeof(names[0])];
+    int selected[sizeof(names) / sizeof(names[0])];
+    for (int b = 0; b < count; b++) {
+        selected[b] = optind == argc;
+        for (int a = optind; a < argc; a++) {
+            selected[b] |= strcmp(argv[a], names[b]) == 0;
+        }
+
+        memset(&results[b], 0, sizeof(results[b]));
+        results[b].name = names[b];
+        results[b].unit = units[b];
+        results[b].capacity = capacity;
+        results[b].samples = malloc(sizeof(unsigned long long) * capacity);
+        if (!selected[b]) {
+            continue;
+        }
+
+        // keep the fastest run; the others were disturbed by something else on the machine
+        bench_run run = results[b];
+        run.samples = malloc(sizeof(unsigned long long) * capacity);
+        if (results[b].samples == NULL || run.samples == NULL) {
+            printf("Error allocating sample memory\n");
+            return 1;
+        }
+        results[b].failed = 1;
+        for (int r = 0; r < repeats; r++) {
+            run.failed = functions[b](&data, &run);
+            if (!run.failed && (results[b].failed || bench_ops_per_second(&run) > bench_ops_per_second(&results[b]))) {
+                unsigned long long* samples = results[b].samples;
+                results[b] = run;
+                run.samples = samples;
+            }
+        }
+        free(run.samples);
+        qsort(results[b].samples, results[b].count, sizeof(unsigned long long), bench_compare_samples);
+    }
+
+    printf("\n%dx%d sample stream, %u frames in %u datagrams and %u units, best of %d, %s conversion\n",
+           TELLOC_SAMPLE_WIDTH, TELLOC_SAMPLE_HEIGHT, frames, data.datagram_count, data.unit_count, repeats,
+           telloc_convert_isa_name(telloc_convert_best_isa()));
+    printf("%-14s %9s %-9s %14s %14s %10s %10s %10s %10s\n", "benchmark", "ops", "", "throughput", "", "p50 us", "p99 us", "max us", "allocs/op");
+    int failed = 0;
+    for (int b = 0; b < count; b++) {
+        if (selected[b]) {
+            bench_print(&results[b]);
+            failed |= results[b].failed;
+        }
+    }
+
+    FILE* file = fopen(output_path, "w");
+    if (file == NULL) {
+        printf("Error opening %s\n", output_path);
+        failed = 1;
+    } else {
+        fprintf(file, "{\n  \"frames\": %u,\n  \"datagrams\": %u,\n  \"units\": %u,\n  \"repeats\": %d,\n  \"isa\": \"%s\",\n  \"results\": [\n",
+                frames, data.datagram_count, data.unit_count, repeats, telloc_convert_isa_name(telloc_convert_best_isa()));
+        int last = -1;
+        for (int b = 0; b < count; b++) {
+            last = selected[b] ? b : last;
+        }
+        for (int b = 0; b < count; b++) {
+            if (selected[b]) {
+                bench_write_json(file, &results[b], b == last);
+            }
+        }
+        fprintf(file, "  ]\n}\n");
+        fclose(file);
+        printf("Results written to %s\n", output_path);
+    }
+
+    for (int b = 0; b < count; b++) {
+        free(results[b].samples);
+    }
+    bench_free(&data);
+    return failed;
+}
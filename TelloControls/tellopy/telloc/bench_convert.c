@@ -0,0 +1,201 @@
+// This program times the yuv420p to rgb conversion kernels against swscale on a Tello sized frame.
+// It converts the same synthetic picture with sws_scale (SWS_BILINEAR, as the library used to) and with every
+// kernel this cpu runs, single threaded and spread over threads, and reports the time per frame and how far
+// the kernels' output is from swscale's.
+//
+//   telloc_convert_bench [iterations] [max threads]
+//
+#include "convert.h"
+
+#include <libswscale/swscale.h>
+#include <libavutil/pixfmt.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_WIDTH 960
+#define BENCH_HEIGHT 720
+
+// a pool of threads that each convert a band of the current job
+typedef struct {
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+    const telloc_convert_job* job;
+    unsigned int threads;
+    int stopping;
+} bench_pool;
+
+typedef struct {
+    bench_pool* pool;
+    unsigned int band;
+} bench_worker;
+
+// function to read a monotonic clock in nanoseconds
+static unsigned long long bench_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+// thread to convert one band of every job
+static void* bench_thread(void* arg) {
+    bench_worker* worker = (bench_worker*) arg;
+    bench_pool* pool = worker->pool;
+    while (1) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->stopping) {
+            return NULL;
+        }
+        telloc_convert_band(pool->job, worker->band, pool->threads);
+        pthread_barrier_wait(&pool->done);
+    }
+}
+
+// function to fill a picture that looks a little like video: smooth gradients with noise on top
+static void bench_picture(unsigned char* y, unsigned char* u, unsigned char* v) {
+    unsigned int seed = 1;
+    for (unsigned int row = 0; row < BENCH_HEIGHT; row++) {
+        for (unsigned int x = 0; x < BENCH_WIDTH; x++) {
+            seed = seed * 1103515245u + 12345u;
+            y[row * BENCH_WIDTH + x] = (unsigned char) (16 + (x + row) * 219 / (BENCH_WIDTH + BENCH_HEIGHT) + (seed >> 28));
+        }
+    }
+    for (unsigned int row = 0; row < BENCH_HEIGHT / 2; row++) {
+        for (unsigned int x = 0; x < BENCH_WIDTH / 2; x++) {
+            seed = seed * 1103515245u + 12345u;
+            u[row * BENCH_WIDTH / 2 + x] = (unsigned char) (16 + x * 224 / (BENCH_WIDTH / 2) + (seed >> 29));
+            v[row * BENCH_WIDTH / 2 + x] = (unsigned char) (240 - row * 224 / (BENCH_HEIGHT / 2) - (seed >> 29));
+        }
+    }
+}
+
+// function to print the time per frame of a run and its speed against swscale
+static void bench_report(const char* name, unsigned long long elapsed, int iterations, double sws_us) {
+    double us = (double) elapsed / 1000.0 / iterations;
+    printf("  %-22s %8.1f us/frame  %6.0f frames/s  x%.2f\n", name, us, 1000000.0 / us, sws_us / us);
+}
+
+// function to compare an output to swscale's
+static void bench_compare(const unsigned char* output, const unsigned char* reference, size_t size) {
+    int largest = 0;
+    size_t off = 0;
+    for (size_t i = 0; i < size; i++) {
+        int difference = abs((int) output[i] - (int) reference[i]);
+        largest = difference > largest ? difference : largest;
+        off += difference > 2;
+    }
+    printf("  %-22s largest difference %d, %.3f%% of bytes off by more than 2\n", "vs swscale:", largest, 100.0 * (double) off / (double) size);
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    unsigned int max_threads = argc > 2 ? (unsigned int) atoi(argv[2]) : 4;
+    if (iterations < 1) {
+        iterations = 1;
+    }
+    if (max_threads < 1 || max_threads > TELLOC_CONVERT_THREADS_MAX) {
+        max_threads = TELLOC_CONVERT_THREADS_MAX;
+    }
+
+    unsigned char* y = malloc(BENCH_WIDTH * BENCH_HEIGHT);
+    unsigned char* u = malloc(BENCH_WIDTH * BENCH_HEIGHT / 4);
+    unsigned char* v = malloc(BENCH_WIDTH * BENCH_HEIGHT / 4);
+    unsigned char* reference = malloc(BENCH_WIDTH * BENCH_HEIGHT * 4);
+    unsigned char* output = malloc(BENCH_WIDTH * BENCH_HEIGHT * 4);
+    if (y == NULL || u == NULL || v == NULL || reference == NULL || output == NULL) {
+        printf("Error allocating frames\n");
+        return 1;
+    }
+    bench_picture(y, u, v);
+
+    const telloc_pixel_format formats[] = {TELLOC_FORMAT_RGB24, TELLOC_FORMAT_BGR24, TELLOC_FORMAT_BGRA};
+    const enum AVPixelFormat sws_formats[] = {AV_PIX_FMT_RGB24, AV_PIX_FMT_BGR24, AV_PIX_FMT_BGRA};
+    const char* names[] = {"RGB24", "BGR24", "BGRA"};
+    printf("%dx%d yuv420p, %d iterations, best kernel %s\n", BENCH_WIDTH, BENCH_HEIGHT, iterations, telloc_convert_isa_name(telloc_convert_best_isa()));
+
+    for (int f = 0; f < 3; f++) {
+        unsigned int bytes_per_pixel = formats[f] == TELLOC_FORMAT_BGRA ? 4 : 3;
+        unsigned int stride = BENCH_WIDTH * bytes_per_pixel;
+        printf("%s\n", names[f]);
+
+        // the baseline, set up like the decoder set it up
+        struct SwsContext* sws = sws_getContext(BENCH_WIDTH, BENCH_HEIGHT, AV_PIX_FMT_YUV420P, BENCH_WIDTH, BENCH_HEIGHT, sws_formats[f], SWS_BILINEAR, NULL, NULL, NULL);
+        if (sws == NULL) {
+            printf("Error creating swscale context\n");
+            return 1;
+        }
+        const uint8_t* source[4] = {y, u, v, NULL};
+        const int source_strides[4] = {BENCH_WIDTH, BENCH_WIDTH / 2, BENCH_WIDTH / 2, 0};
+        uint8_t* destination[4] = {reference, NULL, NULL, NULL};
+        int destination_strides[4] = {(int) stride, 0, 0, 0};
+        sws_scale(sws, source, source_strides, 0, BENCH_HEIGHT, destination, destination_strides);
+        unsigned long long start = bench_time();
+        for (int i = 0; i < iterations; i++) {
+            sws_scale(sws, source, source_strides, 0, BENCH_HEIGHT, destination, destination_strides);
+        }
+        double sws_us = (double) (bench_time() - start) / 1000.0 / iterations;
+        bench_report("sws_scale bilinear", bench_time() - start, iterations, sws_us);
+        sws_freeContext(sws);
+
+        telloc_convert_job job = {{y, u, v}, {BENCH_WIDTH, BENCH_WIDTH / 2, BENCH_WIDTH / 2}, output, stride, BENCH_WIDTH, BENCH_HEIGHT, formats[f], TELLOC_CONVERT_SCALAR};
+        for (int isa = 0; isa < TELLOC_CONVERT_ISA_COUNT; isa++) {
+            if (!telloc_convert_isa_supported((telloc_convert_isa) isa)) {
+                continue;
+            }
+            job.isa = (telloc_convert_isa) isa;
+            telloc_convert_rows(&job, 0, BENCH_HEIGHT);
+            start = bench_time();
+            for (int i = 0; i < iterations; i++) {
+                telloc_convert_rows(&job, 0, BENCH_HEIGHT);
+            }
+            bench_report(telloc_convert_isa_name(job.isa), bench_time() - start, iterations, sws_us);
+        }
+        bench_compare(output, reference, (size_t) stride * BENCH_HEIGHT);
+
+        // the best kernel with its rows spread over threads; each frame is handed out and collected like the library does
+        job.isa = telloc_convert_best_isa();
+        for (unsigned int threads = 2; threads <= max_threads; threads *= 2) {
+            bench_pool pool;
+            bench_worker workers[TELLOC_CONVERT_THREADS_MAX];
+            pthread_t handles[TELLOC_CONVERT_THREADS_MAX];
+            pool.job = &job;
+            pool.threads = threads;
+            pool.stopping = 0;
+            pthread_barrier_init(&pool.start, NULL, threads);
+            pthread_barrier_init(&pool.done, NULL, threads);
+            for (unsigned int t = 1; t < threads; t++) {
+                workers[t].pool = &pool;
+                workers[t].band = t;
+                pthread_create(&handles[t], NULL, bench_thread, &workers[t]);
+            }
+            start = bench_time();
+            for (int i = 0; i < iterations; i++) {
+                pthread_barrier_wait(&pool.start);
+                telloc_convert_band(&job, 0, threads);
+                pthread_barrier_wait(&pool.done);
+            }
+            unsigned long long elapsed = bench_time() - start;
+            pool.stopping = 1;
+            pthread_barrier_wait(&pool.start);
+            for (unsigned int t = 1; t < threads; t++) {
+                pthread_join(handles[t], NULL);
+            }
+            pthread_barrier_destroy(&pool.start);
+            pthread_barrier_destroy(&pool.done);
+
+            char name[32];
+            snprintf(name, sizeof(name), "%s, %u threads", telloc_convert_isa_name(job.isa), threads);
+            bench_report(name, elapsed, iterations, sws_us);
+        }
+    }
+
+    free(y);
+    free(u);
+    free(v);
+    free(reference);
+    free(output);
+    return 0;
+}
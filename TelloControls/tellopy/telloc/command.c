@@ -0,0 +1,349 @@
+// Contains the implementation of the command queue for the telloc library
+//
+#include "command.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+// commands the drone only answers once it is done moving
+static const char *telloc_command_actions[] = {
+    "takeoff", "land", "up", "down", "left", "right", "forward", "back", "cw", "ccw", "flip", "go", "curve", "jump"
+};
+
+// reads whose reply is a number
+static const char *telloc_command_numbers[] = {
+    "battery?", "wifi?", "speed?", "time?", "height?", "tof?", "temp?", "baro?"
+};
+
+// starts of the replies a control command gives besides "ok"
+static const char *telloc_command_errors[] = {
+    "error", "out of range", "unknown command", "forced stop", "not joystick"
+};
+
+// function to check if the first word of a command is one of words
+static int telloc_command_word(const char *command, unsigned int length, const char **words, unsigned int count) {
+    unsigned int end = 0;
+    while (end < length && command[end] != ' ') {
+        end++;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        if (strlen(words[i]) == end && strncmp(command, words[i], end) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// function to check if a reply starts with prefix, ignoring case
+static int telloc_command_starts(const char *response, unsigned int length, const char *prefix) {
+    unsigned int prefix_length = (unsigned int) strlen(prefix);
+    if (length < prefix_length) {
+        return 0;
+    }
+    for (unsigned int i = 0; i < prefix_length; i++) {
+        if (tolower((unsigned char) response[i]) != prefix[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// function to check if a reply is one a command with that kind of reply can give
+static int telloc_command_fits(telloc_command_reply reply, const char *response, unsigned int length) {
+    // any command can fail
+    for (unsigned int i = 0; i < sizeof(telloc_command_errors) / sizeof(telloc_command_errors[0]); i++) {
+        if (telloc_command_starts(response, length, telloc_command_errors[i])) {
+            return 1;
+        }
+    }
+    // the drone ends some replies with a line break
+    while (length > 0 && isspace((unsigned char) response[length - 1])) {
+        length--;
+    }
+    int ok = length == 2 && telloc_command_starts(response, length, "ok");
+    switch (reply) {
+        case TELLOC_REPLY_CONTROL:
+            return ok;
+        case TELLOC_REPLY_NUMBER:
+            return length > 0 && (isdigit((unsigned char) response[0]) || response[0] == '-' || response[0] == '.');
+        default:
+            return length > 0 && !ok;
+    }
+}
+
+// function to remember that a command that stopped waiting still has a reply coming
+static void telloc_command_owe(telloc_command_queue *queue, telloc_command *command, unsigned long long time) {
+    if (command->late_taken) {
+        return;
+    }
+    if (queue->late_replies == TELLOC_COMMAND_LATE_MAX) {
+        memmove(queue->late, queue->late + 1, sizeof(queue->late[0]) * (TELLOC_COMMAND_LATE_MAX - 1));
+        queue->late_replies--;
+    }
+    queue->late[queue->late_replies++] = command->reply;
+    // a command cut off before its deadline may still answer up to it
+    unsigned long long until = time + TELLOC_COMMAND_LATE_TIMEOUT * 1000000ULL;
+    if (command->deadline > until) {
+        until = command->deadline;
+    }
+    if (queue->late_replies == 1 || until > queue->late_until) {
+        queue->late_until = until;
+    }
+}
+
+// function to finish a command with a status
+static void telloc_command_finish(telloc_command_queue *queue, telloc_command *command, telloc_command_status status) {
+    if (queue->in_flight == command) {
+        queue->in_flight = NULL;
+    }
+    command->status = status;
+}
+
+// function to initialize an empty queue
+void telloc_command_queue_init(telloc_command_queue *queue) {
+    memset(queue, 0, sizeof(telloc_command_queue));
+}
+
+// function to queue a command
+telloc_command *telloc_command_queue_push(telloc_command_queue *queue, const char *command, unsigned int length, telloc_command_priority priority,
+                                          int timeout_ms, telloc_command_callback callback, void *user, unsigned long long time) {
+    if (length > TELLOC_COMMAND_LENGTH) {
+        return NULL;
+    }
+
+    for (int i = 0; i < TELLOC_COMMAND_QUEUE_SIZE; i++) {
+        telloc_command *slot = &queue->commands[i];
+        if (slot->references != 0) {
+            continue;
+        }
+
+        memcpy(slot->command, command, length);
+        slot->length = length;
+        slot->response[0] = '\0';
+        slot->response_length = 0;
+        slot->priority = priority;
+        int action = telloc_command_word(command, length, telloc_command_actions, sizeof(telloc_command_actions) / sizeof(telloc_command_actions[0]));
+        if (timeout_ms < 0) {
+            timeout_ms = action ? TELLOC_ACTION_TIMEOUT : TELLOC_RESPONSE_TIMEOUT;
+        }
+        slot->timeout_ms = timeout_ms;
+        if (length > 0 && command[length - 1] == '?') {
+            int number = telloc_command_word(command, length, telloc_command_numbers, sizeof(telloc_command_numbers) / sizeof(telloc_command_numbers[0]));
+            slot->reply = number ? TELLOC_REPLY_NUMBER : TELLOC_REPLY_TEXT;
+        } else {
+            slot->reply = TELLOC_REPLY_CONTROL;
+        }
+        slot->callback = callback;
+        slot->user = user;
+        slot->status = TELLOC_COMMAND_QUEUED;
+        slot->references = 2;
+        slot->reported = 0;
+        slot->late_taken = 0;
+        slot->order = ++queue->order;
+        slot->queued_time = time;
+        slot->sent_time = 0;
+        slot->replied_time = 0;
+        slot->deadline = 0;
+        return slot;
+    }
+    return NULL;
+}
+
+// function to take the next command to send
+telloc_command *telloc_command_queue_next(telloc_command_queue *queue, unsigned long long time) {
+    // the most urgent command, first come first served within a priority
+    telloc_command *next = NULL;
+    for (int i = 0; i < TELLOC_COMMAND_QUEUE_SIZE; i++) {
+        telloc_command *slot = &queue->commands[i];
+        if (slot->references == 0 || slot->status != TELLOC_COMMAND_QUEUED) {
+            continue;
+        }
+        if (next == NULL || slot->priority > next->priority || (slot->priority == next->priority && slot->order < next->order)) {
+            next = slot;
+        }
+    }
+    if (next == NULL) {
+        return NULL;
+    }
+
+    if (queue->in_flight != NULL) {
+        if (next->priority != TELLOC_PRIORITY_EMERGENCY) {
+            return NULL;
+        }
+        // the drone drops whatever it was doing on an emergency, so don't wait for that reply; it may still
+        // come ahead of the emergency's, so it is owed like the reply of a command that timed out
+        telloc_command *cancelled = queue->in_flight;
+        telloc_command_finish(queue, cancelled, TELLOC_COMMAND_CANCELLED);
+        telloc_command_owe(queue, cancelled, time);
+    }
+
+    next->status = TELLOC_COMMAND_SENT;
+    next->sent_time = time;
+    if (next->timeout_ms > 0) {
+        next->deadline = time + (unsigned long long) next->timeout_ms * 1000000ULL;
+        queue->in_flight = next;
+    }
+    return next;
+}
+
+// function to record whether a command went out
+void telloc_command_queue_sent(telloc_command_queue *queue, telloc_command *command, int sent) {
+    if (command->status != TELLOC_COMMAND_SENT) {
+        return;
+    }
+    if (!sent) {
+        telloc_command_finish(queue, command, TELLOC_COMMAND_FAILED);
+    } else if (command->timeout_ms == 0) {
+        // nothing to wait for
+        telloc_command_finish(queue, command, TELLOC_COMMAND_DONE);
+    }
+}
+
+// function to match a reply to the command waiting for it
+void telloc_command_queue_reply(telloc_command_queue *queue, const char *response, unsigned int length, unsigned long long time) {
+    if (queue->late_replies > 0 && time > queue->late_until) {
+        queue->late_replies = 0;
+    }
+    telloc_command *command = queue->in_flight;
+    int fits = command != NULL && telloc_command_fits(command->reply, response, length);
+
+    // replies come back in order, so the ones owed by commands that timed out come first. the first owed reply this
+    // can be is taken to be it, and any owed before that were lost
+    for (unsigned int i = 0; i < queue->late_replies; i++) {
+        if (!telloc_command_fits(queue->late[i], response, length)) {
+            continue;
+        }
+        queue->late_replies -= i + 1;
+        memmove(queue->late, queue->late + i + 1, sizeof(queue->late[0]) * queue->late_replies);
+        if (fits) {
+            // it could just as well have been this command's own reply
+            command->late_taken = 1;
+        }
+        return;
+    }
+
+    // a reply the waiting command can't have given, like the "ok" of a takeoff that ended while a battery? waits
+    if (!fits) {
+        return;
+    }
+    // this command's own reply came, so the owed ones were lost
+    queue->late_replies = 0;
+    if (length >= TELLOC_COMMAND_RESPONSE_LENGTH) {
+        length = TELLOC_COMMAND_RESPONSE_LENGTH - 1;
+    }
+    memcpy(command->response, response, length);
+    command->response[length] = '\0';
+    command->response_length = length;
+    command->replied_time = time;
+    telloc_command_finish(queue, command, TELLOC_COMMAND_DONE);
+}
+
+// function to time out the command waiting for its reply
+void telloc_command_queue_expire(telloc_command_queue *queue, unsigned long long time) {
+    telloc_command *command = queue->in_flight;
+    if (command == NULL || time < command->deadline) {
+        return;
+    }
+    telloc_command_finish(queue, command, TELLOC_COMMAND_TIMEOUT);
+    telloc_command_owe(queue, command, time);
+}
+
+// function to get when the command waiting for its reply times out
+unsigned long long telloc_command_queue_deadline(telloc_command_queue *queue) {
+    return queue->in_flight != NULL ? queue->in_flight->deadline : 0;
+}
+
+// function to take a finished command whose callback has not run yet
+telloc_command *telloc_command_queue_finished(telloc_command_queue *queue) {
+    for (int i = 0; i < TELLOC_COMMAND_QUEUE_SIZE; i++) {
+        telloc_command *slot = &queue->commands[i];
+        if (slot->references != 0 && !slot->reported && slot->status >= TELLOC_COMMAND_DONE) {
+            slot->reported = 1;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// function to cancel every command that has not finished
+void telloc_command_queue_cancel(telloc_command_queue *queue) {
+    for (int i = 0; i < TELLOC_COMMAND_QUEUE_SIZE; i++) {
+        telloc_command *slot = &queue->commands[i];
+        if (slot->references != 0 && slot->status < TELLOC_COMMAND_DONE) {
+            telloc_command_finish(queue, slot, TELLOC_COMMAND_CANCELLED);
+        }
+    }
+}
+
+// function to drop a reference to a command
+void telloc_command_queue_release(telloc_command_queue *queue, telloc_command *command) {
+    if (command->references > 0) {
+        command->references--;
+    }
+}
+
+// function to initialize an idle rc channel
+void telloc_rc_init(telloc_rc_channel *rc, const telloc_rc_config *config) {
+    memset(rc, 0, sizeof(telloc_rc_channel));
+    int rate = config->rate > 0 ? config->rate : 20;
+    rc->period = 1000000000ULL / (unsigned long long) rate;
+    rc->stale = (unsigned long long) (config->stale_ms > 0 ? config->stale_ms : 500) * 1000000ULL;
+}
+
+// function to keep a stick within the range the drone takes
+static int telloc_rc_clamp(int value) {
+    return value < -100 ? -100 : value > 100 ? 100 : value;
+}
+
+// function to set the sticks
+int telloc_rc_set(telloc_rc_channel *rc, int lr, int fb, int ud, int yaw, unsigned long long time) {
+    rc->sticks[0] = telloc_rc_clamp(lr);
+    rc->sticks[1] = telloc_rc_clamp(fb);
+    rc->sticks[2] = telloc_rc_clamp(ud);
+    rc->sticks[3] = telloc_rc_clamp(yaw);
+    rc->set_time = time;
+    rc->stop_repeats = TELLOC_RC_STOP_REPEATS;
+    if (rc->next_time != 0) {
+        return 0;
+    }
+    // send the first one right away
+    rc->next_time = time;
+    return 1;
+}
+
+// function to write the rc command due at time
+unsigned int telloc_rc_due(telloc_rc_channel *rc, unsigned long long time, char *command, unsigned int size) {
+    if (rc->next_time == 0 || time < rc->next_time) {
+        return 0;
+    }
+
+    int stale = time - rc->set_time >= rc->stale;
+    if (stale) {
+        if (rc->stop_repeats == 0) {
+            // the drone has been told to stop; go quiet until the next setpoint
+            rc->next_time = 0;
+            return 0;
+        }
+        rc->stop_repeats--;
+    }
+
+    // keep to the rate without drifting, but don't send a burst to catch up after a stall
+    rc->next_time += rc->period;
+    if (rc->next_time <= time) {
+        rc->next_time = time + rc->period;
+    }
+
+    int length;
+    if (stale) {
+        length = snprintf(command, size, "rc 0 0 0 0");
+    } else {
+        length = snprintf(command, size, "rc %d %d %d %d", rc->sticks[0], rc->sticks[1], rc->sticks[2], rc->sticks[3]);
+    }
+    return length > 0 && (unsigned int) length < size ? (unsigned int) length : 0;
+}
+
+// function to get when the next rc command is due
+unsigned long long telloc_rc_deadline(telloc_rc_channel *rc) {
+    return rc->next_time;
+}
@@ -0,0 +1,139 @@
+// Contains the command queue behind the telloc library's command thread
+//
+#ifndef TELLOC_COMMAND_H
+#define TELLOC_COMMAND_H
+
+#include "telloc.h"
+
+// commands that can be queued or waiting for their reply at once
+#define TELLOC_COMMAND_QUEUE_SIZE 32
+// longest command the queue holds
+#define TELLOC_COMMAND_LENGTH 1024
+// longest reply kept for a command
+#define TELLOC_COMMAND_RESPONSE_LENGTH 256
+// how long after a timeout a reply is still taken to be the late reply of the command that timed out
+#define TELLOC_COMMAND_LATE_TIMEOUT 1000
+// late replies kept track of at once; the oldest is forgotten first
+#define TELLOC_COMMAND_LATE_MAX 4
+
+// zero setpoints sent after the rc setpoint goes stale, in case some are lost
+#define TELLOC_RC_STOP_REPEATS 5
+
+// struct for the rc setpoint the command thread sends at a fixed rate; guarded by the command mutex like the queue
+typedef struct {
+    // left/right, forward/back, up/down, yaw
+    int sticks[4];
+    // when the setpoint was last set, 0 if never
+    unsigned long long set_time;
+    // when the next rc command is due, 0 while idle
+    unsigned long long next_time;
+    unsigned long long period;
+    unsigned long long stale;
+    // zero setpoints still to send since the setpoint went stale
+    int stop_repeats;
+} telloc_rc_channel;
+
+// the replies a command can get, so a reply meant for another command is not taken as its own
+typedef enum {
+    // "ok" or an error, for commands that make the drone do something
+    TELLOC_REPLY_CONTROL = 0,
+    // a number, like the reply to battery? or wifi?
+    TELLOC_REPLY_NUMBER = 1,
+    // anything but "ok", like the reply to sn? or attitude?
+    TELLOC_REPLY_TEXT = 2
+} telloc_command_reply;
+
+// struct for a queued command; handed out as the opaque telloc_command handle
+struct telloc_command {
+    char command[TELLOC_COMMAND_LENGTH];
+    unsigned int length;
+    char response[TELLOC_COMMAND_RESPONSE_LENGTH];
+    unsigned int response_length;
+    telloc_command_priority priority;
+    // milliseconds to wait for the reply; 0 for commands the drone does not answer
+    int timeout_ms;
+    telloc_command_reply reply;
+    telloc_command_callback callback;
+    void *user;
+
+    volatile telloc_command_status status;
+    // the caller's reference and the queue's; the slot is free at 0
+    int references;
+    // set once the command thread has run the callback and woken waiters for a finished command
+    int reported;
+    // set when a reply that fit this command was taken as a late reply of an earlier one. the drone has
+    // then answered as often as it was asked, so this command owes no late reply if it times out
+    int late_taken;
+    // queue order among commands of the same priority
+    unsigned long long order;
+    unsigned long long queued_time;
+    unsigned long long sent_time;
+    // when the reply came, 0 without one
+    unsigned long long replied_time;
+    unsigned long long deadline;
+};
+
+// struct for the commands of a connection. the drone answers one command at a time and its replies
+// carry no id, so at most one command waits for a reply and replies are matched to it in order.
+// replies that turn up late for a command that timed out or was cancelled by an emergency are dropped
+// instead of being taken as the reply to the next one, and replies the waiting command can't have
+// given are dropped too.
+// the queue does no locking; the backend holds its command mutex around every call
+typedef struct {
+    telloc_command commands[TELLOC_COMMAND_QUEUE_SIZE];
+    // the command waiting for its reply, if any
+    telloc_command *in_flight;
+    unsigned long long order;
+    // the kinds of reply still owed by commands that timed out or were cancelled, oldest first, and until when to expect them
+    telloc_command_reply late[TELLOC_COMMAND_LATE_MAX];
+    unsigned int late_replies;
+    unsigned long long late_until;
+} telloc_command_queue;
+
+// function to initialize an empty queue
+void telloc_command_queue_init(telloc_command_queue *queue);
+
+// function to queue a command; returns NULL if the queue is full or the command too long.
+// a timeout_ms below 0 picks TELLOC_ACTION_TIMEOUT for commands that answer when the drone is done moving
+// and TELLOC_RESPONSE_TIMEOUT for the rest
+telloc_command *telloc_command_queue_push(telloc_command_queue *queue, const char *command, unsigned int length, telloc_command_priority priority,
+                                          int timeout_ms, telloc_command_callback callback, void *user, unsigned long long time);
+
+// function to take the next command to send and mark it sent, or NULL if nothing may be sent yet.
+// emergency commands are taken even while another command waits for its reply, which is then cancelled
+telloc_command *telloc_command_queue_next(telloc_command_queue *queue, unsigned long long time);
+
+// function to record whether a command taken with telloc_command_queue_next actually went out
+void telloc_command_queue_sent(telloc_command_queue *queue, telloc_command *command, int sent);
+
+// function to match a reply from the drone to the command waiting for it
+void telloc_command_queue_reply(telloc_command_queue *queue, const char *response, unsigned int length, unsigned long long time);
+
+// function to time out the command waiting for its reply once its deadline has passed
+void telloc_command_queue_expire(telloc_command_queue *queue, unsigned long long time);
+
+// function to get when the command waiting for its reply times out, or 0 if none is waiting
+unsigned long long telloc_command_queue_deadline(telloc_command_queue *queue);
+
+// function to take a finished command whose callback has not run yet, or NULL if there is none
+telloc_command *telloc_command_queue_finished(telloc_command_queue *queue);
+
+// function to cancel every command that has not finished
+void telloc_command_queue_cancel(telloc_command_queue *queue);
+
+// function to drop a reference to a command; the slot is reused once both are gone
+void telloc_command_queue_release(telloc_command_queue *queue, telloc_command *command);
+
+// function to initialize an idle rc channel
+void telloc_rc_init(telloc_rc_channel *rc, const telloc_rc_config *config);
+
+// function to set the sticks, clamped to -100..100; returns 1 if the channel was idle and now has a command due
+int telloc_rc_set(telloc_rc_channel *rc, int lr, int fb, int ud, int yaw, unsigned long long time);
+
+// function to write the rc command due at time into command; returns its length, or 0 if none is due
+unsigned int telloc_rc_due(telloc_rc_channel *rc, unsigned long long time, char *command, unsigned int size);
+
+// function to get when the next rc command is due, or 0 if the channel is idle
+unsigned long long telloc_rc_deadline(telloc_rc_channel *rc);
+
+#endif //TELLOC_COMMAND_H
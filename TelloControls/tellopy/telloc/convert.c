@@ -0,0 +1,452 @@
+// Contains the implementation of the yuv420p to packed rgb conversion kernels for the telloc library
+//
+// Every kernel does the same BT.601 limited range fixed point math, so they all write the same bytes:
+//   luma = (Y * 257 * 18997) >> 16                          (1.164 * 64 * Y)
+//   B = (luma + 129 * (U - 128) - 1160) >> 6                 (-1160 is -1.164 * 64 * 16, plus 32 to round the shift)
+//   G = (luma - 25 * (U - 128) - 52 * (V - 128) - 1160) >> 6
+//   R = (luma + 102 * (V - 128) - 1160) >> 6
+// clamped to 0..255. The chroma terms are worked out once per 2x2 block of pixels. The sums fit 16-bit lanes;
+// only sums far above 255 << 6 saturate, and those clamp to 255 anyway.
+//
+#include "convert.h"
+#include "atomics.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define TELLOC_CONVERT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+#define TELLOC_CONVERT_ARM 1
+#include <arm_neon.h>
+#endif
+
+// the kernels are inlined into each specialised loop; MSVC needs no target attributes for intrinsics
+#ifdef _MSC_VER
+#define TELLOC_CONVERT_INLINE __forceinline
+#define TELLOC_CONVERT_TARGET_SSE41
+#define TELLOC_CONVERT_TARGET_AVX2
+#else
+#define TELLOC_CONVERT_INLINE __inline __attribute__((always_inline))
+#define TELLOC_CONVERT_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TELLOC_CONVERT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define TELLOC_CONVERT_YG 18997
+#define TELLOC_CONVERT_YB (-1160)
+#define TELLOC_CONVERT_UB 129
+#define TELLOC_CONVERT_UG 25
+#define TELLOC_CONVERT_VG 52
+#define TELLOC_CONVERT_VR 102
+
+// byte orders the kernels write
+#define TELLOC_CONVERT_RGB 0
+#define TELLOC_CONVERT_BGR 1
+#define TELLOC_CONVERT_BGRA 2
+
+
+// function to clamp a shifted channel to a byte
+static TELLOC_CONVERT_INLINE unsigned char telloc_convert_clamp(int value) {
+    return (unsigned char) (value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+// function to write a pixel in layout order
+static TELLOC_CONVERT_INLINE void telloc_convert_pixel(unsigned char* pixel, int luma, int b, int g, int r, int layout) {
+    luma = (int) (((unsigned int) luma * 257u * TELLOC_CONVERT_YG) >> 16);
+    unsigned char blue = telloc_convert_clamp((luma + b) >> 6);
+    unsigned char green = telloc_convert_clamp((luma + g) >> 6);
+    unsigned char red = telloc_convert_clamp((luma + r) >> 6);
+    if (layout == TELLOC_CONVERT_RGB) {
+        pixel[0] = red;
+        pixel[1] = green;
+        pixel[2] = blue;
+    } else {
+        pixel[0] = blue;
+        pixel[1] = green;
+        pixel[2] = red;
+        if (layout == TELLOC_CONVERT_BGRA) {
+            pixel[3] = 255;
+        }
+    }
+}
+
+// function to convert pixels x to width of one or two rows sharing a chroma row, a chroma sample at a time;
+// the vector kernels finish their rows with it
+static TELLOC_CONVERT_INLINE void telloc_convert_rows_scalar_tail(const unsigned char* const* y, const unsigned char* u, const unsigned char* v,
+                                                                  unsigned char* const* out, int rows, unsigned int x, unsigned int width, int layout) {
+    unsigned int step = layout == TELLOC_CONVERT_BGRA ? 4 : 3;
+    for (; x < width; x += 2) {
+        // the chroma terms, with the luma offset folded in, serve up to four pixels
+        int cb = u[x / 2] - 128;
+        int cr = v[x / 2] - 128;
+        int b = TELLOC_CONVERT_UB * cb + TELLOC_CONVERT_YB;
+        int g = TELLOC_CONVERT_YB - TELLOC_CONVERT_UG * cb - TELLOC_CONVERT_VG * cr;
+        int r = TELLOC_CONVERT_VR * cr + TELLOC_CONVERT_YB;
+        for (int row = 0; row < rows; row++) {
+            telloc_convert_pixel(out[row] + x * step, y[row][x], b, g, r, layout);
+            if (x + 1 < width) {
+                telloc_convert_pixel(out[row] + (x + 1) * step, y[row][x + 1], b, g, r, layout);
+            }
+        }
+    }
+}
+
+
+#ifdef TELLOC_CONVERT_X86
+
+// pshufb masks that spread 16 bytes of each channel over the 48 bytes of 16 packed pixels; mask[channel][output vector]
+static const signed char telloc_convert_pack3[3][3][16] = {
+    {{0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5},
+     {-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1},
+     {-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1}},
+    {{-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1},
+     {5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10},
+     {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1}},
+    {{-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1},
+     {-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1},
+     {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}}
+};
+
+// function to write 16 pixels given as a vector per channel, in layout order
+static TELLOC_CONVERT_INLINE TELLOC_CONVERT_TARGET_SSE41 void telloc_convert_store_sse41(__m128i b, __m128i g, __m128i r, unsigned char* out, int layout) {
+    if (layout == TELLOC_CONVERT_BGRA) {
+        __m128i alpha = _mm_set1_epi8((char) 0xff);
+        __m128i bg_low = _mm_unpacklo_epi8(b, g);
+        __m128i bg_high = _mm_unpackhi_epi8(b, g);
+        __m128i ra_low = _mm_unpacklo_epi8(r, alpha);
+        __m128i ra_high = _mm_unpackhi_epi8(r, alpha);
+        _mm_storeu_si128((__m128i*) out, _mm_unpacklo_epi16(bg_low, ra_low));
+        _mm_storeu_si128((__m128i*) (out + 16), _mm_unpackhi_epi16(bg_low, ra_low));
+        _mm_storeu_si128((__m128i*) (out + 32), _mm_unpacklo_epi16(bg_high, ra_high));
+        _mm_storeu_si128((__m128i*) (out + 48), _mm_unpackhi_epi16(bg_high, ra_high));
+        return;
+    }
+    __m128i first = layout == TELLOC_CONVERT_RGB ? r : b;
+    __m128i third = layout == TELLOC_CONVERT_RGB ? b : r;
+    for (int part = 0; part < 3; part++) {
+        __m128i packed = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(first, _mm_loadu_si128((const __m128i*) telloc_convert_pack3[0][part])),
+            _mm_shuffle_epi8(g, _mm_loadu_si128((const __m128i*) telloc_convert_pack3[1][part]))),
+            _mm_shuffle_epi8(third, _mm_loadu_si128((const __m128i*) telloc_convert_pack3[2][part])));
+        _mm_storeu_si128((__m128i*) (out + part * 16), packed);
+    }
+}
+
+// function to add the chroma terms to 8 pixels of luma * 257 and narrow the channels to bytes
+static TELLOC_CONVERT_INLINE TELLOC_CONVERT_TARGET_SSE41 __m128i telloc_convert_channel_sse41(__m128i luma_low, __m128i luma_high, __m128i term_low, __m128i term_high) {
+    __m128i low = _mm_srai_epi16(_mm_adds_epi16(luma_low, term_low), 6);
+    __m128i high = _mm_srai_epi16(_mm_adds_epi16(luma_high, term_high), 6);
+    return _mm_packus_epi16(low, high);
+}
+
+// function to convert one or two rows sharing a chroma row 16 pixels at a time
+static TELLOC_CONVERT_INLINE TELLOC_CONVERT_TARGET_SSE41 void telloc_convert_row_sse41(const unsigned char* const* y, const unsigned char* u, const unsigned char* v,
+                                                                                       unsigned char* const* out, int rows, unsigned int width, int layout) {
+    unsigned int step = layout == TELLOC_CONVERT_BGRA ? 4 : 3;
+    __m128i zero = _mm_setzero_si128();
+    __m128i bias = _mm_set1_epi16(128);
+    __m128i offset = _mm_set1_epi16(TELLOC_CONVERT_YB);
+    __m128i scale = _mm_set1_epi16(TELLOC_CONVERT_YG);
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // the chroma terms for 8 samples, each of which covers two pixels in each row
+        __m128i cb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (u + x / 2)), zero), bias);
+        __m128i cr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (v + x / 2)), zero), bias);
+        __m128i b = _mm_add_epi16(_mm_mullo_epi16(cb, _mm_set1_epi16(TELLOC_CONVERT_UB)), offset);
+        __m128i g = _mm_sub_epi16(offset, _mm_add_epi16(_mm_mullo_epi16(cb, _mm_set1_epi16(TELLOC_CONVERT_UG)),
+                                                        _mm_mullo_epi16(cr, _mm_set1_epi16(TELLOC_CONVERT_VG))));
+        __m128i r = _mm_add_epi16(_mm_mullo_epi16(cr, _mm_set1_epi16(TELLOC_CONVERT_VR)), offset);
+        __m128i b_low = _mm_unpacklo_epi16(b, b), b_high = _mm_unpackhi_epi16(b, b);
+        __m128i g_low = _mm_unpacklo_epi16(g, g), g_high = _mm_unpackhi_epi16(g, g);
+        __m128i r_low = _mm_unpacklo_epi16(r, r), r_high = _mm_unpackhi_epi16(r, r);
+
+        for (int row = 0; row < rows; row++) {
+            __m128i luma = _mm_loadu_si128((const __m128i*) (y[row] + x));
+            // a byte unpacked with itself is the byte times 257
+            __m128i luma_low = _mm_mulhi_epu16(_mm_unpacklo_epi8(luma, luma), scale);
+            __m128i luma_high = _mm_mulhi_epu16(_mm_unpackhi_epi8(luma, luma), scale);
+            telloc_convert_store_sse41(telloc_convert_channel_sse41(luma_low, luma_high, b_low, b_high),
+                                       telloc_convert_channel_sse41(luma_low, luma_high, g_low, g_high),
+                                       telloc_convert_channel_sse41(luma_low, luma_high, r_low, r_high), out[row] + x * step, layout);
+        }
+    }
+    telloc_convert_rows_scalar_tail(y, u, v, out, rows, x, width, layout);
+}
+
+// function to add the chroma terms to 16 pixels of luma * 257 and narrow the channels to bytes
+static TELLOC_CONVERT_INLINE TELLOC_CONVERT_TARGET_AVX2 __m256i telloc_convert_channel_avx2(__m256i luma_low, __m256i luma_high, __m256i term_low, __m256i term_high) {
+    __m256i low = _mm256_srai_epi16(_mm256_adds_epi16(luma_low, term_low), 6);
+    __m256i high = _mm256_srai_epi16(_mm256_adds_epi16(luma_high, term_high), 6);
+    return _mm256_packus_epi16(low, high);
+}
+
+// function to convert one or two rows sharing a chroma row 32 pixels at a time.
+// the unpacks and packs work within 128-bit lanes, which keeps pixels 0-15 in the low lane and 16-31 in the high one
+static TELLOC_CONVERT_INLINE TELLOC_CONVERT_TARGET_AVX2 void telloc_convert_row_avx2(const unsigned char* const* y, const unsigned char* u, const unsigned char* v,
+                                                                                     unsigned char* const* out, int rows, unsigned int width, int layout) {
+    unsigned int step = layout == TELLOC_CONVERT_BGRA ? 4 : 3;
+    __m256i bias = _mm256_set1_epi16(128);
+    __m256i offset = _mm256_set1_epi16(TELLOC_CONVERT_YB);
+    __m256i scale = _mm256_set1_epi16(TELLOC_CONVERT_YG);
+    unsigned int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        // chroma samples 0-7 in the low lane and 8-15 in the high one
+        __m256i cb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (u + x / 2))), bias);
+        __m256i cr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (v + x / 2))), bias);
+        __m256i b = _mm256_add_epi16(_mm256_mullo_epi16(cb, _mm256_set1_epi16(TELLOC_CONVERT_UB)), offset);
+        __m256i g = _mm256_sub_epi16(offset, _mm256_add_epi16(_mm256_mullo_epi16(cb, _mm256_set1_epi16(TELLOC_CONVERT_UG)),
+                                                              _mm256_mullo_epi16(cr, _mm256_set1_epi16(TELLOC_CONVERT_VG))));
+        __m256i r = _mm256_add_epi16(_mm256_mullo_epi16(cr, _mm256_set1_epi16(TELLOC_CONVERT_VR)), offset);
+        __m256i b_low = _mm256_unpacklo_epi16(b, b), b_high = _mm256_unpackhi_epi16(b, b);
+        __m256i g_low = _mm256_unpacklo_epi16(g, g), g_high = _mm256_unpackhi_epi16(g, g);
+        __m256i r_low = _mm256_unpacklo_epi16(r, r), r_high = _mm256_unpackhi_epi16(r, r);
+
+        for (int row = 0; row < rows; row++) {
+            __m256i luma = _mm256_loadu_si256((const __m256i*) (y[row] + x));
+            __m256i luma_low = _mm256_mulhi_epu16(_mm256_unpacklo_epi8(luma, luma), scale);
+            __m256i luma_high = _mm256_mulhi_epu16(_mm256_unpackhi_epi8(luma, luma), scale);
+            __m256i blue = telloc_convert_channel_avx2(luma_low, luma_high, b_low, b_high);
+            __m256i green = telloc_convert_channel_avx2(luma_low, luma_high, g_low, g_high);
+            __m256i red = telloc_convert_channel_avx2(luma_low, luma_high, r_low, r_high);
+            // interleaving three channels does not vectorise across lanes; store each lane like sse
+            telloc_convert_store_sse41(_mm256_castsi256_si128(blue), _mm256_castsi256_si128(green), _mm256_castsi256_si128(red),
+                                       out[row] + x * step, layout);
+            telloc_convert_store_sse41(_mm256_extracti128_si256(blue, 1), _mm256_extracti128_si256(green, 1), _mm256_extracti128_si256(red, 1),
+                                       out[row] + (x + 16) * step, layout);
+        }
+    }
+    telloc_convert_rows_scalar_tail(y, u, v, out, rows, x, width, layout);
+}
+
+#endif
+
+
+#ifdef TELLOC_CONVERT_ARM
+
+// function to add the chroma terms to 8 pixels of scaled luma and narrow the channel to bytes; the saturating
+// narrow is the shift and the clamp in one
+static TELLOC_CONVERT_INLINE uint8x16_t telloc_convert_channel_neon(int16x8_t luma_low, int16x8_t luma_high, int16x8x2_t term) {
+    return vcombine_u8(vqshrun_n_s16(vqaddq_s16(luma_low, term.val[0]), 6), vqshrun_n_s16(vqaddq_s16(luma_high, term.val[1]), 6));
+}
+
+// function to scale 8 luma bytes like pmulhuw does with luma * 257
+static TELLOC_CONVERT_INLINE int16x8_t telloc_convert_luma_neon(uint8x8_t luma) {
+    uint16x8_t wide = vmovl_u8(luma);
+    wide = vorrq_u16(wide, vshlq_n_u16(wide, 8));
+    uint16x4_t low = vshrn_n_u32(vmull_n_u16(vget_low_u16(wide), TELLOC_CONVERT_YG), 16);
+    uint16x4_t high = vshrn_n_u32(vmull_n_u16(vget_high_u16(wide), TELLOC_CONVERT_YG), 16);
+    return vreinterpretq_s16_u16(vcombine_u16(low, high));
+}
+
+// function to convert one or two rows sharing a chroma row 16 pixels at a time
+static TELLOC_CONVERT_INLINE void telloc_convert_row_neon(const unsigned char* const* y, const unsigned char* u, const unsigned char* v,
+                                                          unsigned char* const* out, int rows, unsigned int width, int layout) {
+    unsigned int step = layout == TELLOC_CONVERT_BGRA ? 4 : 3;
+    int16x8_t bias = vdupq_n_s16(128);
+    int16x8_t offset = vdupq_n_s16(TELLOC_CONVERT_YB);
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // the chroma terms for 8 samples, each of which covers two pixels in each row
+        int16x8_t cb = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(u + x / 2))), bias);
+        int16x8_t cr = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(v + x / 2))), bias);
+        int16x8_t b = vaddq_s16(vmulq_n_s16(cb, TELLOC_CONVERT_UB), offset);
+        int16x8_t g = vsubq_s16(offset, vaddq_s16(vmulq_n_s16(cb, TELLOC_CONVERT_UG), vmulq_n_s16(cr, TELLOC_CONVERT_VG)));
+        int16x8_t r = vaddq_s16(vmulq_n_s16(cr, TELLOC_CONVERT_VR), offset);
+        int16x8x2_t b2 = vzipq_s16(b, b);
+        int16x8x2_t g2 = vzipq_s16(g, g);
+        int16x8x2_t r2 = vzipq_s16(r, r);
+
+        for (int row = 0; row < rows; row++) {
+            uint8x16_t luma = vld1q_u8(y[row] + x);
+            int16x8_t luma_low = telloc_convert_luma_neon(vget_low_u8(luma));
+            int16x8_t luma_high = telloc_convert_luma_neon(vget_high_u8(luma));
+            uint8x16_t blue = telloc_convert_channel_neon(luma_low, luma_high, b2);
+            uint8x16_t green = telloc_convert_channel_neon(luma_low, luma_high, g2);
+            uint8x16_t red = telloc_convert_channel_neon(luma_low, luma_high, r2);
+            // the structured stores interleave the channels
+            if (layout == TELLOC_CONVERT_BGRA) {
+                uint8x16x4_t pixels = {{blue, green, red, vdupq_n_u8(255)}};
+                vst4q_u8(out[row] + x * step, pixels);
+            } else if (layout == TELLOC_CONVERT_BGR) {
+                uint8x16x3_t pixels = {{blue, green, red}};
+                vst3q_u8(out[row] + x * step, pixels);
+            } else {
+                uint8x16x3_t pixels = {{red, green, blue}};
+                vst3q_u8(out[row] + x * step, pixels);
+            }
+        }
+    }
+    telloc_convert_rows_scalar_tail(y, u, v, out, rows, x, width, layout);
+}
+
+#endif
+
+
+// each instruction set gets a band loop with the kernel inlined, called with the Tello's width as a constant or
+// with any other width. the constant lets the compiler drop the tail and unroll the row loop for 960 wide frames.
+// rows go in pairs that share a chroma row, so each chroma term is worked out once for four pixels
+#define TELLOC_CONVERT_BAND(isa, target, row_function)                                                                    \
+static TELLOC_CONVERT_INLINE target void telloc_convert_band_##isa(const telloc_convert_job* job, unsigned int first,      \
+                                                                   unsigned int last, unsigned int width, int layout) {   \
+    unsigned int line = first;                                                                                            \
+    while (line < last) {                                                                                                 \
+        const unsigned char* y[2];                                                                                        \
+        unsigned char* out[2];                                                                                            \
+        const unsigned char* u = job->planes[1] + (size_t) (line / 2) * job->strides[1];                                  \
+        const unsigned char* v = job->planes[2] + (size_t) (line / 2) * job->strides[2];                                  \
+        y[0] = job->planes[0] + (size_t) line * job->strides[0];                                                          \
+        out[0] = job->destination + (size_t) line * job->destination_stride;                                              \
+        if (line % 2 == 0 && line + 1 < last) {                                                                           \
+            y[1] = y[0] + job->strides[0];                                                                                \
+            out[1] = out[0] + job->destination_stride;                                                                    \
+            row_function(y, u, v, out, 2, width, layout);                                                                 \
+            line += 2;                                                                                                    \
+        } else {                                                                                                          \
+            row_function(y, u, v, out, 1, width, layout);                                                                 \
+            line++;                                                                                                       \
+        }                                                                                                                 \
+    }                                                                                                                     \
+}                                                                                                                         \
+static target void telloc_convert_rows_##isa(const telloc_convert_job* job, unsigned int first, unsigned int last) {      \
+    int layout = job->format == TELLOC_FORMAT_BGRA ? TELLOC_CONVERT_BGRA : job->format == TELLOC_FORMAT_BGR24 ? TELLOC_CONVERT_BGR : TELLOC_CONVERT_RGB; \
+    if (job->width == TELLOC_CONVERT_WIDTH) {                                                                             \
+        if (layout == TELLOC_CONVERT_RGB) {                                                                               \
+            telloc_convert_band_##isa(job, first, last, TELLOC_CONVERT_WIDTH, TELLOC_CONVERT_RGB);                        \
+        } else if (layout == TELLOC_CONVERT_BGR) {                                                                        \
+            telloc_convert_band_##isa(job, first, last, TELLOC_CONVERT_WIDTH, TELLOC_CONVERT_BGR);                        \
+        } else {                                                                                                          \
+            telloc_convert_band_##isa(job, first, last, TELLOC_CONVERT_WIDTH, TELLOC_CONVERT_BGRA);                       \
+        }                                                                                                                 \
+    } else {                                                                                                              \
+        telloc_convert_band_##isa(job, first, last, job->width, layout);                                                 \
+    }                                                                                                                     \
+}
+
+// function to run the scalar kernel over whole rows
+static TELLOC_CONVERT_INLINE void telloc_convert_row_scalar(const unsigned char* const* y, const unsigned char* u, const unsigned char* v,
+                                                            unsigned char* const* out, int rows, unsigned int width, int layout) {
+    telloc_convert_rows_scalar_tail(y, u, v, out, rows, 0, width, layout);
+}
+
+TELLOC_CONVERT_BAND(scalar, , telloc_convert_row_scalar)
+#ifdef TELLOC_CONVERT_X86
+TELLOC_CONVERT_BAND(sse41, TELLOC_CONVERT_TARGET_SSE41, telloc_convert_row_sse41)
+TELLOC_CONVERT_BAND(avx2, TELLOC_CONVERT_TARGET_AVX2, telloc_convert_row_avx2)
+#endif
+#ifdef TELLOC_CONVERT_ARM
+TELLOC_CONVERT_BAND(neon, , telloc_convert_row_neon)
+#endif
+
+
+// function to tell whether the kernels write a pixel format
+int telloc_convert_supported(telloc_pixel_format format) {
+    return format == TELLOC_FORMAT_RGB24 || format == TELLOC_FORMAT_BGR24 || format == TELLOC_FORMAT_BGRA;
+}
+
+// function to tell whether this build and cpu can run an instruction set
+int telloc_convert_isa_supported(telloc_convert_isa isa) {
+    switch (isa) {
+        case TELLOC_CONVERT_SCALAR:
+            return 1;
+#ifdef TELLOC_CONVERT_X86
+#ifdef _MSC_VER
+        case TELLOC_CONVERT_SSE41: {
+            int info[4];
+            __cpuid(info, 1);
+            return (info[2] & (1 << 19)) != 0;
+        }
+        case TELLOC_CONVERT_AVX2: {
+            int info[4];
+            __cpuid(info, 1);
+            // the cpu has avx and the os saves the ymm registers
+            if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6) {
+                return 0;
+            }
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+        }
+#else
+        case TELLOC_CONVERT_SSE41:
+            return __builtin_cpu_supports("sse4.1");
+        case TELLOC_CONVERT_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+#endif
+#ifdef TELLOC_CONVERT_ARM
+        case TELLOC_CONVERT_NEON:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+// function to get the fastest instruction set this cpu runs
+telloc_convert_isa telloc_convert_best_isa(void) {
+    // 0 until checked, then the instruction set plus one; every thread that races here finds the same answer
+    static volatile unsigned int best = 0;
+    unsigned int found = telloc_atomic_load_acquire(&best);
+    if (found == 0) {
+        telloc_convert_isa isa = TELLOC_CONVERT_SCALAR;
+        if (telloc_convert_isa_supported(TELLOC_CONVERT_NEON)) {
+            isa = TELLOC_CONVERT_NEON;
+        } else if (telloc_convert_isa_supported(TELLOC_CONVERT_AVX2)) {
+            isa = TELLOC_CONVERT_AVX2;
+        } else if (telloc_convert_isa_supported(TELLOC_CONVERT_SSE41)) {
+            isa = TELLOC_CONVERT_SSE41;
+        }
+        found = (unsigned int) isa + 1;
+        telloc_atomic_store_release(&best, found);
+    }
+    return (telloc_convert_isa) (found - 1);
+}
+
+// function to get the name of an instruction set
+const char* telloc_convert_isa_name(telloc_convert_isa isa) {
+    switch (isa) {
+        case TELLOC_CONVERT_SSE41:
+            return "sse4.1";
+        case TELLOC_CONVERT_AVX2:
+            return "avx2";
+        case TELLOC_CONVERT_NEON:
+            return "neon";
+        default:
+            return "scalar";
+    }
+}
+
+// function to convert a band of rows with the job's instruction set
+void telloc_convert_rows(const telloc_convert_job* job, unsigned int first, unsigned int last) {
+    if (last > job->height) {
+        last = job->height;
+    }
+    switch (job->isa) {
+#ifdef TELLOC_CONVERT_X86
+        case TELLOC_CONVERT_AVX2:
+            telloc_convert_rows_avx2(job, first, last);
+            return;
+        case TELLOC_CONVERT_SSE41:
+            telloc_convert_rows_sse41(job, first, last);
+            return;
+#endif
+#ifdef TELLOC_CONVERT_ARM
+        case TELLOC_CONVERT_NEON:
+            telloc_convert_rows_neon(job, first, last);
+            return;
+#endif
+        default:
+            telloc_convert_rows_scalar(job, first, last);
+            return;
+    }
+}
+
+// function to convert one of bands equal bands of a job; bands start on even rows so no chroma row is split
+void telloc_convert_band(const telloc_convert_job* job, unsigned int band, unsigned int bands) {
+    unsigned int rows = ((job->height + bands - 1) / bands + 1) & ~1u;
+    if (band * rows < job->height) {
+        telloc_convert_rows(job, band * rows, (band + 1) * rows);
+    }
+}
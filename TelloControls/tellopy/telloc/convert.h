@@ -0,0 +1,61 @@
+// Contains the yuv420p to packed rgb conversion kernels for the telloc library
+//
+#ifndef TELLOC_CONVERT_H
+#define TELLOC_CONVERT_H
+
+#include "telloc.h"
+
+// most threads the rows of one conversion are spread over, the reader's own included
+#define TELLOC_CONVERT_THREADS_MAX 8
+
+// the width the kernels are specialised for at compile time; other widths take the generic loop
+#define TELLOC_CONVERT_WIDTH 960
+
+// instruction sets the kernels are written for
+typedef enum {
+    TELLOC_CONVERT_SCALAR = 0,
+    TELLOC_CONVERT_SSE41 = 1,
+    TELLOC_CONVERT_AVX2 = 2,
+    TELLOC_CONVERT_NEON = 3
+} telloc_convert_isa;
+
+#define TELLOC_CONVERT_ISA_COUNT 4
+
+// a yuv420p picture and the packed frame to write it to
+typedef struct {
+    const unsigned char* planes[3];
+    unsigned int strides[3];
+    unsigned char* destination;
+    unsigned int destination_stride;
+    unsigned int width;
+    unsigned int height;
+    // TELLOC_FORMAT_RGB24, TELLOC_FORMAT_BGR24 or TELLOC_FORMAT_BGRA
+    telloc_pixel_format format;
+    telloc_convert_isa isa;
+} telloc_convert_job;
+
+// the threads a backend spreads conversions over; each backend defines it
+typedef struct telloc_convert_pool_ telloc_convert_pool;
+
+// function to tell whether the kernels write a pixel format; the others go through swscale
+int telloc_convert_supported(telloc_pixel_format format);
+
+// function to tell whether this build and this cpu can run an instruction set
+int telloc_convert_isa_supported(telloc_convert_isa isa);
+
+// function to get the fastest instruction set this cpu runs; checked once
+telloc_convert_isa telloc_convert_best_isa(void);
+
+// function to get the name of an instruction set, e.g. for benchmark output
+const char* telloc_convert_isa_name(telloc_convert_isa isa);
+
+// function to convert rows first to last (exclusive) of a job; bands of one job can run on different threads at once
+void telloc_convert_rows(const telloc_convert_job* job, unsigned int first, unsigned int last);
+
+// function to convert one of bands equal bands of a job, the way the pools split it
+void telloc_convert_band(const telloc_convert_job* job, unsigned int band, unsigned int bands);
+
+// function to convert a whole job, its rows split over the pool's threads and the calling thread; each backend implements it
+void telloc_convert_pool_run(telloc_convert_pool* pool, const telloc_convert_job* job);
+
+#endif //TELLOC_CONVERT_H
@@ -0,0 +1,436 @@
+// This program emulates a Tello drone on the loopback interface.
+// It answers the SDK command protocol, sends state strings at 10 Hz and streams
+// h264 video in 1460 byte datagrams at 30 fps, so the library can be tested and
+// benchmarked without a drone.
+//
+// usage: telloc_emulator [-a drone_address] [-n drones] [-f stream.h264] [-l response_latency_ms]
+//
+// The emulator listens for commands on drone_address:8889 (default 127.0.0.2) and
+// sends state and video to the address the "command" command came from, like the
+// drone does, on ports 8890 and 11111 unless a "port" command moved them.
+// Connect to it with telloc_connect_address("127.0.0.1", "127.0.0.2").
+// Without -f a synthetic stream is generated. -n emulates a swarm of drones at
+// consecutive addresses (127.0.0.2, 127.0.0.3, ...), each in its own process.
+//
+#include "telloc.h"
+#include "sample.h"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the Tello splits video into datagrams of this size
+#define EMULATOR_FRAGMENT_SIZE 1460
+#define EMULATOR_FRAME_PERIOD_NS (1000000000L / 30)
+#define EMULATOR_STATE_PERIOD_NS (1000000000L / 10)
+#define EMULATOR_SAMPLE_FRAMES 300
+#define EMULATOR_SWARM_MAX 64
+
+// struct to hold the state of the emulated drone
+typedef struct {
+    volatile int alive;
+
+    int command_socket;
+    int send_socket;
+
+    // the client is known once it sent "command"
+    pthread_mutex_t mutex;
+    int has_client;
+    struct sockaddr_in client;
+    // where state and video go on the client; the "port" command moves them
+    unsigned short state_port;
+    unsigned short video_port;
+    int streaming;
+    int flying;
+    int height;
+    int yaw;
+    int battery;
+    int response_latency_ms;
+
+    // h264 elementary stream and the offsets of its nal units
+    unsigned char* stream;
+    unsigned int stream_size;
+    unsigned int* nal_offsets;
+    unsigned int nal_count;
+} emulator;
+
+static emulator emu;
+
+
+// function to stop the emulator on ctrl-c
+static void emulator_signal(int signal) {
+    (void) signal;
+    emu.alive = 0;
+}
+
+// function to add nanoseconds to a timespec
+static void emulator_add_ns(struct timespec* time, long ns) {
+    time->tv_nsec += ns;
+    while (time->tv_nsec >= 1000000000L) {
+        time->tv_nsec -= 1000000000L;
+        time->tv_sec += 1;
+    }
+}
+
+// function to read a whole file into memory
+static int emulator_read_file(const char* path, unsigned char** data, unsigned int* size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("Could not open %s\n", path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    *data = malloc(length > 0 ? (size_t) length : 1);
+    if (*data == NULL || fread(*data, 1, (size_t) length, file) != (size_t) length) {
+        printf("Could not read %s\n", path);
+        fclose(file);
+        free(*data);
+        return 1;
+    }
+    fclose(file);
+    *size = (unsigned int) length;
+    return 0;
+}
+
+// function to find the start of every nal unit in the stream
+static int emulator_index_stream(void) {
+    emu.nal_offsets = malloc(sizeof(unsigned int) * (emu.stream_size / 4 + 2));
+    if (emu.nal_offsets == NULL) {
+        return 1;
+    }
+    emu.nal_count = 0;
+    for (unsigned int i = 0; i + 3 < emu.stream_size; i++) {
+        if (emu.stream[i] == 0 && emu.stream[i + 1] == 0 && emu.stream[i + 2] == 0 && emu.stream[i + 3] == 1) {
+            emu.nal_offsets[emu.nal_count++] = i;
+            i += 3;
+        }
+    }
+    emu.nal_offsets[emu.nal_count] = emu.stream_size;
+    if (emu.nal_count == 0) {
+        printf("No h264 start codes found in the stream\n");
+        return 1;
+    }
+    return 0;
+}
+
+// function to send a datagram to the client on a port
+static void emulator_send(const void* data, unsigned int size, unsigned short port) {
+    pthread_mutex_lock(&emu.mutex);
+    int has_client = emu.has_client;
+    struct sockaddr_in addr = emu.client;
+    pthread_mutex_unlock(&emu.mutex);
+    if (!has_client) {
+        return;
+    }
+    addr.sin_port = htons(port);
+    sendto(emu.send_socket, data, size, 0, (struct sockaddr*) &addr, sizeof(addr));
+}
+
+// function to build the response to an SDK command
+static int emulator_respond(const char* command, char* response, unsigned int response_length) {
+    pthread_mutex_lock(&emu.mutex);
+    int reply = 1;
+    if (strncmp(command, "rc ", 3) == 0) {
+        // rc commands are not answered
+        reply = 0;
+    } else if (strcmp(command, "command") == 0) {
+        snprintf(response, response_length, "ok");
+    } else if (strncmp(command, "port ", 5) == 0) {
+        int state_port = 0;
+        int video_port = 0;
+        if (sscanf(command + 5, "%d %d", &state_port, &video_port) == 2 && state_port > 1024 && state_port < 65536
+            && video_port > 1024 && video_port < 65536) {
+            emu.state_port = (unsigned short) state_port;
+            emu.video_port = (unsigned short) video_port;
+            snprintf(response, response_length, "ok");
+        } else {
+            snprintf(response, response_length, "error");
+        }
+    } else if (strcmp(command, "streamon") == 0) {
+        emu.streaming = 1;
+        snprintf(response, response_length, "ok");
+    } else if (strcmp(command, "streamoff") == 0) {
+        emu.streaming = 0;
+        snprintf(response, response_length, "ok");
+    } else if (strcmp(command, "takeoff") == 0) {
+        emu.flying = 1;
+        emu.height = 80;
+        snprintf(response, response_length, "ok");
+    } else if (strcmp(command, "land") == 0 || strcmp(command, "emergency") == 0) {
+        emu.flying = 0;
+        emu.height = 0;
+        snprintf(response, response_length, "ok");
+    } else if (strcmp(command, "battery?") == 0) {
+        snprintf(response, response_length, "%d", emu.battery);
+    } else if (strcmp(command, "speed?") == 0) {
+        snprintf(response, response_length, "10.0");
+    } else if (strcmp(command, "time?") == 0) {
+        snprintf(response, response_length, "0s");
+    } else if (strcmp(command, "wifi?") == 0) {
+        snprintf(response, response_length, "90");
+    } else if (strcmp(command, "sdk?") == 0) {
+        snprintf(response, response_length, "20");
+    } else if (strcmp(command, "sn?") == 0) {
+        snprintf(response, response_length, "0TQDEMULATOR");
+    } else if (strncmp(command, "cw ", 3) == 0 || strncmp(command, "ccw ", 4) == 0) {
+        int degrees = atoi(strchr(command, ' ') + 1);
+        emu.yaw = (emu.yaw + (command[1] == 'w' ? degrees : -degrees) + 540) % 360 - 180;
+        snprintf(response, response_length, emu.flying ? "ok" : "error Not flying");
+    } else if (strncmp(command, "up ", 3) == 0 || strncmp(command, "down ", 5) == 0) {
+        int distance = atoi(strchr(command, ' ') + 1);
+        emu.height += command[0] == 'u' ? distance : -distance;
+        emu.height = emu.height < 20 ? 20 : emu.height;
+        snprintf(response, response_length, emu.flying ? "ok" : "error Not flying");
+    } else if (strncmp(command, "forward ", 8) == 0 || strncmp(command, "back ", 5) == 0
+               || strncmp(command, "left ", 5) == 0 || strncmp(command, "right ", 6) == 0) {
+        snprintf(response, response_length, emu.flying ? "ok" : "error Not flying");
+    } else {
+        snprintf(response, response_length, "error");
+    }
+    pthread_mutex_unlock(&emu.mutex);
+    return reply;
+}
+
+// thread to answer commands
+static void* emulator_thread_command(void* arg) {
+    (void) arg;
+    char command[1024];
+    char response[256];
+    while (emu.alive) {
+        struct sockaddr_in from;
+        socklen_t from_length = sizeof(from);
+        int bytes_received = (int) recvfrom(emu.command_socket, command, sizeof(command) - 1, 0, (struct sockaddr*) &from, &from_length);
+        if (bytes_received < 0) {
+            continue;
+        }
+        command[bytes_received] = '\0';
+
+        // the drone sends state and video to whoever sent "command"
+        if (strcmp(command, "command") == 0) {
+            pthread_mutex_lock(&emu.mutex);
+            emu.client = from;
+            emu.has_client = 1;
+            pthread_mutex_unlock(&emu.mutex);
+            printf("Client %s:%d connected\n", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+        }
+
+        if (!emulator_respond(command, response, sizeof(response))) {
+            continue;
+        }
+        if (emu.response_latency_ms > 0) {
+            usleep((useconds_t) emu.response_latency_ms * 1000);
+        }
+        sendto(emu.command_socket, response, strlen(response), 0, (struct sockaddr*) &from, from_length);
+    }
+    return NULL;
+}
+
+// thread to send state strings at 10 Hz
+static void* emulator_thread_state(void* arg) {
+    (void) arg;
+    struct timespec next;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    next = start;
+    unsigned int tick = 0;
+    char state[TELLOC_STATE_SIZE];
+    while (emu.alive) {
+        emulator_add_ns(&next, EMULATOR_STATE_PERIOD_NS);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        tick++;
+
+        pthread_mutex_lock(&emu.mutex);
+        // drain one percent of battery per minute
+        if (tick % 600 == 0 && emu.battery > 0) {
+            emu.battery--;
+        }
+        int pitch = emu.flying ? (int) (tick % 7) - 3 : 0;
+        int roll = emu.flying ? (int) (tick % 5) - 2 : 0;
+        int length = snprintf(state, sizeof(state),
+                              "mid:-1;x:0;y:0;z:0;mpry:0,0,0;pitch:%d;roll:%d;yaw:%d;vgx:0;vgy:0;vgz:0;templ:%d;temph:%d;"
+                              "tof:%d;h:%d;bat:%d;baro:%.2f;time:%d;agx:%.2f;agy:%.2f;agz:%.2f;\r\n",
+                              pitch, roll, emu.yaw, 60 + (int) (tick / 600), 63 + (int) (tick / 600),
+                              emu.flying ? emu.height + 10 : 10, emu.height, emu.battery,
+                              100.0 + emu.height / 100.0, emu.flying ? (int) (tick / 10) : 0,
+                              (double) pitch * 2.0, (double) roll * 2.0, -1000.0 + (double) (tick % 9));
+        unsigned short port = emu.state_port;
+        pthread_mutex_unlock(&emu.mutex);
+
+        emulator_send(state, (unsigned int) length, port);
+    }
+    return NULL;
+}
+
+// thread to stream the h264 nal units in fragments at 30 fps
+static void* emulator_thread_video(void* arg) {
+    (void) arg;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    unsigned int nal = 0;
+    while (emu.alive) {
+        pthread_mutex_lock(&emu.mutex);
+        int streaming = emu.streaming;
+        unsigned short port = emu.video_port;
+        pthread_mutex_unlock(&emu.mutex);
+
+        // send nal units up to and including the next picture
+        while (streaming && emu.alive) {
+            unsigned int begin = emu.nal_offsets[nal];
+            unsigned int end = emu.nal_offsets[nal + 1];
+            int nal_type = end - begin > 4 ? emu.stream[begin + 4] & 0x1f : 0;
+            for (unsigned int offset = begin; offset < end; offset += EMULATOR_FRAGMENT_SIZE) {
+                unsigned int size = end - offset < EMULATOR_FRAGMENT_SIZE ? end - offset : EMULATOR_FRAGMENT_SIZE;
+                emulator_send(emu.stream + offset, size, port);
+            }
+            // loop the recording
+            nal = nal + 1 < emu.nal_count ? nal + 1 : 0;
+            if (nal_type == 1 || nal_type == 5) {
+                break;
+            }
+        }
+
+        emulator_add_ns(&next, EMULATOR_FRAME_PERIOD_NS);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+// function to create a UDP socket bound to an address and port
+static int emulator_bind(const char* address, unsigned short port) {
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == -1) {
+        printf("Error creating socket: %d\n", errno);
+        return -1;
+    }
+    // wake up once per second to check if we should exit
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(address);
+    if (bind(sock, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        printf("Error binding socket to %s:%d: %d\n", address, port, errno);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int main(int argc, char** argv) {
+    const char* address = "127.0.0.2";
+    const char* stream_path = NULL;
+    int drones = 1;
+    int option;
+
+    memset(&emu, 0, sizeof(emu));
+    while ((option = getopt(argc, argv, "a:n:f:l:")) != -1) {
+        switch (option) {
+            case 'a':
+                address = optarg;
+                break;
+            case 'n':
+                drones = atoi(optarg);
+                drones = drones < 1 ? 1 : drones > EMULATOR_SWARM_MAX ? EMULATOR_SWARM_MAX : drones;
+                break;
+            case 'f':
+                stream_path = optarg;
+                break;
+            case 'l':
+                emu.response_latency_ms = atoi(optarg);
+                break;
+            default:
+                printf("usage: %s [-a drone_address] [-n drones] [-f stream.h264] [-l response_latency_ms]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    // load the recording or generate a synthetic stream
+    if (stream_path != NULL) {
+        if (emulator_read_file(stream_path, &emu.stream, &emu.stream_size)) {
+            return 1;
+        }
+    } else if (telloc_sample_stream(EMULATOR_SAMPLE_FRAMES, &emu.stream, &emu.stream_size)) {
+        printf("Could not generate the sample stream\n");
+        return 1;
+    }
+    if (emulator_index_stream()) {
+        return 1;
+    }
+
+    // a swarm is a process per drone, each at the next address; they share the stream until they exit
+    char swarm_address[INET_ADDRSTRLEN];
+    pid_t children[EMULATOR_SWARM_MAX];
+    int child_count = 0;
+    for (int i = 1; i < drones; i++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            printf("Could not start drone %d: %d\n", i + 1, errno);
+            break;
+        }
+        if (pid == 0) {
+            struct in_addr drone;
+            drone.s_addr = htonl(ntohl(inet_addr(address)) + (unsigned int) i);
+            inet_ntop(AF_INET, &drone, swarm_address, sizeof(swarm_address));
+            address = swarm_address;
+            child_count = 0;
+            break;
+        }
+        children[child_count++] = pid;
+    }
+
+    emu.command_socket = emulator_bind(address, TELLOC_COMMAND_PORT);
+    emu.send_socket = emulator_bind(address, 0);
+    if (emu.command_socket == -1 || emu.send_socket == -1) {
+        return 1;
+    }
+
+    emu.alive = 1;
+    emu.battery = 87;
+    emu.state_port = TELLOC_STATE_PORT;
+    emu.video_port = TELLOC_VIDEO_PORT;
+    emu.mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    signal(SIGINT, emulator_signal);
+    signal(SIGTERM, emulator_signal);
+
+    printf("Emulating a Tello on %s with %u nal units of video\n", address, emu.nal_count);
+
+    pthread_t command_thread;
+    pthread_t state_thread;
+    pthread_t video_thread;
+    pthread_create(&command_thread, NULL, emulator_thread_command, NULL);
+    pthread_create(&state_thread, NULL, emulator_thread_state, NULL);
+    pthread_create(&video_thread, NULL, emulator_thread_video, NULL);
+
+    pthread_join(command_thread, NULL);
+    pthread_join(state_thread, NULL);
+    pthread_join(video_thread, NULL);
+
+    // the rest of the swarm goes with the first drone
+    for (int i = 0; i < child_count; i++) {
+        kill(children[i], SIGTERM);
+        waitpid(children[i], NULL, 0);
+    }
+
+    close(emu.command_socket);
+    close(emu.send_socket);
+    free(emu.stream);
+    free(emu.nal_offsets);
+    return 0;
+}
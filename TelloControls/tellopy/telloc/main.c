@@ -1,17 +1,25 @@
 // This program is a test program for the telloc library.
 // Connects to the tello and prints out video size and state information
 // Assumes you are connected to the tello over wifi.
+// Run as `main 127.0.0.1 127.0.0.2` to connect to telloc_emulator instead.
 //
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "telloc.h"
 
 // test main function
-int main(void) {
+int main(int argc, char **argv) {
     // default connect on all interfaces 0.0.0.0
-    telloc_connection *connection=telloc_connect();
+    telloc_connection *connection;
+    if (argc > 2) {
+        // connect to a drone (or emulator) at a given address from a given interface
+        connection = telloc_connect_address(argv[1], argv[2]);
+    } else {
+        connection = telloc_connect();
+    }
 
 //    // connect on a specific interface
 //    telloc_connection *connection= = telloc_connect_interface(""192.168.10.2");
@@ -22,33 +30,69 @@ int main(void) {
         return 1;
     }
 
+    // show how the decoder ended up being configured
+    telloc_video_config video_config;
+    if (!telloc_get_video_config(connection, &video_config)) {
+        printf("Decoder: %d thread(s), threading %d, low delay %d\n", video_config.thread_count, video_config.threading, video_config.low_delay);
+    }
+
     // send a command to the Tello drone
     if (telloc_send_command(connection, "streamon", 8, NULL, 0)) {
         return 1;
     }
 
-    // state is a string
-    char *state = malloc(TELLOC_STATE_SIZE);
-
-    // our video is 960x720 pixels, encoded as RGB 8-bit format
-    unsigned char *image = malloc(TELLOC_VIDEO_SIZE);
-    unsigned int image_bytes;
-    unsigned int image_width;
-    unsigned int image_height;
+    // our video is 960x720 pixels, encoded as RGB 8-bit format.
+    // frames are borrowed from the library instead of copied into our own buffer.
+    const telloc_frame *frame;
 
+    // count frames as they arrive and report once a second
+    unsigned int frames = 0;
+    unsigned int bytes = 0, width = 0, height = 0;
+    telloc_frame_info info = {0};
+    telloc_frame_info reported = {0};
+    unsigned long long age = 0;
+    time_t last_report = time(NULL);
 
-    // check if user is pressing any key asynchronously
     while (1) {
 
-        // read a video frame from the Tello drone
-        if(!telloc_read_image(connection, image, TELLOC_VIDEO_SIZE, &image_bytes, &image_width, &image_height)) {
-            printf("Image: %d bytes; %d x %d\n", image_bytes, image_width, image_height);
+        // sleep until the next video frame is decoded, then borrow it
+        if(!telloc_wait_frame(connection, 1000, &frame)) {
+            frames++;
+            bytes = frame->bytes;
+            width = frame->width;
+            height = frame->height;
+            info = frame->info;
+            age = telloc_time() - info.received_time;
+            telloc_release_frame(connection, frame);
+        }
+        if (time(NULL) == last_report) {
+            continue;
+        }
+        last_report = time(NULL);
+
+        printf("Image: %d bytes; %d x %d; %u frames\n", bytes, width, height, frames);
+        // where the last frame's latency went, in microseconds
+        printf("Frame %llu: assemble %llu us, decode %llu us, convert %llu us, age %llu us when read; %u overwritten%s\n",
+               info.sequence, (info.assembled_time - info.received_time) / 1000, (info.decoded_time - info.assembled_time) / 1000,
+               (info.converted_time - info.decoded_time) / 1000, age / 1000, info.frames_overwritten, info.keyframe ? "; keyframe" : "");
+        frames = 0;
+        // get the latest parsed state
+        telloc_state state;
+        if(!telloc_get_state(connection, &state)) {
+            printf("State %llu: pitch %d, roll %d, yaw %d; height %d cm; battery %d%%; baro %.2f cm; agz %.2f\n",
+                   state.sequence, state.pitch, state.roll, state.yaw, state.h, state.bat, state.baro, state.agz);
+        }
+        // line the telemetry up with the frame reported last time; the newest frame is usually ahead of the newest state
+        telloc_state at_frame;
+        if(reported.sequence && !telloc_interpolate_state(connection, reported.received_time, &at_frame)) {
+            printf("At frame %llu: pitch %d, roll %d, yaw %d; height %d cm\n", reported.sequence, at_frame.pitch, at_frame.roll, at_frame.yaw, at_frame.h);
         }
-        // try to read state now
-        if(!telloc_read_state(connection, state, TELLOC_STATE_SIZE)) {
-            printf("State: %s\n", state);
+        reported = info;
+        // show how well the video socket is keeping up
+        telloc_receive_stats receive_stats;
+        if(!telloc_get_receive_stats(connection, &receive_stats)) {
+            printf("Video: %lu datagrams in %lu batches; %lu dropped, %lu truncated\n", receive_stats.datagrams_received, receive_stats.batches, receive_stats.datagrams_dropped, receive_stats.datagrams_truncated);
         }
-        sleep(1);
     }
 
     // disconnect from the Tello drone
@@ -7,21 +7,14 @@
 #include <stdlib.h>
 #include <windows.h>
 
-// Convert raw rgb frame to bi format for Windows display
-void rgb_to_bi(const unsigned char* rgb, unsigned char* bi, int width, int height) {
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            bi[(i * width + j) * 3 + 0] = rgb[(i * width + j) * 3 + 2];
-            bi[(i * width + j) * 3 + 1] = rgb[(i * width + j) * 3 + 1];
-            bi[(i * width + j) * 3 + 2] = rgb[(i * width + j) * 3 + 0];
-        }
-    }
-}
-
 // test main function
 int main(void) {
     // default connect on all interfaces 0.0.0.0
-    telloc_connection *connection = telloc_connect();
+    // ask for BGR frames, the byte order Windows bitmaps use, so they can be drawn as they are
+    telloc_config config;
+    telloc_config_default(&config);
+    config.video.format = TELLOC_FORMAT_BGR24;
+    telloc_connection *connection = telloc_connect_config(&config);
     if (!connection) {
         return 1;
     }
@@ -35,7 +28,7 @@ int main(void) {
     HWND hwnd = CreateWindowEx(0, "STATIC", "Tello Video", WS_OVERLAPPEDWINDOW, 0, 0, 960, 720, NULL, NULL, NULL, NULL);
 
     // create a device context frame buffer for the video
-    // our video is 960x720 pixels, encoded as RGB 8-bit format
+    // our video is 960x720 pixels, encoded as BGR 8-bit format
     BITMAPINFO bmi;
     bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
     bmi.bmiHeader.biWidth = 960;
@@ -50,19 +43,14 @@ int main(void) {
     // show the window
     ShowWindow(hwnd, SW_SHOW);
 
-    unsigned char *image = malloc(TELLOC_VIDEO_SIZE);
-    unsigned char *bi = malloc(TELLOC_VIDEO_SIZE);
-    unsigned int image_bytes;
-    unsigned int image_width;
-    unsigned int image_height;
+    const telloc_frame *frame;
     while(1) {
-        // read a video frame from the Tello drone
-        if(!telloc_read_image(connection, image, TELLOC_VIDEO_SIZE, &image_bytes, &image_width, &image_height)) {
-            // display the video frame using Windows API
-            rgb_to_bi(image, bi, image_width, image_height);
-            StretchDIBits(hdc, 0, 0, image_width, image_height, 0, 0, image_width, image_height, bi, &bmi, DIB_RGB_COLORS, SRCCOPY);
-            printf("Image: %d bytes; %d x %d\n", image_bytes, image_width, image_height);
-            Sleep(5);
+        // wait briefly for the next video frame from the Tello drone, so window messages are still handled
+        if(!telloc_wait_frame(connection, 10, &frame)) {
+            // display the video frame using Windows API straight from the library's buffer
+            StretchDIBits(hdc, 0, 0, frame->width, frame->height, 0, 0, frame->width, frame->height, frame->data, &bmi, DIB_RGB_COLORS, SRCCOPY);
+            printf("Image: %d bytes; %d x %d\n", frame->bytes, frame->width, frame->height);
+            telloc_release_frame(connection, frame);
         }
         // windows event loop
         MSG msg;
@@ -82,9 +70,5 @@ int main(void) {
     }
     connection = NULL;
 
-    // free memory
-    free(image);
-    free(bi);
-
     return 0;
 }
\ No newline at end of file
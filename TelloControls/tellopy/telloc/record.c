@@ -0,0 +1,269 @@
+// Contains the implementation of the recorder for the telloc library
+//
+#include "record.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// function to collect the sequence and picture parameter sets of an access unit, start codes included, for the mp4 header
+static unsigned int telloc_recorder_parameter_sets(const telloc_video_unit* unit, unsigned char* destination, unsigned int capacity) {
+    unsigned int length = 0;
+    unsigned int position = telloc_video_find_start_code(unit->data, 0, unit->length);
+    while (position + 3 < unit->length) {
+        unsigned int next = telloc_video_find_start_code(unit->data, position + 3, unit->length);
+        int nal_type = unit->data[position + 3] & 0x1f;
+        if (nal_type == 7 || nal_type == 8) {
+            // a trailing zero before the next start code belongs to that start code
+            unsigned int end = next < unit->length && unit->data[next - 1] == 0 ? next - 1 : next;
+            if (length + end - position > capacity) {
+                return 0;
+            }
+            memcpy(destination + length, unit->data + position, end - position);
+            length += end - position;
+        }
+        position = next;
+    }
+    return length;
+}
+
+// function to set up the mp4 muxer; its header waits for the first keyframe, which carries the parameter sets
+static int telloc_recorder_open_mp4(telloc_recorder* recorder, const char* path) {
+    if (avformat_alloc_output_context2(&recorder->muxer, NULL, "mp4", path) < 0 || recorder->muxer == NULL) {
+        printf("Error creating mp4 muxer for %s\n", path);
+        return 1;
+    }
+    recorder->stream = avformat_new_stream(recorder->muxer, NULL);
+    recorder->packet = av_packet_alloc();
+    if (recorder->stream == NULL || recorder->packet == NULL) {
+        printf("Error creating mp4 stream for %s\n", path);
+        return 1;
+    }
+    recorder->stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    recorder->stream->codecpar->codec_id = AV_CODEC_ID_H264;
+    recorder->stream->codecpar->width = TELLOC_FRAME_WIDTH;
+    recorder->stream->codecpar->height = TELLOC_FRAME_HEIGHT;
+    // receive times are in nanoseconds; microseconds are plenty for the mp4
+    recorder->stream->time_base = (AVRational) {1, 1000000};
+
+    if (!(recorder->muxer->oformat->flags & AVFMT_NOFILE) && avio_open(&recorder->muxer->pb, path, AVIO_FLAG_WRITE) < 0) {
+        printf("Error opening %s for writing\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+// function to open path with a suffix for writing, behind a big buffer, and write a header for format to it
+static FILE* telloc_recorder_open_log(const char* path, const char* suffix, unsigned int format, char** buffer) {
+    size_t path_length = strlen(path);
+    size_t suffix_length = strlen(suffix);
+    char* log_path = (char*) malloc(path_length + suffix_length + 1);
+    if (log_path == NULL) {
+        return NULL;
+    }
+    memcpy(log_path, path, path_length);
+    memcpy(log_path + path_length, suffix, suffix_length + 1);
+    FILE* file = fopen(log_path, "wb");
+    if (file == NULL) {
+        printf("Error opening %s for writing\n", log_path);
+        free(log_path);
+        return NULL;
+    }
+    free(log_path);
+
+    // big buffers turn the small writes into one system call per megabyte
+    *buffer = (char*) malloc(TELLOC_RECORD_BUFFER_SIZE);
+    if (*buffer != NULL) {
+        setvbuf(file, *buffer, _IOFBF, TELLOC_RECORD_BUFFER_SIZE);
+    }
+
+    telloc_record_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TELLOC_RECORD_MAGIC, sizeof(header.magic));
+    header.version = TELLOC_RECORD_VERSION;
+    header.entry_size = sizeof(telloc_record_entry);
+    header.format = format;
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        printf("Error writing recording header\n");
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+// function to create the recording files
+int telloc_recorder_open(telloc_recorder* recorder, const char* path, telloc_record_format format) {
+    memset(recorder, 0, sizeof(telloc_recorder));
+    recorder->format = format;
+    recorder->last_pts = -1;
+
+    recorder->index = telloc_recorder_open_log(path, ".idx", (unsigned int) format, &recorder->index_buffer);
+    recorder->state = telloc_recorder_open_log(path, ".state", TELLOC_RECORD_STATE, &recorder->state_buffer);
+    if (recorder->index == NULL || recorder->state == NULL) {
+        telloc_recorder_close(recorder);
+        return 1;
+    }
+
+    if (format == TELLOC_RECORD_MP4) {
+        if (telloc_recorder_open_mp4(recorder, path) != 0) {
+            telloc_recorder_close(recorder);
+            return 1;
+        }
+    } else {
+        recorder->video = fopen(path, "wb");
+        if (recorder->video == NULL) {
+            printf("Error opening %s for writing\n", path);
+            telloc_recorder_close(recorder);
+            return 1;
+        }
+        recorder->video_buffer = (char*) malloc(TELLOC_RECORD_BUFFER_SIZE);
+        if (recorder->video_buffer != NULL) {
+            setvbuf(recorder->video, recorder->video_buffer, _IOFBF, TELLOC_RECORD_BUFFER_SIZE);
+        }
+    }
+
+    recorder->stats.recording = 1;
+    return 0;
+}
+
+// function to start the mp4 at its first keyframe
+static int telloc_recorder_start_mp4(telloc_recorder* recorder, const telloc_video_unit* unit) {
+    unsigned char parameter_sets[TELLOC_RECORD_EXTRADATA_SIZE];
+    unsigned int length = telloc_recorder_parameter_sets(unit, parameter_sets, sizeof(parameter_sets));
+    if (length == 0) {
+        // a keyframe without its parameter sets can't start an mp4; wait for the next one
+        return 1;
+    }
+    AVCodecParameters* parameters = recorder->stream->codecpar;
+    parameters->extradata = (uint8_t*) av_mallocz(length + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (parameters->extradata == NULL) {
+        return 1;
+    }
+    memcpy(parameters->extradata, parameter_sets, length);
+    parameters->extradata_size = (int) length;
+
+    if (avformat_write_header(recorder->muxer, NULL) < 0) {
+        printf("Error writing mp4 header\n");
+        return 1;
+    }
+    return 0;
+}
+
+// function to write an access unit
+int telloc_recorder_write(telloc_recorder* recorder, const telloc_video_unit* unit) {
+    if (!recorder->stats.recording) {
+        return 1;
+    }
+
+    if (!recorder->started) {
+        if (!unit->keyframe || (recorder->format == TELLOC_RECORD_MP4 && telloc_recorder_start_mp4(recorder, unit) != 0)) {
+            recorder->stats.units_skipped++;
+            return 1;
+        }
+        recorder->started = 1;
+        recorder->first_time = unit->received_time;
+    }
+
+    telloc_record_entry entry;
+    entry.received_time = unit->received_time;
+    entry.length = unit->length;
+    entry.flags = unit->keyframe ? TELLOC_RECORD_KEYFRAME : 0;
+
+    if (recorder->format == TELLOC_RECORD_MP4) {
+        entry.offset = recorder->stats.units;
+
+        // the muxer turns the annex b start codes into length prefixes; times must keep increasing
+        long long pts = (long long) av_rescale_q((int64_t) (unit->received_time - recorder->first_time), (AVRational) {1, 1000000000},
+                                                 recorder->stream->time_base);
+        if (pts <= recorder->last_pts) {
+            pts = recorder->last_pts + 1;
+        }
+        recorder->last_pts = pts;
+        AVPacket* packet = recorder->packet;
+        packet->data = (uint8_t*) unit->data;
+        packet->size = (int) unit->length;
+        packet->pts = pts;
+        packet->dts = pts;
+        packet->flags = unit->keyframe ? AV_PKT_FLAG_KEY : 0;
+        packet->stream_index = recorder->stream->index;
+        int written = av_interleaved_write_frame(recorder->muxer, packet);
+        av_packet_unref(packet);
+        if (written < 0) {
+            printf("Error writing to mp4 recording\n");
+            return 1;
+        }
+    } else {
+        entry.offset = recorder->stats.bytes;
+        if (fwrite(unit->data, 1, unit->length, recorder->video) != unit->length) {
+            printf("Error writing to h264 recording\n");
+            return 1;
+        }
+    }
+    if (fwrite(&entry, sizeof(entry), 1, recorder->index) != 1) {
+        printf("Error writing recording index\n");
+        return 1;
+    }
+
+    recorder->stats.units++;
+    recorder->stats.keyframes += unit->keyframe ? 1 : 0;
+    recorder->stats.bytes += unit->length;
+    return 0;
+}
+
+// function to write a state datagram to the state log
+int telloc_recorder_write_state(telloc_recorder* recorder, const char* data, unsigned int length, unsigned long long time) {
+    if (!recorder->stats.recording) {
+        return 1;
+    }
+
+    telloc_record_entry entry;
+    entry.offset = recorder->states++;
+    entry.received_time = time;
+    entry.length = length;
+    entry.flags = 0;
+    if (fwrite(&entry, sizeof(entry), 1, recorder->state) != 1 || fwrite(data, 1, length, recorder->state) != length) {
+        printf("Error writing recording state log\n");
+        return 1;
+    }
+    return 0;
+}
+
+// function to finish the recording
+int telloc_recorder_close(telloc_recorder* recorder) {
+    int failed = 0;
+    if (recorder->muxer != NULL) {
+        if (recorder->started && av_write_trailer(recorder->muxer) < 0) {
+            printf("Error finishing mp4 recording\n");
+            failed = 1;
+        }
+        if (!(recorder->muxer->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&recorder->muxer->pb);
+        }
+        avformat_free_context(recorder->muxer);
+        recorder->muxer = NULL;
+        recorder->stream = NULL;
+    }
+    av_packet_free(&recorder->packet);
+    if (recorder->video != NULL && fclose(recorder->video) != 0) {
+        printf("Error finishing h264 recording\n");
+        failed = 1;
+    }
+    if (recorder->index != NULL && fclose(recorder->index) != 0) {
+        printf("Error finishing recording index\n");
+        failed = 1;
+    }
+    if (recorder->state != NULL && fclose(recorder->state) != 0) {
+        printf("Error finishing recording state log\n");
+        failed = 1;
+    }
+    recorder->video = NULL;
+    recorder->index = NULL;
+    recorder->state = NULL;
+    free(recorder->video_buffer);
+    free(recorder->index_buffer);
+    free(recorder->state_buffer);
+    recorder->video_buffer = NULL;
+    recorder->index_buffer = NULL;
+    recorder->state_buffer = NULL;
+    recorder->stats.recording = 0;
+    return failed;
+}
@@ -0,0 +1,53 @@
+// Contains the recorder that writes the reassembled video stream to disk for the telloc library
+//
+#ifndef TELLOC_RECORD_H
+#define TELLOC_RECORD_H
+
+#include "telloc.h"
+#include "video.h"
+
+#include "libavformat/avformat.h"
+#include <stdio.h>
+
+// stdio buffer for each recording file, so the video thread seldom waits for a write to reach the disk
+#define TELLOC_RECORD_BUFFER_SIZE (1024 * 1024)
+
+// longest run of parameter sets taken from a keyframe for the mp4 header
+#define TELLOC_RECORD_EXTRADATA_SIZE 1024
+
+// struct to write access units to an h264 or mp4 file and their index, as they come out of the reassembler.
+// the recorder does no locking; the backend holds its record mutex around every call
+typedef struct {
+    telloc_record_format format;
+    // the h264 file; mp4 recordings go through the muxer instead
+    FILE* video;
+    FILE* index;
+    // the state datagrams, so the flight can be replayed with its state
+    FILE* state;
+    char* video_buffer;
+    char* index_buffer;
+    char* state_buffer;
+    unsigned long long states;
+    AVFormatContext* muxer;
+    AVStream* stream;
+    AVPacket* packet;
+    // set once the first keyframe was written; everything before it is skipped
+    int started;
+    unsigned long long first_time;
+    long long last_pts;
+    telloc_record_stats stats;
+} telloc_recorder;
+
+// function to create the recording files for path; the index goes to path.idx and the state datagrams to path.state
+int telloc_recorder_open(telloc_recorder* recorder, const char* path, telloc_record_format format);
+
+// function to write an access unit to the recording; units before the first keyframe are skipped
+int telloc_recorder_write(telloc_recorder* recorder, const telloc_video_unit* unit);
+
+// function to write a state datagram received at time to the state log
+int telloc_recorder_write_state(telloc_recorder* recorder, const char* data, unsigned int length, unsigned long long time);
+
+// function to finish the recording and close its files
+int telloc_recorder_close(telloc_recorder* recorder);
+
+#endif //TELLOC_RECORD_H
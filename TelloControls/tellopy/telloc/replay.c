@@ -0,0 +1,176 @@
+// Contains the implementation of the recording reader for the telloc library
+//
+#include "replay.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// function to open path with a suffix and check its header; returns NULL if it is missing or not a recording of format
+static FILE* telloc_replay_open_log(const char* path, const char* suffix, unsigned int format, unsigned int* entry_size) {
+    size_t path_length = strlen(path);
+    size_t suffix_length = strlen(suffix);
+    char* log_path = (char*) malloc(path_length + suffix_length + 1);
+    if (log_path == NULL) {
+        return NULL;
+    }
+    memcpy(log_path, path, path_length);
+    memcpy(log_path + path_length, suffix, suffix_length + 1);
+    FILE* file = fopen(log_path, "rb");
+    if (file == NULL) {
+        printf("Error opening %s for reading\n", log_path);
+        free(log_path);
+        return NULL;
+    }
+
+    telloc_record_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TELLOC_RECORD_MAGIC, sizeof(header.magic)) != 0
+        || header.version != TELLOC_RECORD_VERSION || header.entry_size < sizeof(telloc_record_entry)) {
+        printf("%s is not a telloc recording\n", log_path);
+        fclose(file);
+        free(log_path);
+        return NULL;
+    }
+    if (header.format != format) {
+        printf("%s is the wrong kind of recording; only h264 recordings can be replayed\n", log_path);
+        fclose(file);
+        free(log_path);
+        return NULL;
+    }
+    free(log_path);
+    *entry_size = header.entry_size;
+    return file;
+}
+
+// function to read an entry, skipping fields added after this version
+static int telloc_replay_read_entry(FILE* file, unsigned int entry_size, telloc_record_entry* entry) {
+    if (fread(entry, sizeof(telloc_record_entry), 1, file) != 1) {
+        return 1;
+    }
+    if (entry_size > sizeof(telloc_record_entry) && fseek(file, (long) (entry_size - sizeof(telloc_record_entry)), SEEK_CUR) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// function to read the next access unit into the replay
+static void telloc_replay_load_unit(telloc_replay* replay) {
+    replay->unit_loaded = 0;
+    telloc_record_entry* entry = &replay->unit_entry;
+    if (replay->index == NULL || telloc_replay_read_entry(replay->index, replay->index_entry_size, entry) != 0) {
+        return;
+    }
+    if (entry->length == 0 || entry->length > TELLOC_VIDEO_UNIT_MAX) {
+        printf("Recording index has a unit of %u bytes; Replay stopped there.\n", entry->length);
+        return;
+    }
+    if (entry->length > replay->unit_capacity) {
+        unsigned char* unit = (unsigned char*) realloc(replay->unit, entry->length);
+        if (unit == NULL) {
+            return;
+        }
+        replay->unit = unit;
+        replay->unit_capacity = entry->length;
+    }
+    // units follow each other in the file, so this only seeks if the index says otherwise
+    if ((unsigned long long) ftell(replay->video) != entry->offset && fseek(replay->video, (long) entry->offset, SEEK_SET) != 0) {
+        return;
+    }
+    if (fread(replay->unit, 1, entry->length, replay->video) != entry->length) {
+        printf("Recording ends before its index does; Replay stopped there.\n");
+        return;
+    }
+    replay->unit_position = 0;
+    replay->unit_loaded = 1;
+}
+
+// function to read the next state datagram into the replay
+static void telloc_replay_load_state(telloc_replay* replay) {
+    replay->state_loaded = 0;
+    telloc_record_entry* entry = &replay->state_entry;
+    if (replay->state == NULL || telloc_replay_read_entry(replay->state, replay->state_entry_size, entry) != 0) {
+        return;
+    }
+    if (entry->length > TELLOC_STATE_SIZE || fread(replay->state_data, 1, entry->length, replay->state) != entry->length) {
+        return;
+    }
+    replay->state_loaded = 1;
+}
+
+// function to open a recording
+int telloc_replay_open(telloc_replay* replay, const char* path) {
+    memset(replay, 0, sizeof(telloc_replay));
+    replay->video = fopen(path, "rb");
+    if (replay->video == NULL) {
+        printf("Error opening %s for reading\n", path);
+        return 1;
+    }
+    replay->index = telloc_replay_open_log(path, ".idx", TELLOC_RECORD_H264, &replay->index_entry_size);
+    if (replay->index == NULL) {
+        telloc_replay_close(replay);
+        return 1;
+    }
+    // a recording without its state log still replays its video
+    replay->state = telloc_replay_open_log(path, ".state", TELLOC_RECORD_STATE, &replay->state_entry_size);
+
+    telloc_replay_load_unit(replay);
+    telloc_replay_load_state(replay);
+    return 0;
+}
+
+// function to get the next datagram
+int telloc_replay_next(telloc_replay* replay, telloc_replay_datagram* datagram) {
+    // move past what the last call handed out; its data had to stay valid until now
+    if (replay->state_taken) {
+        replay->state_taken = 0;
+        telloc_replay_load_state(replay);
+    }
+    if (replay->unit_loaded && replay->unit_position >= replay->unit_entry.length) {
+        telloc_replay_load_unit(replay);
+    }
+
+    // whichever was received first; state wins ties, it is the smaller datagram
+    if (replay->state_loaded && (!replay->unit_loaded || replay->state_entry.received_time <= replay->unit_entry.received_time)) {
+        datagram->video = 0;
+        datagram->data = (const unsigned char*) replay->state_data;
+        datagram->length = replay->state_entry.length;
+        datagram->time = replay->state_entry.received_time;
+        datagram->unit_start = 0;
+        replay->state_taken = 1;
+        return 0;
+    }
+    if (!replay->unit_loaded) {
+        return 1;
+    }
+
+    // the rest of the current nal unit, up to a fragment; a leading zero before the next start code belongs to that start code
+    unsigned int position = replay->unit_position;
+    unsigned int length = replay->unit_entry.length;
+    unsigned int end = telloc_video_find_start_code(replay->unit, position + 3 < length ? position + 3 : length, length);
+    if (end < length && end > position + 1 && replay->unit[end - 1] == 0) {
+        end--;
+    }
+    unsigned int size = end - position < TELLOC_VIDEO_FRAGMENT_SIZE ? end - position : TELLOC_VIDEO_FRAGMENT_SIZE;
+
+    datagram->video = 1;
+    datagram->data = replay->unit + position;
+    datagram->length = size;
+    datagram->time = replay->unit_entry.received_time;
+    datagram->unit_start = position == 0;
+    replay->unit_position += size;
+    return 0;
+}
+
+// function to close a recording
+void telloc_replay_close(telloc_replay* replay) {
+    if (replay->video != NULL) {
+        fclose(replay->video);
+    }
+    if (replay->index != NULL) {
+        fclose(replay->index);
+    }
+    if (replay->state != NULL) {
+        fclose(replay->state);
+    }
+    free(replay->unit);
+    memset(replay, 0, sizeof(telloc_replay));
+}
@@ -0,0 +1,58 @@
+// Contains the reader that plays a recording back as the datagrams the drone sent, for the telloc library
+//
+#ifndef TELLOC_REPLAY_H
+#define TELLOC_REPLAY_H
+
+#include "telloc.h"
+#include "video.h"
+
+#include <stdio.h>
+
+// a datagram read back from a recording
+typedef struct {
+    // 1 for video, 0 for state
+    int video;
+    const unsigned char* data;
+    unsigned int length;
+    // when it was received while recording
+    unsigned long long time;
+    // set on the first datagram of an access unit
+    int unit_start;
+} telloc_replay_datagram;
+
+// struct to read a recording's access units and state datagrams back in the order they were received.
+// access units are cut into datagrams the way the drone sends them, each nal unit in TELLOC_VIDEO_FRAGMENT_SIZE
+// pieces, so they go through the same reassembly as live video
+typedef struct {
+    FILE* video;
+    FILE* index;
+    FILE* state;
+    unsigned int index_entry_size;
+    unsigned int state_entry_size;
+
+    // the access unit being cut into datagrams
+    unsigned char* unit;
+    unsigned int unit_capacity;
+    telloc_record_entry unit_entry;
+    unsigned int unit_position;
+    int unit_loaded;
+
+    // the next state datagram
+    char state_data[TELLOC_STATE_SIZE];
+    telloc_record_entry state_entry;
+    int state_loaded;
+    // the last call handed out the state datagram
+    int state_taken;
+} telloc_replay;
+
+// function to open the recording at path with its index and state log
+int telloc_replay_open(telloc_replay* replay, const char* path);
+
+// function to get the next datagram, video or state, by receive time; returns 1 at the end of the recording.
+// the data is valid until the next call
+int telloc_replay_next(telloc_replay* replay, telloc_replay_datagram* datagram);
+
+// function to close the recording
+void telloc_replay_close(telloc_replay* replay);
+
+#endif //TELLOC_REPLAY_H
@@ -0,0 +1,291 @@
+// Contains the synthetic h264 stream generator used by the emulator
+//
+#include "sample.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_MB_WIDTH (TELLOC_SAMPLE_WIDTH / 16)
+#define SAMPLE_MB_HEIGHT (TELLOC_SAMPLE_HEIGHT / 16)
+
+// size of the moving block of raw macroblocks in I and P pictures
+#define SAMPLE_I_BLOCK_WIDTH 8
+#define SAMPLE_I_BLOCK_HEIGHT 6
+#define SAMPLE_P_BLOCK_WIDTH 4
+#define SAMPLE_P_BLOCK_HEIGHT 4
+
+// bit writer for a nal unit payload (rbsp)
+typedef struct {
+    unsigned char* data;
+    unsigned int capacity;
+    unsigned int bits;
+} sample_bits;
+
+// function to append the lowest count bits of value, most significant first
+static int sample_put_bits(sample_bits* bits, unsigned int value, int count) {
+    for (int i = count - 1; i >= 0; i--) {
+        unsigned int byte = bits->bits >> 3;
+        if (byte >= bits->capacity) {
+            return 1;
+        }
+        if ((bits->bits & 7) == 0) {
+            bits->data[byte] = 0;
+        }
+        if ((value >> i) & 1) {
+            bits->data[byte] |= (unsigned char) (0x80 >> (bits->bits & 7));
+        }
+        bits->bits++;
+    }
+    return 0;
+}
+
+// function to write an unsigned exp-golomb code
+static int sample_put_ue(sample_bits* bits, unsigned int value) {
+    unsigned int code = value + 1;
+    int length = 0;
+    while ((code >> length) > 1) {
+        length++;
+    }
+    return sample_put_bits(bits, 0, length) || sample_put_bits(bits, code, length + 1);
+}
+
+// function to write a signed exp-golomb code
+static int sample_put_se(sample_bits* bits, int value) {
+    return sample_put_ue(bits, value > 0 ? (unsigned int) (2 * value - 1) : (unsigned int) (-2 * value));
+}
+
+// function to write the stop bit and zero bits up to the next byte
+static int sample_put_trailing(sample_bits* bits) {
+    if (sample_put_bits(bits, 1, 1)) {
+        return 1;
+    }
+    while (bits->bits & 7) {
+        if (sample_put_bits(bits, 0, 1)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// function to append a nal unit with start code and emulation prevention to the stream
+static int sample_put_nal(unsigned char* stream, unsigned int capacity, unsigned int* size, int ref_idc, int type, const sample_bits* bits) {
+    unsigned int bytes = bits->bits >> 3;
+    // worst case every third byte needs an emulation prevention byte
+    if (*size + 5 + bytes + bytes / 2 > capacity) {
+        return 1;
+    }
+    unsigned char* out = stream + *size;
+    unsigned int n = 0;
+    out[n++] = 0x00;
+    out[n++] = 0x00;
+    out[n++] = 0x00;
+    out[n++] = 0x01;
+    out[n++] = (unsigned char) ((ref_idc << 5) | type);
+    int zeros = 0;
+    for (unsigned int i = 0; i < bytes; i++) {
+        if (zeros == 2 && bits->data[i] <= 0x03) {
+            out[n++] = 0x03;
+            zeros = 0;
+        }
+        out[n++] = bits->data[i];
+        zeros = bits->data[i] == 0 ? zeros + 1 : 0;
+    }
+    *size += n;
+    return 0;
+}
+
+// function to write the sequence parameter set
+static int sample_put_sps(sample_bits* bits) {
+    int error = 0;
+    error |= sample_put_bits(bits, 66, 8);  // baseline profile
+    error |= sample_put_bits(bits, 0xC0, 8);  // constraint_set0 and constraint_set1
+    error |= sample_put_bits(bits, 40, 8);  // level 4.0
+    error |= sample_put_ue(bits, 0);  // seq_parameter_set_id
+    error |= sample_put_ue(bits, 0);  // log2_max_frame_num_minus4
+    error |= sample_put_ue(bits, 2);  // pic_order_cnt_type
+    error |= sample_put_ue(bits, 1);  // max_num_ref_frames
+    error |= sample_put_bits(bits, 0, 1);  // gaps_in_frame_num_value_allowed_flag
+    error |= sample_put_ue(bits, SAMPLE_MB_WIDTH - 1);
+    error |= sample_put_ue(bits, SAMPLE_MB_HEIGHT - 1);
+    error |= sample_put_bits(bits, 1, 1);  // frame_mbs_only_flag
+    error |= sample_put_bits(bits, 1, 1);  // direct_8x8_inference_flag
+    error |= sample_put_bits(bits, 0, 1);  // frame_cropping_flag
+    error |= sample_put_bits(bits, 0, 1);  // vui_parameters_present_flag
+    error |= sample_put_trailing(bits);
+    return error;
+}
+
+// function to write the picture parameter set
+static int sample_put_pps(sample_bits* bits) {
+    int error = 0;
+    error |= sample_put_ue(bits, 0);  // pic_parameter_set_id
+    error |= sample_put_ue(bits, 0);  // seq_parameter_set_id
+    error |= sample_put_bits(bits, 0, 1);  // entropy_coding_mode_flag (cavlc)
+    error |= sample_put_bits(bits, 0, 1);  // bottom_field_pic_order_in_frame_present_flag
+    error |= sample_put_ue(bits, 0);  // num_slice_groups_minus1
+    error |= sample_put_ue(bits, 0);  // num_ref_idx_l0_default_active_minus1
+    error |= sample_put_ue(bits, 0);  // num_ref_idx_l1_default_active_minus1
+    error |= sample_put_bits(bits, 0, 1);  // weighted_pred_flag
+    error |= sample_put_bits(bits, 0, 2);  // weighted_bipred_idc
+    error |= sample_put_se(bits, 0);  // pic_init_qp_minus26
+    error |= sample_put_se(bits, 0);  // pic_init_qs_minus26
+    error |= sample_put_se(bits, 0);  // chroma_qp_index_offset
+    error |= sample_put_bits(bits, 1, 1);  // deblocking_filter_control_present_flag
+    error |= sample_put_bits(bits, 0, 1);  // constrained_intra_pred_flag
+    error |= sample_put_bits(bits, 0, 1);  // redundant_pic_cnt_present_flag
+    error |= sample_put_trailing(bits);
+    return error;
+}
+
+// function to write a raw macroblock; the samples are a pattern that changes every frame
+static int sample_put_pcm(sample_bits* bits, unsigned int mb_x, unsigned int mb_y, unsigned int frame) {
+    int error = 0;
+    // pcm_alignment_zero_bit
+    while (bits->bits & 7) {
+        error |= sample_put_bits(bits, 0, 1);
+    }
+    for (unsigned int y = 0; y < 16; y++) {
+        for (unsigned int x = 0; x < 16; x++) {
+            unsigned int luma = ((mb_x * 16 + x) * 3 + (mb_y * 16 + y) * 5 + frame * 7) & 0xff;
+            error |= sample_put_bits(bits, 16 + luma * 219 / 255, 8);
+        }
+    }
+    for (unsigned int plane = 0; plane < 2; plane++) {
+        for (unsigned int i = 0; i < 64; i++) {
+            unsigned int chroma = (mb_x * 11 + mb_y * 13 + frame * (plane ? 5 : 3) + i) & 0x7f;
+            error |= sample_put_bits(bits, 64 + chroma, 8);
+        }
+    }
+    return error;
+}
+
+// function to check if a macroblock is inside the moving block of raw macroblocks
+static int sample_in_block(unsigned int mb_x, unsigned int mb_y, unsigned int frame, unsigned int width, unsigned int height) {
+    unsigned int x0 = (frame * 2) % (SAMPLE_MB_WIDTH - width + 1);
+    unsigned int y0 = frame % (SAMPLE_MB_HEIGHT - height + 1);
+    return mb_x >= x0 && mb_x < x0 + width && mb_y >= y0 && mb_y < y0 + height;
+}
+
+// function to write an IDR slice: flat intra macroblocks around a block of raw macroblocks
+static int sample_put_idr_slice(sample_bits* bits, unsigned int frame, unsigned int idr_id) {
+    int error = 0;
+    error |= sample_put_ue(bits, 0);  // first_mb_in_slice
+    error |= sample_put_ue(bits, 7);  // slice_type I (all slices)
+    error |= sample_put_ue(bits, 0);  // pic_parameter_set_id
+    error |= sample_put_bits(bits, 0, 4);  // frame_num
+    error |= sample_put_ue(bits, idr_id & 0xff);  // idr_pic_id
+    error |= sample_put_bits(bits, 0, 1);  // no_output_of_prior_pics_flag
+    error |= sample_put_bits(bits, 0, 1);  // long_term_reference_flag
+    error |= sample_put_se(bits, 0);  // slice_qp_delta
+    error |= sample_put_ue(bits, 1);  // disable_deblocking_filter_idc
+
+    for (unsigned int mb_y = 0; mb_y < SAMPLE_MB_HEIGHT; mb_y++) {
+        for (unsigned int mb_x = 0; mb_x < SAMPLE_MB_WIDTH; mb_x++) {
+            if (sample_in_block(mb_x, mb_y, frame, SAMPLE_I_BLOCK_WIDTH, SAMPLE_I_BLOCK_HEIGHT)) {
+                error |= sample_put_ue(bits, 25);  // I_PCM
+                error |= sample_put_pcm(bits, mb_x, mb_y, frame);
+                continue;
+            }
+            // Intra 16x16, DC prediction, no coded residual
+            error |= sample_put_ue(bits, 3);
+            error |= sample_put_ue(bits, 0);  // intra_chroma_pred_mode DC
+            error |= sample_put_se(bits, 0);  // mb_qp_delta
+
+            // the luma DC block's coeff_token table depends on the neighbours' coefficient
+            // counts; raw macroblocks count as 16 coefficients, flat ones as none
+            int left = mb_x > 0;
+            int top = mb_y > 0;
+            int n_left = left && sample_in_block(mb_x - 1, mb_y, frame, SAMPLE_I_BLOCK_WIDTH, SAMPLE_I_BLOCK_HEIGHT) ? 16 : 0;
+            int n_top = top && sample_in_block(mb_x, mb_y - 1, frame, SAMPLE_I_BLOCK_WIDTH, SAMPLE_I_BLOCK_HEIGHT) ? 16 : 0;
+            int n = left && top ? (n_left + n_top + 1) >> 1 : n_left + n_top;
+            if (n >= 8) {
+                error |= sample_put_bits(bits, 0x03, 6);
+            } else {
+                error |= sample_put_bits(bits, 1, 1);
+            }
+        }
+    }
+    error |= sample_put_trailing(bits);
+    return error;
+}
+
+// function to write a P slice: skipped macroblocks around a block of raw macroblocks
+static int sample_put_p_slice(sample_bits* bits, unsigned int frame, unsigned int frame_num) {
+    int error = 0;
+    error |= sample_put_ue(bits, 0);  // first_mb_in_slice
+    error |= sample_put_ue(bits, 5);  // slice_type P (all slices)
+    error |= sample_put_ue(bits, 0);  // pic_parameter_set_id
+    error |= sample_put_bits(bits, frame_num & 0x0f, 4);  // frame_num
+    error |= sample_put_bits(bits, 0, 1);  // num_ref_idx_active_override_flag
+    error |= sample_put_bits(bits, 0, 1);  // ref_pic_list_modification_flag_l0
+    error |= sample_put_bits(bits, 0, 1);  // adaptive_ref_pic_marking_mode_flag
+    error |= sample_put_se(bits, 0);  // slice_qp_delta
+    error |= sample_put_ue(bits, 1);  // disable_deblocking_filter_idc
+
+    unsigned int skip_run = 0;
+    for (unsigned int mb_y = 0; mb_y < SAMPLE_MB_HEIGHT; mb_y++) {
+        for (unsigned int mb_x = 0; mb_x < SAMPLE_MB_WIDTH; mb_x++) {
+            if (!sample_in_block(mb_x, mb_y, frame, SAMPLE_P_BLOCK_WIDTH, SAMPLE_P_BLOCK_HEIGHT)) {
+                skip_run++;
+                continue;
+            }
+            error |= sample_put_ue(bits, skip_run);  // mb_skip_run
+            skip_run = 0;
+            error |= sample_put_ue(bits, 5 + 25);  // I_PCM in a P slice
+            error |= sample_put_pcm(bits, mb_x, mb_y, frame);
+        }
+    }
+    if (skip_run > 0) {
+        error |= sample_put_ue(bits, skip_run);
+    }
+    error |= sample_put_trailing(bits);
+    return error;
+}
+
+// function to generate an Annex-B baseline h264 stream of frame_count frames
+int telloc_sample_stream(unsigned int frame_count, unsigned char** stream, unsigned int* stream_size) {
+    // raw macroblocks dominate the size; leave room for headers and escapes
+    unsigned int mb_bytes = 16 * 16 + 2 * 8 * 8 + 8;
+    unsigned int slice_capacity = SAMPLE_MB_WIDTH * SAMPLE_MB_HEIGHT * 2 + SAMPLE_I_BLOCK_WIDTH * SAMPLE_I_BLOCK_HEIGHT * mb_bytes + 64;
+    unsigned int capacity = (frame_count / TELLOC_SAMPLE_GOP + 1) * (slice_capacity * 3 / 2 + 64)
+                            + frame_count * (SAMPLE_P_BLOCK_WIDTH * SAMPLE_P_BLOCK_HEIGHT * mb_bytes * 3 / 2 + 128);
+
+    sample_bits bits;
+    bits.capacity = slice_capacity;
+    bits.data = malloc(slice_capacity);
+    *stream = malloc(capacity);
+    *stream_size = 0;
+    if (bits.data == NULL || *stream == NULL) {
+        free(bits.data);
+        free(*stream);
+        *stream = NULL;
+        return 1;
+    }
+
+    int error = 0;
+    unsigned int frame_num = 0;
+    for (unsigned int frame = 0; frame < frame_count && !error; frame++) {
+        if (frame % TELLOC_SAMPLE_GOP == 0) {
+            bits.bits = 0;
+            error |= sample_put_sps(&bits) || sample_put_nal(*stream, capacity, stream_size, 3, 7, &bits);
+            bits.bits = 0;
+            error |= sample_put_pps(&bits) || sample_put_nal(*stream, capacity, stream_size, 3, 8, &bits);
+            bits.bits = 0;
+            error |= sample_put_idr_slice(&bits, frame, frame / TELLOC_SAMPLE_GOP) || sample_put_nal(*stream, capacity, stream_size, 3, 5, &bits);
+            frame_num = 0;
+        } else {
+            frame_num++;
+            bits.bits = 0;
+            error |= sample_put_p_slice(&bits, frame, frame_num) || sample_put_nal(*stream, capacity, stream_size, 2, 1, &bits);
+        }
+    }
+
+    free(bits.data);
+    if (error) {
+        free(*stream);
+        *stream = NULL;
+        *stream_size = 0;
+        return 1;
+    }
+    return 0;
+}
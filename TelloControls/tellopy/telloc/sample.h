@@ -0,0 +1,16 @@
+// Contains a generator for a synthetic h264 stream shaped like the Tello camera stream
+//
+#ifndef TELLOC_SAMPLE_H
+#define TELLOC_SAMPLE_H
+
+#define TELLOC_SAMPLE_WIDTH 960
+#define TELLOC_SAMPLE_HEIGHT 720
+#define TELLOC_SAMPLE_GOP 30
+
+// function to generate an Annex-B baseline h264 stream of frame_count 960x720 frames.
+// every TELLOC_SAMPLE_GOP frames starts with SPS, PPS and an IDR picture; the other
+// frames are P pictures. A block of raw (I_PCM) macroblocks moves across the picture so
+// the decoder does real work on every frame. The stream is malloc'd; free it when done.
+int telloc_sample_stream(unsigned int frame_count, unsigned char** stream, unsigned int* stream_size);
+
+#endif //TELLOC_SAMPLE_H
@@ -0,0 +1,118 @@
+// Contains the implementation of the timer heap for the telloc library
+//
+#include "schedule.h"
+
+#include <string.h>
+
+// function to swap two heap entries
+static void telloc_schedule_swap(telloc_schedule *schedule, int a, int b) {
+    telloc_task task = schedule->tasks[a];
+    schedule->tasks[a] = schedule->tasks[b];
+    schedule->tasks[b] = task;
+}
+
+// function to move an entry towards the top while it is due earlier than its parent
+static void telloc_schedule_up(telloc_schedule *schedule, int index) {
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (schedule->tasks[parent].deadline <= schedule->tasks[index].deadline) {
+            return;
+        }
+        telloc_schedule_swap(schedule, parent, index);
+        index = parent;
+    }
+}
+
+// function to move an entry towards the bottom while a child is due earlier
+static void telloc_schedule_down(telloc_schedule *schedule, int index) {
+    while (1) {
+        int earliest = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+        if (left < schedule->count && schedule->tasks[left].deadline < schedule->tasks[earliest].deadline) {
+            earliest = left;
+        }
+        if (right < schedule->count && schedule->tasks[right].deadline < schedule->tasks[earliest].deadline) {
+            earliest = right;
+        }
+        if (earliest == index) {
+            return;
+        }
+        telloc_schedule_swap(schedule, earliest, index);
+        index = earliest;
+    }
+}
+
+// function to initialize an empty schedule
+void telloc_schedule_init(telloc_schedule *schedule) {
+    memset(schedule, 0, sizeof(telloc_schedule));
+}
+
+// function to add a task
+int telloc_schedule_add(telloc_schedule *schedule, unsigned long long deadline, unsigned long long period, telloc_periodic_callback function, void *user) {
+    if (schedule->count == TELLOC_SCHEDULE_SIZE || period == 0) {
+        return -1;
+    }
+    int id = schedule->next_id++;
+    telloc_task *task = &schedule->tasks[schedule->count];
+    task->deadline = deadline;
+    task->period = period;
+    task->function = function;
+    task->user = user;
+    task->id = id;
+    schedule->count++;
+    telloc_schedule_up(schedule, schedule->count - 1);
+    return id;
+}
+
+// function to reserve the tasks added so far
+void telloc_schedule_reserve(telloc_schedule *schedule) {
+    schedule->reserved = schedule->next_id;
+}
+
+// function to remove a task
+int telloc_schedule_remove(telloc_schedule *schedule, int id) {
+    for (int i = 0; i < schedule->count; i++) {
+        if (schedule->tasks[i].id != id) {
+            continue;
+        }
+        // the last entry takes its place and settles either way
+        schedule->count--;
+        if (i != schedule->count) {
+            schedule->tasks[i] = schedule->tasks[schedule->count];
+            telloc_schedule_up(schedule, i);
+            telloc_schedule_down(schedule, i);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+// function to remove a task a caller added
+int telloc_schedule_remove_public(telloc_schedule *schedule, int id) {
+    if (id < schedule->reserved) {
+        return 1;
+    }
+    return telloc_schedule_remove(schedule, id);
+}
+
+// function to get the next deadline
+unsigned long long telloc_schedule_deadline(telloc_schedule *schedule) {
+    return schedule->count > 0 ? schedule->tasks[0].deadline : 0;
+}
+
+// function to take a due task and schedule its next run
+int telloc_schedule_due(telloc_schedule *schedule, unsigned long long time, telloc_task *task) {
+    if (schedule->count == 0 || schedule->tasks[0].deadline > time) {
+        return 0;
+    }
+    *task = schedule->tasks[0];
+
+    telloc_task *top = &schedule->tasks[0];
+    top->deadline += top->period;
+    if (top->deadline <= time) {
+        top->deadline = time + top->period;
+    }
+    telloc_schedule_down(schedule, 0);
+    return 1;
+}
@@ -0,0 +1,59 @@
+// Contains the timer heap behind the telloc library's scheduler thread
+//
+#ifndef TELLOC_SCHEDULE_H
+#define TELLOC_SCHEDULE_H
+
+#include "telloc.h"
+
+// periodic tasks a connection can have, its own included
+#define TELLOC_SCHEDULE_SIZE 32
+// milliseconds between battery? queries, which also keep the drone from landing (it does after 15 seconds of silence)
+#define TELLOC_KEEPALIVE_PERIOD 10000
+// milliseconds between wifi? queries
+#define TELLOC_WIFI_PERIOD 5000
+// milliseconds without state or video before a watchdog reports it lost, and between checks
+#define TELLOC_WATCHDOG_TIMEOUT 1000
+#define TELLOC_WATCHDOG_PERIOD 500
+
+// struct for a periodic task
+typedef struct {
+    unsigned long long deadline;
+    unsigned long long period;
+    telloc_periodic_callback function;
+    void *user;
+    int id;
+} telloc_task;
+
+// struct for a connection's periodic tasks, a binary heap with the next deadline on top.
+// the schedule does no locking; the backend holds its schedule mutex around every call
+typedef struct {
+    telloc_task tasks[TELLOC_SCHEDULE_SIZE];
+    int count;
+    int next_id;
+    // ids below this belong to the backend's own tasks, which callers can't remove
+    int reserved;
+} telloc_schedule;
+
+// function to initialize an empty schedule
+void telloc_schedule_init(telloc_schedule *schedule);
+
+// function to add a task first due at deadline and every period nanoseconds after; returns its id, or -1 if the schedule is full
+int telloc_schedule_add(telloc_schedule *schedule, unsigned long long deadline, unsigned long long period, telloc_periodic_callback function, void *user);
+
+// function to keep the tasks added so far out of reach of telloc_schedule_remove_public
+void telloc_schedule_reserve(telloc_schedule *schedule);
+
+// function to remove a task; returns 1 if there is no task with that id
+int telloc_schedule_remove(telloc_schedule *schedule, int id);
+
+// function to remove a task a caller added; returns 1 if there is no such task or it is one of the reserved ones
+int telloc_schedule_remove_public(telloc_schedule *schedule, int id);
+
+// function to get the next deadline, or 0 if there are no tasks
+unsigned long long telloc_schedule_deadline(telloc_schedule *schedule);
+
+// function to take a task due at time into task and schedule its next run; returns 0 if none is due.
+// a task that fell behind runs once, then keeps to its period from now
+int telloc_schedule_due(telloc_schedule *schedule, unsigned long long time, telloc_task *task);
+
+#endif //TELLOC_SCHEDULE_H
@@ -0,0 +1,338 @@
+// Contains the implementation of the state parser and seqlock for the telloc library
+//
+#include "state.h"
+#include "atomics.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define TELLOC_STATE_INT 0
+#define TELLOC_STATE_FLOAT 1
+
+// how a field is interpolated between two samples
+#define TELLOC_STATE_LINEAR 0
+// ids and counters; the earlier sample's value is kept
+#define TELLOC_STATE_DISCRETE 1
+// degrees that wrap around at +-180
+#define TELLOC_STATE_ANGLE 2
+
+// struct describing where a state key is stored
+typedef struct {
+    const char* key;
+    unsigned int key_length;
+    int type;
+    // number of comma separated values
+    int count;
+    size_t offset;
+    int interpolation;
+} telloc_state_field;
+
+// the fields in the order the drone sends them, so the next key is usually the next entry
+static const telloc_state_field telloc_state_fields[] = {
+    {"mid", 3, TELLOC_STATE_INT, 1, offsetof(telloc_state, mid), TELLOC_STATE_DISCRETE},
+    {"x", 1, TELLOC_STATE_INT, 1, offsetof(telloc_state, x), TELLOC_STATE_LINEAR},
+    {"y", 1, TELLOC_STATE_INT, 1, offsetof(telloc_state, y), TELLOC_STATE_LINEAR},
+    {"z", 1, TELLOC_STATE_INT, 1, offsetof(telloc_state, z), TELLOC_STATE_LINEAR},
+    {"mpry", 4, TELLOC_STATE_INT, 3, offsetof(telloc_state, mpry), TELLOC_STATE_ANGLE},
+    {"pitch", 5, TELLOC_STATE_INT, 1, offsetof(telloc_state, pitch), TELLOC_STATE_ANGLE},
+    {"roll", 4, TELLOC_STATE_INT, 1, offsetof(telloc_state, roll), TELLOC_STATE_ANGLE},
+    {"yaw", 3, TELLOC_STATE_INT, 1, offsetof(telloc_state, yaw), TELLOC_STATE_ANGLE},
+    {"vgx", 3, TELLOC_STATE_INT, 1, offsetof(telloc_state, vgx), TELLOC_STATE_LINEAR},
+    {"vgy", 3, TELLOC_STATE_INT, 1, offsetof(telloc_state, vgy), TELLOC_STATE_LINEAR},
+    {"vgz", 3, TELLOC_STATE_INT, 1, offsetof(telloc_state, vgz), TELLOC_STATE_LINEAR},
+    {"templ", 5, TELLOC_STATE_INT, 1, offsetof(telloc_state, templ), TELLOC_STATE_LINEAR},
+    {"temph", 5, TELLOC_STATE_INT, 1, offsetof(telloc_state, temph), TELLOC_STATE_LINEAR},
+    {"tof", 3, TELLOC_STATE_INT, 1, offsetof(telloc_state, tof), TELLOC_STATE_LINEAR},
+    {"h", 1, TELLOC_STATE_INT, 1, offsetof(telloc_state, h), TELLOC_STATE_LINEAR},
+    {"bat", 3, TELLOC_STATE_INT, 1, offsetof(telloc_state, bat), TELLOC_STATE_DISCRETE},
+    {"baro", 4, TELLOC_STATE_FLOAT, 1, offsetof(telloc_state, baro), TELLOC_STATE_LINEAR},
+    {"time", 4, TELLOC_STATE_INT, 1, offsetof(telloc_state, time), TELLOC_STATE_DISCRETE},
+    {"agx", 3, TELLOC_STATE_FLOAT, 1, offsetof(telloc_state, agx), TELLOC_STATE_LINEAR},
+    {"agy", 3, TELLOC_STATE_FLOAT, 1, offsetof(telloc_state, agy), TELLOC_STATE_LINEAR},
+    {"agz", 3, TELLOC_STATE_FLOAT, 1, offsetof(telloc_state, agz), TELLOC_STATE_LINEAR},
+};
+
+#define TELLOC_STATE_FIELD_COUNT ((int) (sizeof(telloc_state_fields) / sizeof(telloc_state_fields[0])))
+
+// function to find the field for a key, trying the expected one first; returns -1 for unknown keys
+static int telloc_state_find(const char* key, unsigned int key_length, int expected) {
+    for (int i = 0; i < TELLOC_STATE_FIELD_COUNT; i++) {
+        int index = (expected + i) % TELLOC_STATE_FIELD_COUNT;
+        const telloc_state_field* field = &telloc_state_fields[index];
+        if (field->key_length == key_length && memcmp(field->key, key, key_length) == 0) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+// function to parse a decimal number with an optional sign and fraction; returns the position after it
+static const char* telloc_state_number(const char* position, const char* end, int* integer, float* real) {
+    int negative = 0;
+    if (position < end && (*position == '-' || *position == '+')) {
+        negative = *position == '-';
+        position++;
+    }
+
+    long whole = 0;
+    while (position < end && *position >= '0' && *position <= '9') {
+        whole = whole * 10 + (*position - '0');
+        position++;
+    }
+
+    long fraction = 0;
+    long scale = 1;
+    if (position < end && *position == '.') {
+        position++;
+        while (position < end && *position >= '0' && *position <= '9') {
+            // the drone sends two decimals; ignore digits past what a float holds anyway
+            if (scale < 1000000) {
+                fraction = fraction * 10 + (*position - '0');
+                scale *= 10;
+            }
+            position++;
+        }
+    }
+
+    *integer = (int) (negative ? -whole : whole);
+    *real = (float) whole + (float) fraction / (float) scale;
+    if (negative) {
+        *real = -*real;
+    }
+    return position;
+}
+
+// function to parse a state string into a state
+int telloc_state_parse(const char* data, unsigned int length, telloc_state* state) {
+    memset(state, 0, sizeof(telloc_state));
+
+    const char* position = data;
+    const char* end = data + length;
+    int expected = 0;
+    int fields = 0;
+    while (position < end) {
+        // the key runs up to the colon, the value up to the semicolon
+        const char* key = position;
+        const char* colon = memchr(position, ':', (size_t) (end - position));
+        if (colon == NULL) {
+            break;
+        }
+        const char* value_end = memchr(colon, ';', (size_t) (end - colon));
+        if (value_end == NULL) {
+            value_end = end;
+        }
+
+        int index = telloc_state_find(key, (unsigned int) (colon - key), expected);
+        if (index >= 0) {
+            const telloc_state_field* field = &telloc_state_fields[index];
+            char* target = (char*) state + field->offset;
+            position = colon + 1;
+            for (int i = 0; i < field->count && position < value_end; i++) {
+                int integer;
+                float real;
+                position = telloc_state_number(position, value_end, &integer, &real);
+                if (field->type == TELLOC_STATE_FLOAT) {
+                    ((float*) target)[i] = real;
+                } else {
+                    ((int*) target)[i] = integer;
+                }
+                // step over the comma between values
+                if (position < value_end) {
+                    position++;
+                }
+            }
+            expected = index + 1;
+            fields++;
+        }
+
+        position = value_end + 1;
+    }
+
+    return fields == 0;
+}
+
+// function to publish a state
+void telloc_state_publish(telloc_state_seqlock* lock, const telloc_state* state) {
+    unsigned int sequence = lock->sequence;
+
+    // an odd sequence tells readers a write is in progress
+    telloc_atomic_store_release(&lock->sequence, sequence + 1);
+    telloc_atomic_fence_release();
+    lock->state = *state;
+    telloc_atomic_store_release(&lock->sequence, sequence + 2);
+}
+
+// function to copy the latest published state
+int telloc_state_latest(telloc_state_seqlock* lock, telloc_state* state) {
+    while (1) {
+        unsigned int before = telloc_atomic_load_acquire(&lock->sequence);
+        if (before & 1) {
+            // the writer copies a hundred bytes; it is done almost at once
+            continue;
+        }
+        *state = lock->state;
+        telloc_atomic_fence_acquire();
+        unsigned int after = telloc_atomic_load_acquire(&lock->sequence);
+        if (before == after) {
+            return before == 0;
+        }
+    }
+}
+
+// function to append a sample to the history
+void telloc_state_history_push(telloc_state_history* history, const telloc_state* state) {
+    unsigned long long written = history->written;
+    // keep the previous count ahead of the overwrite, as the seqlock does with its odd sequence
+    telloc_atomic_fence_release();
+    history->samples[written % TELLOC_STATE_HISTORY_SIZE] = *state;
+    telloc_atomic_store64_release(&history->written, written + 1);
+}
+
+// function to copy the samples numbered first to first + count - 1 and keep the ones the writer did not overwrite meanwhile.
+// returns how many were kept; they are moved to the front of samples
+static unsigned int telloc_state_history_copy(telloc_state_history* history, unsigned long long first, unsigned int count, telloc_state* samples) {
+    for (unsigned int i = 0; i < count; i++) {
+        samples[i] = history->samples[(first + i) % TELLOC_STATE_HISTORY_SIZE];
+    }
+    telloc_atomic_fence_acquire();
+
+    // the writer may be overwriting the slot of sample number written, which held sample written - SIZE
+    unsigned long long written = telloc_atomic_load64_acquire(&history->written);
+    unsigned long long oldest = written >= TELLOC_STATE_HISTORY_SIZE ? written - TELLOC_STATE_HISTORY_SIZE + 1 : 0;
+    if (first >= oldest) {
+        return count;
+    }
+    if (oldest - first >= count) {
+        return 0;
+    }
+    unsigned int lost = (unsigned int) (oldest - first);
+    memmove(samples, samples + lost, (count - lost) * sizeof(telloc_state));
+    return count - lost;
+}
+
+// function to get the range of sample numbers that can be read, from first up to but not including end
+static void telloc_state_history_range(telloc_state_history* history, unsigned long long* first, unsigned long long* end) {
+    *end = telloc_atomic_load64_acquire(&history->written);
+    // keep one slot of slack for the sample being written
+    *first = *end >= TELLOC_STATE_HISTORY_SIZE ? *end - TELLOC_STATE_HISTORY_SIZE + 1 : 0;
+}
+
+// function to find the first sample number in [first, end) received at or after time
+static unsigned long long telloc_state_history_search(telloc_state_history* history, unsigned long long first, unsigned long long end, unsigned long long time) {
+    while (first < end) {
+        unsigned long long middle = first + (end - first) / 2;
+        if (history->samples[middle % TELLOC_STATE_HISTORY_SIZE].received_time < time) {
+            first = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    return first;
+}
+
+// function to copy up to the last count samples, oldest first
+unsigned int telloc_state_history_last(telloc_state_history* history, telloc_state* samples, unsigned int count) {
+    unsigned long long first, end;
+    telloc_state_history_range(history, &first, &end);
+    if (end - first > count) {
+        first = end - count;
+    }
+    return telloc_state_history_copy(history, first, (unsigned int) (end - first), samples);
+}
+
+// function to copy the samples received from start_time to end_time, oldest first, up to capacity of them
+unsigned int telloc_state_history_window(telloc_state_history* history, unsigned long long start_time, unsigned long long end_time, telloc_state* samples, unsigned int capacity) {
+    unsigned long long first, end;
+    telloc_state_history_range(history, &first, &end);
+    unsigned long long window_first = telloc_state_history_search(history, first, end, start_time);
+    unsigned long long window_end = telloc_state_history_search(history, window_first, end, end_time + 1);
+    if (window_end - window_first > capacity) {
+        window_end = window_first + capacity;
+    }
+
+    unsigned int copied = telloc_state_history_copy(history, window_first, (unsigned int) (window_end - window_first), samples);
+
+    // a sample overwritten while we searched could have moved the edges; trim anything outside the window
+    unsigned int skip = 0;
+    while (skip < copied && samples[skip].received_time < start_time) {
+        skip++;
+    }
+    while (copied > skip && samples[copied - 1].received_time > end_time) {
+        copied--;
+    }
+    if (skip > 0) {
+        memmove(samples, samples + skip, (copied - skip) * sizeof(telloc_state));
+    }
+    return copied - skip;
+}
+
+// function to blend a field value between two samples, fraction of the way from a to b
+static float telloc_state_blend(float a, float b, float fraction, int interpolation) {
+    if (interpolation == TELLOC_STATE_DISCRETE) {
+        return a;
+    }
+    float difference = b - a;
+    if (interpolation == TELLOC_STATE_ANGLE) {
+        // go the short way around
+        if (difference > 180.0f) {
+            difference -= 360.0f;
+        } else if (difference < -180.0f) {
+            difference += 360.0f;
+        }
+        float angle = a + difference * fraction;
+        if (angle > 180.0f) {
+            angle -= 360.0f;
+        } else if (angle <= -180.0f) {
+            angle += 360.0f;
+        }
+        return angle;
+    }
+    return a + difference * fraction;
+}
+
+// function to estimate the state at a time between the oldest and newest samples
+int telloc_state_history_interpolate(telloc_state_history* history, unsigned long long time, telloc_state* state) {
+    unsigned long long first, end;
+    telloc_state_history_range(history, &first, &end);
+    unsigned long long after = telloc_state_history_search(history, first, end, time);
+    if (after == end) {
+        return 1;
+    }
+
+    // a sample received exactly then, or the two around the time
+    telloc_state samples[2];
+    unsigned long long from = after > first ? after - 1 : after;
+    unsigned int copied = telloc_state_history_copy(history, from, (unsigned int) (after - from + 1), samples);
+    if (copied == 0 || samples[copied - 1].received_time < time) {
+        return 1;
+    }
+    if (samples[copied - 1].received_time == time) {
+        *state = samples[copied - 1];
+        return 0;
+    }
+    if (copied < 2 || samples[0].received_time > time) {
+        return 1;
+    }
+
+    const telloc_state* a = &samples[0];
+    const telloc_state* b = &samples[1];
+    float fraction = (float) (time - a->received_time) / (float) (b->received_time - a->received_time);
+    *state = *a;
+    state->received_time = time;
+    for (int i = 0; i < TELLOC_STATE_FIELD_COUNT; i++) {
+        const telloc_state_field* field = &telloc_state_fields[i];
+        for (int value = 0; value < field->count; value++) {
+            if (field->type == TELLOC_STATE_FLOAT) {
+                const float* from_value = (const float*) ((const char*) a + field->offset) + value;
+                const float* to_value = (const float*) ((const char*) b + field->offset) + value;
+                ((float*) ((char*) state + field->offset))[value] = telloc_state_blend(*from_value, *to_value, fraction, field->interpolation);
+            } else {
+                const int* from_value = (const int*) ((const char*) a + field->offset) + value;
+                const int* to_value = (const int*) ((const char*) b + field->offset) + value;
+                float blended = telloc_state_blend((float) *from_value, (float) *to_value, fraction, field->interpolation);
+                ((int*) ((char*) state + field->offset))[value] = (int) (blended < 0 ? blended - 0.5f : blended + 0.5f);
+            }
+        }
+    }
+    return 0;
+}
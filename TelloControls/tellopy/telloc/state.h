@@ -0,0 +1,49 @@
+// Contains the parser for Tello state strings and the seqlock that publishes parsed states
+//
+#ifndef TELLOC_STATE_H
+#define TELLOC_STATE_H
+
+#include "telloc.h"
+
+// struct to hand the latest state from the state thread to any number of readers without locking.
+// the writer makes sequence odd while it copies a state in, readers retry until they copy with
+// the same even sequence before and after.
+typedef struct {
+    volatile unsigned int sequence;
+    telloc_state state;
+} telloc_state_seqlock;
+
+// struct to keep the last TELLOC_STATE_HISTORY_SIZE samples for readers on other threads without locking.
+// only the state thread writes. Readers copy samples out and then check the write count to drop any the
+// writer overwrote while they copied.
+typedef struct {
+    telloc_state samples[TELLOC_STATE_HISTORY_SIZE];
+    // samples ever written; sample n is kept in samples[n % TELLOC_STATE_HISTORY_SIZE]
+    volatile unsigned long long written;
+} telloc_state_history;
+
+// function to parse a "pitch:0;roll:0;...;" state string into a state without allocating.
+// unknown keys are skipped; returns 1 if no field was recognized
+int telloc_state_parse(const char* data, unsigned int length, telloc_state* state);
+
+// function to publish a state; only one thread may publish to a seqlock
+void telloc_state_publish(telloc_state_seqlock* lock, const telloc_state* state);
+
+// function to copy the latest published state; returns 1 if nothing was published yet
+int telloc_state_latest(telloc_state_seqlock* lock, telloc_state* state);
+
+// function to append a sample to the history; only one thread may push to a history
+void telloc_state_history_push(telloc_state_history* history, const telloc_state* state);
+
+// function to copy up to the last count samples, oldest first; returns how many were copied
+unsigned int telloc_state_history_last(telloc_state_history* history, telloc_state* samples, unsigned int count);
+
+// function to copy the samples received from start_time to end_time (inclusive), oldest first, up to capacity of them.
+// returns how many were copied
+unsigned int telloc_state_history_window(telloc_state_history* history, unsigned long long start_time, unsigned long long end_time, telloc_state* samples, unsigned int capacity);
+
+// function to estimate the state at a time between the oldest and newest samples by interpolating the two samples
+// around it; angles take the short way round, ids and counters keep the earlier value. returns 1 outside the history
+int telloc_state_history_interpolate(telloc_state_history* history, unsigned long long time, telloc_state* state);
+
+#endif //TELLOC_STATE_H
@@ -0,0 +1,348 @@
+// Contains the implementation of the counters, latency histograms and Prometheus export for the telloc library
+//
+#include "stats.h"
+#include "atomics.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// names of the stages in the Prometheus export, in telloc_stage order
+static const char* const telloc_stage_names[TELLOC_STAGE_COUNT] = {
+    "receive", "assembly", "decode", "convert", "handoff", "read", "command"
+};
+
+// the upper bounds of the Prometheus buckets, in seconds; each histogram bucket is counted under the first one it fits
+static const double telloc_stats_bounds[] = {
+    0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0
+};
+#define TELLOC_STATS_BOUND_COUNT (sizeof(telloc_stats_bounds) / sizeof(telloc_stats_bounds[0]))
+
+// room for one connection's export; telloc_write_stats grows it if needed
+#define TELLOC_STATS_TEXT_SIZE 16384
+// room for the labels that tell connections apart
+#define TELLOC_STATS_LABEL_SIZE 96
+
+// function to find the highest set bit of a value that is not 0
+static unsigned int telloc_histogram_log2(unsigned long long value) {
+#ifdef _MSC_VER
+    unsigned long bit;
+#ifdef _WIN64
+    _BitScanReverse64(&bit, value);
+#else
+    if (value >> 32) {
+        _BitScanReverse(&bit, (unsigned long) (value >> 32));
+        bit += 32;
+    } else {
+        _BitScanReverse(&bit, (unsigned long) value);
+    }
+#endif
+    return (unsigned int) bit;
+#else
+    return 63u - (unsigned int) __builtin_clzll(value);
+#endif
+}
+
+// function to find the bucket of a value
+static unsigned int telloc_histogram_index(unsigned long long value) {
+    if (value < TELLOC_HISTOGRAM_SUB_BUCKETS) {
+        return (unsigned int) value;
+    }
+    unsigned int exponent = telloc_histogram_log2(value);
+    if (exponent >= TELLOC_HISTOGRAM_MAX_BITS) {
+        return TELLOC_HISTOGRAM_BUCKETS - 1;
+    }
+    // the bits below the highest pick the sub bucket
+    unsigned int shift = exponent - TELLOC_HISTOGRAM_SUB_BITS;
+    unsigned int sub = (unsigned int) (value >> shift) & (TELLOC_HISTOGRAM_SUB_BUCKETS - 1);
+    return (shift + 1) * TELLOC_HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+// function to get the highest value that lands in a bucket
+static unsigned long long telloc_histogram_highest(unsigned int index) {
+    if (index < TELLOC_HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+    unsigned int shift = index / TELLOC_HISTOGRAM_SUB_BUCKETS - 1;
+    unsigned long long lowest = (unsigned long long) (TELLOC_HISTOGRAM_SUB_BUCKETS + index % TELLOC_HISTOGRAM_SUB_BUCKETS) << shift;
+    return lowest + (1ULL << shift) - 1;
+}
+
+// function to zero the metrics
+void telloc_metrics_init(telloc_metrics* metrics) {
+    memset((void*) metrics, 0, sizeof(telloc_metrics));
+}
+
+// function to record how long a stage took
+void telloc_metrics_record(telloc_metrics* metrics, telloc_stage stage, unsigned long long nanoseconds) {
+    telloc_histogram* histogram = &metrics->stages[stage];
+    telloc_atomic_add64(&histogram->buckets[telloc_histogram_index(nanoseconds)], 1);
+    telloc_atomic_add64(&histogram->sum, nanoseconds);
+}
+
+// function to record the time between two readings
+void telloc_metrics_record_span(telloc_metrics* metrics, telloc_stage stage, unsigned long long start, unsigned long long end) {
+    if (start != 0 && end >= start) {
+        telloc_metrics_record(metrics, stage, end - start);
+    }
+}
+
+// function to add to a counter
+void telloc_metrics_count(telloc_metrics* metrics, telloc_counter counter, unsigned long long add) {
+    telloc_atomic_add64(&metrics->counters[counter], add);
+}
+
+// function to read a counter
+unsigned long long telloc_metrics_counter(const telloc_metrics* metrics, telloc_counter counter) {
+    return telloc_atomic_load64_acquire((volatile unsigned long long*) &metrics->counters[counter]);
+}
+
+// function to count a finished command
+void telloc_metrics_command(telloc_metrics* metrics, const telloc_command* command) {
+    // a command that never went out is not counted; one cancelled while waiting for its reply is
+    if (command->sent_time == 0 || command->status == TELLOC_COMMAND_FAILED) {
+        return;
+    }
+    telloc_metrics_count(metrics, TELLOC_COUNTER_COMMANDS_SENT, 1);
+    if (command->status == TELLOC_COMMAND_TIMEOUT) {
+        telloc_metrics_count(metrics, TELLOC_COUNTER_COMMAND_TIMEOUTS, 1);
+    } else if (command->status == TELLOC_COMMAND_DONE && command->timeout_ms > 0) {
+        telloc_metrics_record_span(metrics, TELLOC_STAGE_COMMAND, command->sent_time, command->replied_time);
+    }
+}
+
+// function to copy a histogram's buckets; the copy may be a few recordings behind the sum, never torn within a bucket
+static unsigned long long telloc_histogram_copy(const telloc_histogram* histogram, unsigned long long* buckets, unsigned long long* sum) {
+    unsigned long long count = 0;
+    for (unsigned int i = 0; i < TELLOC_HISTOGRAM_BUCKETS; i++) {
+        buckets[i] = telloc_atomic_load64_acquire((volatile unsigned long long*) &histogram->buckets[i]);
+        count += buckets[i];
+    }
+    *sum = telloc_atomic_load64_acquire((volatile unsigned long long*) &histogram->sum);
+    return count;
+}
+
+// function to get the highest value of the bucket holding the value at a rank (1 based)
+static unsigned long long telloc_histogram_rank(const unsigned long long* buckets, unsigned long long rank) {
+    unsigned long long seen = 0;
+    for (unsigned int i = 0; i < TELLOC_HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return telloc_histogram_highest(i);
+        }
+    }
+    return 0;
+}
+
+// function to get a percentile from copied buckets holding count values
+static unsigned long long telloc_histogram_percentile(const unsigned long long* buckets, unsigned long long count, double percentile) {
+    unsigned long long rank = (unsigned long long) (percentile / 100.0 * (double) count + 0.999999);
+    return telloc_histogram_rank(buckets, rank < 1 ? 1 : rank);
+}
+
+// function to copy the counters and summarize the histograms
+void telloc_metrics_snapshot(const telloc_metrics* metrics, telloc_stats* stats) {
+    volatile unsigned long long* counters = (volatile unsigned long long*) metrics->counters;
+    stats->frames_decoded = telloc_atomic_load64_acquire(&counters[TELLOC_COUNTER_FRAMES_DECODED]);
+    stats->frames_overwritten = telloc_atomic_load64_acquire(&counters[TELLOC_COUNTER_FRAMES_OVERWRITTEN]);
+    stats->frames_dropped = telloc_atomic_load64_acquire(&counters[TELLOC_COUNTER_FRAMES_DROPPED]);
+    stats->decode_errors = telloc_atomic_load64_acquire(&counters[TELLOC_COUNTER_DECODE_ERRORS]);
+    stats->commands_sent = telloc_atomic_load64_acquire(&counters[TELLOC_COUNTER_COMMANDS_SENT]);
+    stats->command_timeouts = telloc_atomic_load64_acquire(&counters[TELLOC_COUNTER_COMMAND_TIMEOUTS]);
+    stats->state_packets = telloc_atomic_load64_acquire(&counters[TELLOC_COUNTER_STATE_PACKETS]);
+    stats->units_discarded = telloc_atomic_load64_acquire(&counters[TELLOC_COUNTER_UNITS_DISCARDED]);
+
+    unsigned long long buckets[TELLOC_HISTOGRAM_BUCKETS];
+    for (int stage = 0; stage < TELLOC_STAGE_COUNT; stage++) {
+        telloc_latency* latency = &stats->stages[stage];
+        latency->count = telloc_histogram_copy(&metrics->stages[stage], buckets, &latency->sum);
+        if (latency->count == 0) {
+            latency->p50 = latency->p90 = latency->p99 = latency->p999 = latency->max = 0;
+            continue;
+        }
+        latency->p50 = telloc_histogram_percentile(buckets, latency->count, 50.0);
+        latency->p90 = telloc_histogram_percentile(buckets, latency->count, 90.0);
+        latency->p99 = telloc_histogram_percentile(buckets, latency->count, 99.0);
+        latency->p999 = telloc_histogram_percentile(buckets, latency->count, 99.9);
+        latency->max = telloc_histogram_rank(buckets, latency->count);
+    }
+}
+
+
+// struct for text written into a buffer of fixed length; written keeps counting past the end
+typedef struct {
+    char* buffer;
+    unsigned int length;
+    unsigned int written;
+} telloc_stats_text;
+
+// function to append formatted text
+static void telloc_stats_append(telloc_stats_text* text, const char* format, ...) {
+    char* end = text->buffer + (text->written < text->length ? text->written : text->length);
+    unsigned int room = text->written < text->length ? text->length - text->written : 0;
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(room > 0 ? end : NULL, room, format, arguments);
+    va_end(arguments);
+    if (length > 0) {
+        text->written += (unsigned int) length;
+    }
+}
+
+// function to write one counter of every connection as a Prometheus counter
+static void telloc_stats_counter(telloc_stats_text* text, const char* name, const char* help, const telloc_stats* stats, size_t offset,
+                                 char (*labels)[TELLOC_STATS_LABEL_SIZE], unsigned int count) {
+    telloc_stats_append(text, "# HELP telloc_%s_total %s\n# TYPE telloc_%s_total counter\n", name, help, name);
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned long long value = *(const unsigned long long*) ((const char*) &stats[i] + offset);
+        telloc_stats_append(text, "telloc_%s_total{%s} %llu\n", name, labels[i], value);
+    }
+}
+
+// function to write the stats of count connections in the Prometheus text format
+int telloc_format_stats(telloc_connection **connections, unsigned int count, char *buffer, unsigned int length, unsigned int *written) {
+    if (connections == NULL || (buffer == NULL && length > 0)) {
+        return 1;
+    }
+
+    // copy everything first, so every family sees the same moment of a connection
+    telloc_stats* stats = (telloc_stats*) calloc(count > 0 ? count : 1, sizeof(telloc_stats));
+    unsigned long long* buckets = (unsigned long long*) malloc(sizeof(unsigned long long) * TELLOC_HISTOGRAM_BUCKETS * TELLOC_STAGE_COUNT * (count > 0 ? count : 1));
+    unsigned long long* sums = (unsigned long long*) calloc(TELLOC_STAGE_COUNT * (count > 0 ? count : 1), sizeof(unsigned long long));
+    char (*labels)[TELLOC_STATS_LABEL_SIZE] = (char (*)[TELLOC_STATS_LABEL_SIZE]) calloc(count > 0 ? count : 1, TELLOC_STATS_LABEL_SIZE);
+    if (stats == NULL || buckets == NULL || sums == NULL || labels == NULL) {
+        printf("Error allocating stats memory\n");
+        free(stats);
+        free(buckets);
+        free(sums);
+        free(labels);
+        return 1;
+    }
+    int failed = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        // several connections can fly the same address (one per wifi adapter) and every replay has none, so the id keeps
+        // their series apart
+        char address[64];
+        unsigned int id = 0;
+        const telloc_metrics* metrics = telloc_connection_metrics(connections[i], address, sizeof(address), &id);
+        if (metrics == NULL || telloc_get_stats(connections[i], &stats[i]) != 0) {
+            failed = 1;
+            break;
+        }
+        snprintf(labels[i], TELLOC_STATS_LABEL_SIZE, "drone=\"%s\",connection=\"%u\"", address, id);
+        for (int stage = 0; stage < TELLOC_STAGE_COUNT; stage++) {
+            telloc_histogram_copy(&metrics->stages[stage], buckets + (i * TELLOC_STAGE_COUNT + stage) * TELLOC_HISTOGRAM_BUCKETS,
+                                  &sums[i * TELLOC_STAGE_COUNT + stage]);
+        }
+    }
+
+    telloc_stats_text text = {buffer, length, 0};
+    if (!failed) {
+        telloc_stats_counter(&text, "frames_decoded", "Frames the decoder returned.", stats, offsetof(telloc_stats, frames_decoded), labels, count);
+        telloc_stats_counter(&text, "frames_overwritten", "Frames replaced by a newer one before anyone read them.", stats, offsetof(telloc_stats, frames_overwritten), labels, count);
+        telloc_stats_counter(&text, "frames_dropped", "Decoded frames dropped because readers held every frame buffer.", stats, offsetof(telloc_stats, frames_dropped), labels, count);
+        telloc_stats_counter(&text, "units_dropped", "Access units dropped because decoding fell behind.", stats, offsetof(telloc_stats, units_dropped), labels, count);
+        telloc_stats_counter(&text, "units_discarded", "Partial access units discarded because datagrams were lost.", stats, offsetof(telloc_stats, units_discarded), labels, count);
+        telloc_stats_counter(&text, "decode_errors", "Access units the decoder rejected.", stats, offsetof(telloc_stats, decode_errors), labels, count);
+        telloc_stats_counter(&text, "commands_sent", "Commands sent to the drone.", stats, offsetof(telloc_stats, commands_sent), labels, count);
+        telloc_stats_counter(&text, "command_timeouts", "Commands the drone did not answer in time.", stats, offsetof(telloc_stats, command_timeouts), labels, count);
+        telloc_stats_counter(&text, "state_packets", "State datagrams received.", stats, offsetof(telloc_stats, state_packets), labels, count);
+
+        telloc_stats_append(&text, "# HELP telloc_stage_latency_seconds Latency of each stage of the video and command pipeline.\n"
+                                   "# TYPE telloc_stage_latency_seconds histogram\n");
+        for (unsigned int i = 0; i < count; i++) {
+            for (int stage = 0; stage < TELLOC_STAGE_COUNT; stage++) {
+                const unsigned long long* stage_buckets = buckets + (i * TELLOC_STAGE_COUNT + stage) * TELLOC_HISTOGRAM_BUCKETS;
+                // cumulative, as Prometheus wants; a histogram bucket counts under the first bound its highest value fits.
+                // the count comes from the same copy of the buckets, so it always matches the +Inf bucket
+                unsigned long long cumulative = 0;
+                unsigned int bucket = 0;
+                for (unsigned int bound = 0; bound < TELLOC_STATS_BOUND_COUNT; bound++) {
+                    unsigned long long limit = (unsigned long long) (telloc_stats_bounds[bound] * 1e9);
+                    while (bucket < TELLOC_HISTOGRAM_BUCKETS && telloc_histogram_highest(bucket) <= limit) {
+                        cumulative += stage_buckets[bucket++];
+                    }
+                    telloc_stats_append(&text, "telloc_stage_latency_seconds_bucket{%s,stage=\"%s\",le=\"%g\"} %llu\n",
+                                        labels[i], telloc_stage_names[stage], telloc_stats_bounds[bound], cumulative);
+                }
+                while (bucket < TELLOC_HISTOGRAM_BUCKETS) {
+                    cumulative += stage_buckets[bucket++];
+                }
+                telloc_stats_append(&text, "telloc_stage_latency_seconds_bucket{%s,stage=\"%s\",le=\"+Inf\"} %llu\n",
+                                    labels[i], telloc_stage_names[stage], cumulative);
+                telloc_stats_append(&text, "telloc_stage_latency_seconds_sum{%s,stage=\"%s\"} %.9f\n",
+                                    labels[i], telloc_stage_names[stage], (double) sums[i * TELLOC_STAGE_COUNT + stage] / 1e9);
+                telloc_stats_append(&text, "telloc_stage_latency_seconds_count{%s,stage=\"%s\"} %llu\n",
+                                    labels[i], telloc_stage_names[stage], cumulative);
+            }
+        }
+    }
+
+    free(stats);
+    free(buckets);
+    free(sums);
+    free(labels);
+    if (written != NULL) {
+        *written = text.written;
+    }
+    if (failed) {
+        printf("Connection not initialized; Stats not available.\n");
+        return 1;
+    }
+    return text.written >= length;
+}
+
+// function to write the stats to a file, replacing it at once
+int telloc_write_stats(telloc_connection **connections, unsigned int count, const char *path) {
+    unsigned int length = TELLOC_STATS_TEXT_SIZE * (count > 0 ? count : 1);
+    char* buffer = NULL;
+    unsigned int written = 0;
+    while (1) {
+        char* grown = (char*) realloc(buffer, length);
+        if (grown == NULL) {
+            printf("Error allocating stats memory\n");
+            free(buffer);
+            return 1;
+        }
+        buffer = grown;
+        if (telloc_format_stats(connections, count, buffer, length, &written) == 0) {
+            break;
+        }
+        // a failure that is not a lack of room
+        if (written < length) {
+            free(buffer);
+            return 1;
+        }
+        length = written + 1;
+    }
+
+    // write next to the file and move it over, so a scraper never reads half of it
+    char temporary[1024];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    FILE* file = fopen(temporary, "wb");
+    if (file == NULL) {
+        printf("Error opening stats file %s\n", temporary);
+        free(buffer);
+        return 1;
+    }
+    int failed = fwrite(buffer, 1, written, file) != written;
+    failed |= fclose(file) != 0;
+    free(buffer);
+#ifdef _WIN32
+    failed |= !failed && !MoveFileExA(temporary, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    failed |= !failed && rename(temporary, path) != 0;
+#endif
+    if (failed) {
+        printf("Error writing stats file %s\n", path);
+        remove(temporary);
+        return 1;
+    }
+    return 0;
+}
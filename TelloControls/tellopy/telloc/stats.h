@@ -0,0 +1,68 @@
+// Contains the lock-free counters and latency histograms behind telloc_get_stats
+//
+#ifndef TELLOC_STATS_H
+#define TELLOC_STATS_H
+
+#include "telloc.h"
+#include "command.h"
+
+// buckets per power of two; a value lands in a bucket at most 1/8 below it
+#define TELLOC_HISTOGRAM_SUB_BITS 3
+#define TELLOC_HISTOGRAM_SUB_BUCKETS (1 << TELLOC_HISTOGRAM_SUB_BITS)
+// values from 2^TELLOC_HISTOGRAM_MAX_BITS nanoseconds (about 18 minutes) up share the last bucket
+#define TELLOC_HISTOGRAM_MAX_BITS 40
+#define TELLOC_HISTOGRAM_BUCKETS ((TELLOC_HISTOGRAM_MAX_BITS - TELLOC_HISTOGRAM_SUB_BITS + 1) * TELLOC_HISTOGRAM_SUB_BUCKETS)
+
+// the counters of telloc_stats the pipeline counts itself
+typedef enum {
+    TELLOC_COUNTER_FRAMES_DECODED = 0,
+    TELLOC_COUNTER_FRAMES_OVERWRITTEN = 1,
+    TELLOC_COUNTER_FRAMES_DROPPED = 2,
+    TELLOC_COUNTER_DECODE_ERRORS = 3,
+    TELLOC_COUNTER_COMMANDS_SENT = 4,
+    TELLOC_COUNTER_COMMAND_TIMEOUTS = 5,
+    TELLOC_COUNTER_STATE_PACKETS = 6,
+    TELLOC_COUNTER_UNITS_DISCARDED = 7,
+    TELLOC_COUNTER_COUNT = 8
+} telloc_counter;
+
+// struct for a log-linear (HDR style) histogram of nanoseconds: values below TELLOC_HISTOGRAM_SUB_BUCKETS get a bucket
+// each, then every power of two is split into TELLOC_HISTOGRAM_SUB_BUCKETS buckets. recording is an atomic add to a
+// bucket and to the sum, so any number of threads record at once and readers copy it without stopping them
+typedef struct {
+    volatile unsigned long long buckets[TELLOC_HISTOGRAM_BUCKETS];
+    volatile unsigned long long sum;
+} telloc_histogram;
+
+// struct for a connection's counters and stage histograms
+typedef struct {
+    telloc_histogram stages[TELLOC_STAGE_COUNT];
+    volatile unsigned long long counters[TELLOC_COUNTER_COUNT];
+} telloc_metrics;
+
+// function to zero the metrics
+void telloc_metrics_init(telloc_metrics* metrics);
+
+// function to record how long a stage took, in nanoseconds
+void telloc_metrics_record(telloc_metrics* metrics, telloc_stage stage, unsigned long long nanoseconds);
+
+// function to record the time between two telloc_time readings, unless either is missing (0) or they are out of order
+void telloc_metrics_record_span(telloc_metrics* metrics, telloc_stage stage, unsigned long long start, unsigned long long end);
+
+// function to add to a counter
+void telloc_metrics_count(telloc_metrics* metrics, telloc_counter counter, unsigned long long add);
+
+// function to read a counter
+unsigned long long telloc_metrics_counter(const telloc_metrics* metrics, telloc_counter counter);
+
+// function to count a finished command, and time its round trip if the drone replied
+void telloc_metrics_command(telloc_metrics* metrics, const telloc_command* command);
+
+// function to copy the counters and summarize the histograms into stats; fields the pipeline does not count are left alone
+void telloc_metrics_snapshot(const telloc_metrics* metrics, telloc_stats* stats);
+
+// function implemented by the backend to get a live connection's metrics, the drone's address ("replay" for a replay)
+// and an id no other connection in the process has. returns NULL if the connection is not alive
+const telloc_metrics* telloc_connection_metrics(telloc_connection* connection, char* address, unsigned int address_length, unsigned int* id);
+
+#endif //TELLOC_STATS_H
@@ -1,12 +1,26 @@
 // Contains a unix implementation of the telloc library.
 //
+// recvmmsg and SO_BUSY_POLL are Linux extensions
+#define _GNU_SOURCE
 #include "telloc.h"
 #include "video.h"
+#include "state.h"
+#include "command.h"
+#include "schedule.h"
+#include "record.h"
+#include "replay.h"
+#include "stats.h"
+#include "trace.h"
 
 // include unix libraries for receiving udp data over a network
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <stdint.h>
 
 // include unix libraries for threading
 #include <pthread.h>
@@ -18,285 +32,1769 @@
 #include <stdlib.h>
 #include <fcntl.h>
 
+// datagrams read by one recvmmsg call, enough for most of a keyframe burst
+#define TELLOC_VIDEO_BATCH 32
+// receive slot per datagram; the Tello sends at most TELLOC_VIDEO_FRAGMENT_SIZE bytes
+#define TELLOC_VIDEO_DATAGRAM_SIZE 2048
+// events the reactor takes from epoll at once
+#define TELLOC_REACTOR_EVENTS 64
+// decoder workers at most, however many cores there are
+#define TELLOC_DECODE_WORKERS_MAX 64
+
+// the descriptors of a connection the reactor watches
+typedef enum {
+    TELLOC_SOURCE_COMMAND = 0,
+    // eventfd set when a command is queued or the sticks move
+    TELLOC_SOURCE_COMMAND_WAKE = 1,
+    // timerfd armed for the next reply timeout or rc send
+    TELLOC_SOURCE_COMMAND_TIMER = 2,
+    TELLOC_SOURCE_STATE = 3,
+    TELLOC_SOURCE_VIDEO = 4,
+    TELLOC_SOURCE_COUNT = 5
+} telloc_source_kind;
+
+// a descriptor registered with the reactor and the connection it belongs to; epoll hands these back
+typedef struct {
+    telloc_connection *connection;
+    telloc_source_kind kind;
+    // -1 while not registered
+    int fd;
+} telloc_source;
+
+// buffers for a batch of video datagrams, and one message pointing at each slot of them.
+// every message also gets room for the kernel's dropped datagram counter
+typedef struct {
+    unsigned char buffer[TELLOC_VIDEO_BATCH * TELLOC_VIDEO_DATAGRAM_SIZE];
+    struct mmsghdr messages[TELLOC_VIDEO_BATCH];
+    struct iovec vectors[TELLOC_VIDEO_BATCH];
+    union {
+        char buffer[CMSG_SPACE(sizeof(uint32_t))];
+        struct cmsghdr align;
+    } controls[TELLOC_VIDEO_BATCH];
+} telloc_video_batch;
+
+// the I/O thread and decoder workers every connection in the process shares, so a swarm of drones costs no more threads
+// than one. the reactor thread sleeps in a single epoll over every connection's command, state and video sockets, and
+// receives, reassembles and sends for all of them; complete access units go to the decoder workers
+typedef struct {
+    // guards users and starting and stopping the threads
+    pthread_mutex_t mutex;
+    unsigned int users;
+    int epoll;
+    // eventfd that wakes the reactor to stop
+    int wake;
+    // cleared under the dispatch mutex to stop the reactor
+    int alive;
+    pthread_t thread;
+    // held while the reactor handles a batch of events, so no connection is removed under it. recursive, so command
+    // callbacks on the reactor thread can disconnect other drones
+    pthread_mutex_t dispatch_mutex;
+    // counts removals; events taken from epoll before a removal may belong to the removed connection and are dropped
+    unsigned long long removals;
+
+    // connections with units to decode that no worker has taken yet, oldest first, linked through decode_next
+    pthread_mutex_t decode_mutex;
+    pthread_cond_t decode_cond;
+    telloc_connection *ready_head;
+    telloc_connection *ready_tail;
+    int decode_stopping;
+    // a worker per connection up to one per core
+    unsigned int workers;
+    unsigned int cores;
+    pthread_t worker_threads[TELLOC_DECODE_WORKERS_MAX];
+} telloc_reactor;
+
+static telloc_reactor telloc_shared_reactor = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .epoll = -1,
+    .wake = -1,
+    .decode_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .decode_cond = PTHREAD_COND_INITIALIZER,
+};
+
+// set on the reactor thread. only it finishes commands, so nothing running on it may wait for a reply
+static __thread int telloc_on_reactor = 0;
+
+// helper threads that each convert a band of a frame while the reader converting it does the first band
+struct telloc_convert_pool_ {
+    // one conversion at a time; readers holding different frames can convert at once
+    pthread_mutex_t run_mutex;
+    pthread_mutex_t mutex;
+    // signalled when a job is handed out, and when the last helper finishes its band
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+    const telloc_convert_job* job;
+    unsigned long long generation;
+    unsigned int pending;
+    int stopping;
+    unsigned int helpers;
+    pthread_t threads[TELLOC_CONVERT_THREADS_MAX];
+};
+
+// a helper's pool and which band it converts
+typedef struct {
+    telloc_convert_pool* pool;
+    unsigned int band;
+} telloc_convert_helper;
+
 // struct to hold the state of the telloc library
 struct telloc_connection_ {
     // thread synchronization
     unsigned alive;
 
-    // Tello command data socket
+    // the descriptors the shared reactor watches for this connection
+    telloc_source sources[TELLOC_SOURCE_COUNT];
+
+    // Tello command data socket and the drone's command address
     int command_socket;
+    struct sockaddr_in drone_address;
     pthread_mutex_t command_mutex;
+    // commands waiting to be sent or for their reply; the reactor does all command I/O
+    telloc_command_queue command_queue;
+    // signalled whenever queued commands finish
+    pthread_cond_t command_cond;
+    // eventfd that wakes the reactor when a command is queued, and a timerfd armed for the next command deadline
+    int command_wake;
+    int command_timer;
+    unsigned long long command_deadline;
+    // the sticks the reactor keeps sending
+    telloc_rc_channel rc;
+    // what the periodic queries and watchdogs found; guarded by the command mutex
+    telloc_health health;
+
+    // periodic tasks (keepalive and queries, watchdogs, user callbacks), run by the scheduler thread
+    // with the schedule mutex held; the mutex is recursive, so tasks can add and remove tasks
+    pthread_mutex_t schedule_mutex;
+    telloc_schedule schedule;
+    // timerfd armed for the next deadline, and an eventfd that wakes the thread when the schedule changes
+    int schedule_timer;
+    int schedule_wake;
 
     // Tello state data
     int state_socket;
     pthread_mutex_t state_mutex;
     char* state_buffer;
     unsigned state_size;
+    // the latest state, parsed
+    telloc_state_seqlock state_latest;
+    // the parsed states received lately, for looking back in time
+    telloc_state_history state_history;
+    unsigned long long state_samples;
+    // signalled while unread state is waiting
+    pthread_cond_t state_cond;
+    int state_event;
 
     // Tello video data
     int video_socket;
+    telloc_receive_stats receive_stats;
+    // counters and stage latencies, updated without locks by whichever thread gets there
+    telloc_metrics metrics;
+    // tells the connection's trace events and Prometheus series from those of other connections
+    unsigned int trace_id;
+
+    // the recording the reactor writes access units to before they are decoded
+    pthread_mutex_t record_mutex;
+    telloc_recorder recorder;
+
+    // set on connections made with telloc_connect_replay; the replay thread feeds the recording in place
+    // of the sockets, and nothing is registered with the reactor
+    int replaying;
+    telloc_replay replay;
+    telloc_replay_pace replay_pace;
+    // guarded by the video mutex
+    telloc_replay_stats replay_stats;
+    pthread_t replay_thread;
+    // when the last video datagram arrived
+    unsigned long long video_time;
     pthread_mutex_t video_mutex;
-    char* video_buffer;
-    unsigned video_size;
+    // signalled while an unread frame is waiting
+    pthread_cond_t frame_cond;
+    int frame_event;
+    telloc_frame_pool frame_pool;
+    telloc_video_reassembler video_reassembler;
 
     telloc_video_decoder video_decoder;
+    // access units waiting for a decoder worker; guarded by the reactor's decode mutex
+    telloc_video_unit_queue decode_queue;
+    // set while the connection is waiting for a worker or being decoded, so only one worker decodes it at a time
+    int decode_scheduled;
+    // set when disconnecting; the worker drops what is left
+    int decode_closing;
+    telloc_connection *decode_next;
+    // signalled when a worker finishes one of the connection's units
+    pthread_cond_t decode_cond;
+    // the threads frames are converted over, and the band each helper converts
+    telloc_convert_pool convert_pool;
+    telloc_convert_helper convert_helpers[TELLOC_CONVERT_THREADS_MAX];
 
     // Threads
-    pthread_t state_thread;
-    pthread_t video_thread;
-    pthread_t keepalive_thread;
+    pthread_t schedule_thread;
+    // counts the command callbacks of this connection running right now, so one can't disconnect the connection under itself
+    int reporting;
 };
 
 
-// thread to receive state data from the Tello drone over UDP
-void* thread_state(void* arg) {
-    printf("State thread started\n");
+// function to read the monotonic clock frame timestamps use, in nanoseconds
+unsigned long long telloc_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+
+// function to make an eventfd readable
+void telloc_event_signal(int event) {
+    uint64_t count = 1;
+    if (write(event, &count, sizeof(count)) != sizeof(count)) {
+        printf("Error signalling event: %d\n", errno);
+    }
+}
+
+
+// function to make an eventfd unreadable again
+void telloc_event_clear(int event) {
+    uint64_t count;
+    while (read(event, &count, sizeof(count)) == sizeof(count));
+}
+
+
+// function to block on a condition until the deadline; timeout_ms below 0 waits forever.
+// returns 1 once the deadline has passed
+int telloc_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, int timeout_ms, const struct timespec *deadline) {
+    if (timeout_ms < 0) {
+        pthread_cond_wait(cond, mutex);
+        return 0;
+    }
+    return pthread_cond_timedwait(cond, mutex, deadline) == ETIMEDOUT;
+}
+
+
+// function to turn a timeout in milliseconds into a CLOCK_MONOTONIC deadline
+void telloc_deadline(struct timespec *deadline, int timeout_ms) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    if (timeout_ms > 0) {
+        deadline->tv_sec += timeout_ms / 1000;
+        deadline->tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+        if (deadline->tv_nsec >= 1000000000L) {
+            deadline->tv_sec++;
+            deadline->tv_nsec -= 1000000000L;
+        }
+    }
+}
+
+
+// function to create a condition variable that measures timeouts on CLOCK_MONOTONIC
+void telloc_cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+
+// function to lock one of a connection's mutexes, tracing the wait under name when tracing is on and the wait was long
+void telloc_lock(telloc_connection *connection, pthread_mutex_t *mutex, const char *name) {
+    if (!telloc_trace_on()) {
+        pthread_mutex_lock(mutex);
+        return;
+    }
+    unsigned long long start = telloc_time();
+    pthread_mutex_lock(mutex);
+    unsigned long long end = telloc_time();
+    if (end - start >= TELLOC_TRACE_WAIT_MIN) {
+        telloc_trace_span(name, connection->trace_id, start, end, NULL, 0);
+    }
+}
+
+
+// function to parse, record and hand out a state datagram received at time
+void telloc_handle_state(telloc_connection *connection, const char *buffer, unsigned int length, unsigned long long time) {
+    telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_STATE_PACKETS, 1);
+
+    // parse the state once here, so readers get typed values without locking or parsing
+    telloc_state state;
+    if (telloc_state_parse(buffer, length, &state) == 0) {
+        state.sequence = ++connection->state_samples;
+        state.received_time = time;
+        telloc_state_publish(&connection->state_latest, &state);
+        telloc_state_history_push(&connection->state_history, &state);
+    }
+
+    pthread_mutex_lock(&connection->record_mutex);
+    if (connection->recorder.stats.recording) {
+        telloc_recorder_write_state(&connection->recorder, buffer, length, time);
+    }
+    pthread_mutex_unlock(&connection->record_mutex);
+
+    // Windows acquire handle to the mutex
+    pthread_mutex_lock(&connection->state_mutex);
+
+    // copy the data string to the connection's state buffer
+    memcpy(connection->state_buffer, buffer, length);
+    // wake waiters when the state goes from read to unread; signal last, the woken reader can run at once
+    int was_read = connection->state_size == 0;
+    connection->state_size = length;
+    pthread_cond_broadcast(&connection->state_cond);
+    if (was_read) {
+        telloc_event_signal(connection->state_event);
+    }
+
+    // release the mutex
+    pthread_mutex_unlock(&connection->state_mutex);
+}
+
+
+// function to take every state datagram waiting on a connection's socket; runs on the reactor thread
+void telloc_receive_state(telloc_connection *connection) {
+    // receive data on the socket, assume UDP max buffer size
+    char buffer[TELLOC_STATE_SIZE];
+    ssize_t bytes_received;
+    while ((bytes_received = recvfrom(connection->state_socket, buffer, TELLOC_STATE_SIZE, MSG_DONTWAIT, NULL, NULL)) >= 0) {
+        telloc_handle_state(connection, buffer, (unsigned int) bytes_received, telloc_time());
+    }
+}
+
+
+// thread to read the most recent state data
+int telloc_read_state(telloc_connection *connection, char* state_buffer, unsigned state_buffer_length) {
+    // clear the state string
+    if (state_buffer_length > 0) {
+        state_buffer[0] = 0;
+    }
+
+    // check if the state socket is open
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State thread not starting.\n");
+        printf("Call telloc_connect() before starting state thread.\n");
+        return 1;
+    }
+
+    // acquire handle to the mutex
+    pthread_mutex_lock(&connection->state_mutex);
+
+    // check if there is state data
+    if (connection->state_size == 0) {
+        pthread_mutex_unlock(&connection->state_mutex);
+        return 1;
+    }
+
+    // check if the buffer is large enough
+    if (state_buffer_length < connection->state_size) {
+        printf("Buffer size is too small to hold state data.\n");
+        pthread_mutex_unlock(&connection->state_mutex);
+        return 1;
+    }
+
+    // copy the data string to the state buffer with memcpy, terminated if there is room
+    memcpy(state_buffer, connection->state_buffer, connection->state_size);
+    if (connection->state_size < state_buffer_length) {
+        state_buffer[connection->state_size] = 0;
+    }
+    connection->state_size = 0;
+    telloc_event_clear(connection->state_event);
+
+    // release the mutex
+    pthread_mutex_unlock(&connection->state_mutex);
+
+    return 0;
+}
+
+
+// function to get the most recently parsed state without blocking
+int telloc_get_state(telloc_connection *connection, telloc_state *state) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State not received.\n");
+        printf("Call telloc_connect() before getting state.\n");
+        return 1;
+    }
+    return telloc_state_latest(&connection->state_latest, state);
+}
+
+// function to copy up to the last count parsed states, oldest first
+int telloc_get_state_history(telloc_connection *connection, telloc_state *samples, unsigned int count, unsigned int *copied) {
+    *copied = 0;
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State not received.\n");
+        printf("Call telloc_connect() before getting state.\n");
+        return 1;
+    }
+    *copied = telloc_state_history_last(&connection->state_history, samples, count);
+    return 0;
+}
+
+
+// function to copy the parsed states received in a time window, oldest first
+int telloc_get_state_window(telloc_connection *connection, unsigned long long start_time, unsigned long long end_time, telloc_state *samples, unsigned int capacity, unsigned int *copied) {
+    *copied = 0;
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State not received.\n");
+        printf("Call telloc_connect() before getting state.\n");
+        return 1;
+    }
+    *copied = telloc_state_history_window(&connection->state_history, start_time, end_time, samples, capacity);
+    return 0;
+}
+
+
+// function to estimate the state at a time from the parsed states around it
+int telloc_interpolate_state(telloc_connection *connection, unsigned long long time, telloc_state *state) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State not received.\n");
+        printf("Call telloc_connect() before getting state.\n");
+        return 1;
+    }
+    return telloc_state_history_interpolate(&connection->state_history, time, state);
+}
+
+
+// function to wait for state newer than the last read, then read it
+int telloc_wait_state(telloc_connection *connection, int timeout_ms, char* state_buffer, unsigned state_buffer_length) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State not received.\n");
+        printf("Call telloc_connect() before waiting for state.\n");
+        return 1;
+    }
+
+    struct timespec deadline;
+    telloc_deadline(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&connection->state_mutex);
+    int timed_out = 0;
+    while (connection->state_size == 0 && connection->alive && !timed_out) {
+        timed_out = telloc_cond_wait(&connection->state_cond, &connection->state_mutex, timeout_ms, &deadline);
+    }
+    pthread_mutex_unlock(&connection->state_mutex);
+
+    return telloc_read_state(connection, state_buffer, state_buffer_length);
+}
+
+
+// function to get an eventfd that is readable while unread state is waiting
+int telloc_get_state_fd(telloc_connection *connection) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State fd not available.\n");
+        return -1;
+    }
+    return connection->state_event;
+}
+
+
+// function to reference the decoder's latest picture from a free pool slot and make it the latest frame.
+// nothing is converted here; the first reader converts the frame, so frames replaced unread cost no conversion.
+void telloc_publish_frame(telloc_connection *connection) {
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    telloc_frame_slot *slot = telloc_frame_pool_take(&connection->frame_pool);
+    pthread_mutex_unlock(&connection->video_mutex);
+
+    // every slot is held by a consumer; drop this frame
+    if (slot == NULL) {
+        telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_FRAMES_DROPPED, 1);
+        return;
+    }
+
+    int converted = telloc_video_decoder_reference(&connection->video_decoder, slot) == 0;
+
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    if (converted) {
+        // wake waiters when the latest frame goes from read to unread
+        int was_read = !connection->frame_pool.latest_unread;
+        if (!was_read) {
+            telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_FRAMES_OVERWRITTEN, 1);
+        }
+        telloc_frame_pool_publish(&connection->frame_pool, slot);
+        pthread_cond_broadcast(&connection->frame_cond);
+        if (was_read) {
+            telloc_event_signal(connection->frame_event);
+        }
+    } else {
+        telloc_frame_pool_release(&connection->frame_pool, slot);
+    }
+    pthread_mutex_unlock(&connection->video_mutex);
+}
+
+
+// function to queue an access unit for the decoder workers. the reactor never waits, so a drone whose decoding falls
+// behind drops units until its next keyframe; a replay waits for room instead
+void telloc_decode_unit(telloc_connection *connection, const telloc_video_unit *unit, int wait) {
+    telloc_reactor *reactor = &telloc_shared_reactor;
+    pthread_mutex_lock(&reactor->decode_mutex);
+    while (wait && connection->alive && connection->decode_queue.count == TELLOC_VIDEO_QUEUE_SIZE) {
+        pthread_cond_wait(&connection->decode_cond, &reactor->decode_mutex);
+    }
+    // line the connection up for a worker unless one already has it
+    if (telloc_video_unit_queue_push(&connection->decode_queue, unit) == 0 && !connection->decode_scheduled) {
+        connection->decode_scheduled = 1;
+        connection->decode_next = NULL;
+        if (reactor->ready_tail != NULL) {
+            reactor->ready_tail->decode_next = connection;
+        } else {
+            reactor->ready_head = connection;
+        }
+        reactor->ready_tail = connection;
+        pthread_cond_signal(&reactor->decode_cond);
+    }
+    pthread_mutex_unlock(&reactor->decode_mutex);
+}
+
+
+// function to split received video data into access units, record them and queue each one for decoding as soon as it is complete
+void telloc_assemble_datagram(telloc_connection *connection, const unsigned char *data, unsigned int length, unsigned long long time, int wait) {
+    // only this thread touches the reassembler, so publish what it discarded through the lock-free counters
+    unsigned long discarded = connection->video_reassembler.units_discarded;
+    telloc_video_reassembler_push(&connection->video_reassembler, data, length, time);
+    if (connection->video_reassembler.units_discarded != discarded) {
+        telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_UNITS_DISCARDED, connection->video_reassembler.units_discarded - discarded);
+    }
+    telloc_video_unit unit;
+    while (telloc_video_reassembler_next(&connection->video_reassembler, &unit) == 0) {
+        telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_ASSEMBLY, unit.received_time, unit.assembled_time);
+
+        // record the unit exactly as it arrived; this only copies it into the file buffer
+        pthread_mutex_lock(&connection->record_mutex);
+        if (connection->recorder.stats.recording) {
+            telloc_recorder_write(&connection->recorder, &unit);
+        }
+        pthread_mutex_unlock(&connection->record_mutex);
+
+        telloc_decode_unit(connection, &unit, wait);
+    }
+}
+
+
+// thread to decode access units for any connection. a worker takes the connection that has waited longest, decodes one
+// of its units and puts it back in line if it has more, so drones take turns and each decoder is used by one worker at a time
+void *thread_decode(void *arg) {
+    telloc_reactor *reactor = (telloc_reactor *) arg;
+    telloc_trace_thread("decoder");
+
+    pthread_mutex_lock(&reactor->decode_mutex);
+    while (1) {
+        while (reactor->ready_head == NULL && !reactor->decode_stopping) {
+            pthread_cond_wait(&reactor->decode_cond, &reactor->decode_mutex);
+        }
+        telloc_connection *connection = reactor->ready_head;
+        if (connection == NULL) {
+            break;
+        }
+        reactor->ready_head = connection->decode_next;
+        if (reactor->ready_head == NULL) {
+            reactor->ready_tail = NULL;
+        }
+
+        // the unit keeps its slot until it is popped, so it can be decoded without the lock
+        const telloc_video_unit *unit = telloc_video_unit_queue_peek(&connection->decode_queue);
+        if (unit != NULL && !connection->decode_closing) {
+            pthread_mutex_unlock(&reactor->decode_mutex);
+            telloc_video_decoder *decoder = &connection->video_decoder;
+            unsigned long long errors = decoder->errors;
+            unsigned long long start = telloc_trace_on() ? telloc_time() : 0;
+            unsigned long long frames = 0;
+            int ready = telloc_video_decoder_decode(decoder, unit) == 0;
+            while (ready) {
+                telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_FRAMES_DECODED, 1);
+                telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_DECODE, decoder->info.assembled_time, decoder->info.decoded_time);
+                if (start != 0) {
+                    telloc_trace_flow(TELLOC_TRACE_FLOW_START, connection->trace_id, decoder->info.sequence, decoder->info.decoded_time);
+                }
+                frames = decoder->info.sequence;
+                telloc_publish_frame(connection);
+                ready = telloc_video_decoder_receive(decoder) == 0;
+            }
+            if (decoder->errors != errors) {
+                telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_DECODE_ERRORS, decoder->errors - errors);
+            }
+            if (start != 0) {
+                telloc_trace_span("decode", connection->trace_id, start, telloc_time(), "frame", frames);
+            }
+            pthread_mutex_lock(&reactor->decode_mutex);
+            telloc_video_unit_queue_pop(&connection->decode_queue);
+        }
+
+        // a closing connection's units are never decoded
+        while (connection->decode_closing && connection->decode_queue.count > 0) {
+            telloc_video_unit_queue_pop(&connection->decode_queue);
+        }
+        if (connection->decode_queue.count > 0) {
+            connection->decode_next = NULL;
+            if (reactor->ready_tail != NULL) {
+                reactor->ready_tail->decode_next = connection;
+            } else {
+                reactor->ready_head = connection;
+            }
+            reactor->ready_tail = connection;
+        } else {
+            connection->decode_scheduled = 0;
+        }
+        pthread_cond_broadcast(&connection->decode_cond);
+    }
+    pthread_mutex_unlock(&reactor->decode_mutex);
+
+    telloc_trace_thread_exit();
+    return NULL;
+}
+
+
+// function to take every video datagram waiting on a connection's socket, a batch at a time with recvmmsg; runs on the reactor thread
+void telloc_receive_video(telloc_connection *connection, telloc_video_batch *batch) {
+    int sock = connection->video_socket;
+    int received;
+    do {
+        for (int i = 0; i < TELLOC_VIDEO_BATCH; i++) {
+            batch->messages[i].msg_hdr.msg_controllen = sizeof(batch->controls[i].buffer);
+        }
+        unsigned long long start = telloc_time();
+        received = recvmmsg(sock, batch->messages, TELLOC_VIDEO_BATCH, MSG_DONTWAIT, NULL);
+        if (received <= 0) {
+            break;
+        }
+        unsigned long long time = telloc_time();
+
+        unsigned long bytes = 0;
+        unsigned long truncated = 0;
+        unsigned long dropped = 0;
+        for (int i = 0; i < received; i++) {
+            struct msghdr *header = &batch->messages[i].msg_hdr;
+
+            // the kernel attaches its running count of dropped datagrams to each message
+            for (struct cmsghdr *control = CMSG_FIRSTHDR(header); control != NULL; control = CMSG_NXTHDR(header, control)) {
+                if (control->cmsg_level == SOL_SOCKET && control->cmsg_type == SO_RXQ_OVFL) {
+                    uint32_t count;
+                    memcpy(&count, CMSG_DATA(control), sizeof(count));
+                    dropped = count;
+                }
+            }
+            if (header->msg_flags & MSG_TRUNC) {
+                truncated++;
+            }
+
+            bytes += batch->messages[i].msg_len;
+            telloc_assemble_datagram(connection, batch->vectors[i].iov_base, batch->messages[i].msg_len, time, 0);
+        }
+
+        // publish the counters once per batch
+        telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+        telloc_receive_stats *stats = &connection->receive_stats;
+        stats->datagrams_received += received;
+        stats->bytes_received += bytes;
+        stats->datagrams_truncated += truncated;
+        if (dropped > stats->datagrams_dropped) {
+            stats->datagrams_dropped = dropped;
+        }
+        stats->batches++;
+        connection->video_time = time;
+        pthread_mutex_unlock(&connection->video_mutex);
+        unsigned long long end = telloc_time();
+        telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_RECEIVE, start, end);
+        if (telloc_trace_on()) {
+            telloc_trace_span("receive", connection->trace_id, start, end, "datagrams", (unsigned long long) received);
+        }
+    } while (received == TELLOC_VIDEO_BATCH);
+}
+
+
+// thread to feed a recording through the same reassembly, decoding and state handling as the reactor
+void* thread_replay(void* arg) {
+    printf("Replay thread started\n");
+    telloc_trace_thread("replay");
+
+    // get the connection from the argument
+    telloc_connection *connection = (telloc_connection *) arg;
+
+    // recorded times are moved onto the clock as it reads now, so frame and state times compare with telloc_time as usual
+    unsigned long long start = telloc_time();
+    unsigned long long first = 0;
+    int started = 0;
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    connection->replay_stats.start_time = start;
+    pthread_mutex_unlock(&connection->video_mutex);
+
+    telloc_replay_datagram datagram;
+    while (connection->alive && telloc_replay_next(&connection->replay, &datagram) == 0) {
+        if (!started) {
+            first = datagram.time;
+            started = 1;
+        }
+        unsigned long long time = start + (datagram.time - first);
+        if (connection->replay_pace == TELLOC_REPLAY_REALTIME) {
+            // wait on the decode condition, which telloc_disconnect signals, so a gap in the recording doesn't hold it up
+            struct timespec deadline;
+            deadline.tv_sec = (time_t) (time / 1000000000ULL);
+            deadline.tv_nsec = (long) (time % 1000000000ULL);
+            pthread_mutex_lock(&telloc_shared_reactor.decode_mutex);
+            while (connection->alive && telloc_time() < time) {
+                pthread_cond_timedwait(&connection->decode_cond, &telloc_shared_reactor.decode_mutex, &deadline);
+            }
+            pthread_mutex_unlock(&telloc_shared_reactor.decode_mutex);
+            if (!connection->alive) {
+                break;
+            }
+        }
+
+        telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+        telloc_replay_stats *stats = &connection->replay_stats;
+        stats->recorded_time = datagram.time - first;
+        if (datagram.video) {
+            stats->video_datagrams++;
+            stats->units += datagram.unit_start ? 1 : 0;
+            connection->receive_stats.datagrams_received++;
+            connection->receive_stats.bytes_received += datagram.length;
+            connection->receive_stats.batches++;
+            connection->video_time = time;
+        } else {
+            stats->states++;
+        }
+        pthread_mutex_unlock(&connection->video_mutex);
+
+        if (datagram.video) {
+            telloc_assemble_datagram(connection, datagram.data, datagram.length, time, 1);
+        } else {
+            telloc_handle_state(connection, (const char *) datagram.data, datagram.length, time);
+        }
+    }
+
+    // finished means every recorded frame is out, so wait for the decoder workers to catch up
+    pthread_mutex_lock(&telloc_shared_reactor.decode_mutex);
+    while (connection->alive && connection->decode_scheduled) {
+        pthread_cond_wait(&connection->decode_cond, &telloc_shared_reactor.decode_mutex);
+    }
+    pthread_mutex_unlock(&telloc_shared_reactor.decode_mutex);
+
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    connection->replay_stats.finished = 1;
+    connection->replay_stats.end_time = telloc_time();
+    pthread_mutex_unlock(&connection->video_mutex);
+    printf("Replay finished\n");
+
+    telloc_trace_thread_exit();
+    return NULL;
+}
+
+
+// function to get the progress of a replay
+int telloc_get_replay_stats(telloc_connection *connection, telloc_replay_stats *stats) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Replay stats not available.\n");
+        return 1;
+    }
+    if (!connection->replaying) {
+        printf("Not a replay; Replay stats not available.\n");
+        printf("Call telloc_connect_replay() to replay a recording.\n");
+        return 1;
+    }
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    *stats = connection->replay_stats;
+    pthread_mutex_unlock(&connection->video_mutex);
+    return 0;
+}
+
+
+// function to reference the latest frame if it is unread, and clear the frame event.
+// the video mutex must be held
+telloc_frame_slot *telloc_acquire_latest(telloc_connection *connection) {
+    telloc_frame_slot *slot = telloc_frame_pool_acquire(&connection->frame_pool);
+    if (slot != NULL) {
+        telloc_event_clear(connection->frame_event);
+        slot->acquired_time = telloc_time();
+        telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_HANDOFF, slot->frame.info.decoded_time, slot->acquired_time);
+    }
+    return slot;
+}
+
+
+// thread to convert one band of every frame the pool is handed
+void *thread_convert(void *arg) {
+    telloc_convert_helper *helper = (telloc_convert_helper *) arg;
+    telloc_convert_pool *pool = helper->pool;
+    unsigned long long seen = 0;
+    telloc_trace_thread("converter");
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (pool->generation == seen && !pool->stopping) {
+            pthread_cond_wait(&pool->start_cond, &pool->mutex);
+        }
+        if (pool->stopping) {
+            break;
+        }
+        seen = pool->generation;
+        const telloc_convert_job *job = pool->job;
+        pthread_mutex_unlock(&pool->mutex);
+
+        unsigned long long start = telloc_trace_on() ? telloc_time() : 0;
+        telloc_convert_band(job, helper->band, pool->helpers + 1);
+        if (start != 0) {
+            telloc_trace_span("convert band", 0, start, telloc_time(), "band", (unsigned long long) helper->band);
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    telloc_trace_thread_exit();
+    return NULL;
+}
+
+
+// function to convert a job over the pool's helpers and the calling thread
+void telloc_convert_pool_run(telloc_convert_pool *pool, const telloc_convert_job *job) {
+    if (pool->helpers == 0) {
+        telloc_convert_rows(job, 0, job->height);
+        return;
+    }
+    pthread_mutex_lock(&pool->run_mutex);
+    pthread_mutex_lock(&pool->mutex);
+    pool->job = job;
+    pool->pending = pool->helpers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    telloc_convert_band(job, 0, pool->helpers + 1);
+
+    // the job lives on the caller's stack, so wait for every band
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_unlock(&pool->run_mutex);
+}
+
+
+// function to start the helper threads of a connection's conversion pool; threads counts the reader
+void telloc_convert_pool_start(telloc_connection *connection, int threads) {
+    telloc_convert_pool *pool = &connection->convert_pool;
+    pool->run_mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    pool->mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    telloc_cond_init(&pool->start_cond);
+    telloc_cond_init(&pool->done_cond);
+    pool->job = NULL;
+    pool->generation = 0;
+    pool->pending = 0;
+    pool->stopping = 0;
+    pool->helpers = 0;
+    for (int band = 1; band < threads; band++) {
+        telloc_convert_helper *helper = &connection->convert_helpers[band];
+        helper->pool = pool;
+        helper->band = (unsigned int) band;
+        if (pthread_create(&pool->threads[pool->helpers], NULL, thread_convert, helper) != 0) {
+            printf("Error starting conversion thread; Converting over %u threads.\n", pool->helpers + 1);
+            break;
+        }
+        pool->helpers++;
+    }
+}
+
+
+// function to stop a connection's conversion threads
+void telloc_convert_pool_stop(telloc_connection *connection) {
+    telloc_convert_pool *pool = &connection->convert_pool;
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (unsigned int helper = 0; helper < pool->helpers; helper++) {
+        pthread_join(pool->threads[helper], NULL);
+    }
+    pthread_mutex_destroy(&pool->run_mutex);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->start_cond);
+    pthread_cond_destroy(&pool->done_cond);
+}
+
+
+// function to convert an acquired frame to the connection's format the first time it is read, and hand it back if that fails.
+// the video mutex must not be held; only the holder of a frame converts it
+int telloc_convert_acquired(telloc_connection *connection, telloc_frame_slot *slot) {
+    telloc_frame *frame;
+    unsigned long long start = telloc_time();
+    if (telloc_frame_slot_convert(slot, slot->frame.format, &connection->convert_pool, &frame) != 0) {
+        printf("Error converting frame\n");
+        telloc_release_frame(connection, &slot->frame);
+        return 1;
+    }
+    unsigned long long end = telloc_time();
+    telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_CONVERT, start, end);
+    if (telloc_trace_on()) {
+        telloc_trace_flow(TELLOC_TRACE_FLOW_END, connection->trace_id, slot->frame.info.sequence, start);
+        telloc_trace_span("convert", connection->trace_id, start, end, "frame", slot->frame.info.sequence);
+    }
+    return 0;
+}
+
+
+// function to borrow the most recent video frame without copying it
+int telloc_acquire_frame(telloc_connection *connection, const telloc_frame** frame) {
+    // check if the video socket is open
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Video not received.\n");
+        printf("Call telloc_connect() before reading an image.\n");
+        return 1;
+    }
+
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    telloc_frame_slot *slot = telloc_acquire_latest(connection);
+    pthread_mutex_unlock(&connection->video_mutex);
+
+    // check if there is new video data
+    if (slot == NULL || telloc_convert_acquired(connection, slot) != 0) {
+        return 1;
+    }
+
+    *frame = &slot->frame;
+    return 0;
+}
+
+
+// function to block until a frame newer than the last one acquired or read is waiting, or the timeout passes.
+// the video mutex must be held; returns 1 on timeout
+int telloc_wait_latest(telloc_connection *connection, int timeout_ms) {
+    struct timespec deadline;
+    telloc_deadline(&deadline, timeout_ms);
+
+    int timed_out = 0;
+    while (!connection->frame_pool.latest_unread && connection->alive && !timed_out) {
+        timed_out = telloc_cond_wait(&connection->frame_cond, &connection->video_mutex, timeout_ms, &deadline);
+    }
+    return !connection->frame_pool.latest_unread;
+}
+
+
+// function to wait for a frame newer than the last one acquired or read, and borrow it
+int telloc_wait_frame(telloc_connection *connection, int timeout_ms, const telloc_frame** frame) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Video not received.\n");
+        printf("Call telloc_connect() before waiting for an image.\n");
+        return 1;
+    }
+
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    telloc_frame_slot *slot = NULL;
+    if (telloc_wait_latest(connection, timeout_ms) == 0) {
+        slot = telloc_acquire_latest(connection);
+    }
+    pthread_mutex_unlock(&connection->video_mutex);
+
+    if (slot == NULL || telloc_convert_acquired(connection, slot) != 0) {
+        return 1;
+    }
+
+    *frame = &slot->frame;
+    return 0;
+}
+
+
+// function to wait for a frame newer than the last one acquired or read, and copy it like telloc_read_image
+int telloc_wait_image(telloc_connection *connection, int timeout_ms, unsigned char* image, unsigned int image_buffer_size, unsigned int* image_bytes, unsigned int* image_width, unsigned int* image_height) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Video not received.\n");
+        printf("Call telloc_connect() before waiting for an image.\n");
+        return 1;
+    }
+
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    int timed_out = telloc_wait_latest(connection, timeout_ms);
+    pthread_mutex_unlock(&connection->video_mutex);
+
+    if (timed_out) {
+        return 1;
+    }
+    return telloc_read_image(connection, image, image_buffer_size, image_bytes, image_width, image_height);
+}
+
+
+// function to get an eventfd that is readable while an unread frame is waiting
+int telloc_get_frame_fd(telloc_connection *connection) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Frame fd not available.\n");
+        return -1;
+    }
+    return connection->frame_event;
+}
+
+
+// function to hand an acquired frame back to the library
+int telloc_release_frame(telloc_connection *connection, const telloc_frame* frame) {
+    if (connection == NULL || frame == NULL) {
+        return 1;
+    }
+
+    // the public frame is the first member of its slot; the caller still holds it, so its acquired time is stable
+    telloc_frame_slot *slot = (telloc_frame_slot *) frame;
+    unsigned long long end = telloc_time();
+    telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_READ, slot->acquired_time, end);
+    if (telloc_trace_on()) {
+        telloc_trace_span("read", connection->trace_id, slot->acquired_time, end, "frame", slot->frame.info.sequence);
+    }
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    telloc_frame_pool_release(&connection->frame_pool, slot);
+    pthread_mutex_unlock(&connection->video_mutex);
+
+    return 0;
+}
+
+
+// function to get an acquired frame in another pixel format
+int telloc_convert_frame(telloc_connection *connection, const telloc_frame* frame, telloc_pixel_format format, const telloc_frame** converted) {
+    if (connection == NULL || frame == NULL) {
+        return 1;
+    }
+
+    // no lock; the caller holds the frame, and only the holder converts it
+    telloc_frame *target;
+    if (telloc_frame_slot_convert((telloc_frame_slot *) frame, format, &connection->convert_pool, &target) != 0) {
+        printf("Error converting frame to format %d\n", (int) format);
+        return 1;
+    }
+    *converted = target;
+    return 0;
+}
+
+
+// function to read the most recent video frame
+// kept for compatibility; copies the frame borrowed with telloc_acquire_frame
+// argument: telloc_connection *connection
+// argument: unsigned char *buffer
+// argument: unsigned buffer_size
+int telloc_read_image(telloc_connection *connection, unsigned char* image, unsigned int image_buffer_size, unsigned int* image_bytes, unsigned int* image_width, unsigned int* image_height) {
+    // check if the video socket is open
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Video not received.\n");
+        printf("Call telloc_connect() before reading an image.\n");
+        return 1;
+    }
+
+    // acquire the mutex unix
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+
+    // check if there is new video data
+    telloc_frame_slot *latest = connection->frame_pool.latest;
+    if (latest == NULL || !connection->frame_pool.latest_unread) {
+        pthread_mutex_unlock(&connection->video_mutex);
+        return 1;
+    }
+
+    if (image_buffer_size < latest->frame.bytes) {
+        printf("Buffer size too small to hold video data\n");
+        pthread_mutex_unlock(&connection->video_mutex);
+        return 1;
+    }
+
+    telloc_frame_slot *slot = telloc_acquire_latest(connection);
+
+    // release the mutex
+    pthread_mutex_unlock(&connection->video_mutex);
+
+    // convert and copy the borrowed frame outside the lock
+    if (telloc_convert_acquired(connection, slot) != 0) {
+        return 1;
+    }
+    telloc_video_frame_copy(&slot->frame, image);
+    *image_bytes = slot->frame.bytes;
+    *image_width = slot->frame.width;
+    *image_height = slot->frame.height;
+
+    telloc_release_frame(connection, &slot->frame);
+
+    return 0;
+}
+
+
+// function to get the video socket counters
+int telloc_get_receive_stats(telloc_connection *connection, telloc_receive_stats *stats) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Receive stats not available.\n");
+        return 1;
+    }
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    *stats = connection->receive_stats;
+    pthread_mutex_unlock(&connection->video_mutex);
+    pthread_mutex_lock(&telloc_shared_reactor.decode_mutex);
+    stats->units_dropped = connection->decode_queue.units_dropped;
+    pthread_mutex_unlock(&telloc_shared_reactor.decode_mutex);
+    stats->units_discarded = (unsigned long) telloc_metrics_counter(&connection->metrics, TELLOC_COUNTER_UNITS_DISCARDED);
+    return 0;
+}
+
+
+// function to get the pipeline counters and stage latencies
+int telloc_get_stats(telloc_connection *connection, telloc_stats *stats) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Stats not available.\n");
+        return 1;
+    }
+    telloc_metrics_snapshot(&connection->metrics, stats);
+    // the decode mutex is only held for queue operations, never across a decode
+    pthread_mutex_lock(&telloc_shared_reactor.decode_mutex);
+    stats->units_dropped = connection->decode_queue.units_dropped;
+    pthread_mutex_unlock(&telloc_shared_reactor.decode_mutex);
+    return 0;
+}
+
+
+// function to get a connection's metrics, its drone's address and its id for the Prometheus export
+const telloc_metrics *telloc_connection_metrics(telloc_connection *connection, char *address, unsigned int address_length, unsigned int *id) {
+    if (connection == NULL || !connection->alive) {
+        return NULL;
+    }
+    if (connection->replaying || inet_ntop(AF_INET, &connection->drone_address.sin_addr, address, address_length) == NULL) {
+        snprintf(address, address_length, "replay");
+    }
+    *id = connection->trace_id;
+    return &connection->metrics;
+}
+
+
+// function to start recording the video stream
+int telloc_start_recording(telloc_connection *connection, const char *path, telloc_record_format format) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Recording not started.\n");
+        printf("Call telloc_connect() before starting a recording.\n");
+        return 1;
+    }
+
+    pthread_mutex_lock(&connection->record_mutex);
+    if (connection->recorder.stats.recording) {
+        pthread_mutex_unlock(&connection->record_mutex);
+        printf("Already recording; Recording not started.\n");
+        printf("Call telloc_stop_recording() before starting another recording.\n");
+        return 1;
+    }
+    int failed = telloc_recorder_open(&connection->recorder, path, format);
+    pthread_mutex_unlock(&connection->record_mutex);
+    return failed;
+}
+
+
+// function to finish the recording
+int telloc_stop_recording(telloc_connection *connection) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Recording not stopped.\n");
+        return 1;
+    }
+
+    pthread_mutex_lock(&connection->record_mutex);
+    int failed = connection->recorder.stats.recording ? telloc_recorder_close(&connection->recorder) : 1;
+    pthread_mutex_unlock(&connection->record_mutex);
+    return failed;
+}
+
+
+// function to get the recording counters
+int telloc_get_record_stats(telloc_connection *connection, telloc_record_stats *stats) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Record stats not available.\n");
+        return 1;
+    }
+    pthread_mutex_lock(&connection->record_mutex);
+    *stats = connection->recorder.stats;
+    pthread_mutex_unlock(&connection->record_mutex);
+    return 0;
+}
+
+
+// function to get the video options in effect
+int telloc_get_video_config(telloc_connection *connection, telloc_video_config *config) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Video config not available.\n");
+        return 1;
+    }
+    *config = connection->video_decoder.config;
+    return 0;
+}
+
+
+// function to run the callbacks of finished commands and wake anyone waiting on them; requires the command mutex
+void telloc_report_commands(telloc_connection *connection) {
+    int finished = 0;
+    telloc_command *command;
+    while ((command = telloc_command_queue_finished(&connection->command_queue)) != NULL) {
+        telloc_metrics_command(&connection->metrics, command);
+        if (telloc_trace_on() && command->sent_time != 0) {
+            unsigned long long end = command->replied_time != 0 ? command->replied_time : telloc_time();
+            telloc_trace_async("command", connection->trace_id, command->order, command->sent_time, end,
+                               command->command, command->length, "status", (unsigned long long) command->status);
+        }
+        if (command->callback != NULL) {
+            // callbacks may use the command API themselves
+            pthread_mutex_unlock(&connection->command_mutex);
+            connection->reporting++;
+            command->callback(command, command->user);
+            connection->reporting--;
+            telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+        }
+        telloc_command_queue_release(&connection->command_queue, command);
+        finished = 1;
+    }
+    if (finished) {
+        pthread_cond_broadcast(&connection->command_cond);
+    }
+}
+
+
+// function to take the drone's replies, send queued commands and the rc setpoint, and arm the command timer for
+// the next reply timeout or rc send; runs on the reactor thread whenever one of the connection's command descriptors is ready
+void telloc_service_commands(telloc_connection *connection) {
+    int sock = connection->command_socket;
+    telloc_command_queue *queue = &connection->command_queue;
+    char buffer[1024];
+
+    telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+
+    // take every reply waiting, in order; nothing is left over to drain before the next command
+    ssize_t bytes_received;
+    while ((bytes_received = recvfrom(sock, buffer, sizeof(buffer), MSG_DONTWAIT, NULL, NULL)) >= 0) {
+        telloc_command_queue_reply(queue, buffer, (unsigned int) bytes_received, telloc_time());
+    }
+
+    unsigned long long now = telloc_time();
+    telloc_command_queue_expire(queue, now);
+
+    // send everything that may go now; a UDP send does not wait for the drone
+    telloc_command *command;
+    while ((command = telloc_command_queue_next(queue, now)) != NULL) {
+        unsigned long long start = telloc_trace_on() ? telloc_time() : 0;
+        ssize_t bytes_sent = sendto(sock, command->command, command->length, 0, (struct sockaddr*) &connection->drone_address, sizeof(connection->drone_address));
+        if (bytes_sent == -1) {
+            printf("Command not sent: %d\n", errno);
+        }
+        if (start != 0) {
+            telloc_trace_span("send", connection->trace_id, start, telloc_time(), "bytes", (unsigned long long) command->length);
+        }
+        telloc_command_queue_sent(queue, command, bytes_sent != -1);
+    }
+
+    // the rc setpoint goes out at its own rate, with no reply to wait for
+    char rc_command[64];
+    unsigned int rc_length = telloc_rc_due(&connection->rc, now, rc_command, sizeof(rc_command));
+    if (rc_length > 0 && sendto(sock, rc_command, rc_length, 0, (struct sockaddr*) &connection->drone_address, sizeof(connection->drone_address)) == -1) {
+        printf("rc not sent: %d\n", errno);
+    }
+    telloc_report_commands(connection);
+
+    // wake again when the command waiting for its reply times out or the next rc is due; 0 disarms the timer
+    unsigned long long deadline = telloc_command_queue_deadline(queue);
+    unsigned long long rc_deadline = telloc_rc_deadline(&connection->rc);
+    if (rc_deadline != 0 && (deadline == 0 || rc_deadline < deadline)) {
+        deadline = rc_deadline;
+    }
+    if (deadline != connection->command_deadline) {
+        struct itimerspec timer;
+        memset(&timer, 0, sizeof(timer));
+        timer.it_value.tv_sec = (time_t) (deadline / 1000000000ULL);
+        timer.it_value.tv_nsec = (long) (deadline % 1000000000ULL);
+        if (timerfd_settime(connection->command_timer, TFD_TIMER_ABSTIME, &timer, NULL) == -1) {
+            printf("Error arming command timer: %d\n", errno);
+        }
+        connection->command_deadline = deadline;
+    }
+
+    pthread_mutex_unlock(&connection->command_mutex);
+}
+
+
+// thread to do the network I/O of every live connection in the process. sleeps in one epoll on all of their
+// sockets, command wake events and command timers, and handles whatever is ready
+void *thread_reactor(void *arg) {
+    printf("Reactor thread started\n");
+    telloc_trace_thread("reactor");
+    telloc_on_reactor = 1;
+
+    telloc_reactor *reactor = (telloc_reactor *) arg;
+
+    // point one message at each slot of the batch buffer; the reactor reads one socket at a time, so every connection shares it
+    telloc_video_batch *batch = (telloc_video_batch *) malloc(sizeof(telloc_video_batch));
+    if (batch == NULL) {
+        printf("Error allocating video batch memory\n");
+        return NULL;
+    }
+    memset(batch->messages, 0, sizeof(batch->messages));
+    for (int i = 0; i < TELLOC_VIDEO_BATCH; i++) {
+        batch->vectors[i].iov_base = batch->buffer + i * TELLOC_VIDEO_DATAGRAM_SIZE;
+        batch->vectors[i].iov_len = TELLOC_VIDEO_DATAGRAM_SIZE;
+        batch->messages[i].msg_hdr.msg_iov = &batch->vectors[i];
+        batch->messages[i].msg_hdr.msg_iovlen = 1;
+        batch->messages[i].msg_hdr.msg_control = batch->controls[i].buffer;
+    }
+
+    struct epoll_event events[TELLOC_REACTOR_EVENTS];
+    pthread_mutex_lock(&reactor->dispatch_mutex);
+    while (reactor->alive) {
+        unsigned long long removals = reactor->removals;
+        pthread_mutex_unlock(&reactor->dispatch_mutex);
+
+        int count = epoll_wait(reactor->epoll, events, TELLOC_REACTOR_EVENTS, -1);
+        pthread_mutex_lock(&reactor->dispatch_mutex);
+        if (count == -1) {
+            if (errno != EINTR) {
+                printf("Error waiting for network data: %d\n", errno);
+                break;
+            }
+            continue;
+        }
+
+        // a batch taken before a connection was removed may point at it; the descriptors still ready come back next time
+        for (int i = 0; i < count && reactor->removals == removals; i++) {
+            telloc_source *source = (telloc_source *) events[i].data.ptr;
+            if (source == NULL) {
+                telloc_event_clear(reactor->wake);
+                continue;
+            }
+            switch (source->kind) {
+                case TELLOC_SOURCE_STATE:
+                    telloc_receive_state(source->connection);
+                    break;
+                case TELLOC_SOURCE_VIDEO:
+                    telloc_receive_video(source->connection, batch);
+                    break;
+                default:
+                    // the timer and the wake event are non-blocking; reading them makes them unreadable again
+                    if (source->kind != TELLOC_SOURCE_COMMAND) {
+                        telloc_event_clear(source->fd);
+                    }
+                    telloc_service_commands(source->connection);
+                    break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&reactor->dispatch_mutex);
+
+    free(batch);
+
+    telloc_trace_thread_exit();
+    return NULL;
+}
+
+
+// function to take a reference to the shared reactor and decoder workers, starting them for the first connection.
+// every connection adds a decoder worker until there is one per core
+int telloc_reactor_acquire(void) {
+    telloc_reactor *reactor = &telloc_shared_reactor;
+    pthread_mutex_lock(&reactor->mutex);
+    if (reactor->users == 0) {
+        reactor->epoll = epoll_create1(EPOLL_CLOEXEC);
+        reactor->wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if (reactor->epoll == -1 || reactor->wake == -1 || epoll_ctl(reactor->epoll, EPOLL_CTL_ADD, reactor->wake, &event) == -1) {
+            printf("Error creating reactor epoll: %d\n", errno);
+            if (reactor->epoll != -1) {
+                close(reactor->epoll);
+            }
+            if (reactor->wake != -1) {
+                close(reactor->wake);
+            }
+            reactor->epoll = -1;
+            reactor->wake = -1;
+            pthread_mutex_unlock(&reactor->mutex);
+            return 1;
+        }
+
+        pthread_mutexattr_t dispatch_attr;
+        pthread_mutexattr_init(&dispatch_attr);
+        pthread_mutexattr_settype(&dispatch_attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&reactor->dispatch_mutex, &dispatch_attr);
+        pthread_mutexattr_destroy(&dispatch_attr);
+        reactor->removals = 0;
+        reactor->alive = 1;
+        pthread_create(&reactor->thread, NULL, thread_reactor, reactor);
+
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        reactor->cores = cores < 1 ? 1 : cores > TELLOC_DECODE_WORKERS_MAX ? TELLOC_DECODE_WORKERS_MAX : (unsigned int) cores;
+        reactor->workers = 0;
+        reactor->decode_stopping = 0;
+        reactor->ready_head = NULL;
+        reactor->ready_tail = NULL;
+    }
+    reactor->users++;
+    while (reactor->workers < reactor->users && reactor->workers < reactor->cores) {
+        pthread_create(&reactor->worker_threads[reactor->workers], NULL, thread_decode, reactor);
+        reactor->workers++;
+    }
+    pthread_mutex_unlock(&reactor->mutex);
+    return 0;
+}
+
+
+// function to drop a reference to the shared reactor, stopping it and the decoder workers after the last connection
+void telloc_reactor_release(void) {
+    telloc_reactor *reactor = &telloc_shared_reactor;
+    pthread_mutex_lock(&reactor->mutex);
+    reactor->users--;
+    if (reactor->users == 0) {
+        pthread_mutex_lock(&reactor->dispatch_mutex);
+        reactor->alive = 0;
+        pthread_mutex_unlock(&reactor->dispatch_mutex);
+        telloc_event_signal(reactor->wake);
+        pthread_join(reactor->thread, NULL);
+
+        pthread_mutex_lock(&reactor->decode_mutex);
+        reactor->decode_stopping = 1;
+        pthread_cond_broadcast(&reactor->decode_cond);
+        pthread_mutex_unlock(&reactor->decode_mutex);
+        for (unsigned int i = 0; i < reactor->workers; i++) {
+            pthread_join(reactor->worker_threads[i], NULL);
+        }
+        reactor->workers = 0;
+
+        close(reactor->epoll);
+        close(reactor->wake);
+        reactor->epoll = -1;
+        reactor->wake = -1;
+        pthread_mutex_destroy(&reactor->dispatch_mutex);
+    }
+    pthread_mutex_unlock(&reactor->mutex);
+}
+
+
+// function to have the reactor watch one of a connection's descriptors
+int telloc_reactor_add(telloc_connection *connection, telloc_source_kind kind, int fd) {
+    telloc_source *source = &connection->sources[kind];
+    source->connection = connection;
+    source->kind = kind;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = source;
+    if (epoll_ctl(telloc_shared_reactor.epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+        printf("Error adding socket to the reactor: %d\n", errno);
+        return 1;
+    }
+    source->fd = fd;
+    return 0;
+}
+
+
+// function to stop the reactor watching a connection's descriptors. once it returns the reactor is not handling any of
+// them and never will again; it must not be called from the reactor thread for the connection being handled
+void telloc_reactor_remove(telloc_connection *connection) {
+    telloc_reactor *reactor = &telloc_shared_reactor;
+    pthread_mutex_lock(&reactor->dispatch_mutex);
+    for (int kind = 0; kind < TELLOC_SOURCE_COUNT; kind++) {
+        telloc_source *source = &connection->sources[kind];
+        if (source->fd != -1) {
+            epoll_ctl(reactor->epoll, EPOLL_CTL_DEL, source->fd, NULL);
+            source->fd = -1;
+        }
+    }
+    reactor->removals++;
+    pthread_mutex_unlock(&reactor->dispatch_mutex);
+}
 
-    // get the connection from the argument
-    telloc_connection* connection = (telloc_connection*) arg;
 
-    // check if the state socket is open
+// function to queue a command for the reactor
+telloc_command *telloc_send_command_async(telloc_connection *connection, const char* command, unsigned int length, telloc_command_priority priority,
+                                          int timeout_ms, telloc_command_callback callback, void *user) {
+    // check if the command socket is open
     if (connection == NULL || !connection->alive) {
-        printf("Connection not initialized; State thread not starting.\n");
-        printf("Call telloc_connect() before starting state thread.\n");
+        printf("Connection not initialized; Command not sent.\n");
+        printf("Call telloc_connect() before sending commands.\n");
+        return NULL;
+    }
+    if (connection->replaying) {
+        printf("Replaying a recording; Command not sent.\n");
         return NULL;
     }
 
-    // get the socket from the connection
-    int sock = connection->state_socket;
+    if (length > TELLOC_COMMAND_LENGTH) {
+        printf("Command too long; Command not sent.\n");
+        return NULL;
+    }
 
-    // while alive, receive data on the socket
-    while (connection->alive) {
-        // receive data on the socket, assume UDP max buffer size
-        char buffer[TELLOC_STATE_SIZE];
-
-        // receive UDP data from the socket using recvfrom
-        int bytes_received = (int) recvfrom(sock, buffer, TELLOC_STATE_SIZE, 0, NULL, NULL);
-        if (bytes_received < 0) {
-            // sleep for 5 ms
-            nanosleep((const struct timespec[]){{0, 5000000L}}, NULL);
-            continue;
-        }
+    telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+    // checked again under the lock, so nothing is queued after telloc_disconnect cancels the queue
+    if (!connection->alive) {
+        pthread_mutex_unlock(&connection->command_mutex);
+        printf("Connection closing; Command not sent.\n");
+        return NULL;
+    }
+    telloc_command *queued = telloc_command_queue_push(&connection->command_queue, command, length, priority, timeout_ms, callback, user, telloc_time());
+    pthread_mutex_unlock(&connection->command_mutex);
+    if (queued == NULL) {
+        printf("Command queue full; Command not sent.\n");
+        return NULL;
+    }
 
-        // Windows acquire handle to the mutex
-        pthread_mutex_lock(&connection->state_mutex);
+    telloc_event_signal(connection->command_wake);
+    return queued;
+}
 
-        // copy the data string to the connection's state buffer
-        // zero out the state buffer
-        memset(connection->state_buffer, 0, TELLOC_STATE_SIZE);
-        // copy the data string to the state buffer with memcpy_s
-        memcpy(connection->state_buffer, buffer, bytes_received);
-        connection->state_size = bytes_received;
 
-        // release the mutex
-        pthread_mutex_unlock(&connection->state_mutex);
+// function to set the sticks the reactor keeps sending
+int telloc_set_rc(telloc_connection *connection, int lr, int fb, int ud, int yaw) {
+    // check if the command socket is open
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; rc not set.\n");
+        printf("Call telloc_connect() before setting rc.\n");
+        return 1;
+    }
+    if (connection->replaying) {
+        printf("Replaying a recording; rc not set.\n");
+        return 1;
+    }
 
+    telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+    int due = telloc_rc_set(&connection->rc, lr, fb, ud, yaw, telloc_time());
+    pthread_mutex_unlock(&connection->command_mutex);
+    // the reactor may be asleep with nothing to do for this drone
+    if (due) {
+        telloc_event_signal(connection->command_wake);
     }
+    return 0;
+}
 
-    // close the socket
-    close(sock);
 
-    return NULL;
+// function to get where a queued command is
+telloc_command_status telloc_command_poll(telloc_connection *connection, telloc_command *command) {
+    telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+    telloc_command_status status = command->status;
+    pthread_mutex_unlock(&connection->command_mutex);
+    return status;
 }
 
 
-// thread to read the most recent state data
-int telloc_read_state(telloc_connection *connection, char* state_buffer, unsigned state_buffer_length) {
-    // clear the state buffer
-    memset(state_buffer, 0, state_buffer_length);
-
-    // check if the state socket is open
-    if (connection == NULL || !connection->alive) {
-        printf("Connection not initialized; State thread not starting.\n");
-        printf("Call telloc_connect() before starting state thread.\n");
-        return 1;
+// function to wait for a queued command to finish
+telloc_command_status telloc_command_wait(telloc_connection *connection, telloc_command *command, int timeout_ms) {
+    if (telloc_on_reactor && timeout_ms != 0) {
+        printf("Can't wait for a command on the I/O thread; Polling instead.\n");
+        timeout_ms = 0;
+    }
+    struct timespec deadline;
+    telloc_deadline(&deadline, timeout_ms);
+
+    telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+    // the reactor finishes every command, and disconnecting cancels the rest
+    while (command->status < TELLOC_COMMAND_DONE && timeout_ms != 0) {
+        if (telloc_cond_wait(&connection->command_cond, &connection->command_mutex, timeout_ms, &deadline)) {
+            break;
+        }
     }
+    telloc_command_status status = command->status;
+    pthread_mutex_unlock(&connection->command_mutex);
+    return status;
+}
 
-    // check if the buffer is large enough
-    if (state_buffer_length < connection->state_size) {
-        printf("Buffer size is too small to hold state data.\n");
+
+// function to copy the reply of a finished command
+int telloc_command_response(telloc_connection *connection, telloc_command *command, char* response, unsigned int response_length) {
+    if (response_length == 0) {
         return 1;
     }
+    response[0] = '\0';
 
-    // check if there is state data
-    if (connection->state_size == 0) {
+    telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+    if (command->status != TELLOC_COMMAND_DONE || command->response_length == 0) {
+        pthread_mutex_unlock(&connection->command_mutex);
         return 1;
     }
+    unsigned int length = command->response_length < response_length ? command->response_length : response_length - 1;
+    memcpy(response, command->response, length);
+    response[length] = '\0';
+    pthread_mutex_unlock(&connection->command_mutex);
+    return 0;
+}
 
-    // acquire handle to the mutex
-    pthread_mutex_lock(&connection->state_mutex);
-
-    // copy the data string to the state buffer with memcpy
-    memcpy(state_buffer, connection->state_buffer, connection->state_size);
-    connection->state_size = 0;
-
-    // release the mutex
-    pthread_mutex_unlock(&connection->state_mutex);
 
-    return 0;
+// function to hand back a command handle
+void telloc_command_release(telloc_connection *connection, telloc_command *command) {
+    telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+    telloc_command_queue_release(&connection->command_queue, command);
+    pthread_mutex_unlock(&connection->command_mutex);
 }
 
 
-// thread to receive video data from the Tello drone over UDP
-void* thread_video(void* arg) {
-    printf("Video thread started\n");
+// thread to run periodic tasks. sleeps on a timerfd armed for the next deadline, so it only wakes when something is due
+// argument: telloc_connection *connection
+void* thread_schedule(void* arg) {
+    printf("Scheduler thread started\n");
+    telloc_trace_thread("scheduler");
 
     // get the connection from the argument
     telloc_connection *connection = (telloc_connection *) arg;
 
-    // check if the video socket is open
-    if (!connection->alive) {
-        printf("Connection not initialized; Video thread not starting.\n");
-        printf("Call telloc_connect() before starting video thread.\n");
-        return NULL;
-    }
-
-    // get the socket from the connection
-    int sock = connection->video_socket;
-
-    // allocate a buffer for the video data
-    unsigned char *udp_buffer = (unsigned char *) malloc(65507);
-
-    // allocate a buffer for multiple video packets
-    unsigned char *h264_buffer = (unsigned char *) malloc(65507 * 10);
-    unsigned h264_buffer_size = 0;
+    // the timer fires at the next deadline; the wake event means the schedule changed
+    struct pollfd fds[2];
+    fds[0].fd = connection->schedule_timer;
+    fds[0].events = POLLIN;
+    fds[1].fd = connection->schedule_wake;
+    fds[1].events = POLLIN;
 
-    // while alive, receive data on the socket
+    pthread_mutex_lock(&connection->schedule_mutex);
     while (connection->alive) {
-        // receive data on the socket on the desired interface
-        int bytes_received = (int) recvfrom(sock, udp_buffer, 65507, 0, NULL, NULL);
-        if (bytes_received == -1) {
-            // sleep for 1 ms
-            nanosleep((const struct timespec[]){{0, 1000000L}}, NULL);
-            continue;
+        // run everything due; tasks run with the schedule locked, so removing one waits for it to finish
+        telloc_task task;
+        while (connection->alive && telloc_schedule_due(&connection->schedule, telloc_time(), &task)) {
+            task.function(connection, task.user);
         }
 
-        // check if the udp packet is a valid h264 start frame (end of previous frame)
-        int new_frame = telloc_video_decoder_is_start_code(udp_buffer, bytes_received);
-        if (new_frame) {
-            // if there is a (hopefully) completed frame in the h264 buffer, send it to the video decoder
-            if (h264_buffer_size > 0) {
-                // send the completed video packet to the video decoder
-                telloc_video_decoder_decode(&connection->video_decoder, h264_buffer, h264_buffer_size);
-            }
-            // copy the udp packet to the h264 buffer
-            memcpy(h264_buffer, udp_buffer, bytes_received);
-            h264_buffer_size = bytes_received;
-        } else if (h264_buffer_size > 0) {  // not a start frame, but there is some data in the h264 buffer
-            //  copy the data to the end of the h264 buffer
-            memcpy(h264_buffer + h264_buffer_size, udp_buffer, bytes_received);
-            h264_buffer_size += bytes_received;
+        // arm the timer for the next deadline on the telloc_time clock; an empty schedule disarms it
+        struct itimerspec timer;
+        memset(&timer, 0, sizeof(timer));
+        unsigned long long deadline = telloc_schedule_deadline(&connection->schedule);
+        timer.it_value.tv_sec = (time_t) (deadline / 1000000000ULL);
+        timer.it_value.tv_nsec = (long) (deadline % 1000000000ULL);
+        if (timerfd_settime(connection->schedule_timer, TFD_TIMER_ABSTIME, &timer, NULL) == -1) {
+            printf("Error arming scheduler timer: %d\n", errno);
         }
+        pthread_mutex_unlock(&connection->schedule_mutex);
 
-        // check if the video decoder has a completed frame
-        if (new_frame && connection->video_decoder.frame_ready) {
-            // acquire handle to the mutex
-            pthread_mutex_lock(&connection->video_mutex);
-
-            // copy the data to the connection's video buffer
-            memcpy(connection->video_buffer, connection->video_decoder.frame_buffer, connection->video_decoder.frame_size);
-            connection->video_decoder.frame_ready = 0;
-            connection->video_size = connection->video_decoder.frame_size;
-
-            // release the mutex
-            pthread_mutex_unlock(&connection->video_mutex);
+        if (poll(fds, 2, -1) == -1 && errno != EINTR) {
+            printf("Error waiting for scheduler timer: %d\n", errno);
         }
+        // both are non-blocking; reading them makes them unreadable again
+        telloc_event_clear(connection->schedule_timer);
+        telloc_event_clear(connection->schedule_wake);
+        pthread_mutex_lock(&connection->schedule_mutex);
     }
+    pthread_mutex_unlock(&connection->schedule_mutex);
 
-    // close the socket
-    close(sock);
+    telloc_trace_thread_exit();
+    return NULL;
+}
 
-    // free the buffers
-    free(udp_buffer);
-    free(h264_buffer);
 
+// function to read the number a query was answered with; returns 1 if the reply is not a number
+int telloc_query_number(telloc_connection *connection, telloc_command *command, int *value) {
+    char response[32];
+    if (telloc_command_response(connection, command, response, sizeof(response)) != 0 || response[0] < '0' || response[0] > '9') {
+        return 1;
+    }
+    *value = atoi(response);
     return 0;
 }
 
 
-// function to read the most recent video frame
-// argument: telloc_connection *connection
-// argument: unsigned char *buffer
-// argument: unsigned buffer_size
-int telloc_read_image(telloc_connection *connection, unsigned char* image, unsigned int image_buffer_size, unsigned int* image_bytes, unsigned int* image_width, unsigned int* image_height) {
-    // check if the video socket is open
-    if (connection == NULL || !connection->alive) {
-        printf("Connection not initialized; Video not received.\n");
-        printf("Call telloc_connect() before reading an image.\n");
-        return 1;
+// function to keep the battery level from a battery? reply; runs on the reactor thread
+void telloc_battery_answered(telloc_command *command, void *user) {
+    telloc_connection *connection = (telloc_connection *) user;
+    int battery;
+    if (telloc_query_number(connection, command, &battery) == 0) {
+        telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+        connection->health.battery = battery;
+        connection->health.battery_time = telloc_time();
+        pthread_mutex_unlock(&connection->command_mutex);
     }
+}
 
-    // acquire the mutex unix
-    pthread_mutex_lock(&connection->video_mutex);
 
-    if (image_buffer_size < connection->video_size) {
-        printf("Buffer size too small to hold video data\n");
-        goto error;
+// function to keep the signal to noise ratio from a wifi? reply; runs on the reactor thread
+void telloc_wifi_answered(telloc_command *command, void *user) {
+    telloc_connection *connection = (telloc_connection *) user;
+    int snr;
+    if (telloc_query_number(connection, command, &snr) == 0) {
+        telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+        connection->health.wifi_snr = snr;
+        connection->health.wifi_time = telloc_time();
+        pthread_mutex_unlock(&connection->command_mutex);
     }
+}
 
-    // check if there is new video data
-    if (connection->video_size == 0) {
-        goto error;
+
+// function to queue a query behind anything the pilot sends, with a callback for the reply
+void telloc_query(telloc_connection *connection, const char *query, telloc_command_callback answered) {
+    telloc_command *command = telloc_send_command_async(connection, query, (unsigned int) strlen(query), TELLOC_PRIORITY_LOW, -1, answered, connection);
+    if (command != NULL) {
+        telloc_command_release(connection, command);
     }
+}
 
-    // copy the data from the connection's video buffer
-    memcpy(image, connection->video_buffer, connection->video_size);
-    *image_bytes = connection->video_size;
-    connection->video_size = 0;
-    *image_width = connection->video_decoder.frame_width;
-    *image_height = connection->video_decoder.frame_height;
 
-    // release the mutex
-    pthread_mutex_unlock(&connection->video_mutex);
+// task to ask for the battery level. it doubles as the keepalive; the drone lands after 15 seconds without a command
+void telloc_task_battery(telloc_connection *connection, void *user) {
+    telloc_query(connection, "battery?", telloc_battery_answered);
+}
 
-    return 0;
 
-    error:
-    // release the mutex
-    pthread_mutex_unlock(&connection->video_mutex);
-    return 1;
+// task to ask for the wifi signal to noise ratio
+void telloc_task_wifi(telloc_connection *connection, void *user) {
+    telloc_query(connection, "wifi?", telloc_wifi_answered);
 }
 
 
-// thread to repeatedly send keepalive (tello connection will timeout after 15 seconds).
-// argument: telloc_connection *connection
-void* thread_keepalive(void* arg) {
-    printf("Keepalive thread started\n");
+// task to notice when state or video stop arriving, and when they come back
+void telloc_task_watchdog(telloc_connection *connection, void *user) {
+    unsigned long long now = telloc_time();
+    unsigned long long timeout = TELLOC_WATCHDOG_TIMEOUT * 1000000ULL;
 
-    // get the connection from the argument
-    telloc_connection *connection = (telloc_connection *) arg;
+    // only once something has arrived; video is off until streamon
+    telloc_state state;
+    int state_lost = telloc_state_latest(&connection->state_latest, &state) == 0 && state.received_time + timeout < now;
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    unsigned long long video_time = connection->video_time;
+    pthread_mutex_unlock(&connection->video_mutex);
+    int video_lost = video_time != 0 && video_time + timeout < now;
 
-    // check if the command socket is open
-    if (!connection->alive) {
-        printf("Connection not initialized; Keepalive thread not starting.\n");
-        printf("Call telloc_connect() before starting keepalive thread.\n");
-        return NULL;
+    telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+    telloc_health *health = &connection->health;
+    if (state_lost != health->state_lost) {
+        printf(state_lost ? "No state from the drone for %d ms\n" : "State from the drone is back\n", TELLOC_WATCHDOG_TIMEOUT);
     }
+    if (video_lost != health->video_lost) {
+        printf(video_lost ? "No video from the drone for %d ms\n" : "Video from the drone is back\n", TELLOC_WATCHDOG_TIMEOUT);
+    }
+    health->state_lost = state_lost;
+    health->video_lost = video_lost;
+    pthread_mutex_unlock(&connection->command_mutex);
+}
 
-    // get the socket from the connection
-    int sock = connection->command_socket;
 
-    char buffer[1024];
-    char const* query = "battery?";
+// function to add a periodic callback
+int telloc_add_periodic(telloc_connection *connection, int period_ms, telloc_periodic_callback callback, void *user) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Periodic callback not added.\n");
+        printf("Call telloc_connect() before adding periodic callbacks.\n");
+        return -1;
+    }
+    if (period_ms <= 0 || callback == NULL) {
+        printf("Periodic callbacks need a callback and a period above 0 ms\n");
+        return -1;
+    }
 
-    // get current time using time.h
-    time_t last_keepalive_time = time(NULL);
+    unsigned long long period = (unsigned long long) period_ms * 1000000ULL;
+    pthread_mutex_lock(&connection->schedule_mutex);
+    int id = telloc_schedule_add(&connection->schedule, telloc_time() + period, period, callback, user);
+    pthread_mutex_unlock(&connection->schedule_mutex);
+    if (id == -1) {
+        printf("Too many periodic callbacks; Periodic callback not added.\n");
+        return -1;
+    }
 
-    // while alive, send keepalive
-    while (connection->alive) {
-        // send the keepalive command
-        // if time since last keepalive command is greater than 10 seconds, send the keepalive command
-        if (time(NULL) - last_keepalive_time > 10) {
-            telloc_send_command(connection, query, (unsigned int) strlen(query), buffer, sizeof(buffer));
-            last_keepalive_time = time(NULL);
-        }
-        // sleep for 5 ms
-        nanosleep((const struct timespec[]){{0, 5000000L}}, NULL);
+    // the thread may be asleep until a later deadline
+    telloc_event_signal(connection->schedule_wake);
+    return id;
+}
+
+
+// function to stop a periodic callback
+int telloc_remove_periodic(telloc_connection *connection, int id) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Periodic callback not removed.\n");
+        printf("Call telloc_connect() before removing periodic callbacks.\n");
+        return 1;
     }
 
-    close(sock);
+    // waits for the callback if it is running right now
+    pthread_mutex_lock(&connection->schedule_mutex);
+    int missing = telloc_schedule_remove_public(&connection->schedule, id);
+    pthread_mutex_unlock(&connection->schedule_mutex);
+    return missing;
+}
 
-    return NULL;
+
+// function to get what the periodic queries and watchdogs last found
+int telloc_get_health(telloc_connection *connection, telloc_health *health) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Health not read.\n");
+        printf("Call telloc_connect() before getting health.\n");
+        return 1;
+    }
+
+    telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+    *health = connection->health;
+    pthread_mutex_unlock(&connection->command_mutex);
+    return 0;
 }
 
 
@@ -332,9 +1830,99 @@ int telloc_bind_udp_socket(int *sock, const char* address, unsigned short port)
 }
 
 
-// function to connect to the Tello drone on a specified interface address
-telloc_connection * telloc_connect_interface(const char *interface_address) {
-    printf("Connecting to Tello on interface %s\n", interface_address);
+// function to get the local port a socket is bound to, e.g. the one the system picked for port 0
+unsigned short telloc_socket_port(int sock) {
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    if (getsockname(sock, (struct sockaddr *) &addr, &length) == -1) {
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+
+// function to size the video socket's receive buffer, and turn on drop reporting and busy polling
+int telloc_setup_video_socket(telloc_connection *connection, const telloc_receive_config *config) {
+    int sock = connection->video_socket;
+
+    if (config->buffer_size > 0) {
+        int size = config->buffer_size;
+        if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+            printf("Error setting video receive buffer: %d\n", errno);
+        }
+    }
+    // Linux reports twice the usable size; it is capped by net.core.rmem_max unless we are privileged
+    int granted = 0;
+    socklen_t granted_length = sizeof(granted);
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &granted, &granted_length);
+    if (config->buffer_size > 0 && granted / 2 < config->buffer_size) {
+        int size = config->buffer_size;
+        if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == 0) {
+            getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &granted, &granted_length);
+        } else {
+            printf("Video receive buffer capped at %d bytes; raise net.core.rmem_max for more\n", granted / 2);
+        }
+    }
+    connection->receive_stats.buffer_size = granted / 2;
+
+    int enable = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) < 0) {
+        printf("Error enabling dropped datagram counter: %d\n", errno);
+    }
+
+    if (config->busy_poll > 0) {
+        int busy_poll = config->busy_poll;
+        if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) < 0) {
+            printf("Error enabling busy polling: %d\n", errno);
+        }
+    }
+
+    return 0;
+}
+
+
+// function to fill a config with the defaults used by telloc_connect
+void telloc_config_default(telloc_config *config) {
+    config->interface_address = "0.0.0.0";
+    config->drone_address = TELLOC_ADDRESS;
+    // the ports the Tello sends to out of the box; a swarm gives each connection its own, or 0 for any free ones
+    config->ports.command = TELLOC_COMMAND_PORT;
+    config->ports.state = TELLOC_STATE_PORT;
+    config->ports.video = TELLOC_VIDEO_PORT;
+    // a single decoder thread with low delay flags, the lowest latency for the single slice Tello stream
+    config->video.thread_count = 1;
+    config->video.threading = TELLOC_THREADING_SLICE;
+    config->video.low_delay = 1;
+    config->video.format = TELLOC_FORMAT_RGB24;
+    // a 960x720 frame converts in well under a millisecond on one core; more threads pay off on slow multicore boards
+    config->video.convert_threads = 1;
+    // room for a few keyframe bursts; the Tello sends keyframes as dozens of datagrams at once
+    config->receive.buffer_size = 1024 * 1024;
+    config->receive.busy_poll = 0;
+    // smooth enough to fly by, and the drone stops within half a second of the pilot letting go
+    config->rc.rate = 20;
+    config->rc.stale_ms = 500;
+    // a live connection; set a recording's path to replay it instead
+    config->replay.path = NULL;
+    config->replay.pace = TELLOC_REPLAY_REALTIME;
+}
+
+
+// function to connect to a Tello drone with the given options
+telloc_connection * telloc_connect_config(const telloc_config *config) {
+    // connecting waits for the drone's replies, which only the reactor delivers
+    if (telloc_on_reactor) {
+        printf("Can't connect from the I/O thread; Connection not made.\n");
+        return NULL;
+    }
+    const char *interface_address = config->interface_address;
+    const char *drone_address = config->drone_address;
+    int replaying = config->replay.path != NULL;
+    if (replaying) {
+        printf("Replaying %s\n", config->replay.path);
+    } else {
+        printf("Connecting to Tello at %s on interface %s\n", drone_address, interface_address);
+    }
 
     // allocate a connection pointer
     telloc_connection *connection = malloc(sizeof(telloc_connection));
@@ -343,59 +1931,134 @@ telloc_connection * telloc_connect_interface(const char *interface_address) {
         return NULL;
     }
 
+    // every connection shares the reactor thread and the decoder workers
+    if (telloc_reactor_acquire() != 0) {
+        free(connection);
+        return NULL;
+    }
+
     // set the connection's alive flag to 0 to stop any threads
     connection->alive = 0;
+    for (int kind = 0; kind < TELLOC_SOURCE_COUNT; kind++) {
+        connection->sources[kind].fd = -1;
+    }
+    connection->command_wake = -1;
+    connection->command_timer = -1;
+    connection->command_deadline = 0;
+    memset(&connection->receive_stats, 0, sizeof(connection->receive_stats));
+    telloc_metrics_init(&connection->metrics);
+    connection->trace_id = telloc_trace_connection();
+    connection->video_time = 0;
+    connection->replaying = replaying;
+    connection->replay_pace = config->replay.pace;
+    memset(&connection->replay_stats, 0, sizeof(connection->replay_stats));
+    telloc_video_unit_queue_init(&connection->decode_queue);
+    connection->decode_scheduled = 0;
+    connection->decode_closing = 0;
+    connection->decode_next = NULL;
+    telloc_cond_init(&connection->decode_cond);
+
+    // commands are sent to the drone's command port
+    memset(&connection->drone_address, 0, sizeof(connection->drone_address));
+    connection->drone_address.sin_family = AF_INET;
+    connection->drone_address.sin_port = htons(TELLOC_COMMAND_PORT);
+    connection->drone_address.sin_addr.s_addr = inet_addr(drone_address);
 
     // create sockets
-    int command_sock = 0;
-    int state_sock = 0;
-    int video_sock = 0;
+    int command_sock = -1;
+    int state_sock = -1;
+    int video_sock = -1;
 
-    // create the command mutex (only one command can be sent at a time)
+    // create the command mutex, guarding the command queue
     connection->command_mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
-    // bind the command socket to our interface and port
-    if (telloc_bind_udp_socket(&command_sock, interface_address, TELLOC_COMMAND_PORT) != 0) {
-        goto error;
-    }
+    telloc_command_queue_init(&connection->command_queue);
+    telloc_rc_init(&connection->rc, &config->rc);
+    memset(&connection->health, 0, sizeof(connection->health));
+    connection->health.battery = -1;
+    connection->health.wifi_snr = -1;
+    telloc_cond_init(&connection->command_cond);
+
+    // a replay reads the recording instead of binding sockets, and has no drone to send commands to
+    if (replaying) {
+        if (telloc_replay_open(&connection->replay, config->replay.path) != 0) {
+            goto error;
+        }
+        connection->alive = 1;
+        connection->command_socket = -1;
+        connection->state_socket = -1;
+        connection->video_socket = -1;
+    } else {
+        // bind the command socket to our interface and port
+        if (telloc_bind_udp_socket(&command_sock, interface_address, (unsigned short) config->ports.command) != 0) {
+            goto error;
+        }
 
-    // bind the state socket to our interface and port
-    if (telloc_bind_udp_socket(&state_sock, interface_address, TELLOC_STATE_PORT) != 0) {
-        goto error;
-    }
+        // bind the state socket to our interface and port
+        if (telloc_bind_udp_socket(&state_sock, interface_address, (unsigned short) config->ports.state) != 0) {
+            goto error;
+        }
 
-    // bind the video socket to our interface and port
-    if (telloc_bind_udp_socket(&video_sock, interface_address, TELLOC_VIDEO_PORT) != 0) {
-        goto error;
-    }
+        // bind the video socket to our interface and port
+        if (telloc_bind_udp_socket(&video_sock, interface_address, (unsigned short) config->ports.video) != 0) {
+            goto error;
+        }
 
 
-    // set the connection's sockets
-    connection->alive = 1;
-    connection->command_socket = command_sock;
-    connection->state_socket = state_sock;
-    connection->video_socket = video_sock;
+        // set the connection's sockets
+        connection->alive = 1;
+        connection->command_socket = command_sock;
+        connection->state_socket = state_sock;
+        connection->video_socket = video_sock;
+        if (telloc_setup_video_socket(connection, &config->receive) != 0) {
+            goto error;
+        }
 
-    // Send a command and get a response. This is to initialize the connection.
-    // set the socket timeout to TELLOC_RESPONSE_TIMEOUT milliseconds
-    struct timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = TELLOC_RESPONSE_TIMEOUT * 1000;
-    if (setsockopt(command_sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) < 0) {
-        printf("Error setting socket timeout\n");
-        goto error;
+        // hand the command socket to the reactor, which sends every command from here on
+        connection->command_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        connection->command_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (connection->command_wake == -1 || connection->command_timer == -1) {
+            printf("Error creating command wake event: %d\n", errno);
+            goto error;
+        }
+        if (telloc_reactor_add(connection, TELLOC_SOURCE_COMMAND, command_sock) != 0
+            || telloc_reactor_add(connection, TELLOC_SOURCE_COMMAND_WAKE, connection->command_wake) != 0
+            || telloc_reactor_add(connection, TELLOC_SOURCE_COMMAND_TIMER, connection->command_timer) != 0) {
+            goto error;
+        }
+
+        // Send a command and get a response. This is to initialize the connection.
+        // send connection command
+        char command[] = "command";
+        char response[1024];
+        printf("Sending command: %s\n", command);
+        if (telloc_send_command(connection, command, (unsigned int) strlen(command), response, 1024) != 0) {
+            goto error;
+        }
+        printf("Response: %s\n", response);
+
+        // drones sharing a network can't all send to the default ports, so tell this one where to send its state and video
+        unsigned short state_port = telloc_socket_port(state_sock);
+        unsigned short video_port = telloc_socket_port(video_sock);
+        if (state_port != TELLOC_STATE_PORT || video_port != TELLOC_VIDEO_PORT) {
+            char port_command[32];
+            snprintf(port_command, sizeof(port_command), "port %d %d", state_port, video_port);
+            printf("Sending command: %s\n", port_command);
+            if (telloc_send_command(connection, port_command, (unsigned int) strlen(port_command), response, 1024) != 0) {
+                goto error;
+            }
+            if (strncmp(response, "ok", 2) != 0) {
+                printf("Drone did not take the ports: %s\n", response);
+                goto error;
+            }
+        }
     }
 
-    // send connection command
-    char command[] = "command";
-    char response[1024];
-    printf("Sending command: %s\n", command);
-    if (telloc_send_command(connection, command, (unsigned int) strlen(command), response, 1024) != 0) {
+    // initialize the video decoder and the access unit reassembler in front of it
+    if (telloc_video_decoder_init(&connection->video_decoder, &config->video) != 0) {
+        telloc_video_decoder_free(&connection->video_decoder);
         goto error;
     }
-    printf("Response: %s\n", response);
-
-    // initialize the video decoder
-    if (telloc_video_decoder_init(&connection->video_decoder) != 0) {
+    if (telloc_video_reassembler_init(&connection->video_reassembler) != 0) {
         telloc_video_decoder_free(&connection->video_decoder);
         goto error;
     }
@@ -404,23 +2067,86 @@ telloc_connection * telloc_connect_interface(const char *interface_address) {
     connection->state_mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
     connection->state_buffer = malloc(TELLOC_STATE_SIZE);
     connection->state_size = 0;
+    memset(&connection->state_latest, 0, sizeof(connection->state_latest));
+    connection->state_history.written = 0;
+    connection->state_samples = 0;
+    telloc_cond_init(&connection->state_cond);
+    connection->state_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 
     connection->video_mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
-    connection->video_buffer = malloc(TELLOC_VIDEO_SIZE);
-    connection->video_size = 0;
+    connection->record_mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    memset(&connection->recorder, 0, sizeof(connection->recorder));
+    telloc_cond_init(&connection->frame_cond);
+    connection->frame_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (telloc_frame_pool_init(&connection->frame_pool, config->video.format) != 0) {
+        printf("Error allocating frame pool memory\n");
+        telloc_video_decoder_free(&connection->video_decoder);
+        telloc_video_reassembler_free(&connection->video_reassembler);
+        free(connection->state_buffer);
+        close(connection->state_event);
+        close(connection->frame_event);
+        goto error;
+    }
 
-    // start the video, state, and keepalive threads using unix threading functionality
-    pthread_create(&connection->video_thread, NULL, thread_video, connection);
-    pthread_create(&connection->state_thread, NULL, thread_state, connection);
-    pthread_create(&connection->keepalive_thread, NULL, thread_keepalive, connection);
+    // the schedule lock is recursive so periodic callbacks can add and remove periodic callbacks
+    pthread_mutexattr_t schedule_attr;
+    pthread_mutexattr_init(&schedule_attr);
+    pthread_mutexattr_settype(&schedule_attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&connection->schedule_mutex, &schedule_attr);
+    pthread_mutexattr_destroy(&schedule_attr);
+    connection->schedule_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    connection->schedule_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    // the queries start a second in so telloc_get_health fills in soon
+    telloc_schedule_init(&connection->schedule);
+    if (!replaying) {
+        unsigned long long now = telloc_time();
+        telloc_schedule_add(&connection->schedule, now + 1000000000ULL, TELLOC_KEEPALIVE_PERIOD * 1000000ULL, telloc_task_battery, NULL);
+        telloc_schedule_add(&connection->schedule, now + 1000000000ULL, TELLOC_WIFI_PERIOD * 1000000ULL, telloc_task_wifi, NULL);
+        telloc_schedule_add(&connection->schedule, now + TELLOC_WATCHDOG_PERIOD * 1000000ULL, TELLOC_WATCHDOG_PERIOD * 1000000ULL, telloc_task_watchdog, NULL);
+    }
+    // the keepalive and watchdogs are not the caller's to remove
+    telloc_schedule_reserve(&connection->schedule);
+
+    // start the conversion helpers, then have the reactor receive state and video, and start the scheduler thread;
+    // a replay thread stands in for the state and video sockets
+    telloc_convert_pool_start(connection, connection->video_decoder.config.convert_threads);
+    if (replaying) {
+        pthread_create(&connection->replay_thread, NULL, thread_replay, connection);
+    } else {
+        telloc_reactor_add(connection, TELLOC_SOURCE_STATE, state_sock);
+        telloc_reactor_add(connection, TELLOC_SOURCE_VIDEO, video_sock);
+    }
+    pthread_create(&connection->schedule_thread, NULL, thread_schedule, connection);
 
     return connection;
 
 error:
+    // take the sockets away from the reactor before they go; commands still queued are never sent
+    connection->alive = 0;
+    telloc_reactor_remove(connection);
+    telloc_command_queue_cancel(&connection->command_queue);
+    telloc_reactor_release();
+    if (connection->command_wake != -1) {
+        close(connection->command_wake);
+    }
+    if (connection->command_timer != -1) {
+        close(connection->command_timer);
+    }
+    if (replaying) {
+        telloc_replay_close(&connection->replay);
+    }
+
     // close the sockets
-    close(command_sock);
-    close(state_sock);
-    close(video_sock);
+    if (command_sock != -1) {
+        close(command_sock);
+    }
+    if (state_sock != -1) {
+        close(state_sock);
+    }
+    if (video_sock != -1) {
+        close(video_sock);
+    }
+    pthread_cond_destroy(&connection->decode_cond);
 
     // free the connection
     free(connection);
@@ -430,6 +2156,32 @@ error:
 }
 
 
+// function to connect to a Tello drone at drone_address on a specified interface address
+telloc_connection * telloc_connect_address(const char *interface_address, const char *drone_address) {
+    telloc_config config;
+    telloc_config_default(&config);
+    config.interface_address = interface_address;
+    config.drone_address = drone_address;
+    return telloc_connect_config(&config);
+}
+
+
+// function to replay a recording as if it came from a drone
+telloc_connection * telloc_connect_replay(const char *path, telloc_replay_pace pace) {
+    telloc_config config;
+    telloc_config_default(&config);
+    config.replay.path = path;
+    config.replay.pace = pace;
+    return telloc_connect_config(&config);
+}
+
+
+// function to connect to the Tello drone on a specified interface address
+telloc_connection * telloc_connect_interface(const char *interface_address) {
+    return telloc_connect_address(interface_address, TELLOC_ADDRESS);
+}
+
+
 // function to connect to the Tello drone
 telloc_connection * telloc_connect(void) {
     return telloc_connect_interface("0.0.0.0");
@@ -438,67 +2190,33 @@ telloc_connection * telloc_connect(void) {
 
 // function to send a command to the drone
 int telloc_send_command(telloc_connection *connection, const char* command, unsigned int length, char* response, unsigned int response_length) {
-    // check if the command socket is open
-    if (connection == NULL || !connection->alive) {
-        printf("Connection not initialized; Command not sent.\n");
-        printf("Call telloc_connect() before sending commands.\n");
+    // only the reactor could deliver the reply, so a command callback waiting for one would wait forever
+    if (telloc_on_reactor) {
+        printf("Can't wait for a reply on the I/O thread; Command not sent.\n");
+        printf("Call telloc_send_command_async() from command callbacks.\n");
         return 1;
     }
-
-    if(length > 1024) {
-        printf("Command too long; Command not sent.\n");
+    // queue it like any other command and wait; the reactor gives up after the command's default timeout
+    telloc_command *queued = telloc_send_command_async(connection, command, length, TELLOC_PRIORITY_NORMAL, -1, NULL, NULL);
+    if (queued == NULL) {
         return 1;
     }
-
-    // acquire the command mutex
-    pthread_mutex_lock(&connection->command_mutex);
-
-    // get the socket from the connection
-    int sock = connection->command_socket;
-
-    // send the command to the drone on the command socket port 8889, ip address 192.168.10.1
-    // uses UNIX posx api functions for sending data over UDP
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(TELLOC_COMMAND_PORT);
-    addr.sin_addr.s_addr = inet_addr(TELLOC_ADDRESS);
-    int bytes_sent = (int) sendto(sock, command, length, 0, (struct sockaddr*) &addr, sizeof(addr));
-    if (bytes_sent == -1) {
-        printf("Command not sent: %d\n", errno);
-        goto error;
-    }
-
-    // recieve a response from the drone on port 8889
-    char response_buffer[256];
-    int bytes_recieved = (int) recvfrom(sock, response_buffer, sizeof(response_buffer), 0, NULL, NULL);
-    if (bytes_recieved == -1) {
-        printf("Response timeout: %d\n", errno);
-        goto error;
+    telloc_command_status status = telloc_command_wait(connection, queued, -1);
+    if (status == TELLOC_COMMAND_TIMEOUT) {
+        printf("Response timeout\n");
+    } else if (status == TELLOC_COMMAND_CANCELLED) {
+        printf("Command cancelled\n");
     }
 
     // Check if the response is null
-    if (response != NULL) {
+    if (response != NULL && status == TELLOC_COMMAND_DONE) {
         // zero out the response string
         memset(response, 0, response_length);
-        // copy the response buffer into the response string with memcpy
-        memcpy(response, response_buffer, bytes_recieved);
+        telloc_command_response(connection, queued, response, response_length);
     }
 
-    // flush the udp socket
-    // this is to prevent the socket from filling up with old data
-    char flush[1024];
-    while (recvfrom(sock, flush, sizeof(flush), 0, NULL, NULL) > 0);
-
-    // release the command mutex
-    pthread_mutex_unlock(&connection->command_mutex);
-
-    return 0;
-
-error:
-    // release the command mutex
-    pthread_mutex_unlock(&connection->command_mutex);
-
-    return 1;
+    telloc_command_release(connection, queued);
+    return status != TELLOC_COMMAND_DONE;
 }
 
 
@@ -510,31 +2228,96 @@ int telloc_disconnect(telloc_connection *connection) {
         printf("Call telloc_connect() before disconnecting.\n");
         return 1;
     }
+    // the threads running its callbacks would be joined from themselves, and return into the freed connection
+    if ((connection->reporting > 0 && pthread_equal(pthread_self(), telloc_shared_reactor.thread))
+        || pthread_equal(pthread_self(), connection->schedule_thread)) {
+        printf("A connection can't be disconnected from its own callbacks; Disconnect not completed.\n");
+        return 1;
+    }
 
     // set the connection's alive flag to 0 to stop any threads
     connection->alive = 0;
 
+    // once the reactor lets go of the sockets nothing is received or sent for this drone any more
+    if (!connection->replaying) {
+        telloc_reactor_remove(connection);
+    }
+
+    // the reactor no longer finishes this connection's commands, so cancel them now; a periodic callback or another thread
+    // waiting in telloc_send_command would otherwise keep the scheduler thread from being joined
+    telloc_lock(connection, &connection->command_mutex, "command_mutex wait");
+    telloc_command_queue_cancel(&connection->command_queue);
+    telloc_report_commands(connection);
+    pthread_cond_broadcast(&connection->command_cond);
+    pthread_mutex_unlock(&connection->command_mutex);
+
+    // wake the scheduler thread out of poll, a replay waiting for the decoder, and anyone waiting for frames or state
+    telloc_event_signal(connection->schedule_wake);
+    pthread_mutex_lock(&telloc_shared_reactor.decode_mutex);
+    pthread_cond_broadcast(&connection->decode_cond);
+    pthread_mutex_unlock(&telloc_shared_reactor.decode_mutex);
+    telloc_lock(connection, &connection->video_mutex, "video_mutex wait");
+    pthread_cond_broadcast(&connection->frame_cond);
+    pthread_mutex_unlock(&connection->video_mutex);
+    pthread_mutex_lock(&connection->state_mutex);
+    pthread_cond_broadcast(&connection->state_cond);
+    pthread_mutex_unlock(&connection->state_mutex);
+
     // WAIT FOR THREADS TO EXIT; use pthread_join() for unix
-    pthread_join(connection->video_thread, NULL);
-    pthread_join(connection->state_thread, NULL);
-    pthread_join(connection->keepalive_thread, NULL);
+    if (connection->replaying) {
+        pthread_join(connection->replay_thread, NULL);
+    }
+    pthread_join(connection->schedule_thread, NULL);
 
-    // close the sockets
-    close(connection->command_socket);
-    close(connection->state_socket);
-    close(connection->video_socket);
+    // let a worker decoding one of our units finish; the units still queued are dropped
+    pthread_mutex_lock(&telloc_shared_reactor.decode_mutex);
+    connection->decode_closing = 1;
+    while (connection->decode_scheduled) {
+        pthread_cond_wait(&connection->decode_cond, &telloc_shared_reactor.decode_mutex);
+    }
+    pthread_mutex_unlock(&telloc_shared_reactor.decode_mutex);
+    telloc_convert_pool_stop(connection);
+    telloc_reactor_release();
+
+    // close the sockets, or the recording of a replay
+    if (connection->replaying) {
+        telloc_replay_close(&connection->replay);
+    } else {
+        close(connection->command_socket);
+        close(connection->state_socket);
+        close(connection->video_socket);
+        close(connection->command_wake);
+        close(connection->command_timer);
+    }
+    close(connection->frame_event);
+    close(connection->state_event);
+    close(connection->schedule_timer);
+    close(connection->schedule_wake);
 
-    // free the state and video buffers
+    // free the state buffer and the frame pool
     free(connection->state_buffer);
-    free(connection->video_buffer);
+    telloc_frame_pool_free(&connection->frame_pool);
 
     // close the state and video mutexes
     pthread_mutex_destroy(&connection->state_mutex);
     pthread_mutex_destroy(&connection->video_mutex);
     pthread_mutex_destroy(&connection->command_mutex);
+    pthread_mutex_destroy(&connection->schedule_mutex);
+    pthread_cond_destroy(&connection->state_cond);
+    pthread_cond_destroy(&connection->frame_cond);
+    pthread_cond_destroy(&connection->command_cond);
+    pthread_cond_destroy(&connection->decode_cond);
+
+    // finish a recording left running, now that nothing receives video for it
+    if (connection->recorder.stats.recording) {
+        telloc_recorder_close(&connection->recorder);
+    }
+    pthread_mutex_destroy(&connection->record_mutex);
 
     // unititialize the video decoder
     telloc_video_decoder_free(&connection->video_decoder);
+    telloc_video_reassembler_free(&connection->video_reassembler);
+    telloc_video_unit_queue_free(&connection->decode_queue);
 
     // free the connection
     free(connection);
@@ -8,293 +8,1732 @@
 #include <winsock2.h>
 #include <process.h>
 #include "video.h"
+#include "state.h"
+#include "command.h"
+#include "schedule.h"
+#include "record.h"
+#include "replay.h"
+#include "stats.h"
+#include "trace.h"
+
+// the largest datagram UDP carries
+#define TELLOC_DATAGRAM_SIZE 65507
+// handles the reactor waits on for each connection: its command, state and video socket events
+#define TELLOC_REACTOR_HANDLES 3
+// WaitForMultipleObjects takes at most MAXIMUM_WAIT_OBJECTS (64) handles and one is the reactor's wake event,
+// so a process can fly up to 21 drones
+#define TELLOC_REACTOR_CONNECTIONS ((MAXIMUM_WAIT_OBJECTS - 1) / TELLOC_REACTOR_HANDLES)
+// decoder workers at most, however many cores there are
+#define TELLOC_DECODE_WORKERS_MAX 64
+
+#ifdef _MSC_VER
+#define TELLOC_THREAD_LOCAL __declspec(thread)
+#else
+#define TELLOC_THREAD_LOCAL __thread
+#endif
+
+// the socket events of a connection the reactor waits on
+typedef enum {
+    TELLOC_SOURCE_COMMAND = 0,
+    TELLOC_SOURCE_STATE = 1,
+    TELLOC_SOURCE_VIDEO = 2
+} telloc_source_kind;
+
+// the I/O thread and decoder workers every connection in the process shares, so a swarm of drones costs no more threads
+// than one. Windows has no epoll, so the reactor thread sleeps in one WaitForMultipleObjects on every connection's
+// socket events, and receives, reassembles and sends for all of them; complete access units go to the decoder workers
+typedef struct {
+    // guards users and starting and stopping the threads. a Windows mutex has no static initializer, so the first
+    // connection creates it
+    HANDLE volatile mutex;
+    unsigned int users;
+    // auto reset event that wakes the reactor when a connection comes or goes, a command is queued, or to stop
+    HANDLE wake;
+    int alive;
+    HANDLE thread;
+    // held while the reactor handles connections and released while it waits. Windows mutexes are recursive, so
+    // command callbacks on the reactor thread can disconnect other drones
+    HANDLE dispatch_mutex;
+    // the connections served, guarded by the dispatch mutex
+    telloc_connection *connections[TELLOC_REACTOR_CONNECTIONS];
+    unsigned int count;
+    // counts removals. the reactor notes the count its handles were gathered at, and a removed connection's handles
+    // can't be closed while the reactor may still be waiting on them
+    unsigned long long removals;
+    unsigned long long waited_removals;
+    int waiting;
+    // manual reset event set each time the reactor comes back from waiting
+    HANDLE resumed;
+
+    // connections with units to decode that no worker has taken yet, oldest first, linked through decode_next.
+    // the semaphore counts them, and is released once per worker to stop the workers
+    HANDLE decode_mutex;
+    HANDLE decode_ready;
+    telloc_connection *ready_head;
+    telloc_connection *ready_tail;
+    int decode_stopping;
+    // a worker per connection up to one per core
+    unsigned int workers;
+    unsigned int cores;
+    HANDLE worker_threads[TELLOC_DECODE_WORKERS_MAX];
+} telloc_reactor;
+
+static telloc_reactor telloc_shared_reactor;
+
+// set on the reactor thread. only it finishes commands, so nothing running on it may wait for a reply
+static TELLOC_THREAD_LOCAL int telloc_on_reactor = 0;
+
+// helper threads that each convert a band of a frame while the reader converting it does the first band
+struct telloc_convert_pool_ {
+    // one conversion at a time; readers holding different frames can convert at once
+    HANDLE run_mutex;
+    // an auto-reset event per helper to hand it a job, and one the last helper to finish sets
+    HANDLE start[TELLOC_CONVERT_THREADS_MAX];
+    HANDLE done;
+    const telloc_convert_job* job;
+    volatile LONG pending;
+    volatile int stopping;
+    unsigned int helpers;
+    HANDLE threads[TELLOC_CONVERT_THREADS_MAX];
+};
+
+// a helper's pool and which band it converts
+typedef struct {
+    telloc_convert_pool* pool;
+    unsigned int band;
+} telloc_convert_helper;
 
 struct telloc_connection_ {
     // thread synchronization
     unsigned alive;
 
-    // Tello command data socket
+    // Tello command data socket and the drone's command address
     SOCKET command_socket;
+    struct sockaddr_in drone_address;
     HANDLE command_mutex;
+    // commands waiting to be sent or for their reply; the reactor does all command I/O
+    telloc_command_queue command_queue;
+    // manual reset events, one per queue slot, set once the slot's command finishes
+    HANDLE command_done[TELLOC_COMMAND_QUEUE_SIZE];
+    // set when a command is queued, the sticks move or a reply arrives, so the reactor services the commands next time round
+    volatile LONG command_wake;
+    // when the reactor must service the commands again, for the next reply timeout or rc send; 0 for never
+    unsigned long long command_deadline;
+    // event the command socket sets when a reply arrives
+    WSAEVENT command_reply;
+    // the sticks the reactor keeps sending
+    telloc_rc_channel rc;
+    // what the periodic queries and watchdogs found; guarded by the command mutex
+    telloc_health health;
+
+    // periodic tasks (keepalive and queries, watchdogs, user callbacks), run by the scheduler thread
+    // with the schedule mutex held; Windows mutexes are recursive, so tasks can add and remove tasks
+    HANDLE schedule_mutex;
+    telloc_schedule schedule;
+    // auto reset event that wakes the scheduler thread when the schedule changes
+    HANDLE schedule_wake;
+
+    // set once the reactor also waits on the state and video sockets; guarded by the reactor's dispatch mutex
+    int receiving;
 
     // Tello state data
     SOCKET state_socket;
+    // event the state socket sets when a datagram arrives
+    WSAEVENT state_ready;
     HANDLE state_mutex;
     char* state_buffer;
     unsigned state_size;
+    // the latest state, parsed
+    telloc_state_seqlock state_latest;
+    // the parsed states received lately, for looking back in time
+    telloc_state_history state_history;
+    unsigned long long state_samples;
+    // manual reset event, set while unread state is waiting
+    HANDLE state_event;
 
     // Tello video data
     SOCKET video_socket;
+    // event the video socket sets when a datagram arrives
+    WSAEVENT video_ready;
     HANDLE video_mutex;
-    char* video_buffer;
-    unsigned video_size;
+    // manual reset event, set while an unread frame is waiting
+    HANDLE frame_event;
+    telloc_receive_stats receive_stats;
+    // counters and stage latencies, updated without locks by whichever thread gets there
+    telloc_metrics metrics;
+    // tells the connection's trace events and Prometheus series from those of other connections
+    unsigned int trace_id;
+
+    // the recording the reactor writes access units to before they are decoded
+    HANDLE record_mutex;
+    telloc_recorder recorder;
+
+    // set on connections made with telloc_connect_replay; the replay thread feeds the recording in place
+    // of the sockets, and the reactor serves nothing for it
+    int replaying;
+    telloc_replay replay;
+    telloc_replay_pace replay_pace;
+    // guarded by the video mutex
+    telloc_replay_stats replay_stats;
+    // when the last video datagram arrived
+    unsigned long long video_time;
+    telloc_frame_pool frame_pool;
+    telloc_video_reassembler video_reassembler;
     telloc_video_decoder video_decoder;
+    // access units waiting for a decoder worker; guarded by the reactor's decode mutex
+    telloc_video_unit_queue decode_queue;
+    // set while the connection is waiting for a worker or being decoded, so only one worker decodes it at a time
+    int decode_scheduled;
+    // set when disconnecting; the worker drops what is left
+    int decode_closing;
+    telloc_connection *decode_next;
+    // manual reset event set when a worker finishes one of the connection's units
+    HANDLE decode_event;
+    // the threads frames are converted over, and the band each helper converts
+    telloc_convert_pool convert_pool;
+    telloc_convert_helper convert_helpers[TELLOC_CONVERT_THREADS_MAX];
 
     // Threads
-    HANDLE state_thread;
-    HANDLE video_thread;
-    HANDLE keepalive_thread;
+    HANDLE schedule_thread;
+    // counts the command callbacks of this connection running right now, so one can't disconnect the connection under itself
+    int reporting;
+    HANDLE replay_thread;
 };
 
 
-// thread function to recieve state data from a UDP socket.
-// this function is run in a thread
+// function to parse, record and hand out a state datagram received at time
+void telloc_handle_state(telloc_connection *connection, const char *buffer, unsigned int length, unsigned long long time) {
+    telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_STATE_PACKETS, 1);
+
+    // parse the state once here, so readers get typed values without locking or parsing
+    telloc_state state;
+    if (telloc_state_parse(buffer, length, &state) == 0) {
+        state.sequence = ++connection->state_samples;
+        state.received_time = time;
+        telloc_state_publish(&connection->state_latest, &state);
+        telloc_state_history_push(&connection->state_history, &state);
+    }
+
+    WaitForSingleObject(connection->record_mutex, INFINITE);
+    if (connection->recorder.stats.recording) {
+        telloc_recorder_write_state(&connection->recorder, buffer, length, time);
+    }
+    ReleaseMutex(connection->record_mutex);
+
+    // Windows acquire handle to the mutex
+    WaitForSingleObject(connection->state_mutex, INFINITE);
+
+    // copy the data string to the state buffer with memcpy_s
+    memcpy_s(connection->state_buffer, TELLOC_STATE_SIZE, buffer, length);
+    connection->state_size = length;
+    SetEvent(connection->state_event);
+
+    // release the mutex
+    ReleaseMutex(connection->state_mutex);
+}
+
+
+// function to take every state datagram waiting on a connection's socket; runs on the reactor thread
+void telloc_receive_state(telloc_connection *connection) {
+    // reset the event first; a datagram arriving after the last recv sets it again
+    WSAResetEvent(connection->state_ready);
+
+    // receive data on the socket, assume UDP max buffer size
+    char buffer[TELLOC_STATE_SIZE];
+    int bytes_received;
+    while ((bytes_received = recv(connection->state_socket, buffer, sizeof(buffer), 0)) != SOCKET_ERROR) {
+        telloc_handle_state(connection, buffer, (unsigned int) bytes_received, telloc_time());
+    }
+}
+
+
+// Function to return a copy of the most recent state data
 // argument: telloc_connection *connection
-unsigned __stdcall thread_state(void *arg) {
-    printf("State thread started\n");
+// argument: char *buffer
+// argument: unsigned buffer_size
+int telloc_read_state(telloc_connection *connection, char *state_buffer, unsigned state_buffer_length) {
+    // clear the state string
+    if (state_buffer_length > 0) {
+        state_buffer[0] = 0;
+    }
+
+    // check if the state socket is open
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State not recieved.\n");
+        printf("Call telloc_connect() before recieving state.\n");
+        return 1;
+    }
+
+    // Windows acquire handle to the mutex
+    WaitForSingleObject(connection->state_mutex, INFINITE);
+
+    // check if there is new state data
+    if (connection->state_size == 0) {
+        ReleaseMutex(connection->state_mutex);
+        return 1;
+    }
+
+    if (state_buffer_length < connection->state_size) {
+        printf("Buffer size too small to hold state data\n");
+        ReleaseMutex(connection->state_mutex);
+        return 1;
+    }
+
+    // copy the data to the connection's state buffer, terminated if there is room
+    memcpy(state_buffer, connection->state_buffer, connection->state_size);
+    if (connection->state_size < state_buffer_length) {
+        state_buffer[connection->state_size] = 0;
+    }
+    connection->state_size = 0;
+    ResetEvent(connection->state_event);
+
+    // release the mutex
+    ReleaseMutex(connection->state_mutex);
+
+    return 0;
+}
+
+
+// function to read the monotonic clock frame timestamps use, in nanoseconds
+unsigned long long telloc_time(void) {
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    // split the division so the multiplication cannot overflow
+    unsigned long long ticks = (unsigned long long) counter.QuadPart;
+    unsigned long long rate = (unsigned long long) frequency.QuadPart;
+    return ticks / rate * 1000000000ULL + ticks % rate * 1000000000ULL / rate;
+}
+
+
+// function to wait on an event until a timeout in milliseconds (-1 waits forever) passes.
+// returns 1 on timeout
+int telloc_wait_event(HANDLE event, int timeout_ms, ULONGLONG start) {
+    DWORD remaining = INFINITE;
+    if (timeout_ms >= 0) {
+        ULONGLONG elapsed = GetTickCount64() - start;
+        remaining = elapsed >= (ULONGLONG) timeout_ms ? 0 : (DWORD) (timeout_ms - elapsed);
+    }
+    return WaitForSingleObject(event, remaining) != WAIT_OBJECT_0;
+}
+
+
+// function to get the most recently parsed state without blocking
+int telloc_get_state(telloc_connection *connection, telloc_state *state) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State not recieved.\n");
+        printf("Call telloc_connect() before getting state.\n");
+        return 1;
+    }
+    return telloc_state_latest(&connection->state_latest, state);
+}
+
+// function to copy up to the last count parsed states, oldest first
+int telloc_get_state_history(telloc_connection *connection, telloc_state *samples, unsigned int count, unsigned int *copied) {
+    *copied = 0;
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State not received.\n");
+        printf("Call telloc_connect() before getting state.\n");
+        return 1;
+    }
+    *copied = telloc_state_history_last(&connection->state_history, samples, count);
+    return 0;
+}
+
+
+// function to copy the parsed states received in a time window, oldest first
+int telloc_get_state_window(telloc_connection *connection, unsigned long long start_time, unsigned long long end_time, telloc_state *samples, unsigned int capacity, unsigned int *copied) {
+    *copied = 0;
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State not received.\n");
+        printf("Call telloc_connect() before getting state.\n");
+        return 1;
+    }
+    *copied = telloc_state_history_window(&connection->state_history, start_time, end_time, samples, capacity);
+    return 0;
+}
+
+
+// function to estimate the state at a time from the parsed states around it
+int telloc_interpolate_state(telloc_connection *connection, unsigned long long time, telloc_state *state) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State not received.\n");
+        printf("Call telloc_connect() before getting state.\n");
+        return 1;
+    }
+    return telloc_state_history_interpolate(&connection->state_history, time, state);
+}
+
+
+// function to wait for state newer than the last read, then read it
+int telloc_wait_state(telloc_connection *connection, int timeout_ms, char *state_buffer, unsigned state_buffer_length) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; State not recieved.\n");
+        printf("Call telloc_connect() before waiting for state.\n");
+        return 1;
+    }
+
+    if (telloc_wait_event(connection->state_event, timeout_ms, GetTickCount64()) != 0) {
+        return 1;
+    }
+    return telloc_read_state(connection, state_buffer, state_buffer_length);
+}
+
+
+// function to get a file descriptor for unread state; Windows has none, use telloc_wait_state
+int telloc_get_state_fd(telloc_connection *connection) {
+    printf("State fd not supported on Windows; use telloc_wait_state.\n");
+    return -1;
+}
+
+
+// function to lock one of a connection's mutexes, tracing the wait under name when tracing is on and the wait was long
+void telloc_lock(telloc_connection *connection, HANDLE mutex, const char *name) {
+    if (!telloc_trace_on()) {
+        WaitForSingleObject(mutex, INFINITE);
+        return;
+    }
+    unsigned long long start = telloc_time();
+    WaitForSingleObject(mutex, INFINITE);
+    unsigned long long end = telloc_time();
+    if (end - start >= TELLOC_TRACE_WAIT_MIN) {
+        telloc_trace_span(name, connection->trace_id, start, end, NULL, 0);
+    }
+}
+
+
+// function to reference the decoder's latest picture from a free pool slot and make it the latest frame.
+// nothing is converted here; the first reader converts the frame, so frames replaced unread cost no conversion.
+void telloc_publish_frame(telloc_connection *connection) {
+    telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+    telloc_frame_slot *slot = telloc_frame_pool_take(&connection->frame_pool);
+    ReleaseMutex(connection->video_mutex);
+
+    // every slot is held by a consumer; drop this frame
+    if (slot == NULL) {
+        telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_FRAMES_DROPPED, 1);
+        return;
+    }
+
+    int converted = telloc_video_decoder_reference(&connection->video_decoder, slot) == 0;
+
+    telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+    if (converted) {
+        if (connection->frame_pool.latest_unread) {
+            telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_FRAMES_OVERWRITTEN, 1);
+        }
+        telloc_frame_pool_publish(&connection->frame_pool, slot);
+        SetEvent(connection->frame_event);
+    } else {
+        telloc_frame_pool_release(&connection->frame_pool, slot);
+    }
+    ReleaseMutex(connection->video_mutex);
+}
+
+
+// function to wait until a decoder worker finishes one of a connection's units, or the connection is disconnected.
+// the reactor's decode mutex must be held, and is held again on return
+void telloc_wait_decoded(telloc_connection *connection) {
+    HANDLE decode_mutex = telloc_shared_reactor.decode_mutex;
+    ResetEvent(connection->decode_event);
+    ReleaseMutex(decode_mutex);
+    WaitForSingleObject(connection->decode_event, INFINITE);
+    WaitForSingleObject(decode_mutex, INFINITE);
+}
+
+
+// function to queue an access unit for the decoder workers. the reactor never waits, so a drone whose decoding falls
+// behind drops units until its next keyframe; a replay waits for room instead
+void telloc_decode_unit(telloc_connection *connection, const telloc_video_unit *unit, int wait) {
+    telloc_reactor *reactor = &telloc_shared_reactor;
+    WaitForSingleObject(reactor->decode_mutex, INFINITE);
+    while (wait && connection->alive && connection->decode_queue.count == TELLOC_VIDEO_QUEUE_SIZE) {
+        telloc_wait_decoded(connection);
+    }
+    // line the connection up for a worker unless one already has it
+    if (telloc_video_unit_queue_push(&connection->decode_queue, unit) == 0 && !connection->decode_scheduled) {
+        connection->decode_scheduled = 1;
+        connection->decode_next = NULL;
+        if (reactor->ready_tail != NULL) {
+            reactor->ready_tail->decode_next = connection;
+        } else {
+            reactor->ready_head = connection;
+        }
+        reactor->ready_tail = connection;
+        ReleaseSemaphore(reactor->decode_ready, 1, NULL);
+    }
+    ReleaseMutex(reactor->decode_mutex);
+}
+
+
+// function to split received video data into access units, record them and queue each one for decoding as soon as it is complete
+void telloc_assemble_datagram(telloc_connection *connection, const unsigned char *data, unsigned int length, unsigned long long time, int wait) {
+    // only this thread touches the reassembler, so publish what it discarded through the lock-free counters
+    unsigned long discarded = connection->video_reassembler.units_discarded;
+    telloc_video_reassembler_push(&connection->video_reassembler, data, length, time);
+    if (connection->video_reassembler.units_discarded != discarded) {
+        telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_UNITS_DISCARDED, connection->video_reassembler.units_discarded - discarded);
+    }
+    telloc_video_unit unit;
+    while (telloc_video_reassembler_next(&connection->video_reassembler, &unit) == 0) {
+        telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_ASSEMBLY, unit.received_time, unit.assembled_time);
+
+        // record the unit exactly as it arrived; this only copies it into the file buffer
+        WaitForSingleObject(connection->record_mutex, INFINITE);
+        if (connection->recorder.stats.recording) {
+            telloc_recorder_write(&connection->recorder, &unit);
+        }
+        ReleaseMutex(connection->record_mutex);
+
+        telloc_decode_unit(connection, &unit, wait);
+    }
+}
+
+
+// thread to decode access units for any connection. a worker takes the connection that has waited longest, decodes one
+// of its units and puts it back in line if it has more, so drones take turns and each decoder is used by one worker at a time
+unsigned __stdcall thread_decode(void *arg) {
+    telloc_reactor *reactor = (telloc_reactor *) arg;
+    telloc_trace_thread("decoder");
+
+    while (1) {
+        // the semaphore counts the connections in line, plus one per worker when stopping
+        WaitForSingleObject(reactor->decode_ready, INFINITE);
+        WaitForSingleObject(reactor->decode_mutex, INFINITE);
+        telloc_connection *connection = reactor->ready_head;
+        if (connection == NULL) {
+            ReleaseMutex(reactor->decode_mutex);
+            break;
+        }
+        reactor->ready_head = connection->decode_next;
+        if (reactor->ready_head == NULL) {
+            reactor->ready_tail = NULL;
+        }
+
+        // the unit keeps its slot until it is popped, so it can be decoded without the lock
+        const telloc_video_unit *unit = telloc_video_unit_queue_peek(&connection->decode_queue);
+        if (unit != NULL && !connection->decode_closing) {
+            ReleaseMutex(reactor->decode_mutex);
+            telloc_video_decoder *decoder = &connection->video_decoder;
+            unsigned long long errors = decoder->errors;
+            unsigned long long start = telloc_trace_on() ? telloc_time() : 0;
+            unsigned long long frames = 0;
+            int ready = telloc_video_decoder_decode(decoder, unit) == 0;
+            while (ready) {
+                telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_FRAMES_DECODED, 1);
+                telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_DECODE, decoder->info.assembled_time, decoder->info.decoded_time);
+                if (start != 0) {
+                    telloc_trace_flow(TELLOC_TRACE_FLOW_START, connection->trace_id, decoder->info.sequence, decoder->info.decoded_time);
+                }
+                frames = decoder->info.sequence;
+                telloc_publish_frame(connection);
+                ready = telloc_video_decoder_receive(decoder) == 0;
+            }
+            if (decoder->errors != errors) {
+                telloc_metrics_count(&connection->metrics, TELLOC_COUNTER_DECODE_ERRORS, decoder->errors - errors);
+            }
+            if (start != 0) {
+                telloc_trace_span("decode", connection->trace_id, start, telloc_time(), "frame", frames);
+            }
+            WaitForSingleObject(reactor->decode_mutex, INFINITE);
+            telloc_video_unit_queue_pop(&connection->decode_queue);
+        }
+
+        // a closing connection's units are never decoded
+        while (connection->decode_closing && connection->decode_queue.count > 0) {
+            telloc_video_unit_queue_pop(&connection->decode_queue);
+        }
+        if (connection->decode_queue.count > 0) {
+            connection->decode_next = NULL;
+            if (reactor->ready_tail != NULL) {
+                reactor->ready_tail->decode_next = connection;
+            } else {
+                reactor->ready_head = connection;
+            }
+            reactor->ready_tail = connection;
+            ReleaseSemaphore(reactor->decode_ready, 1, NULL);
+        } else {
+            connection->decode_scheduled = 0;
+        }
+        SetEvent(connection->decode_event);
+        ReleaseMutex(reactor->decode_mutex);
+    }
+
+    telloc_trace_thread_exit();
+    return 0;
+}
+
+
+// function to take every video datagram waiting on a connection's socket; runs on the reactor thread.
+// buffer holds TELLOC_DATAGRAM_SIZE bytes
+void telloc_receive_video(telloc_connection *connection, char *buffer) {
+    // reset the event first; a datagram arriving after the last recvfrom sets it again
+    WSAResetEvent(connection->video_ready);
+
+    // Windows has no batched receive or drop counter; a batch is whatever was waiting when the socket signalled
+    unsigned long received = 0;
+    unsigned long bytes = 0;
+    unsigned long truncated = 0;
+    unsigned long long time = telloc_time();
+    while (1) {
+        int bytes_received = recvfrom(connection->video_socket, buffer, TELLOC_DATAGRAM_SIZE, 0, NULL, NULL);
+        if (bytes_received == SOCKET_ERROR) {
+            // a datagram too large for the buffer still delivers its head
+            if (WSAGetLastError() != WSAEMSGSIZE) {
+                if (WSAGetLastError() != WSAEWOULDBLOCK) {
+                    printf("Error receiving data: %d\n", WSAGetLastError());
+                }
+                break;
+            }
+            bytes_received = TELLOC_DATAGRAM_SIZE;
+            truncated++;
+        }
+        received++;
+        bytes += bytes_received;
+        telloc_assemble_datagram(connection, (unsigned char*) buffer, bytes_received, time, 0);
+    }
+    if (received == 0) {
+        return;
+    }
+
+    // publish the counters once per batch
+    telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+    connection->receive_stats.datagrams_received += received;
+    connection->receive_stats.bytes_received += bytes;
+    connection->receive_stats.datagrams_truncated += truncated;
+    connection->receive_stats.batches++;
+    connection->video_time = time;
+    ReleaseMutex(connection->video_mutex);
+    unsigned long long end = telloc_time();
+    telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_RECEIVE, time, end);
+    if (telloc_trace_on()) {
+        telloc_trace_span("receive", connection->trace_id, time, end, "datagrams", (unsigned long long) received);
+    }
+}
+
+
+// thread to feed a recording through the same reassembly, decoding and state handling as the reactor
+unsigned __stdcall thread_replay(void *arg) {
+    printf("Replay thread started\n");
+    telloc_trace_thread("replay");
 
     // get the connection from the argument
     telloc_connection *connection = (telloc_connection *) arg;
 
-    // check if the state socket is open
+    // recorded times are moved onto the clock as it reads now, so frame and state times compare with telloc_time as usual
+    unsigned long long start = telloc_time();
+    unsigned long long first = 0;
+    int started = 0;
+    telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+    connection->replay_stats.start_time = start;
+    ReleaseMutex(connection->video_mutex);
+
+    telloc_replay_datagram datagram;
+    while (connection->alive && telloc_replay_next(&connection->replay, &datagram) == 0) {
+        if (!started) {
+            first = datagram.time;
+            started = 1;
+        }
+        unsigned long long time = start + (datagram.time - first);
+        if (connection->replay_pace == TELLOC_REPLAY_REALTIME) {
+            // wait on the decode event, which telloc_disconnect sets, so a gap in the recording doesn't hold it up.
+            // waits only count milliseconds; datagrams due within the same millisecond go out together
+            WaitForSingleObject(telloc_shared_reactor.decode_mutex, INFINITE);
+            unsigned long long now = telloc_time();
+            while (connection->alive && time > now + 1000000ULL) {
+                ResetEvent(connection->decode_event);
+                ReleaseMutex(telloc_shared_reactor.decode_mutex);
+                WaitForSingleObject(connection->decode_event, (DWORD) ((time - now) / 1000000ULL));
+                WaitForSingleObject(telloc_shared_reactor.decode_mutex, INFINITE);
+                now = telloc_time();
+            }
+            ReleaseMutex(telloc_shared_reactor.decode_mutex);
+            if (!connection->alive) {
+                break;
+            }
+        }
+
+        telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+        telloc_replay_stats *stats = &connection->replay_stats;
+        stats->recorded_time = datagram.time - first;
+        if (datagram.video) {
+            stats->video_datagrams++;
+            stats->units += datagram.unit_start ? 1 : 0;
+            connection->receive_stats.datagrams_received++;
+            connection->receive_stats.bytes_received += datagram.length;
+            connection->receive_stats.batches++;
+            connection->video_time = time;
+        } else {
+            stats->states++;
+        }
+        ReleaseMutex(connection->video_mutex);
+
+        if (datagram.video) {
+            telloc_assemble_datagram(connection, datagram.data, datagram.length, time, 1);
+        } else {
+            telloc_handle_state(connection, (const char *) datagram.data, datagram.length, time);
+        }
+    }
+
+    // finished means every recorded frame is out, so wait for the decoder workers to catch up
+    WaitForSingleObject(telloc_shared_reactor.decode_mutex, INFINITE);
+    while (connection->alive && connection->decode_scheduled) {
+        telloc_wait_decoded(connection);
+    }
+    ReleaseMutex(telloc_shared_reactor.decode_mutex);
+
+    telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+    connection->replay_stats.finished = 1;
+    connection->replay_stats.end_time = telloc_time();
+    ReleaseMutex(connection->video_mutex);
+    printf("Replay finished\n");
+
+    telloc_trace_thread_exit();
+    return 0;
+}
+
+
+// function to get the progress of a replay
+int telloc_get_replay_stats(telloc_connection *connection, telloc_replay_stats *stats) {
     if (connection == NULL || !connection->alive) {
-        printf("Connection not initialized; State thread not starting.\n");
-        printf("Call telloc_connect() before starting state thread.\n");
+        printf("Connection not initialized; Replay stats not available.\n");
+        return 1;
+    }
+    if (!connection->replaying) {
+        printf("Not a replay; Replay stats not available.\n");
+        printf("Call telloc_connect_replay() to replay a recording.\n");
         return 1;
     }
+    telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+    *stats = connection->replay_stats;
+    ReleaseMutex(connection->video_mutex);
+    return 0;
+}
+
+
+// function to reference the latest frame if it is unread, and reset the frame event.
+// the video mutex must be held
+telloc_frame_slot *telloc_acquire_latest(telloc_connection *connection) {
+    telloc_frame_slot *slot = telloc_frame_pool_acquire(&connection->frame_pool);
+    if (slot != NULL) {
+        ResetEvent(connection->frame_event);
+        slot->acquired_time = telloc_time();
+        telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_HANDOFF, slot->frame.info.decoded_time, slot->acquired_time);
+    }
+    return slot;
+}
+
+
+// thread to convert one band of every frame the pool is handed
+unsigned __stdcall thread_convert(void *arg) {
+    telloc_convert_helper *helper = (telloc_convert_helper *) arg;
+    telloc_convert_pool *pool = helper->pool;
+    telloc_trace_thread("converter");
+    while (1) {
+        WaitForSingleObject(pool->start[helper->band - 1], INFINITE);
+        if (pool->stopping) {
+            break;
+        }
+        unsigned long long start = telloc_trace_on() ? telloc_time() : 0;
+        telloc_convert_band(pool->job, helper->band, pool->helpers + 1);
+        if (start != 0) {
+            telloc_trace_span("convert band", 0, start, telloc_time(), "band", (unsigned long long) helper->band);
+        }
+        if (InterlockedDecrement(&pool->pending) == 0) {
+            SetEvent(pool->done);
+        }
+    }
+    telloc_trace_thread_exit();
+    return 0;
+}
+
+
+// function to convert a job over the pool's helpers and the calling thread
+void telloc_convert_pool_run(telloc_convert_pool *pool, const telloc_convert_job *job) {
+    if (pool->helpers == 0) {
+        telloc_convert_rows(job, 0, job->height);
+        return;
+    }
+    WaitForSingleObject(pool->run_mutex, INFINITE);
+    pool->job = job;
+    pool->pending = (LONG) pool->helpers;
+    for (unsigned int helper = 0; helper < pool->helpers; helper++) {
+        SetEvent(pool->start[helper]);
+    }
+
+    telloc_convert_band(job, 0, pool->helpers + 1);
+
+    // the job lives on the caller's stack, so wait for every band
+    WaitForSingleObject(pool->done, INFINITE);
+    ReleaseMutex(pool->run_mutex);
+}
+
+
+// function to start the helper threads of a connection's conversion pool; threads counts the reader
+void telloc_convert_pool_start(telloc_connection *connection, int threads) {
+    telloc_convert_pool *pool = &connection->convert_pool;
+    pool->run_mutex = CreateMutex(NULL, FALSE, NULL);
+    pool->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+    pool->job = NULL;
+    pool->pending = 0;
+    pool->stopping = 0;
+    pool->helpers = 0;
+    for (int band = 1; band < threads; band++) {
+        telloc_convert_helper *helper = &connection->convert_helpers[band];
+        helper->pool = pool;
+        helper->band = (unsigned int) band;
+        pool->start[pool->helpers] = CreateEvent(NULL, FALSE, FALSE, NULL);
+        pool->threads[pool->helpers] = (HANDLE) _beginthreadex(NULL, 0, &thread_convert, helper, 0, NULL);
+        if (pool->threads[pool->helpers] == NULL) {
+            CloseHandle(pool->start[pool->helpers]);
+            printf("Error starting conversion thread; Converting over %u threads.\n", pool->helpers + 1);
+            break;
+        }
+        pool->helpers++;
+    }
+}
+
+
+// function to stop a connection's conversion threads
+void telloc_convert_pool_stop(telloc_connection *connection) {
+    telloc_convert_pool *pool = &connection->convert_pool;
+    pool->stopping = 1;
+    for (unsigned int helper = 0; helper < pool->helpers; helper++) {
+        SetEvent(pool->start[helper]);
+    }
+    for (unsigned int helper = 0; helper < pool->helpers; helper++) {
+        WaitForSingleObject(pool->threads[helper], INFINITE);
+        CloseHandle(pool->threads[helper]);
+        CloseHandle(pool->start[helper]);
+    }
+    CloseHandle(pool->done);
+    CloseHandle(pool->run_mutex);
+}
+
+
+// function to convert an acquired frame to the connection's format the first time it is read, and hand it back if that fails.
+// the video mutex must not be held; only the holder of a frame converts it
+int telloc_convert_acquired(telloc_connection *connection, telloc_frame_slot *slot) {
+    telloc_frame *frame;
+    unsigned long long start = telloc_time();
+    if (telloc_frame_slot_convert(slot, slot->frame.format, &connection->convert_pool, &frame) != 0) {
+        printf("Error converting frame\n");
+        telloc_release_frame(connection, &slot->frame);
+        return 1;
+    }
+    unsigned long long end = telloc_time();
+    telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_CONVERT, start, end);
+    if (telloc_trace_on()) {
+        telloc_trace_flow(TELLOC_TRACE_FLOW_END, connection->trace_id, slot->frame.info.sequence, start);
+        telloc_trace_span("convert", connection->trace_id, start, end, "frame", slot->frame.info.sequence);
+    }
+    return 0;
+}
+
+
+// function to borrow the most recent video frame without copying it
+int telloc_acquire_frame(telloc_connection *connection, const telloc_frame** frame) {
+    // check if the video socket is open
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Video not received.\n");
+        printf("Call telloc_connect() before reading an image.\n");
+        return 1;
+    }
+
+    telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+    telloc_frame_slot *slot = telloc_acquire_latest(connection);
+    ReleaseMutex(connection->video_mutex);
+
+    // check if there is new video data
+    if (slot == NULL || telloc_convert_acquired(connection, slot) != 0) {
+        return 1;
+    }
+
+    *frame = &slot->frame;
+    return 0;
+}
+
+
+// function to wait for a frame newer than the last one acquired or read, and borrow it
+int telloc_wait_frame(telloc_connection *connection, int timeout_ms, const telloc_frame** frame) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Video not received.\n");
+        printf("Call telloc_connect() before waiting for an image.\n");
+        return 1;
+    }
+
+    // another reader can take the frame between the wake and the acquire; wait again until the timeout
+    ULONGLONG start = GetTickCount64();
+    while (connection->alive) {
+        if (telloc_wait_event(connection->frame_event, timeout_ms, start) != 0) {
+            return 1;
+        }
+        telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+        telloc_frame_slot *slot = telloc_acquire_latest(connection);
+        ReleaseMutex(connection->video_mutex);
+        if (slot != NULL) {
+            if (telloc_convert_acquired(connection, slot) != 0) {
+                return 1;
+            }
+            *frame = &slot->frame;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+// function to wait for a frame newer than the last one acquired or read, and copy it like telloc_read_image
+int telloc_wait_image(telloc_connection *connection, int timeout_ms, unsigned char* image, unsigned int image_buffer_size, unsigned int* image_bytes, unsigned int* image_width, unsigned int* image_height) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Video not received.\n");
+        printf("Call telloc_connect() before waiting for an image.\n");
+        return 1;
+    }
+
+    if (telloc_wait_event(connection->frame_event, timeout_ms, GetTickCount64()) != 0) {
+        return 1;
+    }
+    return telloc_read_image(connection, image, image_buffer_size, image_bytes, image_width, image_height);
+}
+
+
+// function to get a file descriptor for unread frames; Windows has none, use telloc_wait_frame
+int telloc_get_frame_fd(telloc_connection *connection) {
+    printf("Frame fd not supported on Windows; use telloc_wait_frame.\n");
+    return -1;
+}
+
+
+// function to hand an acquired frame back to the library
+int telloc_release_frame(telloc_connection *connection, const telloc_frame* frame) {
+    if (connection == NULL || frame == NULL) {
+        return 1;
+    }
+
+    // the public frame is the first member of its slot; the caller still holds it, so its acquired time is stable
+    telloc_frame_slot *slot = (telloc_frame_slot *) frame;
+    unsigned long long end = telloc_time();
+    telloc_metrics_record_span(&connection->metrics, TELLOC_STAGE_READ, slot->acquired_time, end);
+    if (telloc_trace_on()) {
+        telloc_trace_span("read", connection->trace_id, slot->acquired_time, end, "frame", slot->frame.info.sequence);
+    }
+    telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+    telloc_frame_pool_release(&connection->frame_pool, slot);
+    ReleaseMutex(connection->video_mutex);
+
+    return 0;
+}
+
+
+// function to get an acquired frame in another pixel format
+int telloc_convert_frame(telloc_connection *connection, const telloc_frame* frame, telloc_pixel_format format, const telloc_frame** converted) {
+    if (connection == NULL || frame == NULL) {
+        return 1;
+    }
+
+    // no lock; the caller holds the frame, and only the holder converts it
+    telloc_frame *target;
+    if (telloc_frame_slot_convert((telloc_frame_slot *) frame, format, &connection->convert_pool, &target) != 0) {
+        printf("Error converting frame to format %d\n", (int) format);
+        return 1;
+    }
+    *converted = target;
+    return 0;
+}
+
+
+// function to read the most recent video frame
+// kept for compatibility; copies the frame borrowed with telloc_acquire_frame
+// argument: telloc_connection *connection
+// argument: unsigned char *buffer
+// argument: unsigned buffer_size
+int telloc_read_image(telloc_connection *connection, unsigned char* image, unsigned int image_buffer_size, unsigned int* image_bytes, unsigned int* image_width, unsigned int* image_height) {
+    // check if the video socket is open
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Video not received.\n");
+        printf("Call telloc_connect() before reading an image.\n");
+        return 1;
+    }
+
+    // acquire the mutex
+    telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+
+    // check if there is new video data
+    telloc_frame_slot *latest = connection->frame_pool.latest;
+    if (latest == NULL || !connection->frame_pool.latest_unread) {
+        ReleaseMutex(connection->video_mutex);
+        return 1;
+    }
+
+    if (image_buffer_size < latest->frame.bytes) {
+        printf("Buffer size too small to hold video data\n");
+        ReleaseMutex(connection->video_mutex);
+        return 1;
+    }
+
+    telloc_frame_slot *slot = telloc_acquire_latest(connection);
+
+    // release the mutex
+    ReleaseMutex(connection->video_mutex);
+
+    // convert and copy the borrowed frame outside the lock
+    if (telloc_convert_acquired(connection, slot) != 0) {
+        return 1;
+    }
+    telloc_video_frame_copy(&slot->frame, image);
+    *image_bytes = slot->frame.bytes;
+    *image_width = slot->frame.width;
+    *image_height = slot->frame.height;
+
+    telloc_release_frame(connection, &slot->frame);
+
+    return 0;
+}
+
+
+// function to get the video socket counters
+int telloc_get_receive_stats(telloc_connection *connection, telloc_receive_stats *stats) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Receive stats not available.\n");
+        return 1;
+    }
+    telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+    *stats = connection->receive_stats;
+    ReleaseMutex(connection->video_mutex);
+    WaitForSingleObject(telloc_shared_reactor.decode_mutex, INFINITE);
+    stats->units_dropped = connection->decode_queue.units_dropped;
+    ReleaseMutex(telloc_shared_reactor.decode_mutex);
+    stats->units_discarded = (unsigned long) telloc_metrics_counter(&connection->metrics, TELLOC_COUNTER_UNITS_DISCARDED);
+    return 0;
+}
+
+
+// function to get the pipeline counters and stage latencies
+int telloc_get_stats(telloc_connection *connection, telloc_stats *stats) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Stats not available.\n");
+        return 1;
+    }
+    telloc_metrics_snapshot(&connection->metrics, stats);
+    // the decode mutex is only held for queue operations, never across a decode
+    WaitForSingleObject(telloc_shared_reactor.decode_mutex, INFINITE);
+    stats->units_dropped = connection->decode_queue.units_dropped;
+    ReleaseMutex(telloc_shared_reactor.decode_mutex);
+    return 0;
+}
+
+
+// function to get a connection's metrics, its drone's address and its id for the Prometheus export
+const telloc_metrics *telloc_connection_metrics(telloc_connection *connection, char *address, unsigned int address_length, unsigned int *id) {
+    if (connection == NULL || !connection->alive) {
+        return NULL;
+    }
+    if (connection->replaying) {
+        snprintf(address, address_length, "replay");
+    } else {
+        snprintf(address, address_length, "%s", inet_ntoa(connection->drone_address.sin_addr));
+    }
+    *id = connection->trace_id;
+    return &connection->metrics;
+}
+
+
+// function to start recording the video stream
+int telloc_start_recording(telloc_connection *connection, const char *path, telloc_record_format format) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Recording not started.\n");
+        printf("Call telloc_connect() before starting a recording.\n");
+        return 1;
+    }
+
+    WaitForSingleObject(connection->record_mutex, INFINITE);
+    if (connection->recorder.stats.recording) {
+        ReleaseMutex(connection->record_mutex);
+        printf("Already recording; Recording not started.\n");
+        printf("Call telloc_stop_recording() before starting another recording.\n");
+        return 1;
+    }
+    int failed = telloc_recorder_open(&connection->recorder, path, format);
+    ReleaseMutex(connection->record_mutex);
+    return failed;
+}
+
+
+// function to finish the recording
+int telloc_stop_recording(telloc_connection *connection) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Recording not stopped.\n");
+        return 1;
+    }
+
+    WaitForSingleObject(connection->record_mutex, INFINITE);
+    int failed = connection->recorder.stats.recording ? telloc_recorder_close(&connection->recorder) : 1;
+    ReleaseMutex(connection->record_mutex);
+    return failed;
+}
+
+
+// function to get the recording counters
+int telloc_get_record_stats(telloc_connection *connection, telloc_record_stats *stats) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Record stats not available.\n");
+        return 1;
+    }
+    WaitForSingleObject(connection->record_mutex, INFINITE);
+    *stats = connection->recorder.stats;
+    ReleaseMutex(connection->record_mutex);
+    return 0;
+}
+
+
+// function to get the video options in effect
+int telloc_get_video_config(telloc_connection *connection, telloc_video_config *config) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Video config not available.\n");
+        return 1;
+    }
+    *config = connection->video_decoder.config;
+    return 0;
+}
+
+
+// function to run the callbacks of finished commands and wake anyone waiting on them; requires the command mutex
+void telloc_report_commands(telloc_connection *connection) {
+    telloc_command *command;
+    while ((command = telloc_command_queue_finished(&connection->command_queue)) != NULL) {
+        telloc_metrics_command(&connection->metrics, command);
+        if (telloc_trace_on() && command->sent_time != 0) {
+            unsigned long long end = command->replied_time != 0 ? command->replied_time : telloc_time();
+            telloc_trace_async("command", connection->trace_id, command->order, command->sent_time, end,
+                               command->command, command->length, "status", (unsigned long long) command->status);
+        }
+        if (command->callback != NULL) {
+            // callbacks may use the command API themselves
+            ReleaseMutex(connection->command_mutex);
+            connection->reporting++;
+            command->callback(command, command->user);
+            connection->reporting--;
+            telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+        }
+        SetEvent(connection->command_done[command - connection->command_queue.commands]);
+        telloc_command_queue_release(&connection->command_queue, command);
+    }
+}
+
+
+// function to take the drone's replies, send queued commands and the rc setpoint, and note when the commands are next
+// due for a reply timeout or rc send; runs on the reactor thread
+void telloc_service_commands(telloc_connection *connection) {
+    SOCKET sock = connection->command_socket;
+    telloc_command_queue *queue = &connection->command_queue;
+    char buffer[1024];
+
+    telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+
+    // take every reply waiting, in order; nothing is left over to drain before the next command.
+    // the event is reset first, and each recvfrom rearms it while data remains
+    WSAResetEvent(connection->command_reply);
+    int bytes_received;
+    while ((bytes_received = recvfrom(sock, buffer, sizeof(buffer), 0, NULL, NULL)) != SOCKET_ERROR) {
+        telloc_command_queue_reply(queue, buffer, (unsigned int) bytes_received, telloc_time());
+    }
+
+    unsigned long long now = telloc_time();
+    telloc_command_queue_expire(queue, now);
+
+    // send everything that may go now; a UDP send does not wait for the drone
+    telloc_command *command;
+    while ((command = telloc_command_queue_next(queue, now)) != NULL) {
+        unsigned long long start = telloc_trace_on() ? telloc_time() : 0;
+        int bytes_sent = sendto(sock, command->command, (int) command->length, 0, (struct sockaddr *) &connection->drone_address, sizeof(connection->drone_address));
+        if (bytes_sent == SOCKET_ERROR) {
+            printf("Error sending command: %d\n", WSAGetLastError());
+        }
+        if (start != 0) {
+            telloc_trace_span("send", connection->trace_id, start, telloc_time(), "bytes", (unsigned long long) command->length);
+        }
+        telloc_command_queue_sent(queue, command, bytes_sent != SOCKET_ERROR);
+    }
+
+    // the rc setpoint goes out at its own rate, with no reply to wait for
+    char rc_command[64];
+    unsigned int rc_length = telloc_rc_due(&connection->rc, now, rc_command, sizeof(rc_command));
+    if (rc_length > 0 && sendto(sock, rc_command, (int) rc_length, 0, (struct sockaddr *) &connection->drone_address, sizeof(connection->drone_address)) == SOCKET_ERROR) {
+        printf("Error sending rc: %d\n", WSAGetLastError());
+    }
+    telloc_report_commands(connection);
+
+    // come back when the command waiting for its reply times out or the next rc is due
+    unsigned long long deadline = telloc_command_queue_deadline(queue);
+    unsigned long long rc_deadline = telloc_rc_deadline(&connection->rc);
+    if (rc_deadline != 0 && (deadline == 0 || rc_deadline < deadline)) {
+        deadline = rc_deadline;
+    }
+    connection->command_deadline = deadline;
+
+    ReleaseMutex(connection->command_mutex);
+}
+
+
+// thread to do the network I/O of every live connection in the process. services the commands of each connection
+// that has something to send or is due, then sleeps in one WaitForMultipleObjects on all of their socket events until
+// the soonest command deadline, and receives whatever is ready
+unsigned __stdcall thread_reactor(void *arg) {
+    printf("Reactor thread started\n");
+    telloc_on_reactor = 1;
+    telloc_trace_thread("reactor");
+
+    telloc_reactor *reactor = (telloc_reactor *) arg;
+
+    // the reactor reads one socket at a time, so every connection shares the receive buffer
+    char *udp_buffer = malloc(TELLOC_DATAGRAM_SIZE);
+    if (udp_buffer == NULL) {
+        printf("Error allocating video buffer memory\n");
+        return 1;
+    }
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    telloc_connection *owners[MAXIMUM_WAIT_OBJECTS];
+    telloc_source_kind kinds[MAXIMUM_WAIT_OBJECTS];
+
+    WaitForSingleObject(reactor->dispatch_mutex, INFINITE);
+    while (reactor->alive) {
+        // commands run callbacks, which may disconnect other drones; start over on the connections left if one does
+        unsigned long long removals = reactor->removals;
+        unsigned long long now = telloc_time();
+        for (unsigned int i = 0; i < reactor->count && reactor->removals == removals; i++) {
+            telloc_connection *connection = reactor->connections[i];
+            unsigned long long deadline = connection->command_deadline;
+            if (InterlockedExchange(&connection->command_wake, 0) || (deadline != 0 && deadline <= now)) {
+                telloc_service_commands(connection);
+            }
+        }
+        if (reactor->removals != removals) {
+            continue;
+        }
+
+        // gather the socket events, and sleep no later than the soonest command deadline
+        DWORD count = 0;
+        handles[count] = reactor->wake;
+        owners[count] = NULL;
+        count++;
+        unsigned long long deadline = 0;
+        for (unsigned int i = 0; i < reactor->count; i++) {
+            telloc_connection *connection = reactor->connections[i];
+            if (connection->command_deadline != 0 && (deadline == 0 || connection->command_deadline < deadline)) {
+                deadline = connection->command_deadline;
+            }
+            handles[count] = connection->command_reply;
+            owners[count] = connection;
+            kinds[count] = TELLOC_SOURCE_COMMAND;
+            count++;
+            if (connection->receiving) {
+                handles[count] = connection->state_ready;
+                owners[count] = connection;
+                kinds[count] = TELLOC_SOURCE_STATE;
+                count++;
+                handles[count] = connection->video_ready;
+                owners[count] = connection;
+                kinds[count] = TELLOC_SOURCE_VIDEO;
+                count++;
+            }
+        }
+        DWORD timeout = INFINITE;
+        if (deadline != 0) {
+            now = telloc_time();
+            timeout = deadline > now ? (DWORD) ((deadline - now + 999999ULL) / 1000000ULL) : 0;
+        }
+        reactor->waited_removals = removals;
+        reactor->waiting = 1;
+        ReleaseMutex(reactor->dispatch_mutex);
+
+        DWORD result = WaitForMultipleObjects(count, handles, FALSE, timeout);
+
+        WaitForSingleObject(reactor->dispatch_mutex, INFINITE);
+        reactor->waiting = 0;
+        SetEvent(reactor->resumed);
+        if (result == WAIT_FAILED) {
+            printf("Error waiting for network data: %lu\n", GetLastError());
+            break;
+        }
+        if (result == WAIT_TIMEOUT || reactor->removals != removals) {
+            // due commands are serviced above; events gathered before a removal may belong to the removed connection,
+            // and whatever is still ready signals again next time
+            continue;
+        }
+
+        // WaitForMultipleObjects only reports the first ready handle, so look at the rest too, or one busy drone
+        // would starve the ones after it
+        DWORD first = result - WAIT_OBJECT_0;
+        for (DWORD i = first; i < count && reactor->removals == removals; i++) {
+            if (i != first && WaitForSingleObject(handles[i], 0) != WAIT_OBJECT_0) {
+                continue;
+            }
+            telloc_connection *connection = owners[i];
+            if (connection == NULL) {
+                continue;
+            }
+            switch (kinds[i]) {
+                case TELLOC_SOURCE_STATE:
+                    telloc_receive_state(connection);
+                    break;
+                case TELLOC_SOURCE_VIDEO:
+                    telloc_receive_video(connection, udp_buffer);
+                    break;
+                default:
+                    // replies are taken with the rest of the command work at the top
+                    InterlockedExchange(&connection->command_wake, 1);
+                    break;
+            }
+        }
+    }
+    ReleaseMutex(reactor->dispatch_mutex);
+
+    free(udp_buffer);
+
+    telloc_trace_thread_exit();
+    return 0;
+}
+
+
+// function to take a reference to the shared reactor and decoder workers, starting them for the first connection.
+// every connection adds a decoder worker until there is one per core
+int telloc_reactor_acquire(void) {
+    telloc_reactor *reactor = &telloc_shared_reactor;
+    if (reactor->mutex == NULL) {
+        // connections made at once race to create the mutex; the loser closes its own
+        HANDLE mutex = CreateMutex(NULL, FALSE, NULL);
+        if (InterlockedCompareExchangePointer((PVOID volatile *) &reactor->mutex, mutex, NULL) != NULL) {
+            CloseHandle(mutex);
+        }
+    }
+
+    WaitForSingleObject(reactor->mutex, INFINITE);
+    if (reactor->users == 0) {
+        reactor->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+        reactor->resumed = CreateEvent(NULL, TRUE, FALSE, NULL);
+        reactor->dispatch_mutex = CreateMutex(NULL, FALSE, NULL);
+        reactor->decode_mutex = CreateMutex(NULL, FALSE, NULL);
+        reactor->decode_ready = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+        if (reactor->wake == NULL || reactor->resumed == NULL || reactor->dispatch_mutex == NULL
+            || reactor->decode_mutex == NULL || reactor->decode_ready == NULL) {
+            printf("Error creating reactor events: %lu\n", GetLastError());
+            HANDLE created[] = {reactor->wake, reactor->resumed, reactor->dispatch_mutex, reactor->decode_mutex, reactor->decode_ready};
+            for (int i = 0; i < 5; i++) {
+                if (created[i] != NULL) {
+                    CloseHandle(created[i]);
+                }
+            }
+            ReleaseMutex(reactor->mutex);
+            return 1;
+        }
+
+        reactor->count = 0;
+        reactor->removals = 0;
+        reactor->waited_removals = 0;
+        reactor->waiting = 0;
+        reactor->alive = 1;
+        reactor->thread = (HANDLE) _beginthreadex(NULL, 0, &thread_reactor, reactor, 0, NULL);
+
+        SYSTEM_INFO system_info;
+        GetSystemInfo(&system_info);
+        DWORD cores = system_info.dwNumberOfProcessors;
+        reactor->cores = cores < 1 ? 1 : cores > TELLOC_DECODE_WORKERS_MAX ? TELLOC_DECODE_WORKERS_MAX : (unsigned int) cores;
+        reactor->workers = 0;
+        reactor->decode_stopping = 0;
+        reactor->ready_head = NULL;
+        reactor->ready_tail = NULL;
+    }
+    reactor->users++;
+    while (reactor->workers < reactor->users && reactor->workers < reactor->cores) {
+        reactor->worker_threads[reactor->workers] = (HANDLE) _beginthreadex(NULL, 0, &thread_decode, reactor, 0, NULL);
+        reactor->workers++;
+    }
+    ReleaseMutex(reactor->mutex);
+    return 0;
+}
+
+
+// function to drop a reference to the shared reactor, stopping it and the decoder workers after the last connection
+void telloc_reactor_release(void) {
+    telloc_reactor *reactor = &telloc_shared_reactor;
+    WaitForSingleObject(reactor->mutex, INFINITE);
+    reactor->users--;
+    if (reactor->users == 0) {
+        WaitForSingleObject(reactor->dispatch_mutex, INFINITE);
+        reactor->alive = 0;
+        ReleaseMutex(reactor->dispatch_mutex);
+        SetEvent(reactor->wake);
+        WaitForSingleObject(reactor->thread, INFINITE);
+        CloseHandle(reactor->thread);
+
+        // every worker wakes once more and finds nothing in line
+        WaitForSingleObject(reactor->decode_mutex, INFINITE);
+        reactor->decode_stopping = 1;
+        ReleaseSemaphore(reactor->decode_ready, (LONG) reactor->workers, NULL);
+        ReleaseMutex(reactor->decode_mutex);
+        WaitForMultipleObjects(reactor->workers, reactor->worker_threads, TRUE, INFINITE);
+        for (unsigned int i = 0; i < reactor->workers; i++) {
+            CloseHandle(reactor->worker_threads[i]);
+        }
+        reactor->workers = 0;
+
+        CloseHandle(reactor->wake);
+        CloseHandle(reactor->resumed);
+        CloseHandle(reactor->dispatch_mutex);
+        CloseHandle(reactor->decode_mutex);
+        CloseHandle(reactor->decode_ready);
+    }
+    ReleaseMutex(reactor->mutex);
+}
+
+
+// function to have the reactor serve a connection's commands. fails once the reactor waits on as many handles as
+// WaitForMultipleObjects takes
+int telloc_reactor_add(telloc_connection *connection) {
+    telloc_reactor *reactor = &telloc_shared_reactor;
+    WaitForSingleObject(reactor->dispatch_mutex, INFINITE);
+    if (reactor->count == TELLOC_REACTOR_CONNECTIONS) {
+        ReleaseMutex(reactor->dispatch_mutex);
+        printf("Too many connections; Windows allows %d per process\n", TELLOC_REACTOR_CONNECTIONS);
+        return 1;
+    }
+    reactor->connections[reactor->count++] = connection;
+    ReleaseMutex(reactor->dispatch_mutex);
+    SetEvent(reactor->wake);
+    return 0;
+}
 
-    // get the socket from the connection
-    SOCKET sock = connection->state_socket;
 
-    // while alive, receive data on the socket
-    while (connection->alive) {
-        // receive data on the socket, assume UDP max buffer size
-        char buffer[TELLOC_STATE_SIZE];
+// function to have the reactor also receive a connection's state and video
+void telloc_reactor_receive(telloc_connection *connection) {
+    telloc_reactor *reactor = &telloc_shared_reactor;
+    WaitForSingleObject(reactor->dispatch_mutex, INFINITE);
+    connection->receiving = 1;
+    ReleaseMutex(reactor->dispatch_mutex);
+    SetEvent(reactor->wake);
+}
 
-        int bytes_received = recv(sock, buffer, sizeof(buffer), 0);
-        if (bytes_received == SOCKET_ERROR) {
-            printf("State thread: error recieving data\n");
-            // sleep for 5ms
-            Sleep(5);
-            continue;
-        }
 
-        // Windows acquire handle to the mutex
-        WaitForSingleObject(connection->state_mutex, INFINITE);
+// function to stop the reactor serving a connection. once it returns the reactor is not handling the connection and
+// not waiting on its events, so they can be closed; it must not be called from the reactor thread for the connection
+// being handled
+void telloc_reactor_remove(telloc_connection *connection) {
+    telloc_reactor *reactor = &telloc_shared_reactor;
+    WaitForSingleObject(reactor->dispatch_mutex, INFINITE);
+    for (unsigned int i = 0; i < reactor->count; i++) {
+        if (reactor->connections[i] == connection) {
+            reactor->connections[i] = reactor->connections[--reactor->count];
+            break;
+        }
+    }
+    unsigned long long removals = ++reactor->removals;
+
+    // the reactor may be waiting on the connection's events; wake it, and let it gather them again without ours
+    while (reactor->waiting && reactor->waited_removals < removals) {
+        ResetEvent(reactor->resumed);
+        SetEvent(reactor->wake);
+        ReleaseMutex(reactor->dispatch_mutex);
+        WaitForSingleObject(reactor->resumed, INFINITE);
+        WaitForSingleObject(reactor->dispatch_mutex, INFINITE);
+    }
+    ReleaseMutex(reactor->dispatch_mutex);
+}
 
-        // copy the data string to the connection's state buffer
-        // zero out the state buffer
-        memset(connection->state_buffer, 0, TELLOC_STATE_SIZE);
-        // copy the data string to the state buffer with memcpy_s
-        memcpy_s(connection->state_buffer, TELLOC_STATE_SIZE, buffer, bytes_received);
-        connection->state_size = bytes_received;
 
-        // release the mutex
-        ReleaseMutex(connection->state_mutex);
+// function to queue a command for the reactor
+telloc_command *telloc_send_command_async(telloc_connection *connection, const char* command, unsigned int length, telloc_command_priority priority,
+                                          int timeout_ms, telloc_command_callback callback, void *user) {
+    // check if the command socket is open
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Command not sent.\n");
+        printf("Call telloc_connect() before sending commands.\n");
+        return NULL;
+    }
+    if (connection->replaying) {
+        printf("Replaying a recording; Command not sent.\n");
+        return NULL;
+    }
 
+    if (length > TELLOC_COMMAND_LENGTH) {
+        printf("Command too long; Command not sent.\n");
+        return NULL;
     }
 
-    // close the socket
-    closesocket(sock);
+    telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+    // checked again under the lock, so nothing is queued after telloc_disconnect cancels the queue
+    if (!connection->alive) {
+        ReleaseMutex(connection->command_mutex);
+        printf("Connection closing; Command not sent.\n");
+        return NULL;
+    }
+    telloc_command *queued = telloc_command_queue_push(&connection->command_queue, command, length, priority, timeout_ms, callback, user, telloc_time());
+    if (queued != NULL) {
+        ResetEvent(connection->command_done[queued - connection->command_queue.commands]);
+    }
+    ReleaseMutex(connection->command_mutex);
+    if (queued == NULL) {
+        printf("Command queue full; Command not sent.\n");
+        return NULL;
+    }
 
-    return 0;
+    InterlockedExchange(&connection->command_wake, 1);
+    SetEvent(telloc_shared_reactor.wake);
+    return queued;
 }
 
 
-// Function to return a copy of the most recent state data
-// argument: telloc_connection *connection
-// argument: char *buffer
-// argument: unsigned buffer_size
-int telloc_read_state(telloc_connection *connection, char *state_buffer, unsigned state_buffer_length) {
-    // clear the state buffer
-    memset(state_buffer, 0, state_buffer_length);
-
-    // check if the state socket is open
+// function to set the sticks the reactor keeps sending
+int telloc_set_rc(telloc_connection *connection, int lr, int fb, int ud, int yaw) {
+    // check if the command socket is open
     if (connection == NULL || !connection->alive) {
-        printf("Connection not initialized; State not recieved.\n");
-        printf("Call telloc_connect() before recieving state.\n");
+        printf("Connection not initialized; rc not set.\n");
+        printf("Call telloc_connect() before setting rc.\n");
         return 1;
     }
-
-    if (state_buffer_length < connection->state_size) {
-        printf("Buffer size too small to hold state data\n");
+    if (connection->replaying) {
+        printf("Replaying a recording; rc not set.\n");
         return 1;
     }
 
-    // check if there is new state data
-    if (connection->state_size == 0) {
-        return 1;
+    telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+    int due = telloc_rc_set(&connection->rc, lr, fb, ud, yaw, telloc_time());
+    ReleaseMutex(connection->command_mutex);
+    // the reactor may be asleep with nothing to do for this drone
+    if (due) {
+        InterlockedExchange(&connection->command_wake, 1);
+        SetEvent(telloc_shared_reactor.wake);
     }
+    return 0;
+}
 
-    // Windows acquire handle to the mutex
-    WaitForSingleObject(connection->state_mutex, INFINITE);
 
-    // copy the data to the connection's state buffer
-    memcpy(state_buffer, connection->state_buffer, connection->state_size);
-    connection->state_size = 0;
+// function to get where a queued command is
+telloc_command_status telloc_command_poll(telloc_connection *connection, telloc_command *command) {
+    telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+    telloc_command_status status = command->status;
+    ReleaseMutex(connection->command_mutex);
+    return status;
+}
 
-    // release the mutex
-    ReleaseMutex(connection->state_mutex);
 
-    return 0;
+// function to wait for a queued command to finish
+telloc_command_status telloc_command_wait(telloc_connection *connection, telloc_command *command, int timeout_ms) {
+    if (telloc_on_reactor && timeout_ms != 0) {
+        printf("Can't wait for a command on the I/O thread; Polling instead.\n");
+        timeout_ms = 0;
+    }
+    // the reactor finishes every command, and disconnecting cancels the rest
+    telloc_wait_event(connection->command_done[command - connection->command_queue.commands], timeout_ms, GetTickCount64());
+    return telloc_command_poll(connection, command);
 }
 
 
-// main function to recieve video data from a UDP socket.
-// this function is run in a thread
-// argument: telloc_connection *connection
-unsigned __stdcall thread_video(void *arg) {
-    printf("Video thread started\n");
-
-    // get the connection from the argument
-    telloc_connection *connection = (telloc_connection *) arg;
+// function to copy the reply of a finished command
+int telloc_command_response(telloc_connection *connection, telloc_command *command, char* response, unsigned int response_length) {
+    if (response_length == 0) {
+        return 1;
+    }
+    response[0] = '\0';
 
-    // check if the video socket is open
-    if (!connection->alive) {
-        printf("Connection not initialized; Video thread not starting.\n");
-        printf("Call telloc_connect() before starting video thread.\n");
+    telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+    if (command->status != TELLOC_COMMAND_DONE || command->response_length == 0) {
+        ReleaseMutex(connection->command_mutex);
         return 1;
     }
+    unsigned int length = command->response_length < response_length ? command->response_length : response_length - 1;
+    memcpy(response, command->response, length);
+    response[length] = '\0';
+    ReleaseMutex(connection->command_mutex);
+    return 0;
+}
 
-    // get the socket from the connection
-    SOCKET sock = connection->video_socket;
 
-    // allocate a buffer for the video data
-    char *udp_buffer = malloc(65507);
+// function to hand back a command handle
+void telloc_command_release(telloc_connection *connection, telloc_command *command) {
+    telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+    telloc_command_queue_release(&connection->command_queue, command);
+    ReleaseMutex(connection->command_mutex);
+}
 
-    // allocate a buffer for multiple video packets
-    unsigned char *h264_buffer = (unsigned char *) malloc(65507 * 10);
-    unsigned h264_buffer_size = 0;
 
-    // while alive, receive data on the socket
-    while (connection->alive) {
-        // receive data on the socket
-        int bytes_received = recvfrom(sock, udp_buffer, 65507, 0, NULL, NULL);
-        if (bytes_received == SOCKET_ERROR) {
-            printf("Error receiving data: %d\n", WSAGetLastError());
-            // sleep for 5ms
-            Sleep(5);
-            continue;
-        }
+// thread to run periodic tasks. sleeps on its wake event until the next deadline, so it only wakes when something is due
+// argument: telloc_connection *connection
+unsigned __stdcall thread_schedule(void* arg) {
+    printf("Scheduler thread started\n");
+    telloc_trace_thread("scheduler");
 
-        // check if the udp packet is a valid h264 start frame
-        int new_frame = telloc_video_decoder_is_start_code((unsigned char*) udp_buffer, bytes_received);
-        if (new_frame) {
-            // check if there is a previous frame
-            if (h264_buffer_size > 0) {
-                // send the completed video packet to the video decoder
-                telloc_video_decoder_decode(&connection->video_decoder, h264_buffer, h264_buffer_size);
-            }
-            // set buffer to the new frame's data
-            memcpy(h264_buffer, udp_buffer, bytes_received);
-            h264_buffer_size = bytes_received;
+    // get the connection from the argument
+    telloc_connection *connection = (telloc_connection *) arg;
 
-        } else if (h264_buffer_size > 0) {
-            // not a new frame, but we already have data; append the data to the h264 buffer
-            memcpy(h264_buffer + h264_buffer_size, udp_buffer, bytes_received);
-            h264_buffer_size += bytes_received;
+    WaitForSingleObject(connection->schedule_mutex, INFINITE);
+    while (connection->alive) {
+        // run everything due; tasks run with the schedule locked, so removing one waits for it to finish
+        telloc_task task;
+        while (connection->alive && telloc_schedule_due(&connection->schedule, telloc_time(), &task)) {
+            task.function(connection, task.user);
         }
 
-        // check if there is a new frame
-        if (new_frame && connection->video_decoder.frame_ready) {
-
-            // Windows acquire handle to the mutex
-            WaitForSingleObject(connection->video_mutex, INFINITE);
-
-            // copy the data to the connection's video buffer
-            memcpy(connection->video_buffer, connection->video_decoder.frame_buffer, connection->video_decoder.frame_size);
-            connection->video_decoder.frame_ready = 0;
-            connection->video_size = connection->video_decoder.frame_size;
-
-            // release the mutex
-            ReleaseMutex(connection->video_mutex);
+        DWORD timeout = INFINITE;
+        unsigned long long deadline = telloc_schedule_deadline(&connection->schedule);
+        if (deadline != 0) {
+            unsigned long long now = telloc_time();
+            timeout = deadline > now ? (DWORD) ((deadline - now + 999999ULL) / 1000000ULL) : 0;
         }
+        ReleaseMutex(connection->schedule_mutex);
+
+        WaitForSingleObject(connection->schedule_wake, timeout);
+        WaitForSingleObject(connection->schedule_mutex, INFINITE);
     }
+    ReleaseMutex(connection->schedule_mutex);
 
-    // close the socket
-    closesocket(sock);
+    telloc_trace_thread_exit();
+    return 0;
+}
 
-    // free the buffers
-    free(udp_buffer);
-    free(h264_buffer);
 
+// function to read the number a query was answered with; returns 1 if the reply is not a number
+int telloc_query_number(telloc_connection *connection, telloc_command *command, int *value) {
+    char response[32];
+    if (telloc_command_response(connection, command, response, sizeof(response)) != 0 || response[0] < '0' || response[0] > '9') {
+        return 1;
+    }
+    *value = atoi(response);
     return 0;
 }
 
 
-// function to read the most recent video frame
-// argument: telloc_connection *connection
-// argument: unsigned char *buffer
-// argument: unsigned buffer_size
-int telloc_read_image(telloc_connection *connection, unsigned char* image, unsigned int image_buffer_size, unsigned int* image_bytes, unsigned int* image_width, unsigned int* image_height) {
-    // check if the video socket is open
-    if (connection == NULL || !connection->alive) {
-        printf("Connection not initialized; Video not received.\n");
-        printf("Call telloc_connect() before reading an image.\n");
-        return 1;
+// function to keep the battery level from a battery? reply; runs on the reactor thread
+void telloc_battery_answered(telloc_command *command, void *user) {
+    telloc_connection *connection = (telloc_connection *) user;
+    int battery;
+    if (telloc_query_number(connection, command, &battery) == 0) {
+        telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+        connection->health.battery = battery;
+        connection->health.battery_time = telloc_time();
+        ReleaseMutex(connection->command_mutex);
     }
+}
 
-    // acquire the mutex
-    WaitForSingleObject(connection->video_mutex, INFINITE);
 
-    if (image_buffer_size < connection->video_size) {
-        printf("Buffer size too small to hold video data\n");
-        goto error;
+// function to keep the signal to noise ratio from a wifi? reply; runs on the reactor thread
+void telloc_wifi_answered(telloc_command *command, void *user) {
+    telloc_connection *connection = (telloc_connection *) user;
+    int snr;
+    if (telloc_query_number(connection, command, &snr) == 0) {
+        telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+        connection->health.wifi_snr = snr;
+        connection->health.wifi_time = telloc_time();
+        ReleaseMutex(connection->command_mutex);
     }
+}
 
-    // check if there is new video data
-    if (connection->video_size == 0) {
-        goto error;
+
+// function to queue a query behind anything the pilot sends, with a callback for the reply
+void telloc_query(telloc_connection *connection, const char *query, telloc_command_callback answered) {
+    telloc_command *command = telloc_send_command_async(connection, query, (unsigned int) strlen(query), TELLOC_PRIORITY_LOW, -1, answered, connection);
+    if (command != NULL) {
+        telloc_command_release(connection, command);
     }
+}
 
-    // copy the data from the connection's video buffer
-    memcpy(image, connection->video_buffer, connection->video_size);
-    *image_bytes = connection->video_size;
-    connection->video_size = 0;
-    *image_width = connection->video_decoder.frame_width;
-    *image_height = connection->video_decoder.frame_height;
 
-    // release the mutex
-    ReleaseMutex(connection->video_mutex);
+// task to ask for the battery level. it doubles as the keepalive; the drone lands after 15 seconds without a command
+void telloc_task_battery(telloc_connection *connection, void *user) {
+    telloc_query(connection, "battery?", telloc_battery_answered);
+}
 
-    return 0;
 
-error:
-    // release the mutex
-    ReleaseMutex(connection->video_mutex);
-    return 1;
+// task to ask for the wifi signal to noise ratio
+void telloc_task_wifi(telloc_connection *connection, void *user) {
+    telloc_query(connection, "wifi?", telloc_wifi_answered);
 }
 
 
-// thread to repeatedly send keepalive
-// argument: telloc_connection *connection
-unsigned __stdcall thread_keepalive(void* arg) {
-    printf("Keepalive thread started\n");
+// task to notice when state or video stop arriving, and when they come back
+void telloc_task_watchdog(telloc_connection *connection, void *user) {
+    unsigned long long now = telloc_time();
+    unsigned long long timeout = TELLOC_WATCHDOG_TIMEOUT * 1000000ULL;
 
-    // get the connection from the argument
-    telloc_connection *connection = (telloc_connection *) arg;
+    // only once something has arrived; video is off until streamon
+    telloc_state state;
+    int state_lost = telloc_state_latest(&connection->state_latest, &state) == 0 && state.received_time + timeout < now;
+    telloc_lock(connection, connection->video_mutex, "video_mutex wait");
+    unsigned long long video_time = connection->video_time;
+    ReleaseMutex(connection->video_mutex);
+    int video_lost = video_time != 0 && video_time + timeout < now;
 
-    // check if the command socket is open
-    if (!connection->alive) {
-        printf("Connection not initialized; Keepalive thread not starting.\n");
-        printf("Call telloc_connect() before starting keepalive thread.\n");
-        return 1;
+    telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+    telloc_health *health = &connection->health;
+    if (state_lost != health->state_lost) {
+        printf(state_lost ? "No state from the drone for %d ms\n" : "State from the drone is back\n", TELLOC_WATCHDOG_TIMEOUT);
+    }
+    if (video_lost != health->video_lost) {
+        printf(video_lost ? "No video from the drone for %d ms\n" : "Video from the drone is back\n", TELLOC_WATCHDOG_TIMEOUT);
     }
+    health->state_lost = state_lost;
+    health->video_lost = video_lost;
+    ReleaseMutex(connection->command_mutex);
+}
 
-    // get the socket from the connection
-    SOCKET sock = connection->command_socket;
 
-    char buffer[1024];
-    const char* query = "battery?";
+// function to add a periodic callback
+int telloc_add_periodic(telloc_connection *connection, int period_ms, telloc_periodic_callback callback, void *user) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Periodic callback not added.\n");
+        printf("Call telloc_connect() before adding periodic callbacks.\n");
+        return -1;
+    }
+    if (period_ms <= 0 || callback == NULL) {
+        printf("Periodic callbacks need a callback and a period above 0 ms\n");
+        return -1;
+    }
+
+    unsigned long long period = (unsigned long long) period_ms * 1000000ULL;
+    WaitForSingleObject(connection->schedule_mutex, INFINITE);
+    int id = telloc_schedule_add(&connection->schedule, telloc_time() + period, period, callback, user);
+    ReleaseMutex(connection->schedule_mutex);
+    if (id == -1) {
+        printf("Too many periodic callbacks; Periodic callback not added.\n");
+        return -1;
+    }
 
-    // use win32 to get current time in seconds
-    unsigned int keepalive_time = GetTickCount() / 1000;
+    // the thread may be asleep until a later deadline
+    SetEvent(connection->schedule_wake);
+    return id;
+}
 
-    // while alive, send keepalive
-    while (connection->alive) {
 
-        // if time since last keepalive is greater than 5 seconds, send keepalive
-        if (GetTickCount() / 1000 - keepalive_time > 5) {
-            // send the keepalive command
-            telloc_send_command(connection, query, (unsigned int) strlen(query), buffer, sizeof(buffer));
-            keepalive_time = GetTickCount() / 1000;
-        }
-        // wait 50 ms
-        Sleep(50);
+// function to stop a periodic callback
+int telloc_remove_periodic(telloc_connection *connection, int id) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Periodic callback not removed.\n");
+        printf("Call telloc_connect() before removing periodic callbacks.\n");
+        return 1;
     }
 
-    closesocket(sock);
+    // waits for the callback if it is running right now
+    WaitForSingleObject(connection->schedule_mutex, INFINITE);
+    int missing = telloc_schedule_remove_public(&connection->schedule, id);
+    ReleaseMutex(connection->schedule_mutex);
+    return missing;
+}
+
+
+// function to get what the periodic queries and watchdogs last found
+int telloc_get_health(telloc_connection *connection, telloc_health *health) {
+    if (connection == NULL || !connection->alive) {
+        printf("Connection not initialized; Health not read.\n");
+        printf("Call telloc_connect() before getting health.\n");
+        return 1;
+    }
 
+    telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+    *health = connection->health;
+    ReleaseMutex(connection->command_mutex);
     return 0;
 }
 
@@ -322,9 +1761,82 @@ int telloc_bind_udp_socket(SOCKET *sock, const char* address, unsigned short por
 }
 
 
-// function to connect to the Tello drone on a specified interface address
-telloc_connection *telloc_connect_interface(const char *interface_address) {
-    printf("Connecting to Tello on interface %s\n", interface_address);
+// function to get the local port a socket is bound to, e.g. the one the system picked for port 0
+unsigned short telloc_socket_port(SOCKET sock) {
+    struct sockaddr_in addr;
+    int length = sizeof(addr);
+    if (getsockname(sock, (struct sockaddr *) &addr, &length) == SOCKET_ERROR) {
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+
+// function to size the video socket's receive buffer
+int telloc_setup_video_socket(telloc_connection *connection, const telloc_receive_config *config) {
+    SOCKET sock = connection->video_socket;
+
+    if (config->buffer_size > 0) {
+        int size = config->buffer_size;
+        if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *) &size, sizeof(size)) == SOCKET_ERROR) {
+            printf("Error setting video receive buffer: %d\n", WSAGetLastError());
+        }
+    }
+    int granted = 0;
+    int granted_length = sizeof(granted);
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *) &granted, &granted_length);
+    connection->receive_stats.buffer_size = granted;
+
+    if (config->busy_poll > 0) {
+        printf("Busy polling is not supported on Windows; ignoring it\n");
+    }
+
+    return 0;
+}
+
+
+// function to fill a config with the defaults used by telloc_connect
+void telloc_config_default(telloc_config *config) {
+    config->interface_address = "0.0.0.0";
+    config->drone_address = TELLOC_ADDRESS;
+    // the ports the Tello sends to out of the box; a swarm gives each connection its own, or 0 for any free ones
+    config->ports.command = TELLOC_COMMAND_PORT;
+    config->ports.state = TELLOC_STATE_PORT;
+    config->ports.video = TELLOC_VIDEO_PORT;
+    // a single decoder thread with low delay flags, the lowest latency for the single slice Tello stream
+    config->video.thread_count = 1;
+    config->video.threading = TELLOC_THREADING_SLICE;
+    config->video.low_delay = 1;
+    config->video.format = TELLOC_FORMAT_RGB24;
+    // a 960x720 frame converts in well under a millisecond on one core; more threads pay off on slow multicore boards
+    config->video.convert_threads = 1;
+    // room for a few keyframe bursts; the Tello sends keyframes as dozens of datagrams at once
+    config->receive.buffer_size = 1024 * 1024;
+    config->receive.busy_poll = 0;
+    // smooth enough to fly by, and the drone stops within half a second of the pilot letting go
+    config->rc.rate = 20;
+    config->rc.stale_ms = 500;
+    // a live connection; set a recording's path to replay it instead
+    config->replay.path = NULL;
+    config->replay.pace = TELLOC_REPLAY_REALTIME;
+}
+
+
+// function to connect to a Tello drone with the given options
+telloc_connection *telloc_connect_config(const telloc_config *config) {
+    // connecting waits for the drone's replies, which only the reactor delivers
+    if (telloc_on_reactor) {
+        printf("Can't connect from the I/O thread; Connection not made.\n");
+        return NULL;
+    }
+    const char *interface_address = config->interface_address;
+    const char *drone_address = config->drone_address;
+    int replaying = config->replay.path != NULL;
+    if (replaying) {
+        printf("Replaying %s\n", config->replay.path);
+    } else {
+        printf("Connecting to Tello at %s on interface %s\n", drone_address, interface_address);
+    }
 
     // initialize Windows networking
     WSADATA wsa_data;
@@ -336,54 +1848,131 @@ telloc_connection *telloc_connect_interface(const char *interface_address) {
     // allocate a connection pointer
     telloc_connection *connection = malloc(sizeof(telloc_connection));
 
+    // every connection shares the reactor thread and the decoder workers
+    if (telloc_reactor_acquire() != 0) {
+        free(connection);
+        return NULL;
+    }
+
     // set the connection's alive flag to 0 to stop any threads
     connection->alive = 0;
-
-    SOCKET command_sock = 0;
-    SOCKET state_sock = 0;
-    SOCKET video_sock = 0;
-
-    // create the command mutex (only one command can be sent at a time)
+    connection->receiving = 0;
+    connection->command_wake = 0;
+    connection->command_deadline = 0;
+    memset(&connection->receive_stats, 0, sizeof(connection->receive_stats));
+    telloc_metrics_init(&connection->metrics);
+    connection->trace_id = telloc_trace_connection();
+    connection->video_time = 0;
+    connection->replaying = replaying;
+    connection->replay_pace = config->replay.pace;
+    memset(&connection->replay_stats, 0, sizeof(connection->replay_stats));
+    telloc_video_unit_queue_init(&connection->decode_queue);
+    connection->decode_scheduled = 0;
+    connection->decode_closing = 0;
+    connection->decode_next = NULL;
+    connection->decode_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    // commands are sent to the drone's command port
+    memset(&connection->drone_address, 0, sizeof(connection->drone_address));
+    connection->drone_address.sin_family = AF_INET;
+    connection->drone_address.sin_port = htons(TELLOC_COMMAND_PORT);
+    connection->drone_address.sin_addr.s_addr = inet_addr(drone_address);
+
+    SOCKET command_sock = INVALID_SOCKET;
+    SOCKET state_sock = INVALID_SOCKET;
+    SOCKET video_sock = INVALID_SOCKET;
+
+    // create the command mutex, guarding the command queue, and the socket events the reactor waits on
     connection->command_mutex = CreateMutex(NULL, FALSE, NULL);
-    // bind the command socket to our interface and port
-    if (telloc_bind_udp_socket(&command_sock, interface_address, TELLOC_COMMAND_PORT) != 0) {
-        goto error;
+    telloc_command_queue_init(&connection->command_queue);
+    for (int i = 0; i < TELLOC_COMMAND_QUEUE_SIZE; i++) {
+        connection->command_done[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
     }
+    connection->command_reply = WSACreateEvent();
+    connection->state_ready = WSACreateEvent();
+    connection->video_ready = WSACreateEvent();
+    telloc_rc_init(&connection->rc, &config->rc);
+    memset(&connection->health, 0, sizeof(connection->health));
+    connection->health.battery = -1;
+    connection->health.wifi_snr = -1;
+    // a replay reads the recording instead of binding sockets, and has no drone to send commands to
+    if (replaying) {
+        if (telloc_replay_open(&connection->replay, config->replay.path) != 0) {
+            goto error;
+        }
+        connection->alive = 1;
+        connection->command_socket = INVALID_SOCKET;
+        connection->state_socket = INVALID_SOCKET;
+        connection->video_socket = INVALID_SOCKET;
+    } else {
+        // bind the command socket to our interface and port
+        if (telloc_bind_udp_socket(&command_sock, interface_address, (unsigned short) config->ports.command) != 0) {
+            goto error;
+        }
 
-    // bind the state socket to our interface and port
-    if (telloc_bind_udp_socket(&state_sock, interface_address, TELLOC_STATE_PORT) != 0) {
-        goto error;
-    }
+        // bind the state socket to our interface and port
+        if (telloc_bind_udp_socket(&state_sock, interface_address, (unsigned short) config->ports.state) != 0) {
+            goto error;
+        }
 
-    // bind the video socket to our interface and port
-    if (telloc_bind_udp_socket(&video_sock, interface_address, TELLOC_VIDEO_PORT) != 0) {
-        goto error;
-    }
+        // bind the video socket to our interface and port
+        if (telloc_bind_udp_socket(&video_sock, interface_address, (unsigned short) config->ports.video) != 0) {
+            goto error;
+        }
+
+        // set the connection's sockets
+        connection->alive = 1;
+        connection->command_socket = command_sock;
+        connection->state_socket = state_sock;
+        connection->video_socket = video_sock;
+        telloc_setup_video_socket(connection, &config->receive);
+
+        // each socket sets its event when data arrives, which also makes it non-blocking
+        if (WSAEventSelect(command_sock, connection->command_reply, FD_READ) == SOCKET_ERROR
+            || WSAEventSelect(state_sock, connection->state_ready, FD_READ) == SOCKET_ERROR
+            || WSAEventSelect(video_sock, connection->video_ready, FD_READ) == SOCKET_ERROR) {
+            printf("Error selecting socket events: %d\n", WSAGetLastError());
+            goto error;
+        }
 
-    // set the connection's sockets
-    connection->alive = 1;
-    connection->command_socket = command_sock;
-    connection->state_socket = state_sock;
-    connection->video_socket = video_sock;
+        // hand the command socket to the reactor, which sends every command from here on
+        if (telloc_reactor_add(connection) != 0) {
+            goto error;
+        }
 
-    // Send a command and get a response. This is to initialize the connection.
-    // set the response timeout
-    int timeout = TELLOC_RESPONSE_TIMEOUT;
-    if (setsockopt(command_sock, SOL_SOCKET, SO_RCVTIMEO, (char *) &timeout, sizeof(timeout)) == SOCKET_ERROR) {
-        printf("Error setting socket timeout: %d\n", WSAGetLastError());
-        goto error;
+        // Send a command and get a response. This is to initialize the connection.
+        // send connection command
+        char command[] = "command";
+        char response[1024];
+        printf("Sending command: %s\n", command);
+        if (telloc_send_command(connection, command, (unsigned int) strlen(command), response, 1024) != 0) {
+            goto error;
+        }
+        printf("Response: %s\n", response);
+
+        // drones sharing a network can't all send to the default ports, so tell this one where to send its state and video
+        unsigned short state_port = telloc_socket_port(state_sock);
+        unsigned short video_port = telloc_socket_port(video_sock);
+        if (state_port != TELLOC_STATE_PORT || video_port != TELLOC_VIDEO_PORT) {
+            char port_command[32];
+            snprintf(port_command, sizeof(port_command), "port %d %d", state_port, video_port);
+            printf("Sending command: %s\n", port_command);
+            if (telloc_send_command(connection, port_command, (unsigned int) strlen(port_command), response, 1024) != 0) {
+                goto error;
+            }
+            if (strncmp(response, "ok", 2) != 0) {
+                printf("Drone did not take the ports: %s\n", response);
+                goto error;
+            }
+        }
     }
 
-    // send connection command
-    char command[] = "command";
-    char response[1024];
-    printf("Sending command: %s\n", command);
-    if (telloc_send_command(connection, command, (unsigned int) strlen(command), response, 1024) != 0) {
+    // initialize the video decoder and the access unit reassembler in front of it
+    if (telloc_video_decoder_init(&connection->video_decoder, &config->video) != 0) {
+        telloc_video_decoder_free(&connection->video_decoder);
         goto error;
     }
-
-    // initialize the video decoder
-    if (telloc_video_decoder_init(&connection->video_decoder) != 0) {
+    if (telloc_video_reassembler_init(&connection->video_reassembler) != 0) {
         telloc_video_decoder_free(&connection->video_decoder);
         goto error;
     }
@@ -392,23 +1981,78 @@ telloc_connection *telloc_connect_interface(const char *interface_address) {
     connection->state_mutex = CreateMutex(NULL, FALSE, NULL);
     connection->state_buffer = malloc(TELLOC_STATE_SIZE);
     connection->state_size = 0;
+    memset(&connection->state_latest, 0, sizeof(connection->state_latest));
+    connection->state_history.written = 0;
+    connection->state_samples = 0;
+    connection->state_event = CreateEvent(NULL, TRUE, FALSE, NULL);
 
     connection->video_mutex = CreateMutex(NULL, FALSE, NULL);
-    connection->video_buffer = malloc(TELLOC_VIDEO_SIZE);
-    connection->video_size = 0;
+    connection->record_mutex = CreateMutex(NULL, FALSE, NULL);
+    memset(&connection->recorder, 0, sizeof(connection->recorder));
+    connection->frame_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (telloc_frame_pool_init(&connection->frame_pool, config->video.format) != 0) {
+        printf("Error allocating frame pool memory\n");
+        telloc_video_decoder_free(&connection->video_decoder);
+        telloc_video_reassembler_free(&connection->video_reassembler);
+        free(connection->state_buffer);
+        CloseHandle(connection->state_event);
+        CloseHandle(connection->frame_event);
+        goto error;
+    }
 
-    // start the video, state, and keepalive threads
-    connection->state_thread = (HANDLE) _beginthreadex(NULL, 0, &thread_state, connection, 0, NULL);
-    connection->video_thread = (HANDLE) _beginthreadex(NULL, 0, &thread_video, connection, 0, NULL);
-    connection->keepalive_thread = (HANDLE) _beginthreadex(NULL, 0, &thread_keepalive, connection, 0, NULL);
+    // the queries start a second in so telloc_get_health fills in soon
+    connection->schedule_mutex = CreateMutex(NULL, FALSE, NULL);
+    connection->schedule_wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    telloc_schedule_init(&connection->schedule);
+    if (!replaying) {
+        unsigned long long now = telloc_time();
+        telloc_schedule_add(&connection->schedule, now + 1000000000ULL, TELLOC_KEEPALIVE_PERIOD * 1000000ULL, telloc_task_battery, NULL);
+        telloc_schedule_add(&connection->schedule, now + 1000000000ULL, TELLOC_WIFI_PERIOD * 1000000ULL, telloc_task_wifi, NULL);
+        telloc_schedule_add(&connection->schedule, now + TELLOC_WATCHDOG_PERIOD * 1000000ULL, TELLOC_WATCHDOG_PERIOD * 1000000ULL, telloc_task_watchdog, NULL);
+    }
+    // the keepalive and watchdogs are not the caller's to remove
+    telloc_schedule_reserve(&connection->schedule);
+
+    // start the conversion helpers, then have the reactor receive state and video, and start the scheduler thread;
+    // a replay thread stands in for the state and video sockets
+    telloc_convert_pool_start(connection, connection->video_decoder.config.convert_threads);
+    if (replaying) {
+        connection->replay_thread = (HANDLE) _beginthreadex(NULL, 0, &thread_replay, connection, 0, NULL);
+    } else {
+        telloc_reactor_receive(connection);
+    }
+    connection->schedule_thread = (HANDLE) _beginthreadex(NULL, 0, &thread_schedule, connection, 0, NULL);
 
     return connection;
 
 error:
+    // take the sockets away from the reactor before they go; commands still queued are never sent
+    connection->alive = 0;
+    telloc_reactor_remove(connection);
+    telloc_command_queue_cancel(&connection->command_queue);
+    telloc_reactor_release();
+    for (int i = 0; i < TELLOC_COMMAND_QUEUE_SIZE; i++) {
+        CloseHandle(connection->command_done[i]);
+    }
+    WSACloseEvent(connection->command_reply);
+    WSACloseEvent(connection->state_ready);
+    WSACloseEvent(connection->video_ready);
+    CloseHandle(connection->command_mutex);
+    CloseHandle(connection->decode_event);
+    if (replaying) {
+        telloc_replay_close(&connection->replay);
+    }
+
     // close the sockets
-    closesocket(command_sock);
-    closesocket(state_sock);
-    closesocket(video_sock);
+    if (command_sock != INVALID_SOCKET) {
+        closesocket(command_sock);
+    }
+    if (state_sock != INVALID_SOCKET) {
+        closesocket(state_sock);
+    }
+    if (video_sock != INVALID_SOCKET) {
+        closesocket(video_sock);
+    }
 
     // free the connection
     free(connection);
@@ -417,6 +2061,32 @@ error:
 }
 
 
+// function to connect to a Tello drone at drone_address on a specified interface address
+telloc_connection *telloc_connect_address(const char *interface_address, const char *drone_address) {
+    telloc_config config;
+    telloc_config_default(&config);
+    config.interface_address = interface_address;
+    config.drone_address = drone_address;
+    return telloc_connect_config(&config);
+}
+
+
+// function to replay a recording as if it came from a drone
+telloc_connection *telloc_connect_replay(const char *path, telloc_replay_pace pace) {
+    telloc_config config;
+    telloc_config_default(&config);
+    config.replay.path = path;
+    config.replay.pace = pace;
+    return telloc_connect_config(&config);
+}
+
+
+// function to connect to the Tello drone on a specified interface address
+telloc_connection *telloc_connect_interface(const char *interface_address) {
+    return telloc_connect_address(interface_address, TELLOC_ADDRESS);
+}
+
+
 // default interface to all 0.0.0.0
 telloc_connection *telloc_connect(void) {
     return telloc_connect_interface("0.0.0.0");
@@ -425,66 +2095,33 @@ telloc_connection *telloc_connect(void) {
 
 // function to send a command to the drone
 int telloc_send_command(telloc_connection *connection, const char* command, unsigned length, char* response, unsigned int response_length) {
-    // check if the command socket is open
-    if (connection == NULL || !connection->alive) {
-        printf("Connection not initialized; Command not sent.\n");
-        printf("Call telloc_connect() before sending commands.\n");
+    // only the reactor could deliver the reply, so a command callback waiting for one would wait forever
+    if (telloc_on_reactor) {
+        printf("Can't wait for a reply on the I/O thread; Command not sent.\n");
+        printf("Call telloc_send_command_async() from command callbacks.\n");
         return 1;
     }
-
-    if(length > 1024) {
-        printf("Command too long; Command not sent.\n");
+    // queue it like any other command and wait; the reactor gives up after the command's default timeout
+    telloc_command *queued = telloc_send_command_async(connection, command, length, TELLOC_PRIORITY_NORMAL, -1, NULL, NULL);
+    if (queued == NULL) {
         return 1;
     }
-
-    // acquire the command mutex
-    WaitForSingleObject(connection->command_mutex, INFINITE);
-
-    // get the socket from the connection
-    SOCKET sock = connection->command_socket;
-
-    // send the command to the drone on the command socket port 8889, ip address 192.168.10.1
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(TELLOC_COMMAND_PORT);
-    addr.sin_addr.s_addr = inet_addr(TELLOC_ADDRESS);
-    int bytes_sent = sendto(sock, command, (int) length, 0, (struct sockaddr *) &addr, sizeof(addr));
-    if (bytes_sent == SOCKET_ERROR) {
-        printf("Error sending command: %d\n", WSAGetLastError());
-        goto error;
-    }
-
-    // recieve a response from the drone on port 8889
-    char response_buffer[256];
-    int bytes_recieved = recvfrom(sock, response_buffer, sizeof(response_buffer), 0, NULL, NULL);
-    if (bytes_recieved == SOCKET_ERROR) {
-        printf("Response timeout: %d\n", WSAGetLastError());
-        goto error;
+    telloc_command_status status = telloc_command_wait(connection, queued, -1);
+    if (status == TELLOC_COMMAND_TIMEOUT) {
+        printf("Response timeout\n");
+    } else if (status == TELLOC_COMMAND_CANCELLED) {
+        printf("Command cancelled\n");
     }
 
     // Check if the response is null
-    if (response != NULL) {
+    if (response != NULL && status == TELLOC_COMMAND_DONE) {
         // zero out the response string
         memset(response, 0, response_length);
-        // copy the response buffer into the response string with strcpy_s
-        memcpy_s(response, response_length, response_buffer, bytes_recieved);
+        telloc_command_response(connection, queued, response, response_length);
     }
 
-    // flush the udp socket
-    // this is to prevent the socket from filling up with old data
-    char flush[1024];
-    while (recvfrom(sock, flush, sizeof(flush), 0, NULL, NULL) != SOCKET_ERROR);
-
-    // release the command mutex
-    ReleaseMutex(connection->command_mutex);
-
-    return 0;
-
-error:
-    // release the command mutex
-    ReleaseMutex(connection->command_mutex);
-
-    return 1;
+    telloc_command_release(connection, queued);
+    return status != TELLOC_COMMAND_DONE;
 }
 
 
@@ -496,39 +2133,98 @@ int telloc_disconnect(telloc_connection *connection) {
         printf("Call telloc_connect() before disconnecting.\n");
         return 1;
     }
+    // the threads running its callbacks would be joined from themselves, and return into the freed connection
+    DWORD self = GetCurrentThreadId();
+    if ((connection->reporting > 0 && GetThreadId(telloc_shared_reactor.thread) == self) || GetThreadId(connection->schedule_thread) == self) {
+        printf("A connection can't be disconnected from its own callbacks; Disconnect not completed.\n");
+        return 1;
+    }
 
     // set the connection's alive flag to 0 to stop any threads
     connection->alive = 0;
 
-    // WAIT FOR THREADS TO EXIT
-    // wait for the state thread to exit
-    WaitForSingleObject(connection->state_thread, INFINITE);
-    CloseHandle(connection->state_thread);
-    // wait for the video thread to exit
-    WaitForSingleObject(connection->video_thread, INFINITE);
-    CloseHandle(connection->video_thread);
-    // wait for the keepalive thread to exit
-    WaitForSingleObject(connection->keepalive_thread, INFINITE);
-    CloseHandle(connection->keepalive_thread);
+    // once the reactor lets go of the sockets nothing is received or sent for this drone any more
+    if (!connection->replaying) {
+        telloc_reactor_remove(connection);
+    }
 
-    // close the sockets
-    closesocket(connection->command_socket);
-    closesocket(connection->state_socket);
-    closesocket(connection->video_socket);
+    // the reactor no longer finishes this connection's commands, so cancel them now; a periodic callback or another thread
+    // waiting in telloc_send_command would otherwise keep the scheduler thread from being joined
+    telloc_lock(connection, connection->command_mutex, "command_mutex wait");
+    telloc_command_queue_cancel(&connection->command_queue);
+    telloc_report_commands(connection);
+    ReleaseMutex(connection->command_mutex);
 
-    // free the state and video buffers
+    // wake the scheduler thread, a replay waiting for the decoder, and anyone waiting for frames or state
+    SetEvent(connection->schedule_wake);
+    WaitForSingleObject(telloc_shared_reactor.decode_mutex, INFINITE);
+    SetEvent(connection->decode_event);
+    ReleaseMutex(telloc_shared_reactor.decode_mutex);
+    SetEvent(connection->frame_event);
+    SetEvent(connection->state_event);
+
+    // WAIT FOR THREADS TO EXIT
+    if (connection->replaying) {
+        // wait for the replay thread to exit
+        WaitForSingleObject(connection->replay_thread, INFINITE);
+        CloseHandle(connection->replay_thread);
+    }
+    // wait for the scheduler thread to exit
+    WaitForSingleObject(connection->schedule_thread, INFINITE);
+    CloseHandle(connection->schedule_thread);
+    CloseHandle(connection->schedule_wake);
+    CloseHandle(connection->schedule_mutex);
+
+    // let a worker decoding one of our units finish; the units still queued are dropped
+    WaitForSingleObject(telloc_shared_reactor.decode_mutex, INFINITE);
+    connection->decode_closing = 1;
+    while (connection->decode_scheduled) {
+        telloc_wait_decoded(connection);
+    }
+    ReleaseMutex(telloc_shared_reactor.decode_mutex);
+    // stop the conversion helpers
+    telloc_convert_pool_stop(connection);
+    telloc_reactor_release();
+
+    // close the sockets, or the recording of a replay
+    if (connection->replaying) {
+        telloc_replay_close(&connection->replay);
+    } else {
+        closesocket(connection->command_socket);
+        closesocket(connection->state_socket);
+        closesocket(connection->video_socket);
+    }
+
+    // free the state buffer and the frame pool
     free(connection->state_buffer);
-    free(connection->video_buffer);
+    telloc_frame_pool_free(&connection->frame_pool);
 
     // close the state and video mutexes
     CloseHandle(connection->state_mutex);
     CloseHandle(connection->video_mutex);
+    CloseHandle(connection->state_event);
+    CloseHandle(connection->frame_event);
 
-    // close the command mutex
+    // close the command mutex and events
     CloseHandle(connection->command_mutex);
+    for (int i = 0; i < TELLOC_COMMAND_QUEUE_SIZE; i++) {
+        CloseHandle(connection->command_done[i]);
+    }
+    WSACloseEvent(connection->command_reply);
+    WSACloseEvent(connection->state_ready);
+    WSACloseEvent(connection->video_ready);
+    CloseHandle(connection->decode_event);
+
+    // finish a recording left running, now that nothing receives video for it
+    if (connection->recorder.stats.recording) {
+        telloc_recorder_close(&connection->recorder);
+    }
+    CloseHandle(connection->record_mutex);
 
     // unititialize the video decoder
     telloc_video_decoder_free(&connection->video_decoder);
+    telloc_video_reassembler_free(&connection->video_reassembler);
+    telloc_video_unit_queue_free(&connection->decode_queue);
 
     // cleanup Windows networking
     WSACleanup();
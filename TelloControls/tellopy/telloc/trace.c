@@ -0,0 +1,331 @@
+// Contains the implementation of event tracing and the Chrome trace export for the telloc library
+//
+#include "trace.h"
+#include "atomics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#define TELLOC_THREAD_LOCAL __declspec(thread)
+#else
+#define TELLOC_THREAD_LOCAL __thread
+#endif
+
+// characters of a thread's name
+#define TELLOC_TRACE_NAME_SIZE 32
+
+// struct for the events of one thread, a ring only that thread writes. readers copy events out and then check the
+// write count to drop any the writer overwrote while they copied. buffers are never freed; one a thread gave up on
+// exit is taken by the next thread that traces, so restarting threads don't add buffers
+typedef struct telloc_trace_buffer_ {
+    telloc_trace_event* events;
+    unsigned int capacity;
+    // events ever written this session; event n is kept in events[n % capacity]
+    volatile unsigned long long written;
+    // the tracing session the events belong to
+    volatile unsigned long long session;
+    // the thread writing to the buffer, or NULL while it is free
+    void* volatile owner;
+    unsigned int thread;
+    char name[TELLOC_TRACE_NAME_SIZE];
+    struct telloc_trace_buffer_* next;
+} telloc_trace_buffer;
+
+volatile int telloc_trace_enabled = 0;
+
+// every buffer ever made; buffers are only ever pushed on the front
+static telloc_trace_buffer* volatile telloc_trace_buffers = NULL;
+// counts telloc_trace_start calls; a buffer from an older session is emptied before it is written again
+static volatile unsigned long long telloc_trace_session = 0;
+static volatile unsigned int telloc_trace_capacity = TELLOC_TRACE_EVENTS;
+static volatile unsigned long long telloc_trace_threads = 0;
+static volatile unsigned long long telloc_trace_connections = 0;
+
+static TELLOC_THREAD_LOCAL telloc_trace_buffer* telloc_trace_local = NULL;
+static TELLOC_THREAD_LOCAL const char* telloc_trace_local_name = NULL;
+// the address of this marks the calling thread as a buffer's owner
+static TELLOC_THREAD_LOCAL char telloc_trace_self;
+
+// function to name a buffer after the thread now writing to it
+static void telloc_trace_name(telloc_trace_buffer* buffer) {
+    if (telloc_trace_local_name != NULL) {
+        snprintf(buffer->name, sizeof(buffer->name), "%s %u", telloc_trace_local_name, buffer->thread);
+    } else {
+        snprintf(buffer->name, sizeof(buffer->name), "thread %u", buffer->thread);
+    }
+}
+
+// function to get the calling thread's buffer, taking a free one or making one the first time the thread traces
+static telloc_trace_buffer* telloc_trace_claim(void) {
+    for (telloc_trace_buffer* buffer = telloc_trace_buffers; buffer != NULL; buffer = buffer->next) {
+        if (buffer->owner == NULL && telloc_atomic_swap_pointer(&buffer->owner, NULL, &telloc_trace_self)) {
+            telloc_trace_name(buffer);
+            return buffer;
+        }
+    }
+
+    telloc_trace_buffer* buffer = (telloc_trace_buffer*) calloc(1, sizeof(telloc_trace_buffer));
+    if (buffer == NULL) {
+        return NULL;
+    }
+    buffer->capacity = telloc_trace_capacity;
+    buffer->events = (telloc_trace_event*) malloc(sizeof(telloc_trace_event) * buffer->capacity);
+    if (buffer->events == NULL) {
+        free(buffer);
+        return NULL;
+    }
+    buffer->owner = &telloc_trace_self;
+    buffer->thread = (unsigned int) telloc_atomic_add64(&telloc_trace_threads, 1) + 1;
+    telloc_trace_name(buffer);
+    do {
+        buffer->next = telloc_trace_buffers;
+    } while (!telloc_atomic_swap_pointer((void* volatile*) &telloc_trace_buffers, buffer->next, buffer));
+    return buffer;
+}
+
+// function to get the slot for the calling thread's next event, or NULL if it has no buffer
+static telloc_trace_event* telloc_trace_next(telloc_trace_buffer** owner) {
+    telloc_trace_buffer* buffer = telloc_trace_local;
+    if (buffer == NULL) {
+        buffer = telloc_trace_claim();
+        if (buffer == NULL) {
+            return NULL;
+        }
+        telloc_trace_local = buffer;
+    }
+    // start over in a new session; only this thread writes the buffer, so it empties it itself
+    unsigned long long session = telloc_atomic_load64_acquire(&telloc_trace_session);
+    if (buffer->session != session) {
+        telloc_atomic_store64_release(&buffer->written, 0);
+        telloc_atomic_store64_release(&buffer->session, session);
+    }
+    *owner = buffer;
+    return &buffer->events[buffer->written % buffer->capacity];
+}
+
+// function to make an event written into the slot from telloc_trace_next visible to readers
+static void telloc_trace_commit(telloc_trace_buffer* buffer) {
+    telloc_atomic_store64_release(&buffer->written, buffer->written + 1);
+}
+
+// function to name the calling thread in traces
+void telloc_trace_thread(const char* name) {
+    telloc_trace_local_name = name;
+    if (telloc_trace_local != NULL) {
+        telloc_trace_name(telloc_trace_local);
+    }
+}
+
+// function to give up the calling thread's buffer when the thread ends; its events stay for telloc_trace_dump
+void telloc_trace_thread_exit(void) {
+    telloc_trace_buffer* buffer = telloc_trace_local;
+    if (buffer != NULL) {
+        telloc_trace_local = NULL;
+        telloc_atomic_swap_pointer(&buffer->owner, &telloc_trace_self, NULL);
+    }
+}
+
+// function to get an id for a new connection
+unsigned int telloc_trace_connection(void) {
+    return (unsigned int) telloc_atomic_add64(&telloc_trace_connections, 1) + 1;
+}
+
+// function to record a span of work on the calling thread
+void telloc_trace_span(const char* name, unsigned int connection, unsigned long long start, unsigned long long end, const char* argument, unsigned long long value) {
+    telloc_trace_buffer* buffer;
+    telloc_trace_event* event = telloc_trace_next(&buffer);
+    if (event == NULL) {
+        return;
+    }
+    event->kind = TELLOC_TRACE_SPAN;
+    event->start = start;
+    event->duration = end > start ? end - start : 0;
+    event->id = 0;
+    event->value = value;
+    event->name = name;
+    event->argument = argument;
+    event->connection = connection;
+    event->detail[0] = '\0';
+    telloc_trace_commit(buffer);
+}
+
+// function to record a span that is not tied to the calling thread
+void telloc_trace_async(const char* name, unsigned int connection, unsigned long long id, unsigned long long start, unsigned long long end,
+                        const char* detail, unsigned int detail_length, const char* argument, unsigned long long value) {
+    telloc_trace_buffer* buffer;
+    telloc_trace_event* event = telloc_trace_next(&buffer);
+    if (event == NULL) {
+        return;
+    }
+    event->kind = TELLOC_TRACE_ASYNC;
+    event->start = start;
+    event->duration = end > start ? end - start : 0;
+    event->id = ((unsigned long long) connection << 40) | id;
+    event->value = value;
+    event->name = name;
+    event->argument = argument;
+    event->connection = connection;
+    if (detail_length >= TELLOC_TRACE_DETAIL_SIZE) {
+        detail_length = TELLOC_TRACE_DETAIL_SIZE - 1;
+    }
+    memcpy(event->detail, detail, detail_length);
+    event->detail[detail_length] = '\0';
+    telloc_trace_commit(buffer);
+}
+
+// function to record where a frame's flow starts or ends
+void telloc_trace_flow(telloc_trace_kind kind, unsigned int connection, unsigned long long sequence, unsigned long long time) {
+    telloc_trace_buffer* buffer;
+    telloc_trace_event* event = telloc_trace_next(&buffer);
+    if (event == NULL) {
+        return;
+    }
+    event->kind = kind;
+    event->start = time;
+    event->duration = 0;
+    // frame sequences count per connection, so the connection keeps the ids of different drones apart
+    event->id = ((unsigned long long) connection << 40) | sequence;
+    event->value = sequence;
+    event->name = "frame";
+    event->argument = "frame";
+    event->connection = connection;
+    event->detail[0] = '\0';
+    telloc_trace_commit(buffer);
+}
+
+
+// function to start tracing
+int telloc_trace_start(unsigned int events_per_thread) {
+    telloc_trace_capacity = events_per_thread > 0 ? events_per_thread : TELLOC_TRACE_EVENTS;
+    telloc_atomic_add64(&telloc_trace_session, 1);
+    telloc_trace_enabled = 1;
+    return 0;
+}
+
+// function to stop tracing
+int telloc_trace_stop(void) {
+    telloc_trace_enabled = 0;
+    return 0;
+}
+
+// function to write a string as a json string body
+static void telloc_trace_escape(FILE* file, const char* text) {
+    for (; *text != '\0'; text++) {
+        unsigned char character = (unsigned char) *text;
+        if (character == '"' || character == '\\') {
+            fprintf(file, "\\%c", character);
+        } else if (character < 0x20) {
+            fprintf(file, "\\u%04x", character);
+        } else {
+            fputc(character, file);
+        }
+    }
+}
+
+// function to write an event's arguments
+static void telloc_trace_arguments(FILE* file, const telloc_trace_event* event) {
+    fprintf(file, "\"args\":{\"connection\":%u", event->connection);
+    if (event->argument != NULL) {
+        fprintf(file, ",\"%s\":%llu", event->argument, event->value);
+    }
+    if (event->detail[0] != '\0') {
+        fprintf(file, ",\"detail\":\"");
+        telloc_trace_escape(file, event->detail);
+        fprintf(file, "\"");
+    }
+    fprintf(file, "}");
+}
+
+// function to write an event as Chrome trace events; times are in microseconds
+static void telloc_trace_write_event(FILE* file, const telloc_trace_event* event, unsigned int thread) {
+    double start = (double) event->start / 1000.0;
+    switch (event->kind) {
+        case TELLOC_TRACE_SPAN:
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"telloc\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,",
+                    event->name, start, (double) event->duration / 1000.0, thread);
+            telloc_trace_arguments(file, event);
+            fprintf(file, "}");
+            break;
+        case TELLOC_TRACE_ASYNC:
+            // async spans get a track of their own, so they may overlap the recording thread's spans
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\",\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,",
+                    event->name, event->name, event->id, start, thread);
+            telloc_trace_arguments(file, event);
+            fprintf(file, "},\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\",\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                    event->name, event->name, event->id, (double) (event->start + event->duration) / 1000.0, thread);
+            break;
+        default: {
+            // the end binds to the span around it, the start to the span it is in
+            const char* phase = event->kind == TELLOC_TRACE_FLOW_START ? "s" : "f";
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"%s\",%s\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,",
+                    event->name, phase, event->kind == TELLOC_TRACE_FLOW_START ? "" : "\"bp\":\"e\",", event->id, start, thread);
+            telloc_trace_arguments(file, event);
+            fprintf(file, "}");
+            break;
+        }
+    }
+}
+
+// function to write the events of the last session as Chrome trace json
+int telloc_trace_dump(const char *path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Error opening trace file %s\n", path);
+        return 1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"telloc\"}}");
+
+    unsigned long long session = telloc_atomic_load64_acquire(&telloc_trace_session);
+    telloc_trace_event* copy = NULL;
+    unsigned int copy_capacity = 0;
+    int failed = 0;
+    for (telloc_trace_buffer* buffer = telloc_trace_buffers; buffer != NULL && !failed; buffer = buffer->next) {
+        if (telloc_atomic_load64_acquire(&buffer->session) != session) {
+            continue;
+        }
+        if (copy_capacity < buffer->capacity) {
+            free(copy);
+            copy_capacity = buffer->capacity;
+            copy = (telloc_trace_event*) malloc(sizeof(telloc_trace_event) * copy_capacity);
+            if (copy == NULL) {
+                printf("Error allocating trace memory\n");
+                failed = 1;
+                break;
+            }
+        }
+
+        // copy the newest events, then keep only those the writer cannot have reached while they were copied
+        unsigned long long written = telloc_atomic_load64_acquire(&buffer->written);
+        unsigned long long first = written > buffer->capacity ? written - buffer->capacity : 0;
+        for (unsigned long long n = first; n < written; n++) {
+            copy[n - first] = buffer->events[n % buffer->capacity];
+        }
+        telloc_atomic_fence_acquire();
+        unsigned long long now = telloc_atomic_load64_acquire(&buffer->written);
+        unsigned long long safe = now >= buffer->capacity ? now - buffer->capacity + 1 : 0;
+        if (now < written) {
+            // the session changed under us; the events copied are gone
+            continue;
+        }
+
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", buffer->thread);
+        telloc_trace_escape(file, buffer->name);
+        fprintf(file, "\"}}");
+        for (unsigned long long n = first > safe ? first : safe; n < written; n++) {
+            telloc_trace_write_event(file, &copy[n - first], buffer->thread);
+        }
+    }
+    free(copy);
+
+    fprintf(file, "\n]}\n");
+    failed |= fclose(file) != 0;
+    if (failed) {
+        printf("Error writing trace file %s\n", path);
+        return 1;
+    }
+    return 0;
+}
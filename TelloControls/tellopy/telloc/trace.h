@@ -0,0 +1,65 @@
+// Contains the opt-in event tracing behind telloc_trace_start and telloc_trace_dump
+//
+#ifndef TELLOC_TRACE_H
+#define TELLOC_TRACE_H
+
+#include "telloc.h"
+
+// events each thread keeps when telloc_trace_start is given 0; the oldest are overwritten first
+#define TELLOC_TRACE_EVENTS 16384
+// characters of a command kept with its event
+#define TELLOC_TRACE_DETAIL_SIZE 24
+// mutex waits shorter than this many nanoseconds are not traced, so uncontended locks don't fill the buffers
+#define TELLOC_TRACE_WAIT_MIN 1000
+
+// kinds of trace events
+typedef enum {
+    // a span of work on the recording thread
+    TELLOC_TRACE_SPAN = 0,
+    // a span that is not tied to one thread, like a command waiting for its reply
+    TELLOC_TRACE_ASYNC = 1,
+    // a frame leaving its decode, and arriving at the reader that converts it
+    TELLOC_TRACE_FLOW_START = 2,
+    TELLOC_TRACE_FLOW_END = 3
+} telloc_trace_kind;
+
+// struct for one trace event. names and argument names are string literals; only the detail is copied
+typedef struct {
+    unsigned long long start;
+    unsigned long long duration;
+    // flow or async id
+    unsigned long long id;
+    // the value of the argument, if there is one
+    unsigned long long value;
+    const char* name;
+    const char* argument;
+    unsigned int connection;
+    telloc_trace_kind kind;
+    char detail[TELLOC_TRACE_DETAIL_SIZE];
+} telloc_trace_event;
+
+// set while tracing; every trace point checks it first, so tracing costs one load when it is off
+extern volatile int telloc_trace_enabled;
+#define telloc_trace_on() (telloc_trace_enabled != 0)
+
+// function to name the calling thread in traces; call it when the thread starts
+void telloc_trace_thread(const char* name);
+
+// function to hand the calling thread's buffer to the next thread that traces; call it when the thread ends
+void telloc_trace_thread_exit(void);
+
+// function to get an id for a new connection; its events are tagged with it
+unsigned int telloc_trace_connection(void);
+
+// function to record a span of work on the calling thread between two telloc_time readings.
+// argument names value in the trace, or is NULL
+void telloc_trace_span(const char* name, unsigned int connection, unsigned long long start, unsigned long long end, const char* argument, unsigned long long value);
+
+// function to record a span between two telloc_time readings that is not tied to the calling thread, with a detail string
+void telloc_trace_async(const char* name, unsigned int connection, unsigned long long id, unsigned long long start, unsigned long long end,
+                        const char* detail, unsigned int detail_length, const char* argument, unsigned long long value);
+
+// function to record where a frame's flow starts or ends at time; it binds to the span around time on the calling thread
+void telloc_trace_flow(telloc_trace_kind kind, unsigned int connection, unsigned long long sequence, unsigned long long time);
+
+#endif //TELLOC_TRACE_H
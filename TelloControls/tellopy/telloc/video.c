@@ -4,21 +4,42 @@
 
 #include <libavutil/imgutils.h>
 #include <libavutil/avutil.h>
+#include <errno.h>
 
 
+// function to get the ffmpeg pixel format for a telloc pixel format
+static enum AVPixelFormat telloc_video_pixel_format(telloc_pixel_format format) {
+    switch (format) {
+        case TELLOC_FORMAT_BGR24:
+            return AV_PIX_FMT_BGR24;
+        case TELLOC_FORMAT_YUV420P:
+            return AV_PIX_FMT_YUV420P;
+        case TELLOC_FORMAT_NV12:
+            return AV_PIX_FMT_NV12;
+        case TELLOC_FORMAT_GRAY8:
+            return AV_PIX_FMT_GRAY8;
+        case TELLOC_FORMAT_BGRA:
+            return AV_PIX_FMT_BGRA;
+        default:
+            return AV_PIX_FMT_RGB24;
+    }
+}
+
 // function to initialize the video decoder
-int telloc_video_decoder_init(telloc_video_decoder* decoder) {
+int telloc_video_decoder_init(telloc_video_decoder* decoder, const telloc_video_config* config) {
     // tell ffmpeg not log anything except panic
     av_log_set_level(AV_LOG_PANIC);
 
     // Initialize state to NULL
     decoder->codec = NULL;
     decoder->codec_context = NULL;
-    decoder->sws_context = NULL;
     decoder->frame = NULL;
-    decoder->frame_rgb = NULL;
     decoder->packet = NULL;
-    decoder->frame_ready = 0;
+    decoder->frame_width = 0;
+    decoder->frame_height = 0;
+    decoder->units_sent = 0;
+    decoder->frames_decoded = 0;
+    memset(&decoder->info, 0, sizeof(decoder->info));
 
     // initialize the ffmpeg state
     decoder->codec = avcodec_find_decoder(AV_CODEC_ID_H264);
@@ -32,9 +53,12 @@ int telloc_video_decoder_init(telloc_video_decoder* decoder) {
     // set the codec context options
     av_opt_set(decoder->codec_context->priv_data, "preset", "ultrafast", 0);
     av_opt_set(decoder->codec_context->priv_data, "tune", "zerolatency", 0);
-    decoder->codec_context->flags |= AV_CODEC_FLAG_LOW_DELAY;
-    decoder->codec_context->flags2 |= AV_CODEC_FLAG2_FAST;
-    decoder->codec_context->thread_count = 1;
+    if (config->low_delay) {
+        decoder->codec_context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        decoder->codec_context->flags2 |= AV_CODEC_FLAG2_FAST;
+    }
+    decoder->codec_context->thread_count = config->threading == TELLOC_THREADING_NONE ? 1 : config->thread_count;
+    decoder->codec_context->thread_type = config->threading == TELLOC_THREADING_FRAME ? FF_THREAD_FRAME : FF_THREAD_SLICE;
     decoder->codec_context->error_concealment = 3;
     decoder->codec_context->workaround_bugs = FF_BUG_AUTODETECT;
     decoder->codec_context->pix_fmt = AV_PIX_FMT_YUV420P;
@@ -42,83 +66,240 @@ int telloc_video_decoder_init(telloc_video_decoder* decoder) {
     decoder->codec_context->height = 720;
     decoder->codec_context->gop_size = 0;
 
-    // initialize sws context
-    decoder->sws_context = sws_getContext(decoder->codec_context->width, decoder->codec_context->height, decoder->codec_context->pix_fmt, decoder->codec_context->width, decoder->codec_context->height, AV_PIX_FMT_RGB24, SWS_BILINEAR, NULL, NULL, NULL);
-
     if (avcodec_open2(decoder->codec_context, decoder->codec, NULL) < 0) {
         return 1;
     }
+
+    // report what the codec actually does; e.g. low delay turns frame threading off
+    decoder->config.format = config->format;
+    decoder->config.thread_count = decoder->codec_context->thread_count;
+    decoder->config.low_delay = (decoder->codec_context->flags & AV_CODEC_FLAG_LOW_DELAY) != 0;
+    decoder->config.convert_threads = config->convert_threads < 1 ? 1 : config->convert_threads > TELLOC_CONVERT_THREADS_MAX ? TELLOC_CONVERT_THREADS_MAX : config->convert_threads;
+    if (decoder->codec_context->active_thread_type & FF_THREAD_FRAME) {
+        decoder->config.threading = TELLOC_THREADING_FRAME;
+    } else if (decoder->codec_context->active_thread_type & FF_THREAD_SLICE) {
+        decoder->config.threading = TELLOC_THREADING_SLICE;
+    } else {
+        decoder->config.threading = TELLOC_THREADING_NONE;
+        decoder->config.thread_count = 1;
+    }
     decoder->frame = av_frame_alloc();
     if (!decoder->frame) {
         return 1;
     }
-    decoder->frame_rgb = av_frame_alloc();
-    if (!decoder->frame_rgb) {
-        return 1;
-    }
     decoder->packet = av_packet_alloc();
     if (!decoder->packet) {
         return 1;
     }
-
-    av_image_alloc(decoder->frame_rgb->data, decoder->frame_rgb->linesize, decoder->codec_context->width, decoder->codec_context->height, AV_PIX_FMT_RGB24, 1);
-
-    decoder->frame_ready = 0;
-    decoder->frame_size = 0;
-    decoder->frame_width = 0;
-    decoder->frame_height = 0;
-    decoder->frame_channels = 0;
-    decoder->frame_buffer_size = 0;
-    decoder->frame_buffer = NULL;
     return 0;
 }
 
-// function to attempt to decode an h264 video frame
-int telloc_video_decoder_decode(telloc_video_decoder* decoder, unsigned char* video_stream, unsigned int video_stream_length) {
-    // decode the video frame
-    av_packet_unref(decoder->packet);
-    decoder->packet = av_packet_alloc();
-    decoder->packet->data = video_stream;
-    decoder->packet->size = (int) video_stream_length;
-    avcodec_send_packet(decoder->codec_context, decoder->packet);
+// function to attempt to decode an h264 access unit
+int telloc_video_decoder_decode(telloc_video_decoder* decoder, const telloc_video_unit* unit) {
+    // remember the unit's timings under its pts; the decoder hands the pts back with the picture
+    telloc_frame_info* pending = &decoder->pending[decoder->units_sent % TELLOC_VIDEO_DECODE_DEPTH];
+    memset(pending, 0, sizeof(telloc_frame_info));
+    pending->received_time = unit->received_time;
+    pending->assembled_time = unit->assembled_time;
+    pending->keyframe = unit->keyframe;
 
+    // point the reusable packet at the access unit; the caller keeps ownership of the data
+    decoder->packet->data = (uint8_t*) unit->data;
+    decoder->packet->size = (int) unit->length;
+    decoder->packet->pts = (int64_t) decoder->units_sent++;
+    if (avcodec_send_packet(decoder->codec_context, decoder->packet) < 0) {
+        decoder->errors++;
+        return 1;
+    }
+
+    return telloc_video_decoder_receive(decoder);
+}
+
+// function to get the next decoded frame
+int telloc_video_decoder_receive(telloc_video_decoder* decoder) {
     // check if the frame is ready
-    if (avcodec_receive_frame(decoder->codec_context, decoder->frame)) {
-        // frame not ready
+    int result = avcodec_receive_frame(decoder->codec_context, decoder->frame);
+    if (result != 0) {
+        // frame not ready, unless the decoder failed
+        if (result != AVERROR(EAGAIN) && result != AVERROR_EOF) {
+            decoder->errors++;
+        }
         return 1;
     }
 
     // frame is ready
+    decoder->frame_width = decoder->frame->width;
+    decoder->frame_height = decoder->frame->height;
+
+    // find the timings of the unit the picture came from
+    int64_t pts = decoder->frame->pts;
+    if (pts != AV_NOPTS_VALUE && pts >= 0 && (unsigned long long) pts < decoder->units_sent && decoder->units_sent - (unsigned long long) pts <= TELLOC_VIDEO_DECODE_DEPTH) {
+        decoder->info = decoder->pending[pts % TELLOC_VIDEO_DECODE_DEPTH];
+    } else {
+        memset(&decoder->info, 0, sizeof(decoder->info));
+    }
+    decoder->info.sequence = ++decoder->frames_decoded;
+    decoder->info.decoded_time = telloc_time();
+
+    return 0;
+}
 
-    // convert the image to rgb24 and save in PIX_FMT_RGB24
-    sws_scale(decoder->sws_context, (const uint8_t* const*)decoder->frame->data, decoder->frame->linesize, 0, decoder->codec_context->height, decoder->frame_rgb->data, decoder->frame_rgb->linesize);
+// function to get the size of a frame in a pixel format, packed without row padding
+unsigned int telloc_video_frame_size(telloc_pixel_format format, unsigned int width, unsigned int height) {
+    int size = av_image_get_buffer_size(telloc_video_pixel_format(format), (int) width, (int) height, 1);
+    return size > 0 ? (unsigned int) size : 0;
+}
 
-    // copy the frame data to the frame buffer
-    decoder->frame_width = decoder->codec_context->width;
-    decoder->frame_height = decoder->codec_context->height;
-    decoder->frame_channels = 3;
-    decoder->frame_size = decoder->frame_width*decoder->frame_height*decoder->frame_channels;
-    if (decoder->frame_buffer_size < decoder->frame_size) {
-        decoder->frame_buffer_size = decoder->frame_size*2;
-        decoder->frame_buffer = realloc(decoder->frame_buffer, decoder->frame_buffer_size);
+// function to copy a frame's planes into a packed buffer
+void telloc_video_frame_copy(const telloc_frame* frame, unsigned char* destination) {
+    for (int plane = 0; plane < frame->plane_count; plane++) {
+        // bytes per row and rows of this plane
+        unsigned int row = frame->width;
+        unsigned int rows = frame->height;
+        if (frame->format == TELLOC_FORMAT_RGB24 || frame->format == TELLOC_FORMAT_BGR24) {
+            row = frame->width * 3;
+        } else if (frame->format == TELLOC_FORMAT_BGRA) {
+            row = frame->width * 4;
+        } else if (plane > 0) {
+            row = frame->format == TELLOC_FORMAT_NV12 ? (frame->width + 1) / 2 * 2 : (frame->width + 1) / 2;
+            rows = (frame->height + 1) / 2;
+        }
+        if (frame->strides[plane] == row) {
+            memcpy(destination, frame->planes[plane], row * rows);
+            destination += row * rows;
+            continue;
+        }
+        for (unsigned int y = 0; y < rows; y++) {
+            memcpy(destination, frame->planes[plane] + y * frame->strides[plane], row);
+            destination += row;
+        }
     }
+}
 
-    av_image_copy_to_buffer(decoder->frame_buffer, decoder->frame_buffer_size, (const uint8_t* const*)decoder->frame_rgb->data, (const int*)decoder->frame_rgb->linesize, AV_PIX_FMT_RGB24, decoder->codec_context->width, decoder->codec_context->height, 1);
+// function to tell whether a format can be handed out as a reference to the decoded planes
+static int telloc_video_passthrough(const AVFrame* picture, telloc_pixel_format format) {
+    int decoded_yuv = picture->format == AV_PIX_FMT_YUV420P || picture->format == AV_PIX_FMT_YUVJ420P;
+    return decoded_yuv && (format == TELLOC_FORMAT_YUV420P || format == TELLOC_FORMAT_GRAY8);
+}
+
+// function to reference the last decoded picture from a slot; nothing is converted until the frame is read
+int telloc_video_decoder_reference(telloc_video_decoder* decoder, telloc_frame_slot* slot) {
+    telloc_pixel_format format = decoder->config.format;
+    unsigned int width = (unsigned int) decoder->frame_width;
+    unsigned int height = (unsigned int) decoder->frame_height;
+    telloc_frame* frame = &slot->frame;
 
-    // set the frame ready flag
-    decoder->frame_ready = 1;
+    // drop the picture this slot referenced the last time it was used, and everything converted from it
+    av_frame_unref(slot->picture);
+    slot->converted = 0;
+    if (av_frame_ref(slot->picture, decoder->frame) < 0) {
+        return 1;
+    }
 
+    // what a reader needs to know before the conversion, e.g. to size its buffer
+    frame->width = width;
+    frame->height = height;
+    frame->format = format;
+    frame->bytes = telloc_video_frame_size(format, width, height);
+    frame->data = NULL;
+    frame->plane_count = 0;
+    memset(frame->planes, 0, sizeof(frame->planes));
+    memset(frame->strides, 0, sizeof(frame->strides));
+    frame->info = decoder->info;
     return 0;
 }
 
-// function to check if a frame is a valid h264 start code
-int telloc_video_decoder_is_start_code(const unsigned char* video_stream, unsigned int video_stream_length) {
-    if (video_stream_length < 4) {
+// function to get a held slot's frame in a pixel format, converting it once
+int telloc_frame_slot_convert(telloc_frame_slot* slot, telloc_pixel_format format, telloc_convert_pool* pool, telloc_frame** frame) {
+    if ((unsigned int) format >= TELLOC_VIDEO_FORMAT_COUNT) {
+        return 1;
+    }
+    telloc_frame* target = format == slot->frame.format ? &slot->frame : &slot->views[format];
+    if (slot->converted & (1u << format)) {
+        *frame = target;
         return 0;
     }
-    if (video_stream[0] == 0x00 && video_stream[1] == 0x00 && video_stream[2] == 0x00 && video_stream[3] == 0x01) {
-        return 1;
+
+    AVFrame* picture = slot->picture;
+    unsigned int width = slot->frame.width;
+    unsigned int height = slot->frame.height;
+    if (target != &slot->frame) {
+        target->width = width;
+        target->height = height;
+        target->format = format;
+        target->bytes = telloc_video_frame_size(format, width, height);
+        target->info = slot->frame.info;
+    }
+    memset(target->planes, 0, sizeof(target->planes));
+    memset(target->strides, 0, sizeof(target->strides));
+
+    // the decoder already produces planar yuv; hand out its planes instead of converting
+    if (telloc_video_passthrough(picture, format)) {
+        target->plane_count = format == TELLOC_FORMAT_GRAY8 ? 1 : 3;
+        for (int plane = 0; plane < target->plane_count; plane++) {
+            target->planes[plane] = picture->data[plane];
+            target->strides[plane] = (unsigned int) picture->linesize[plane];
+        }
+        target->data = target->planes[0];
+        target->info.converted_time = telloc_time();
+        slot->converted |= 1u << format;
+        *frame = target;
+        return 0;
+    }
+
+    // the pool is preallocated for the Tello stream in the connection's format, other formats allocate on first use
+    if (slot->buffer_sizes[format] < target->bytes) {
+        unsigned char* buffer = realloc(slot->buffers[format], target->bytes);
+        if (buffer == NULL) {
+            return 1;
+        }
+        slot->buffers[format] = buffer;
+        slot->buffer_sizes[format] = target->bytes;
+    }
+
+    uint8_t* data[4];
+    int linesize[4];
+    enum AVPixelFormat destination = telloc_video_pixel_format(format);
+    av_image_fill_arrays(data, linesize, slot->buffers[format], destination, (int) width, (int) height, 1);
+
+    if (picture->format == AV_PIX_FMT_YUV420P && telloc_convert_supported(format)) {
+        // the Tello stream's packed formats take the vector kernels, spread over the connection's conversion threads
+        telloc_convert_job job;
+        for (int plane = 0; plane < 3; plane++) {
+            job.planes[plane] = picture->data[plane];
+            job.strides[plane] = (unsigned int) picture->linesize[plane];
+        }
+        job.destination = data[0];
+        job.destination_stride = (unsigned int) linesize[0];
+        job.width = width;
+        job.height = height;
+        job.format = format;
+        job.isa = telloc_convert_best_isa();
+        if (pool != NULL) {
+            telloc_convert_pool_run(pool, &job);
+        } else {
+            telloc_convert_rows(&job, 0, height);
+        }
+    } else {
+        // the context is only rebuilt when the decoded size differs from the one it was made for
+        slot->sws_contexts[format] = sws_getCachedContext(slot->sws_contexts[format], (int) width, (int) height, (enum AVPixelFormat) picture->format, (int) width, (int) height, destination, SWS_BILINEAR, NULL, NULL, NULL);
+        if (!slot->sws_contexts[format]) {
+            return 1;
+        }
+        sws_scale(slot->sws_contexts[format], (const uint8_t* const*) picture->data, picture->linesize, 0, (int) height, data, linesize);
     }
+
+    target->plane_count = 0;
+    for (int plane = 0; plane < 3 && data[plane] != NULL && linesize[plane] > 0; plane++) {
+        target->planes[plane] = data[plane];
+        target->strides[plane] = (unsigned int) linesize[plane];
+        target->plane_count++;
+    }
+    target->data = slot->buffers[format];
+    target->info.converted_time = telloc_time();
+    slot->converted |= 1u << format;
+    *frame = target;
+
     return 0;
 }
 
@@ -131,13 +312,339 @@ int telloc_video_decoder_free(telloc_video_decoder* decoder) {
     if (decoder->frame) {
         av_frame_free(&decoder->frame);
     }
-    if(decoder->frame_rgb){
-        av_frame_free(&decoder->frame_rgb);
-    }
     av_packet_free(&decoder->packet);
-    av_freep(&decoder->frame_buffer);
-    sws_freeContext(decoder->sws_context);
     return 0;
 }
 
 
+// function to initialize the access unit reassembler
+int telloc_video_reassembler_init(telloc_video_reassembler* reassembler) {
+    memset(reassembler, 0, sizeof(telloc_video_reassembler));
+    reassembler->capacity = 65507 * 2;
+    reassembler->fragment_size = TELLOC_VIDEO_FRAGMENT_SIZE;
+    reassembler->buffer = malloc(reassembler->capacity);
+    if (reassembler->buffer == NULL) {
+        return 1;
+    }
+    return 0;
+}
+
+// function to find the first h264 start code (00 00 01) at or after offset; returns length if there is none
+unsigned int telloc_video_find_start_code(const unsigned char* data, unsigned int offset, unsigned int length) {
+    for (unsigned int i = offset; i + 2 < length; i++) {
+        // skip ahead quickly while the middle byte can't be part of a start code
+        if (data[i + 1] != 0) {
+            i++;
+            continue;
+        }
+        if (data[i] == 0 && data[i + 2] == 1) {
+            return i;
+        }
+    }
+    return length;
+}
+
+// function to drop the unit in progress and skip data until the next start code
+static void telloc_video_reassembler_reset(telloc_video_reassembler* reassembler) {
+    if (!reassembler->discarding) {
+        reassembler->units_discarded++;
+    }
+    reassembler->discarding = 1;
+    reassembler->size = 0;
+    reassembler->returned = 0;
+    reassembler->scan = 0;
+    reassembler->has_picture = 0;
+    reassembler->keyframe = 0;
+    reassembler->nal_ended = 0;
+}
+
+// function to remove the unit handed out by the last call to next from the buffer
+static void telloc_video_reassembler_compact(telloc_video_reassembler* reassembler) {
+    if (reassembler->returned == 0) {
+        return;
+    }
+    reassembler->size -= reassembler->returned;
+    memmove(reassembler->buffer, reassembler->buffer + reassembler->returned, reassembler->size);
+    reassembler->scan -= reassembler->returned;
+    reassembler->returned = 0;
+}
+
+// function to append a udp datagram to the reassembler
+int telloc_video_reassembler_push(telloc_video_reassembler* reassembler, const unsigned char* datagram, unsigned int datagram_length, unsigned long long time) {
+    telloc_video_reassembler_compact(reassembler);
+
+    // a datagram that lands in an empty buffer holds the first byte of the next unit
+    reassembler->last_time = time;
+    if (reassembler->size == 0) {
+        reassembler->unit_time = time;
+    }
+
+    // a unit must begin with a start code; anything before one belongs to a unit we lost the start of
+    if (reassembler->size == 0) {
+        unsigned int start = telloc_video_find_start_code(datagram, 0, datagram_length);
+        if (start > 0 && start < datagram_length && datagram[start - 1] == 0) {
+            start--;
+        }
+        if (start > 0 && !reassembler->discarding) {
+            reassembler->units_discarded++;
+        }
+        if (start >= datagram_length) {
+            reassembler->discarding = 1;
+            return 1;
+        }
+        reassembler->discarding = 0;
+        reassembler->scan = 0;
+        datagram += start;
+        datagram_length -= start;
+    }
+
+    // drop units that grow past any sane picture size
+    if (reassembler->size + datagram_length > TELLOC_VIDEO_UNIT_MAX) {
+        telloc_video_reassembler_reset(reassembler);
+        return 1;
+    }
+
+    // grow the buffer by doubling
+    if (reassembler->size + datagram_length > reassembler->capacity) {
+        unsigned int capacity = reassembler->capacity;
+        while (capacity < reassembler->size + datagram_length) {
+            capacity *= 2;
+        }
+        unsigned char* buffer = realloc(reassembler->buffer, capacity);
+        if (buffer == NULL) {
+            telloc_video_reassembler_reset(reassembler);
+            return 1;
+        }
+        reassembler->buffer = buffer;
+        reassembler->capacity = capacity;
+    }
+
+    memcpy(reassembler->buffer + reassembler->size, datagram, datagram_length);
+    reassembler->size += datagram_length;
+    reassembler->nal_ended = datagram_length < reassembler->fragment_size;
+    return 0;
+}
+
+// function to get the next complete access unit
+int telloc_video_reassembler_next(telloc_video_reassembler* reassembler, telloc_video_unit* unit) {
+    telloc_video_reassembler_compact(reassembler);
+    unsigned char* buffer = reassembler->buffer;
+
+    // walk the nal units that started since the last call
+    int header_pending = 0;
+    while (reassembler->scan < reassembler->size) {
+        unsigned int position = telloc_video_find_start_code(buffer, reassembler->scan, reassembler->size);
+        if (position == reassembler->size) {
+            // keep the last bytes; they may be the beginning of a start code split across datagrams
+            reassembler->scan = reassembler->size > 3 ? reassembler->size - 3 : 0;
+            break;
+        }
+        // wait for the nal header and the first slice header byte
+        if (position + 4 >= reassembler->size) {
+            reassembler->scan = position;
+            header_pending = 1;
+            break;
+        }
+        unsigned int nal_start = position > 0 && buffer[position - 1] == 0 ? position - 1 : position;
+        int nal_type = buffer[position + 3] & 0x1f;
+        int is_slice = nal_type == 1 || nal_type == 5;
+        reassembler->scan = position + 3;
+
+        // an access unit delimiter, sei, parameter set or the first slice of a picture starts a new access unit
+        int starts_unit = nal_type == 6 || nal_type == 7 || nal_type == 8 || nal_type == 9
+                          || (is_slice && (buffer[position + 4] & 0x80));
+        if (starts_unit && reassembler->has_picture && nal_start > 0) {
+            unit->data = buffer;
+            unit->length = nal_start;
+            unit->keyframe = reassembler->keyframe;
+            unit->received_time = reassembler->unit_time;
+            unit->assembled_time = telloc_time();
+            // the next unit began in the datagram that revealed this unit's end
+            reassembler->unit_time = reassembler->last_time;
+            reassembler->returned = nal_start;
+            reassembler->has_picture = is_slice;
+            reassembler->keyframe = nal_type == 5;
+            reassembler->units_emitted++;
+            return 0;
+        }
+
+        if (is_slice) {
+            reassembler->has_picture = 1;
+            reassembler->keyframe |= nal_type == 5;
+        }
+    }
+
+    // a short datagram ended the picture's slice, so the unit is complete without waiting for the next one
+    if (reassembler->nal_ended && reassembler->has_picture && !header_pending) {
+        unit->data = buffer;
+        unit->length = reassembler->size;
+        unit->keyframe = reassembler->keyframe;
+        unit->received_time = reassembler->unit_time;
+        unit->assembled_time = telloc_time();
+        reassembler->returned = reassembler->size;
+        reassembler->scan = reassembler->size;
+        reassembler->has_picture = 0;
+        reassembler->keyframe = 0;
+        reassembler->nal_ended = 0;
+        reassembler->units_emitted++;
+        return 0;
+    }
+
+    return 1;
+}
+
+// function to free the reassembler buffer
+void telloc_video_reassembler_free(telloc_video_reassembler* reassembler) {
+    free(reassembler->buffer);
+    reassembler->buffer = NULL;
+    reassembler->size = 0;
+    reassembler->capacity = 0;
+}
+
+// function to initialize an empty unit queue; slot buffers are allocated as units arrive
+void telloc_video_unit_queue_init(telloc_video_unit_queue* queue) {
+    memset(queue, 0, sizeof(telloc_video_unit_queue));
+}
+
+// function to copy a unit into the queue
+int telloc_video_unit_queue_push(telloc_video_unit_queue* queue, const telloc_video_unit* unit) {
+    // after a drop the decoder would only produce garbage until the next keyframe, so skip straight to it
+    if (queue->waiting_keyframe && !unit->keyframe) {
+        queue->units_dropped++;
+        return 1;
+    }
+    if (queue->count == TELLOC_VIDEO_QUEUE_SIZE) {
+        queue->waiting_keyframe = 1;
+        queue->units_dropped++;
+        return 1;
+    }
+
+    unsigned int index = (queue->head + queue->count) % TELLOC_VIDEO_QUEUE_SIZE;
+    if (queue->capacities[index] < unit->length) {
+        unsigned char* buffer = realloc(queue->buffers[index], unit->length);
+        if (buffer == NULL) {
+            queue->waiting_keyframe = 1;
+            queue->units_dropped++;
+            return 1;
+        }
+        queue->buffers[index] = buffer;
+        queue->capacities[index] = unit->length;
+    }
+    memcpy(queue->buffers[index], unit->data, unit->length);
+    queue->units[index] = *unit;
+    queue->units[index].data = queue->buffers[index];
+    queue->count++;
+    queue->waiting_keyframe = 0;
+    return 0;
+}
+
+// function to get the oldest unit, or NULL if the queue is empty
+const telloc_video_unit* telloc_video_unit_queue_peek(const telloc_video_unit_queue* queue) {
+    if (queue->count == 0) {
+        return NULL;
+    }
+    return &queue->units[queue->head];
+}
+
+// function to remove the oldest unit once it is decoded
+void telloc_video_unit_queue_pop(telloc_video_unit_queue* queue) {
+    if (queue->count == 0) {
+        return;
+    }
+    queue->head = (queue->head + 1) % TELLOC_VIDEO_QUEUE_SIZE;
+    queue->count--;
+}
+
+// function to free the unit queue's buffers
+void telloc_video_unit_queue_free(telloc_video_unit_queue* queue) {
+    for (int i = 0; i < TELLOC_VIDEO_QUEUE_SIZE; i++) {
+        free(queue->buffers[i]);
+        queue->buffers[i] = NULL;
+        queue->capacities[i] = 0;
+    }
+    queue->count = 0;
+}
+
+// function to preallocate the frame pool buffers
+int telloc_frame_pool_init(telloc_frame_pool* pool, telloc_pixel_format format) {
+    memset(pool, 0, sizeof(telloc_frame_pool));
+    // passthrough formats reference the decoder's pictures and need no buffers of their own
+    unsigned int buffer_size = format == TELLOC_FORMAT_YUV420P || format == TELLOC_FORMAT_GRAY8 ? 0 : telloc_video_frame_size(format, TELLOC_FRAME_WIDTH, TELLOC_FRAME_HEIGHT);
+    for (int i = 0; i < TELLOC_FRAME_POOL_SIZE; i++) {
+        telloc_frame_slot* slot = &pool->slots[i];
+        slot->frame.format = format;
+        slot->picture = av_frame_alloc();
+        slot->buffers[format] = buffer_size > 0 ? malloc(buffer_size) : NULL;
+        if (slot->picture == NULL || (buffer_size > 0 && slot->buffers[format] == NULL)) {
+            telloc_frame_pool_free(pool);
+            return 1;
+        }
+        slot->buffer_sizes[format] = buffer_size;
+    }
+    return 0;
+}
+
+// function to take an unused slot for writing
+telloc_frame_slot* telloc_frame_pool_take(telloc_frame_pool* pool) {
+    for (int i = 0; i < TELLOC_FRAME_POOL_SIZE; i++) {
+        telloc_frame_slot* slot = &pool->slots[i];
+        if (slot->refcount == 0) {
+            // the writer's reference
+            slot->refcount = 1;
+            return slot;
+        }
+    }
+    // every slot is the latest frame, being written, or held by a consumer
+    pool->frames_dropped++;
+    return NULL;
+}
+
+// function to make a written slot the latest frame
+void telloc_frame_pool_publish(telloc_frame_pool* pool, telloc_frame_slot* slot) {
+    // the writer's reference becomes the pool's reference, drop the one on the old frame
+    if (pool->latest != NULL) {
+        pool->latest->refcount--;
+        if (pool->latest_unread) {
+            pool->frames_overwritten++;
+        }
+    }
+    slot->frame.info.frames_overwritten = pool->frames_overwritten;
+    pool->latest = slot;
+    pool->latest_unread = 1;
+}
+
+// function to reference the latest frame if it has not been handed out yet
+telloc_frame_slot* telloc_frame_pool_acquire(telloc_frame_pool* pool) {
+    if (pool->latest == NULL || !pool->latest_unread) {
+        return NULL;
+    }
+    pool->latest->refcount++;
+    pool->latest_unread = 0;
+    pool->frames_overwritten = 0;
+    return pool->latest;
+}
+
+// function to drop a reference to a slot
+void telloc_frame_pool_release(telloc_frame_pool* pool, telloc_frame_slot* slot) {
+    if (slot->refcount > 0) {
+        slot->refcount--;
+    }
+}
+
+// function to free the frame pool buffers
+void telloc_frame_pool_free(telloc_frame_pool* pool) {
+    for (int i = 0; i < TELLOC_FRAME_POOL_SIZE; i++) {
+        telloc_frame_slot* slot = &pool->slots[i];
+        for (int format = 0; format < TELLOC_VIDEO_FORMAT_COUNT; format++) {
+            free(slot->buffers[format]);
+            slot->buffers[format] = NULL;
+            slot->buffer_sizes[format] = 0;
+            sws_freeContext(slot->sws_contexts[format]);
+            slot->sws_contexts[format] = NULL;
+        }
+        av_frame_free(&slot->picture);
+    }
+    pool->latest = NULL;
+}
+
+
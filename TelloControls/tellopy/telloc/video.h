@@ -3,6 +3,9 @@
 #ifndef TELLOC_VIDEO_H
 #define TELLOC_VIDEO_H
 
+#include "telloc.h"
+#include "convert.h"
+
 // include the ffmpeg libraries
 #include "libavcodec/avcodec.h"
 #include <libswscale/swscale.h>
@@ -10,6 +13,116 @@
 // include for codec advanced usage
 #include "libavutil/opt.h"
 
+// number of preallocated frames shared between the decoder and consumers
+#define TELLOC_FRAME_POOL_SIZE 4
+
+// size of the Tello stream, used to preallocate the pool
+#define TELLOC_FRAME_WIDTH 960
+#define TELLOC_FRAME_HEIGHT 720
+
+
+// the Tello splits every nal unit into datagrams of this size; a shorter datagram ends a nal unit
+#define TELLOC_VIDEO_FRAGMENT_SIZE 1460
+
+// access units larger than this are dropped as corrupt
+#define TELLOC_VIDEO_UNIT_MAX (2 * 1024 * 1024)
+
+// access units the decoder can hold before returning their pictures (frame threading delays by one per thread)
+#define TELLOC_VIDEO_DECODE_DEPTH 64
+
+// number of telloc_pixel_format values, for per-format tables
+#define TELLOC_VIDEO_FORMAT_COUNT (TELLOC_FORMAT_BGRA + 1)
+
+
+// a complete access unit handed out by the reassembler
+typedef struct {
+    const unsigned char* data;
+    unsigned int length;
+    int keyframe;
+    // when the datagram holding the unit's first byte was received
+    unsigned long long received_time;
+    // when the unit was found to be complete
+    unsigned long long assembled_time;
+} telloc_video_unit;
+
+
+// struct to reassemble h264 access units from udp datagrams.
+// start codes are found anywhere in the datagrams, not only at their start. An access
+// unit is complete as soon as its picture's last datagram arrives (the Tello sends one
+// slice per picture), or at the latest when the next access unit starts.
+typedef struct {
+    unsigned char* buffer;
+    unsigned int size;
+    unsigned int capacity;
+    // datagrams shorter than this end a nal unit; 0 to only split on start codes
+    unsigned int fragment_size;
+    // bytes at the start of the buffer handed out by the last call to next
+    unsigned int returned;
+    // offset to continue searching for start codes from
+    unsigned int scan;
+    int has_picture;
+    int keyframe;
+    // the last datagram was short, so it ended a nal unit
+    int nal_ended;
+    // data is dropped until the next start code
+    int discarding;
+    // receive times of the unit in progress and of the last datagram
+    unsigned long long unit_time;
+    unsigned long long last_time;
+    unsigned long units_emitted;
+    unsigned long units_discarded;
+} telloc_video_reassembler;
+
+// access units waiting for a decoder worker, per connection
+#define TELLOC_VIDEO_QUEUE_SIZE 8
+
+// queue of complete access units between the thread receiving them and the decoder worker decoding them.
+// each slot keeps its buffer, so a steady stream allocates nothing. when the queue is full the unit is dropped,
+// and so is everything after it until the next keyframe. None of the queue functions lock; the caller must
+// serialize access (the reactor's decode mutex).
+typedef struct {
+    telloc_video_unit units[TELLOC_VIDEO_QUEUE_SIZE];
+    unsigned char* buffers[TELLOC_VIDEO_QUEUE_SIZE];
+    unsigned int capacities[TELLOC_VIDEO_QUEUE_SIZE];
+    unsigned int head;
+    unsigned int count;
+    int waiting_keyframe;
+    unsigned long units_dropped;
+} telloc_video_unit_queue;
+
+// a frame buffer in the frame pool; the public frame must stay the first member.
+// the decoder only references its picture here; the picture is converted when a consumer first reads the frame,
+// so frames replaced unread are never converted. converted formats are written to the buffers, passthrough
+// formats reference the decoded picture. only the holder of a slot converts it, so conversion needs no lock.
+typedef struct {
+    // the frame in the connection's pixel format
+    telloc_frame frame;
+    int refcount;
+    // when a reader last acquired the slot
+    unsigned long long acquired_time;
+    AVFrame* picture;
+    // a bit per pixel format the picture has been converted to
+    unsigned int converted;
+    // the frame in other pixel formats, for telloc_convert_frame
+    telloc_frame views[TELLOC_VIDEO_FORMAT_COUNT];
+    unsigned char* buffers[TELLOC_VIDEO_FORMAT_COUNT];
+    unsigned int buffer_sizes[TELLOC_VIDEO_FORMAT_COUNT];
+    // conversions run on the consumers' threads, so each slot has its own scaler per format
+    struct SwsContext* sws_contexts[TELLOC_VIDEO_FORMAT_COUNT];
+} telloc_frame_slot;
+
+// pool of refcounted frames. The pool holds one reference to the latest frame,
+// the decoder holds one reference to the frame it is writing, and each consumer
+// holds one reference per acquired frame. None of the pool functions lock; the
+// caller must serialize access (the connection's video mutex).
+typedef struct {
+    telloc_frame_slot slots[TELLOC_FRAME_POOL_SIZE];
+    telloc_frame_slot* latest;
+    int latest_unread;
+    unsigned int frames_dropped;
+    // frames replaced unread since a frame was last handed out
+    unsigned int frames_overwritten;
+} telloc_frame_pool;
 
 // struct to hold the state of the video decoder
 typedef struct {
@@ -17,27 +130,93 @@ typedef struct {
     const AVCodec* codec;
     AVPacket* packet;
     AVFrame* frame;
-    AVFrame* frame_rgb;
-    struct SwsContext* sws_context;
-    int frame_ready;
-    int frame_size;
     int frame_width;
     int frame_height;
-    int frame_channels;
-    int frame_buffer_size;
-    unsigned char* frame_buffer;
+    // timings of the units sent to the decoder, indexed by packet pts; their pictures can come back later
+    telloc_frame_info pending[TELLOC_VIDEO_DECODE_DEPTH];
+    unsigned long long units_sent;
+    unsigned long long frames_decoded;
+    // access units the codec rejected and pictures it failed to return
+    unsigned long long errors;
+    // the info of the picture in frame
+    telloc_frame_info info;
+    // the options in effect after opening the codec
+    telloc_video_config config;
 } telloc_video_decoder;
 
-// function to initialize the video decoder
-int telloc_video_decoder_init(telloc_video_decoder* decoder);
+// function to initialize the video decoder with the requested threading options
+int telloc_video_decoder_init(telloc_video_decoder* decoder, const telloc_video_config* config);
 
-// function to decode a video_stream frame
-int telloc_video_decoder_decode(telloc_video_decoder* decoder, unsigned char* video_stream, unsigned int video_stream_length);
+// function to decode an access unit; returns 0 when a new frame is held in decoder->frame
+int telloc_video_decoder_decode(telloc_video_decoder* decoder, const telloc_video_unit* unit);
 
-// function to check if a frame is a valid h264 start code
-int telloc_video_decoder_is_start_code(const unsigned char* video_stream, unsigned int video_stream_length);
+// function to get the next decoded frame into decoder->frame; with frame threading one access unit can complete several
+int telloc_video_decoder_receive(telloc_video_decoder* decoder);
+
+// function to reference the last decoded picture from a frame pool slot, to be converted when it is read
+int telloc_video_decoder_reference(telloc_video_decoder* decoder, telloc_frame_slot* slot);
+
+// function to get a held slot's frame in a pixel format, converting the picture the first time that format is asked for.
+// the frame in the slot's own format is the slot's public frame; the others stay valid as long as the slot is held.
+// packed rgb formats are spread over pool's threads, or converted on the calling thread alone if pool is NULL
+int telloc_frame_slot_convert(telloc_frame_slot* slot, telloc_pixel_format format, telloc_convert_pool* pool, telloc_frame** frame);
+
+// function to get the size of a frame in a pixel format, packed without row padding
+unsigned int telloc_video_frame_size(telloc_pixel_format format, unsigned int width, unsigned int height);
+
+// function to copy a frame's planes into a packed buffer of frame->bytes bytes
+void telloc_video_frame_copy(const telloc_frame* frame, unsigned char* destination);
 
 // function to free the video decoder
 int telloc_video_decoder_free(telloc_video_decoder* decoder);
 
+// function to find the first h264 start code (00 00 01) at or after offset; returns length if there is none
+unsigned int telloc_video_find_start_code(const unsigned char* data, unsigned int offset, unsigned int length);
+
+// function to initialize the access unit reassembler
+int telloc_video_reassembler_init(telloc_video_reassembler* reassembler);
+
+// function to append a udp datagram received at time (telloc_time) to the reassembler
+int telloc_video_reassembler_push(telloc_video_reassembler* reassembler, const unsigned char* datagram, unsigned int datagram_length, unsigned long long time);
+
+// function to get the next complete access unit; returns 1 if there is none yet.
+// the unit's data points into the reassembler and is valid until the next push or next call.
+int telloc_video_reassembler_next(telloc_video_reassembler* reassembler, telloc_video_unit* unit);
+
+// function to free the reassembler buffer
+void telloc_video_reassembler_free(telloc_video_reassembler* reassembler);
+
+// function to initialize an empty unit queue
+void telloc_video_unit_queue_init(telloc_video_unit_queue* queue);
+
+// function to copy a unit into the queue; returns 1 if it was dropped because the queue is full or a keyframe is awaited
+int telloc_video_unit_queue_push(telloc_video_unit_queue* queue, const telloc_video_unit* unit);
+
+// function to get the oldest unit without removing it, or NULL if the queue is empty. it keeps its slot until popped
+const telloc_video_unit* telloc_video_unit_queue_peek(const telloc_video_unit_queue* queue);
+
+// function to remove the oldest unit
+void telloc_video_unit_queue_pop(telloc_video_unit_queue* queue);
+
+// function to free the unit queue's buffers
+void telloc_video_unit_queue_free(telloc_video_unit_queue* queue);
+
+// function to preallocate the frame pool buffers for frames converted to format; passthrough formats need none
+int telloc_frame_pool_init(telloc_frame_pool* pool, telloc_pixel_format format);
+
+// function to take an unused slot for writing; returns NULL if every slot is referenced
+telloc_frame_slot* telloc_frame_pool_take(telloc_frame_pool* pool);
+
+// function to make a written slot the latest frame, handing the writer's reference to the pool
+void telloc_frame_pool_publish(telloc_frame_pool* pool, telloc_frame_slot* slot);
+
+// function to reference the latest frame if it has not been handed out yet; returns NULL otherwise
+telloc_frame_slot* telloc_frame_pool_acquire(telloc_frame_pool* pool);
+
+// function to drop a reference to a slot
+void telloc_frame_pool_release(telloc_frame_pool* pool, telloc_frame_slot* slot);
+
+// function to free the frame pool buffers
+void telloc_frame_pool_free(telloc_frame_pool* pool);
+
 #endif //TELLOC_VIDEO_H
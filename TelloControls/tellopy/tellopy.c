@@ -1,7 +1,316 @@
 #include <Python.h>
+#include <stddef.h>
 #include "telloc.h"
 
 static telloc_connection *connection=NULL;
+// frames handed to python and not released yet; the connection can't be closed under them
+static Py_ssize_t frames_held=0;
+// a connection python disconnected from while it still held frames; it is closed when the last of them goes
+static telloc_connection *closing=NULL;
+// commands sent with send_command_async whose callbacks have not run; guarded by the GIL
+static Py_ssize_t commands_pending=0;
+
+// a video frame borrowed from telloc. it exposes the library's frame buffer through the buffer protocol
+// without copying it, (height, width, channels) for packed formats and the (height, width) luma plane otherwise
+typedef struct {
+    PyObject_HEAD
+    telloc_connection *connection;
+    const telloc_frame *frame;
+    // buffer views of the frame that are still alive; the frame is only released once they are gone
+    Py_ssize_t exports;
+    // set when the frame was released while views were alive; the last view to go hands it back
+    int release_pending;
+    int ndim;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+} tellopy_frame;
+
+// parsed state samples, copied out of the library and exposed through the buffer protocol as an array of structs
+typedef struct {
+    PyObject_VAR_HEAD
+    Py_ssize_t shape[1];
+    telloc_state samples[1];
+} tellopy_states;
+
+// the PEP 3118 format of telloc_state, with its field names; numpy turns it into a structured dtype.
+// filled in by PyInit with the padding the compiler put at the end of the struct
+static char tellopy_state_format[512];
+static const char tellopy_state_fields[] =
+    "T{Q:sequence:Q:received_time:i:mid:i:x:i:y:i:z:(3)i:mpry:i:pitch:i:roll:i:yaw:i:vgx:i:vgy:i:vgz:"
+    "i:templ:i:temph:i:tof:i:h:i:bat:f:baro:i:time:f:agx:f:agy:f:agz:";
+
+static PyTypeObject tellopy_frame_type;
+static PyTypeObject tellopy_states_type;
+
+// function to close a connection; its threads are joined without the GIL so callbacks still waiting on it can finish
+static int tellopy_close(telloc_connection *target)
+{
+    int failed;
+    Py_BEGIN_ALLOW_THREADS
+    failed = telloc_disconnect(target);
+    Py_END_ALLOW_THREADS
+    return failed;
+}
+
+// function to hand a python frame's library frame back, and close a connection that was only waiting for it
+static void tellopy_frame_release_frame(tellopy_frame *self)
+{
+    if (self->frame == NULL) {
+        return;
+    }
+    telloc_release_frame(self->connection, self->frame);
+    self->frame = NULL;
+    frames_held--;
+    if (frames_held == 0 && closing != NULL) {
+        tellopy_close(closing);
+        closing = NULL;
+    }
+}
+
+// function to wrap an acquired frame in a python frame
+static PyObject *tellopy_frame_new(const telloc_frame *frame)
+{
+    tellopy_frame *self = PyObject_New(tellopy_frame, &tellopy_frame_type);
+    if (self == NULL) {
+        telloc_release_frame(connection, frame);
+        return NULL;
+    }
+    self->connection = connection;
+    self->frame = frame;
+    self->exports = 0;
+    self->release_pending = 0;
+    frames_held++;
+
+    unsigned int channels = frame->format == TELLOC_FORMAT_BGRA ? 4 : (frame->format == TELLOC_FORMAT_RGB24 || frame->format == TELLOC_FORMAT_BGR24) ? 3 : 1;
+    self->ndim = channels > 1 ? 3 : 2;
+    self->shape[0] = frame->height;
+    self->shape[1] = frame->width;
+    self->shape[2] = channels;
+    self->strides[0] = frame->strides[0];
+    self->strides[1] = channels;
+    self->strides[2] = 1;
+    return (PyObject *) self;
+}
+
+static int tellopy_frame_getbuffer(PyObject *object, Py_buffer *view, int flags)
+{
+    tellopy_frame *self = (tellopy_frame *) object;
+    view->obj = NULL;
+    if (self->frame == NULL || self->release_pending) {
+        PyErr_SetString(PyExc_BufferError, "frame was released");
+        return -1;
+    }
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "frames are read-only; copy the frame to change it");
+        return -1;
+    }
+    Py_ssize_t row = self->shape[1] * self->shape[2];
+    if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES && self->strides[0] != row) {
+        PyErr_SetString(PyExc_BufferError, "frame rows are padded; ask for a strided buffer");
+        return -1;
+    }
+
+    view->buf = self->frame->planes[0];
+    view->obj = object;
+    Py_INCREF(object);
+    view->len = self->shape[0] * row;
+    view->readonly = 1;
+    view->itemsize = 1;
+    view->format = (flags & PyBUF_FORMAT) ? "B" : NULL;
+    view->ndim = self->ndim;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    self->exports++;
+    return 0;
+}
+
+static void tellopy_frame_releasebuffer(PyObject *object, Py_buffer *view)
+{
+    tellopy_frame *self = (tellopy_frame *) object;
+    if (--self->exports == 0 && self->release_pending) {
+        tellopy_frame_release_frame(self);
+    }
+}
+
+static void tellopy_frame_dealloc(PyObject *object)
+{
+    tellopy_frame_release_frame((tellopy_frame *) object);
+    PyObject_Free(object);
+}
+
+static PyObject *tellopy_frame_release(PyObject *self, PyObject *args)
+{
+    // arrays made from the frame keep it until they go
+    tellopy_frame *frame = (tellopy_frame *) self;
+    if (frame->exports > 0) {
+        frame->release_pending = 1;
+    } else {
+        tellopy_frame_release_frame(frame);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *tellopy_frame_enter(PyObject *self, PyObject *args)
+{
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject *tellopy_frame_exit(PyObject *self, PyObject *args)
+{
+    PyObject *result = tellopy_frame_release(self, NULL);
+    if (result == NULL) {
+        return NULL;
+    }
+    Py_DECREF(result);
+    Py_RETURN_FALSE;
+}
+
+// function to get a frame's field, or raise if the frame was released
+static const telloc_frame *tellopy_frame_get(PyObject *self)
+{
+    const telloc_frame *frame = ((tellopy_frame *) self)->frame;
+    if (frame == NULL) {
+        PyErr_SetString(PyExc_ValueError, "frame was released");
+    }
+    return frame;
+}
+
+static PyObject *tellopy_frame_width(PyObject *self, void *closure)
+{
+    const telloc_frame *frame = tellopy_frame_get(self);
+    return frame == NULL ? NULL : PyLong_FromUnsignedLong(frame->width);
+}
+
+static PyObject *tellopy_frame_height(PyObject *self, void *closure)
+{
+    const telloc_frame *frame = tellopy_frame_get(self);
+    return frame == NULL ? NULL : PyLong_FromUnsignedLong(frame->height);
+}
+
+static PyObject *tellopy_frame_sequence(PyObject *self, void *closure)
+{
+    const telloc_frame *frame = tellopy_frame_get(self);
+    return frame == NULL ? NULL : PyLong_FromUnsignedLongLong(frame->info.sequence);
+}
+
+static PyObject *tellopy_frame_received_time(PyObject *self, void *closure)
+{
+    const telloc_frame *frame = tellopy_frame_get(self);
+    return frame == NULL ? NULL : PyLong_FromUnsignedLongLong(frame->info.received_time);
+}
+
+static PyObject *tellopy_frame_keyframe(PyObject *self, void *closure)
+{
+    const telloc_frame *frame = tellopy_frame_get(self);
+    return frame == NULL ? NULL : PyBool_FromLong(frame->info.keyframe);
+}
+
+static PyObject *tellopy_frame_frames_overwritten(PyObject *self, void *closure)
+{
+    const telloc_frame *frame = tellopy_frame_get(self);
+    return frame == NULL ? NULL : PyLong_FromUnsignedLong(frame->info.frames_overwritten);
+}
+
+static PyObject *tellopy_frame_released(PyObject *self, void *closure)
+{
+    return PyBool_FromLong(((tellopy_frame *) self)->frame == NULL);
+}
+
+static PyMethodDef tellopy_frame_methods[] = {
+    {"release", tellopy_frame_release, METH_NOARGS, "Hand the frame back to the library, or once the arrays made from it are gone"},
+    {"__enter__", tellopy_frame_enter, METH_NOARGS, NULL},
+    {"__exit__", tellopy_frame_exit, METH_VARARGS, NULL},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef tellopy_frame_getset[] = {
+    {"width", tellopy_frame_width, NULL, "Width in pixels", NULL},
+    {"height", tellopy_frame_height, NULL, "Height in pixels", NULL},
+    {"sequence", tellopy_frame_sequence, NULL, "Counts decoded frames from 1; gaps are frames that were skipped", NULL},
+    {"received_time", tellopy_frame_received_time, NULL, "When the frame's first datagram arrived, in monotonic nanoseconds", NULL},
+    {"keyframe", tellopy_frame_keyframe, NULL, "True for IDR pictures", NULL},
+    {"frames_overwritten", tellopy_frame_frames_overwritten, NULL, "Frames replaced unread since the previous frame handed out", NULL},
+    {"released", tellopy_frame_released, NULL, "True once the frame was handed back to the library", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyBufferProcs tellopy_frame_buffer = {
+    tellopy_frame_getbuffer,
+    tellopy_frame_releasebuffer
+};
+
+static PyTypeObject tellopy_frame_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "libtellopy.Frame",
+    .tp_basicsize = sizeof(tellopy_frame),
+    .tp_dealloc = tellopy_frame_dealloc,
+    .tp_as_buffer = &tellopy_frame_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "A video frame held from the Tello's stream without copying; numpy.asarray(frame) views it",
+    .tp_methods = tellopy_frame_methods,
+    .tp_getset = tellopy_frame_getset,
+};
+
+// function to make a states object with room for count samples
+static tellopy_states *tellopy_states_new(Py_ssize_t count)
+{
+    tellopy_states *self = PyObject_NewVar(tellopy_states, &tellopy_states_type, count);
+    if (self != NULL) {
+        self->shape[0] = count;
+    }
+    return self;
+}
+
+static int tellopy_states_getbuffer(PyObject *object, Py_buffer *view, int flags)
+{
+    tellopy_states *self = (tellopy_states *) object;
+    view->obj = NULL;
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "states are read-only");
+        return -1;
+    }
+    view->buf = self->samples;
+    view->obj = object;
+    Py_INCREF(object);
+    view->len = self->shape[0] * (Py_ssize_t) sizeof(telloc_state);
+    view->readonly = 1;
+    view->itemsize = sizeof(telloc_state);
+    view->format = (flags & PyBUF_FORMAT) ? tellopy_state_format : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static Py_ssize_t tellopy_states_length(PyObject *object)
+{
+    return ((tellopy_states *) object)->shape[0];
+}
+
+static PyBufferProcs tellopy_states_buffer = {
+    tellopy_states_getbuffer,
+    NULL
+};
+
+static PySequenceMethods tellopy_states_sequence = {
+    .sq_length = tellopy_states_length,
+};
+
+static PyTypeObject tellopy_states_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "libtellopy.States",
+    .tp_basicsize = offsetof(tellopy_states, samples),
+    .tp_itemsize = sizeof(telloc_state),
+    .tp_as_sequence = &tellopy_states_sequence,
+    .tp_as_buffer = &tellopy_states_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Parsed Tello state samples; numpy.asarray(states) is a structured array with the telloc_state fields",
+};
 
 static PyObject *tellopy_connect(PyObject *self, PyObject *args)
 {
@@ -9,8 +318,16 @@ static PyObject *tellopy_connect(PyObject *self, PyObject *args)
         // already connected
         return PyBool_FromLong(1);
     }
+    if (closing) {
+        // the last connection still holds the drone's ports
+        PyErr_SetString(PyExc_RuntimeError, "tellopy.connect() before the frames of the last connection were released");
+        return NULL;
+    }
 
+    // connecting waits for the drone to answer
+    Py_BEGIN_ALLOW_THREADS
     connection = telloc_connect();
+    Py_END_ALLOW_THREADS
     if (!connection) {
         // connect failed
         return PyBool_FromLong(0);
@@ -21,11 +338,11 @@ static PyObject *tellopy_connect(PyObject *self, PyObject *args)
 
 static PyObject *tellopy_send_command(PyObject *self, PyObject *args)
 {
-    PyObject *connection_ptr;
     const char *command;
     unsigned int length;
-    char *response=malloc(sizeof(char) * 1024);
+    char response[1024];
     unsigned int response_length=1024;
+    int failed;
 
     if (!PyArg_ParseTuple(args, "s", &command)) {
         PyErr_SetString(PyExc_TypeError, "tellopy.send_command() takes one string argument");
@@ -33,55 +350,193 @@ static PyObject *tellopy_send_command(PyObject *self, PyObject *args)
     }
     length = strlen(command);
 
-    if (telloc_send_command(connection, command, length, response, response_length)) {
+    // the reply takes up to a few seconds; let other python threads run meanwhile
+    telloc_connection *target = connection;
+    Py_BEGIN_ALLOW_THREADS
+    failed = telloc_send_command(target, command, length, response, response_length);
+    Py_END_ALLOW_THREADS
+    if (failed) {
+        return PyBool_FromLong(0);
+    }
+    return PyUnicode_FromString(response);
+}
+
+// what an async command's callback needs; the module's connection can change before it runs
+typedef struct {
+    telloc_connection *connection;
+    PyObject *done;
+} tellopy_command_user;
+
+// function called on the library's I/O thread when an async command finishes.
+// it takes the GIL to call the python callback with the reply, or None if there was none
+static void tellopy_command_done(telloc_command *command, void *user)
+{
+    tellopy_command_user *context = (tellopy_command_user *) user;
+    PyObject *done = context->done;
+    char response[1024];
+    int replied = telloc_command_poll(context->connection, command) == TELLOC_COMMAND_DONE
+                  && telloc_command_response(context->connection, command, response, sizeof(response)) == 0;
+    telloc_command_release(context->connection, command);
+    PyMem_RawFree(context);
+
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyObject *result = replied ? PyObject_CallFunction(done, "s", response) : PyObject_CallFunctionObjArgs(done, Py_None, NULL);
+    if (result == NULL) {
+        PyErr_WriteUnraisable(done);
+    }
+    Py_XDECREF(result);
+    Py_DECREF(done);
+    commands_pending--;
+    PyGILState_Release(gil);
+}
+
+static PyObject *tellopy_send_command_async(PyObject *self, PyObject *args)
+{
+    const char *command;
+    PyObject *done;
+
+    if (!PyArg_ParseTuple(args, "sO", &command, &done) || !PyCallable_Check(done)) {
+        PyErr_SetString(PyExc_TypeError, "tellopy.send_command_async() takes a string and a callable");
+        return NULL;
+    }
+
+    // queueing never blocks; the callback owns a reference to done until it runs
+    tellopy_command_user *context = PyMem_RawMalloc(sizeof(tellopy_command_user));
+    if (context == NULL) {
+        return PyErr_NoMemory();
+    }
+    context->connection = connection;
+    context->done = done;
+    Py_INCREF(done);
+    commands_pending++;
+    telloc_command *queued = telloc_send_command_async(connection, command, (unsigned int) strlen(command), TELLOC_PRIORITY_NORMAL, -1, tellopy_command_done, context);
+    if (queued == NULL) {
+        commands_pending--;
+        Py_DECREF(done);
+        PyMem_RawFree(context);
         return PyBool_FromLong(0);
     }
-    PyObject *response_obj = PyUnicode_FromString(response);
-    free(response);
-    return response_obj;
+    return PyBool_FromLong(1);
+}
+
+static PyObject *tellopy_frame_fd(PyObject *self, PyObject *args)
+{
+    return PyLong_FromLong(telloc_get_frame_fd(connection));
+}
+
+static PyObject *tellopy_state_fd(PyObject *self, PyObject *args)
+{
+    return PyLong_FromLong(telloc_get_state_fd(connection));
 }
 
 static PyObject *tellopy_read_state(PyObject *self, PyObject *args)
 {
-    PyObject *connection_ptr;
-    char *state_buffer = malloc(sizeof(char) * TELLOC_STATE_SIZE);
+    char state_buffer[TELLOC_STATE_SIZE];
     unsigned int state_buffer_length = TELLOC_STATE_SIZE;
 
     if (telloc_read_state(connection, state_buffer, state_buffer_length)) {
-        return Py_None;
+        Py_RETURN_NONE;
     }
 
     // convert buffer to python string
-    PyObject *state = PyUnicode_FromString(state_buffer);
-    free(state_buffer);
-    return state;
+    return PyUnicode_FromString(state_buffer);
 }
 
-static PyObject *tellopy_read_image(PyObject *self, PyObject *args)
+static PyObject *tellopy_wait_state(PyObject *self, PyObject *args)
 {
-    PyObject *connection_ptr;
-    unsigned char *image_buffer=malloc(sizeof(unsigned char) * TELLOC_VIDEO_SIZE);
-    unsigned int image_buffer_length=TELLOC_VIDEO_SIZE;
-    unsigned int image_bytes=0;
-    unsigned int image_width=0;
-    unsigned int image_height=0;
-    if (telloc_read_image(connection, image_buffer, image_buffer_length, &image_bytes, &image_width, &image_height)) {
-        return Py_None;
+    int timeout_ms = -1;
+    char state_buffer[TELLOC_STATE_SIZE];
+    int failed;
+
+    if (!PyArg_ParseTuple(args, "|i", &timeout_ms)) {
+        return NULL;
     }
-    // nobody knows how to use byes...
-    // so convert buffer to a python list of integers
-    PyObject *image = PyList_New(image_bytes);
-    for (unsigned int i=0; i<image_bytes; i++) {
-        PyList_SetItem(image, i, PyLong_FromLong(image_buffer[i]));
+    telloc_connection *target = connection;
+    Py_BEGIN_ALLOW_THREADS
+    failed = telloc_wait_state(target, timeout_ms, state_buffer, TELLOC_STATE_SIZE);
+    Py_END_ALLOW_THREADS
+    if (failed) {
+        Py_RETURN_NONE;
     }
-    free(image_buffer);
+    return PyUnicode_FromString(state_buffer);
+}
 
-    // return tuple of (image_width, image_height, image_buffer)
-    PyObject *image_tuple = PyTuple_New(3);
-    PyTuple_SetItem(image_tuple, 0, PyLong_FromLong(image_width));
-    PyTuple_SetItem(image_tuple, 1, PyLong_FromLong(image_height));
-    PyTuple_SetItem(image_tuple, 2, image);
-    return image_tuple;
+static PyObject *tellopy_get_state(PyObject *self, PyObject *args)
+{
+    tellopy_states *states = tellopy_states_new(1);
+    if (states == NULL) {
+        return NULL;
+    }
+    if (telloc_get_state(connection, &states->samples[0])) {
+        Py_DECREF(states);
+        Py_RETURN_NONE;
+    }
+    return (PyObject *) states;
+}
+
+static PyObject *tellopy_get_state_history(PyObject *self, PyObject *args)
+{
+    int count = TELLOC_STATE_HISTORY_SIZE;
+    unsigned int copied = 0;
+    int failed;
+
+    if (!PyArg_ParseTuple(args, "|i", &count)) {
+        return NULL;
+    }
+    if (count < 0 || count > TELLOC_STATE_HISTORY_SIZE) {
+        count = TELLOC_STATE_HISTORY_SIZE;
+    }
+    tellopy_states *states = tellopy_states_new(count);
+    if (states == NULL) {
+        return NULL;
+    }
+    // copying a thousand samples is long enough to let other threads run
+    telloc_connection *target = connection;
+    Py_BEGIN_ALLOW_THREADS
+    failed = telloc_get_state_history(target, states->samples, (unsigned int) count, &copied);
+    Py_END_ALLOW_THREADS
+    if (failed) {
+        Py_DECREF(states);
+        Py_RETURN_NONE;
+    }
+    // the unused tail stays allocated but out of the buffer
+    states->shape[0] = copied;
+    return (PyObject *) states;
+}
+
+static PyObject *tellopy_read_image(PyObject *self, PyObject *args)
+{
+    const telloc_frame *frame;
+    int failed;
+
+    // acquiring converts the frame the first time it is read
+    telloc_connection *target = connection;
+    Py_BEGIN_ALLOW_THREADS
+    failed = telloc_acquire_frame(target, &frame);
+    Py_END_ALLOW_THREADS
+    if (failed) {
+        Py_RETURN_NONE;
+    }
+    return tellopy_frame_new(frame);
+}
+
+static PyObject *tellopy_wait_image(PyObject *self, PyObject *args)
+{
+    int timeout_ms = -1;
+    const telloc_frame *frame;
+    int failed;
+
+    if (!PyArg_ParseTuple(args, "|i", &timeout_ms)) {
+        return NULL;
+    }
+    telloc_connection *target = connection;
+    Py_BEGIN_ALLOW_THREADS
+    failed = telloc_wait_frame(target, timeout_ms, &frame);
+    Py_END_ALLOW_THREADS
+    if (failed) {
+        Py_RETURN_NONE;
+    }
+    return tellopy_frame_new(frame);
 }
 
 static PyObject *tellopy_disconnect(PyObject *self, PyObject *args)
@@ -90,8 +545,15 @@ static PyObject *tellopy_disconnect(PyObject *self, PyObject *args)
         // already disconnected
         return PyBool_FromLong(1);
     }
+    if (frames_held > 0) {
+        // arrays still point into the frame pool; stop using the connection now and close it when they are gone
+        closing = connection;
+        connection = NULL;
+        return PyBool_FromLong(1);
+    }
 
-    if (telloc_disconnect(connection)) {
+    // joining the library's threads can take a moment
+    if (tellopy_close(connection)) {
         // disconnect failed... something is wrong
         PyErr_SetString(PyExc_TypeError, "tellopy_disconnect() failed");
         return NULL;
@@ -101,18 +563,32 @@ static PyObject *tellopy_disconnect(PyObject *self, PyObject *args)
     return PyBool_FromLong(1);
 }
 
-// disconnect on free
+// disconnect on free; frames python still holds, or commands whose callbacks would need the interpreter,
+// keep the connection alive until the process goes
 static void tellopy_free(void *module)
 {
-    tellopy_disconnect(NULL, NULL);
+    if (frames_held > 0 || commands_pending > 0) {
+        return;
+    }
+    if (connection != NULL) {
+        telloc_disconnect(connection);
+        connection = NULL;
+    }
 }
 
 
 static PyMethodDef tellopy_methods[] = {
     {"connect", tellopy_connect, METH_VARARGS, "Connect to the Tello drone using the default address"},
     {"send_command", tellopy_send_command, METH_VARARGS, "Send a command to the Tello drone and receive a response"},
-    {"read_state", tellopy_read_state, METH_VARARGS, "Receive the most recent state of the Tello drone"},
-    {"read_image", tellopy_read_image, METH_VARARGS, "Receive an RGB format video frame from the Tello drone"},
+    {"send_command_async", tellopy_send_command_async, METH_VARARGS, "Queue a command and return at once; done is called with the response, or None, on the library's I/O thread"},
+    {"frame_fd", tellopy_frame_fd, METH_VARARGS, "Get a file descriptor that is readable while an unread frame is waiting; -1 on Windows"},
+    {"state_fd", tellopy_state_fd, METH_VARARGS, "Get a file descriptor that is readable while an unread state is waiting; -1 on Windows"},
+    {"read_state", tellopy_read_state, METH_VARARGS, "Receive the most recent state string of the Tello drone"},
+    {"wait_state", tellopy_wait_state, METH_VARARGS, "Wait up to timeout_ms milliseconds for a new state string"},
+    {"get_state", tellopy_get_state, METH_VARARGS, "Get the most recent parsed state as a States buffer of one sample"},
+    {"get_state_history", tellopy_get_state_history, METH_VARARGS, "Get up to the last count parsed states as a States buffer, oldest first"},
+    {"read_image", tellopy_read_image, METH_VARARGS, "Hold the newest RGB video frame without copying it, or get None if there is none"},
+    {"wait_image", tellopy_wait_image, METH_VARARGS, "Wait up to timeout_ms milliseconds for a new video frame and hold it"},
     {"disconnect", tellopy_disconnect, METH_VARARGS, "Disconnect from the Tello drone"},
     {NULL, NULL, 0, NULL}
 };
@@ -129,12 +605,40 @@ static struct PyModuleDef tellopy_module = {
     &tellopy_free
 };
 
+// function to create the module and its types
+static PyObject *tellopy_create(void)
+{
+    // the padding at the end of telloc_state, so the format's size matches the struct's
+    size_t padding = sizeof(telloc_state) - (offsetof(telloc_state, agz) + sizeof(float));
+    if (padding > 0) {
+        PyOS_snprintf(tellopy_state_format, sizeof(tellopy_state_format), "%s%ux}", tellopy_state_fields, (unsigned int) padding);
+    } else {
+        PyOS_snprintf(tellopy_state_format, sizeof(tellopy_state_format), "%s}", tellopy_state_fields);
+    }
+
+    if (PyType_Ready(&tellopy_frame_type) < 0 || PyType_Ready(&tellopy_states_type) < 0) {
+        return NULL;
+    }
+    PyObject *module = PyModule_Create(&tellopy_module);
+    if (module == NULL) {
+        return NULL;
+    }
+    Py_INCREF(&tellopy_frame_type);
+    Py_INCREF(&tellopy_states_type);
+    if (PyModule_AddObject(module, "Frame", (PyObject *) &tellopy_frame_type) < 0
+        || PyModule_AddObject(module, "States", (PyObject *) &tellopy_states_type) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
+
 PyMODINIT_FUNC PyInit_tellopy(void)
 {
-    return PyModule_Create(&tellopy_module);
+    return tellopy_create();
 }
 
 PyMODINIT_FUNC PyInit_libtellopy(void)
 {
-    return PyModule_Create(&tellopy_module);
+    return tellopy_create();
 }
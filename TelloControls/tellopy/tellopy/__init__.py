@@ -1,5 +1,12 @@
+import numpy
+
 from . import libtellopy
 
+# a video frame held from the stream without copying; numpy.asarray(frame) views its pixels
+Frame = libtellopy.Frame
+# parsed state samples; numpy.asarray(states) is a structured array with the telloc_state fields
+States = libtellopy.States
+
 
 def connect():
     """
@@ -18,10 +25,44 @@ def send_command(command):
     return libtellopy.send_command(command)
 
 
-def read_image():
+def _frame_array(frame, copy):
+    if frame is None:
+        return None
+    if not copy:
+        return numpy.asarray(frame)
+    image = numpy.array(frame)
+    frame.release()
+    return image
+
+
+def read_image(copy=False):
     """
-    Read a frame from the video stream, returning a tuple of (height, width, flat) where flat is a list of RGB values.
-    :return: height, width, rgblist
+    Read the newest frame from the video stream as a (height, width, 3) uint8 RGB array, or None if no frame was decoded
+    since the last read.
+    The array is a read-only view of the library's frame buffer, so nothing is copied; the frame goes back to the library
+    when the array is garbage collected. The library only has a few frame buffers, so don't keep many of these around.
+    :param copy: return a writable copy instead and hand the frame back right away
+    :return: numpy array or None
+    """
+    return _frame_array(libtellopy.read_image(), copy)
+
+
+def wait_image(timeout_ms=-1, copy=False):
+    """
+    Wait up to timeout_ms milliseconds (-1 waits forever) for a new frame and read it like read_image.
+    Other Python threads run while this waits.
+    :return: numpy array or None on timeout
+    """
+    return _frame_array(libtellopy.wait_image(timeout_ms), copy)
+
+
+def read_frame():
+    """
+    Hold the newest frame from the video stream, or get None if no frame was decoded since the last read.
+    Use it as a context manager, or call release(), to hand it back as soon as you are done:
+        with tellopy.read_frame() as frame:
+            image = numpy.asarray(frame)
+    :return: Frame or None
     """
     return libtellopy.read_image()
 
@@ -34,11 +75,42 @@ def read_state():
     return libtellopy.read_state()
 
 
+def wait_state(timeout_ms=-1):
+    """
+    Wait up to timeout_ms milliseconds (-1 waits forever) for a state newer than the last one read, and read it.
+    :return: string of comma-separated state information, or None on timeout
+    """
+    return libtellopy.wait_state(timeout_ms)
+
+
+def get_state():
+    """
+    Get the most recent parsed state, e.g. state['pitch'] or state['bat'], or None if none was received yet.
+    :return: numpy record with the fields of telloc_state
+    """
+    states = libtellopy.get_state()
+    return None if states is None else numpy.asarray(states)[0]
+
+
+def get_state_history(count=1024):
+    """
+    Get up to the last count parsed states, oldest first, e.g. history['h'] is the height over time.
+    :return: numpy structured array with the fields of telloc_state
+    """
+    states = libtellopy.get_state_history(count)
+    return None if states is None else numpy.asarray(states)
+
+
 def disconnect():
     """
     Disconnect from the Tello drone.
+    Arrays still viewing frames keep the connection open until they are gone; connect() raises until then.
     Throws and exception if there is a problme disconnecting. But honestly, you are likely to segfault in that case.
     :return: True if disconnected or disconnection successful.
     """
     return libtellopy.disconnect()
 
+
+# the asyncio interface
+from .aio import Drone
+
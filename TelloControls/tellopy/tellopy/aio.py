@@ -0,0 +1,139 @@
+import asyncio
+
+# tellopy imports this module last, so its helpers are there already
+from . import libtellopy, _frame_array, get_state
+
+
+def _resolve(future, result):
+    # the waiter may have been cancelled in the meantime
+    if not future.done():
+        future.set_result(result)
+
+
+class Drone:
+    """
+    The Tello for asyncio code, so one event loop can fly, watch the video and read telemetry at once:
+
+        async with tellopy.Drone() as drone:
+            print(await drone.send_command("streamon"))
+            async for image in drone.frames():
+                ...
+
+    frames() and states() sleep on the library's readiness descriptors with loop.add_reader, so nothing polls and no
+    thread is started; commands are queued on the library's I/O thread, which resolves the awaited reply.
+    Windows has no such descriptors, so there they wait on the loop's default executor instead.
+    tellopy holds one connection per process, so there is one Drone at a time.
+    """
+
+    def __init__(self):
+        self._connected = False
+        # futures waiting for a descriptor, and the descriptor each waits on
+        self._waiters = {}
+
+    async def connect(self):
+        """
+        Connect to the Tello drone, returning True if successful and False otherwise.
+        The connection waits for the drone's first reply, so it is made on the default executor.
+        :return: success
+        """
+        loop = asyncio.get_running_loop()
+        self._connected = await loop.run_in_executor(None, libtellopy.connect)
+        return self._connected
+
+    async def send_command(self, command):
+        """
+        Send a command to the Tello drone and wait for its response without blocking the loop.
+        :param command: string command from Tello SDK api commands (e.g. 'battery?', 'takeoff', 'land', 'streamon')
+        :return: string response, or False if the command got no reply
+        """
+        loop = asyncio.get_running_loop()
+        future = loop.create_future()
+
+        def done(response):
+            # called on the library's I/O thread
+            try:
+                loop.call_soon_threadsafe(_resolve, future, response)
+            except RuntimeError:
+                # the loop was closed before the reply came
+                pass
+
+        if not libtellopy.send_command_async(command, done):
+            return False
+        response = await future
+        return False if response is None else response
+
+    async def _readable(self, fd):
+        loop = asyncio.get_running_loop()
+        future = loop.create_future()
+        loop.add_reader(fd, _resolve, future, None)
+        self._waiters[future] = fd
+        try:
+            await future
+        finally:
+            if self._waiters.pop(future, None) is not None:
+                loop.remove_reader(fd)
+
+    async def frames(self, copy=False):
+        """
+        Yield every new video frame as a (height, width, 3) uint8 RGB array until disconnect().
+        Arrays view the library's frame buffers like tellopy.read_image(); frames decoded while the loop was busy
+        elsewhere are skipped, so the newest frame always comes next.
+        :param copy: yield writable copies and hand each frame back right away
+        """
+        fd = libtellopy.frame_fd()
+        loop = asyncio.get_running_loop()
+        while self._connected:
+            frame = libtellopy.read_image()
+            if frame is None and fd < 0:
+                frame = await loop.run_in_executor(None, libtellopy.wait_image, 100)
+            elif frame is None:
+                await self._readable(fd)
+                continue
+            if frame is not None:
+                yield _frame_array(frame, copy)
+
+    async def states(self):
+        """
+        Yield every new parsed state as a numpy record (state['h'], state['bat'], ...) until disconnect().
+        """
+        fd = libtellopy.state_fd()
+        loop = asyncio.get_running_loop()
+        while self._connected:
+            if fd < 0:
+                ready = await loop.run_in_executor(None, libtellopy.wait_state, 100) is not None
+            else:
+                # reading the state string is what makes the descriptor unreadable again
+                ready = libtellopy.read_state() is not None
+            if not ready:
+                if fd >= 0:
+                    await self._readable(fd)
+                continue
+            state = get_state()
+            if state is not None:
+                yield state
+
+    async def disconnect(self):
+        """
+        Disconnect from the Tello drone, ending frames() and states().
+        Arrays still viewing frames keep the connection open until they are gone.
+        :return: True if disconnected or disconnection successful.
+        """
+        self._connected = False
+        loop = asyncio.get_running_loop()
+        # wake the iterators; their descriptors go with the connection
+        for future, fd in list(self._waiters.items()):
+            loop.remove_reader(fd)
+            _resolve(future, None)
+        self._waiters.clear()
+        # joining the library's threads takes milliseconds; commands still queued are cancelled and their sends return False
+        return libtellopy.disconnect()
+
+    async def __aenter__(self):
+        if not await self.connect():
+            raise ConnectionError("could not connect to the Tello drone")
+        return self
+
+    async def __aexit__(self, exc_type, exc, traceback):
+        await self.disconnect()
+        return False
+
@@ -0,0 +1,178 @@
+// Contains the implementation of the screenshot writer
+//
+#include "capture.h"
+
+#include <opencv2/imgcodecs.hpp>
+#include <chrono>
+#include <stdio.h>
+#ifdef _WIN32
+#include <direct.h>
+#define capture_mkdir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define capture_mkdir(path) mkdir(path, 0755)
+#endif
+
+// function to get milliseconds between two clock readings
+static double capture_ms(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+capture_writer::capture_writer(const capture_config &config)
+    : config(config), next_number(config.first_number), finishing(false), counters(), encode_total_ms(0), write_total_ms(0) {
+    if (this->config.threads < 1) {
+        this->config.threads = 1;
+    }
+    if (this->config.queue_size < 1) {
+        this->config.queue_size = 1;
+    }
+
+    // imwrite's flags for the chosen format; the encoder itself comes from the extension
+    int quality = config.quality < 0 ? 0 : config.quality > 100 ? 100 : config.quality;
+    if (config.format == "jpg" || config.format == "jpeg") {
+        params = {cv::IMWRITE_JPEG_QUALITY, quality};
+    } else if (config.format == "webp") {
+        params = {cv::IMWRITE_WEBP_QUALITY, quality};
+    } else if (config.format == "png") {
+        // png is lossless either way; higher quality spends less time compressing
+        params = {cv::IMWRITE_PNG_COMPRESSION, (100 - quality) * 9 / 100};
+    }
+
+    // fails harmlessly if it already exists; a real failure shows up as failed writes
+    capture_mkdir(this->config.directory.c_str());
+
+    for (int i = 0; i < this->config.threads; i++) {
+        threads.emplace_back(&capture_writer::run, this);
+    }
+}
+
+capture_writer::~capture_writer() {
+    finish();
+}
+
+// function to queue a copy of a frame
+bool capture_writer::submit(const cv::Mat &frame) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (finishing) {
+        return false;
+    }
+
+    if ((int) jobs.size() >= config.queue_size) {
+        if (config.policy == CAPTURE_DROP_NEWEST) {
+            // decided before copying, so a full queue costs nothing
+            counters.dropped++;
+            return false;
+        } else if (config.policy == CAPTURE_DROP_OLDEST) {
+            jobs.pop_front();
+            counters.dropped++;
+        } else {
+            taken.wait(lock, [this] { return finishing || (int) jobs.size() < config.queue_size; });
+            if (finishing) {
+                return false;
+            }
+        }
+    }
+
+    // the frame belongs to the caller (usually the telloc library's pool), so keep a copy.
+    // numbers are handed out in capture order; dropped frames leave gaps
+    jobs.push_back(job{frame.clone(), next_number++});
+    counters.depth = (int) jobs.size();
+    if (counters.depth > counters.max_depth) {
+        counters.max_depth = counters.depth;
+    }
+    lock.unlock();
+
+    queued.notify_one();
+    return true;
+}
+
+// function to get the counters
+capture_stats capture_writer::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    capture_stats stats = counters;
+    unsigned long done = counters.written + counters.failed;
+    stats.encode_ms = done > 0 ? encode_total_ms / (double) done : 0;
+    stats.write_ms = counters.written > 0 ? write_total_ms / (double) counters.written : 0;
+    return stats;
+}
+
+// function to write what is queued and stop the threads
+void capture_writer::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finishing = true;
+    }
+    queued.notify_all();
+    taken.notify_all();
+
+    for (std::thread &thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+// thread to encode and write queued frames
+void capture_writer::run() {
+    std::vector<unsigned char> encoded;
+    char path[1024];
+
+    while (true) {
+        job next;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queued.wait(lock, [this] { return finishing || !jobs.empty(); });
+            // drain the queue before stopping
+            if (jobs.empty()) {
+                return;
+            }
+            next = std::move(jobs.front());
+            jobs.pop_front();
+            counters.depth = (int) jobs.size();
+        }
+        taken.notify_one();
+
+        // encode into memory first so the encode and the disk are timed separately
+        auto start = std::chrono::steady_clock::now();
+        bool ok = false;
+        try {
+            ok = cv::imencode("." + config.format, next.image, encoded, params);
+            if (!ok) {
+                printf("Error encoding image %lu as %s\n", next.number, config.format.c_str());
+            }
+        } catch (const cv::Exception &error) {
+            printf("Error encoding image %lu: %s\n", next.number, error.what());
+        }
+        auto encoded_at = std::chrono::steady_clock::now();
+
+        if (ok) {
+            snprintf(path, sizeof(path), "%s/img_%lu.%s", config.directory.c_str(), next.number, config.format.c_str());
+            FILE *file = fopen(path, "wb");
+            ok = file != NULL && fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size();
+            if (file != NULL && fclose(file) != 0) {
+                ok = false;
+            }
+            if (!ok) {
+                printf("Error writing image %s\n", path);
+            }
+        }
+        auto written_at = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        double encode_ms = capture_ms(start, encoded_at);
+        encode_total_ms += encode_ms;
+        if (encode_ms > counters.encode_max_ms) {
+            counters.encode_max_ms = encode_ms;
+        }
+        if (ok) {
+            double write_ms = capture_ms(encoded_at, written_at);
+            write_total_ms += write_ms;
+            if (write_ms > counters.write_max_ms) {
+                counters.write_max_ms = write_ms;
+            }
+            counters.written++;
+        } else {
+            counters.failed++;
+        }
+    }
+}
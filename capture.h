@@ -0,0 +1,99 @@
+// Contains the screenshot writer: frames are copied into a bounded queue and encoded and written to disk
+// by a pool of threads, so saving images for SfM never holds up the display loop
+//
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <opencv2/core/core.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// what to do with a frame when the queue is full
+enum capture_policy {
+    // skip the new frame; costs the display loop nothing, the default
+    CAPTURE_DROP_NEWEST,
+    // throw away the oldest queued frame to make room
+    CAPTURE_DROP_OLDEST,
+    // wait for room; every image gets written, but a slow disk slows the feed
+    CAPTURE_BLOCK
+};
+
+// options for the writer
+struct capture_config {
+    // where images go, created if missing
+    std::string directory = "images";
+    // file extension, which picks the encoder: jpg, png or webp
+    std::string format = "jpg";
+    // 0 to 100 for jpg and webp; png maps it onto its compression level
+    int quality = 95;
+    // encoder threads
+    int threads = 2;
+    // frames that can wait to be encoded
+    int queue_size = 8;
+    capture_policy policy = CAPTURE_DROP_NEWEST;
+    // number of the first image, e.g. to continue after an earlier run
+    unsigned long first_number = 0;
+};
+
+// counters since the writer started
+struct capture_stats {
+    // frames waiting right now, and the most there have been
+    int depth;
+    int max_depth;
+    unsigned long written;
+    unsigned long dropped;
+    // frames that failed to encode or write
+    unsigned long failed;
+    // milliseconds per image for encoding and for writing the file, averaged and the worst
+    double encode_ms;
+    double encode_max_ms;
+    double write_ms;
+    double write_max_ms;
+};
+
+class capture_writer {
+public:
+    explicit capture_writer(const capture_config &config = capture_config());
+    // writes what is still queued, then stops the threads
+    ~capture_writer();
+
+    // function to queue a copy of frame to be saved as the next numbered image.
+    // returns false if the frame was dropped or the writer has finished
+    bool submit(const cv::Mat &frame);
+
+    // function to get the counters
+    capture_stats stats();
+
+    // function to stop taking frames, write what is queued and stop the threads; called by the destructor
+    void finish();
+
+private:
+    struct job {
+        cv::Mat image;
+        unsigned long number;
+    };
+
+    // thread to encode and write queued frames
+    void run();
+
+    capture_config config;
+    std::vector<int> params;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    // signalled when a job is queued or the writer finishes, and when a job is taken off the queue
+    std::condition_variable queued;
+    std::condition_variable taken;
+    std::deque<job> jobs;
+    unsigned long next_number;
+    bool finishing;
+    capture_stats counters;
+    double encode_total_ms;
+    double write_total_ms;
+};
+
+#endif //CAPTURE_H
@@ -5,20 +5,37 @@
 extern "C" {
 #include "telloc.h"
 }
+#include "capture.h"
+#include "keyframe.h"
 using namespace cv;
 
+// stick deflection for movement keys, out of 100
+#define STICK 50
+// print the selector's and writer's counters every Nth save
+#define CAPTURE_REPORT_EVERY 10
+
+// prints a command's reply once the drone answers; runs on the library's command thread
+static void print_response(telloc_command *command, void *user) {
+    telloc_connection *connection = (telloc_connection *) user;
+    char response[256];
+    if (telloc_command_response(connection, command, response, sizeof(response)) == 0) {
+        printf("Response was %s\n", response);
+    }
+}
+
 int main() {
-    telloc_connection *connection=telloc_connect();
+    // ask for BGR frames, OpenCV's byte order, so frames need no conversion here
+    telloc_config config;
+    telloc_config_default(&config);
+    config.video.format = TELLOC_FORMAT_BGR24;
+    telloc_connection *connection=telloc_connect_config(&config);
     char *command=(char*)malloc(TELLOC_STATE_SIZE);
     sprintf(command, "streamon");
     char *response=(char*)malloc(TELLOC_STATE_SIZE);
     int ret_command = telloc_send_command(connection, command, strlen(command), response, TELLOC_STATE_SIZE);
     printf("Response was %s\n", response);
     
-    unsigned char *image = (unsigned char*)malloc(TELLOC_VIDEO_SIZE);
-    unsigned int image_bytes;
-    unsigned int image_width;
-    unsigned int image_height;
+    const telloc_frame *image;
 
     char *state = (char *)malloc(TELLOC_STATE_SIZE);
     int ret_state = telloc_read_state(connection, state, TELLOC_STATE_SIZE);
@@ -28,41 +45,67 @@ int main() {
     }
 
     unsigned long i = 0;
-    unsigned int long imgCount = 0;
-    char *fileName = (char*)malloc(TELLOC_STATE_SIZE);
+    unsigned long imgCount = 0;
     unsigned long message_sent_i=0;
 
+    // screenshots are encoded and written on their own threads; if the disk falls behind, captures are skipped rather than the feed
+    capture_config capture_options;
+    capture_options.format = "jpg";
+    capture_options.quality = 95;
+    capture_writer capture(capture_options);
+    // only sharp frames that show something the last saved one did not are saved
+    keyframe_selector keyframes;
+
     while (true)
     {
-        // read and check for video input from rone
-        int ret_video = telloc_read_image(connection, image, TELLOC_VIDEO_SIZE, &image_bytes, &image_width, &image_height);
+        // sleep until the drone's next video frame is decoded, then borrow it
+        int ret_video = telloc_wait_frame(connection, 100, &image);
         if (ret_video !=0)
         {
+            // keep the window responsive while the stream is stalled
+            waitKey(1);
             continue;
         }
         
-        // convert the image from the drone into cv
-        auto frame = cv::Mat((int) image_height, (int) image_width, CV_8UC3, image);
-        cv::cvtColor(frame, frame, cv::COLOR_RGB2BGR);
+        // wrap the library's BGR buffer in a cv::Mat without copying it
+        auto frame = cv::Mat((int) image->height, (int) image->width, CV_8UC3, image->data, image->strides[0]);
 
         // If frame is empty, break loop
         if (frame.empty())
+        {
+            telloc_release_frame(connection, image);
             continue;
+        }
 
         // Display the resulting frame
         imshow("Drone Feed", frame);
 
-        // Wait for 1/4 of 5 miliseconds and save a screenshot of the video image
+        // save a screenshot when the selector picks the frame as a keyframe; the writer copies it, so this only costs a memcpy.
+        // the drone's state when the frame arrived tells the selector how far it moved
         i+=1;
-        if (i%32 == 0) {
-            snprintf(fileName, TELLOC_STATE_SIZE, "%s%d%s", "images/img_", imgCount, ".jpg");
-            printf("Saving image: %d\n", imgCount);
-            imwrite(fileName, frame);
+        telloc_state frame_state;
+        bool have_state = telloc_interpolate_state(connection, image->info.received_time, &frame_state) == 0
+                          || telloc_get_state(connection, &frame_state) == 0;
+        if (keyframes.consider(frame, have_state ? &frame_state : NULL) && capture.submit(frame)) {
             imgCount += 1;
+            if (imgCount%CAPTURE_REPORT_EVERY == 0) {
+                keyframe_stats picked = keyframes.stats();
+                capture_stats stats = capture.stats();
+                printf("Keyframes: %lu of %lu scored (%lu blurry, %lu redundant, %lu forced)\n",
+                       picked.kept, picked.scored, picked.blurry, picked.redundant, picked.forced);
+                printf("Saved images: %lu written, %lu dropped, %d queued (max %d), encode %.1f ms (max %.1f), write %.1f ms\n",
+                       stats.written, stats.dropped, stats.depth, stats.max_depth, stats.encode_ms, stats.encode_max_ms, stats.write_ms);
+            }
         }
+
+        // imshow and the capture copy are done with the pixels, hand the frame back
+        telloc_release_frame(connection, image);
         
-        int ch = waitKey(5);
+        // frames pace the loop now, so only give the window a moment to handle input
+        int ch = waitKey(1);
         // printf("ch is %d\n", ch);
+        // movement keys steer with the rc sticks; a held key repeats, and the library stops the drone once it is let go
+        int lr = 0, fb = 0, ud = 0, yaw = 0;
         switch (ch) 
         {
             case 'g':
@@ -72,51 +115,64 @@ int main() {
                 sprintf(command, "land");
                 break;
             case 'w':
-                sprintf(command, "forward 40");
+                fb = STICK;
                 break;
             case 'a':
-                sprintf(command, "left 40");
+                lr = -STICK;
                 break;
             case 's':
-                sprintf(command, "back 40");
+                fb = -STICK;
                 break;
             case 'd':
-                sprintf(command, "right 40");
+                lr = STICK;
                 break;
             case 'r':
-                sprintf(command, "up 40");
+                ud = STICK;
                 break;
             case 'f': // ASCII code for [shift]
-                sprintf(command, "down 40");
+                ud = -STICK;
                 break;
             case '.': // ASCII code for [<-]
-                sprintf(command, "cw 15");
+                yaw = STICK;
                 break;
             case ',': // ASCII code for [->]
-                sprintf(command, "ccw 15");
+                yaw = -STICK;
                 break;
             case ' ': // emergency land
                 sprintf(command, "emergency");
                 break;
             case '=': // quit program
+            {
+                // jump the queue, then give the drone a moment to answer before exiting
                 sprintf(command, "emergency");
-                ret_command = telloc_send_command(connection, command, strlen(command), response, TELLOC_STATE_SIZE);
-                if(ret_command == 0) {
-                    printf("Response was %s\n", response);
+                telloc_command *stop = telloc_send_command_async(connection, command, strlen(command), TELLOC_PRIORITY_EMERGENCY, -1, NULL, NULL);
+                if (stop != NULL) {
+                    if (telloc_command_wait(connection, stop, 30) == TELLOC_COMMAND_DONE && telloc_command_response(connection, stop, response, TELLOC_STATE_SIZE) == 0) {
+                        printf("Response was %s\n", response);
+                    }
+                    telloc_command_release(connection, stop);
                 }
-                Sleep(30);
+                // exit skips destructors, so write the screenshots still queued first
+                capture.finish();
                 exit(1);
+            }
             default:
                 ch = -1;
                 break;
         }
+        if (lr != 0 || fb != 0 || ud != 0 || yaw != 0) {
+            // the latest sticks win; the library sends them at a steady rate off this loop
+            telloc_set_rc(connection, lr, fb, ud, yaw);
+            ch = -1;
+        }
         // printf("if1\n");
         if (ch != -1 && (i-message_sent_i) > 8) {
             printf("Command is: %s\n", command);
-            // send the inputted key to the drone
-            ret_command = telloc_send_command(connection, command, strlen(command), response, TELLOC_STATE_SIZE);
-            if(ret_command == 0) {
-                printf("Response was %s\n", response);
+            // queue the inputted key for the drone and keep the video going; the reply is printed when it comes
+            telloc_command_priority priority = strcmp(command, "emergency") == 0 ? TELLOC_PRIORITY_EMERGENCY : TELLOC_PRIORITY_NORMAL;
+            telloc_command *queued = telloc_send_command_async(connection, command, strlen(command), priority, -1, print_response, connection);
+            if (queued != NULL) {
+                telloc_command_release(connection, queued);
             }
             message_sent_i = i;
         }
@@ -126,7 +182,6 @@ int main() {
         {
             printf("State: %s\n", state);
         }
-        Sleep(1);
         // printf("endsleep\n");
     }
 
@@ -0,0 +1,114 @@
+// Contains the implementation of the keyframe selector
+//
+#include "keyframe.h"
+
+#include <opencv2/imgproc.hpp>
+#include <math.h>
+
+// size frames are shrunk to before finding the shift between them; plenty for overlap and cheap to correlate
+#define KEYFRAME_THUMBNAIL_WIDTH 160
+#define KEYFRAME_THUMBNAIL_HEIGHT 120
+
+keyframe_selector::keyframe_selector(const keyframe_config &config)
+    : config(config), counters(), average_sharpness(0), have_state(false), last_state(), yaw(0), distance(0), kept_height(0) {
+    if (this->config.stride < 1) {
+        this->config.stride = 1;
+    }
+    // the window keeps the thumbnail edges from dominating the correlation
+    cv::createHanningWindow(window, cv::Size(KEYFRAME_THUMBNAIL_WIDTH, KEYFRAME_THUMBNAIL_HEIGHT), CV_32F);
+}
+
+// function to decide whether to keep a frame
+bool keyframe_selector::consider(const cv::Mat &frame, const telloc_state *state, keyframe_score *score) {
+    counters.offered++;
+    if ((counters.offered - 1) % (unsigned long) config.stride != 0) {
+        return false;
+    }
+    counters.scored++;
+
+    // add up the motion between the states of scored frames; the drone reports speeds in dm/s
+    if (state != NULL) {
+        if (have_state && state->received_time > last_state.received_time) {
+            double seconds = (double) (state->received_time - last_state.received_time) / 1e9;
+            double turned = fmod(fabs((double) (state->yaw - last_state.yaw)), 360.0);
+            yaw += turned > 180 ? 360 - turned : turned;
+            distance += hypot((double) state->vgx, (double) state->vgy) * 10.0 * seconds;
+        }
+        if (!have_state) {
+            kept_height = state->h;
+        }
+        last_state = *state;
+        have_state = true;
+    }
+
+    // sharpness: a blurred frame has little high frequency left, so the Laplacian barely varies.
+    // half size keeps it cheap and averages away sensor noise that would pass for detail
+    cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+    cv::resize(gray, half, cv::Size(gray.cols / 2, gray.rows / 2), 0, 0, cv::INTER_AREA);
+    cv::Laplacian(half, laplacian, CV_32F);
+    cv::Scalar mean, deviation;
+    cv::meanStdDev(laplacian, mean, deviation);
+    double sharpness = deviation[0] * deviation[0];
+
+    // blurry next to what this scene usually gives, or blurry at all
+    average_sharpness = average_sharpness == 0 ? sharpness : 0.9 * average_sharpness + 0.1 * sharpness;
+    bool sharp = sharpness >= config.min_sharpness && sharpness >= config.relative_sharpness * average_sharpness;
+
+    cv::resize(half, shrunk, cv::Size(KEYFRAME_THUMBNAIL_WIDTH, KEYFRAME_THUMBNAIL_HEIGHT), 0, 0, cv::INTER_AREA);
+    shrunk.convertTo(thumbnail, CV_32F);
+
+    // overlap with the last kept frame from how far the image shifted; turning and sideways flight both show up as a shift
+    double overlap = 0;
+    if (!kept_thumbnail.empty()) {
+        double response = 0;
+        cv::Point2d shift = cv::phaseCorrelate(kept_thumbnail, thumbnail, window, &response);
+        if (response >= config.min_response) {
+            double across = 1.0 - fabs(shift.x) / KEYFRAME_THUMBNAIL_WIDTH;
+            double down = 1.0 - fabs(shift.y) / KEYFRAME_THUMBNAIL_HEIGHT;
+            overlap = across > 0 && down > 0 ? across * down : 0;
+        }
+    }
+
+    double height = have_state ? fabs((double) (last_state.h - kept_height)) : 0;
+    bool novel = kept_thumbnail.empty() || overlap <= config.novel_overlap
+                 || yaw >= config.novel_yaw || distance >= config.novel_distance || height >= config.novel_height;
+
+    if (score != NULL) {
+        score->sharpness = sharpness;
+        score->overlap = overlap;
+        score->yaw = yaw;
+        score->distance = distance;
+        score->height = height;
+        score->sharp = sharp;
+        score->novel = novel;
+    }
+
+    bool keep = novel && sharp;
+    // waiting any longer for a sharp frame would leave a gap in the coverage, so settle for a usable one
+    bool forced = !keep && novel && !kept_thumbnail.empty() && overlap < config.min_overlap && sharpness >= config.min_sharpness;
+    if (!keep && !forced) {
+        if (!novel) {
+            counters.redundant++;
+        } else {
+            counters.blurry++;
+        }
+        return false;
+    }
+
+    counters.kept++;
+    if (forced) {
+        counters.forced++;
+    }
+    thumbnail.copyTo(kept_thumbnail);
+    yaw = 0;
+    distance = 0;
+    if (have_state) {
+        kept_height = last_state.h;
+    }
+    return true;
+}
+
+// function to get the counters
+keyframe_stats keyframe_selector::stats() const {
+    return counters;
+}
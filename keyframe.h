@@ -0,0 +1,93 @@
+// Contains the keyframe selector: decides which frames are worth saving for SfM, keeping sharp frames
+// that show something the last kept frame did not, instead of every Nth frame
+//
+#ifndef KEYFRAME_H
+#define KEYFRAME_H
+
+#include <opencv2/core/core.hpp>
+#include <stddef.h>
+extern "C" {
+#include "telloc.h"
+}
+
+// options for the selector
+struct keyframe_config {
+    // score every Nth frame offered; the rest are skipped without looking at them
+    int stride = 3;
+    // variance of the Laplacian of the half size luma below which a frame is always too blurry
+    double min_sharpness = 10;
+    // and the fraction of the recent average below which it is blurrier than the scene allows
+    double relative_sharpness = 0.7;
+    // the frame adds coverage once at most this much of it overlaps the last kept frame
+    double novel_overlap = 0.7;
+    // below this overlap matching gets unreliable, so a frame is kept even if it is only above min_sharpness
+    double min_overlap = 0.45;
+    // phase correlation peaks below this mean the views do not line up at all (e.g. flying forward), which counts as no overlap
+    double min_response = 0.05;
+    // or once the drone has turned this many degrees, moved this many cm or changed height this many cm since the last kept frame
+    double novel_yaw = 15;
+    double novel_distance = 50;
+    double novel_height = 30;
+};
+
+// how the last frame scored
+struct keyframe_score {
+    double sharpness;
+    // fraction of the frame that overlaps the last kept frame, from the image shift between them
+    double overlap;
+    // motion since the last kept frame from the drone's state; 0 without state
+    double yaw;
+    double distance;
+    double height;
+    bool sharp;
+    bool novel;
+};
+
+// counters since the selector started
+struct keyframe_stats {
+    unsigned long offered;
+    unsigned long scored;
+    unsigned long kept;
+    // kept only because the view was about to lose overlap with the last kept frame
+    unsigned long forced;
+    unsigned long blurry;
+    unsigned long redundant;
+};
+
+class keyframe_selector {
+public:
+    explicit keyframe_selector(const keyframe_config &config = keyframe_config());
+
+    // function to decide whether to keep a BGR frame. state is the drone's state when the frame was received,
+    // or NULL if there is none; without it novelty comes from the image alone. score, if not NULL, gets the scores
+    bool consider(const cv::Mat &frame, const telloc_state *state, keyframe_score *score = NULL);
+
+    // function to get the counters
+    keyframe_stats stats() const;
+
+private:
+    keyframe_config config;
+    keyframe_stats counters;
+
+    // reused buffers, so scoring allocates nothing once the size is known
+    cv::Mat gray;
+    cv::Mat half;
+    cv::Mat laplacian;
+    cv::Mat shrunk;
+    cv::Mat thumbnail;
+    cv::Mat window;
+    // the last kept frame's thumbnail, 0 x 0 until a frame is kept
+    cv::Mat kept_thumbnail;
+
+    // running average of sharpness, 0 until a frame is scored
+    double average_sharpness;
+
+    // motion since the last kept frame, added up from the states of scored frames
+    bool have_state;
+    telloc_state last_state;
+    double yaw;
+    double distance;
+    int kept_height;
+};
+
+#endif //KEYFRAME_H
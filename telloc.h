@@ -4,32 +4,524 @@
 #define TELLOC_TELLOC_H
 
 #define TELLOC_RESPONSE_TIMEOUT 150
+// the drone answers takeoff, land, moves, turns and flips only once it is done, so they wait this long instead
+#define TELLOC_ACTION_TIMEOUT 20000
 #define TELLOC_ADDRESS "192.168.10.1"
 #define TELLOC_COMMAND_PORT 8889
 #define TELLOC_STATE_PORT 8890
 #define TELLOC_VIDEO_PORT 11111
 #define TELLOC_STATE_SIZE 1024
 #define TELLOC_VIDEO_SIZE (960 * 720 * 3 * 2)
+// parsed state samples each connection keeps; a little over a minute and a half of Tello state at 10 Hz
+#define TELLOC_STATE_HISTORY_SIZE 1024
 
 typedef struct telloc_connection_ telloc_connection;
 
+// how urgently a queued command is sent. the drone takes one command at a time, so commands wait for the
+// previous reply, most urgent first; an emergency goes out at once and cancels the command still waiting
+typedef enum {
+    // background queries, e.g. the keepalive
+    TELLOC_PRIORITY_LOW = 0,
+    TELLOC_PRIORITY_NORMAL = 1,
+    TELLOC_PRIORITY_HIGH = 2,
+    TELLOC_PRIORITY_EMERGENCY = 3
+} telloc_command_priority;
+
+// where a queued command is; from TELLOC_COMMAND_DONE on it is finished
+typedef enum {
+    TELLOC_COMMAND_QUEUED = 0,
+    // sent, waiting for the reply
+    TELLOC_COMMAND_SENT = 1,
+    // the drone replied (with "ok", "error" or a value) or, for commands without a reply, it was sent
+    TELLOC_COMMAND_DONE = 2,
+    TELLOC_COMMAND_TIMEOUT = 3,
+    // the command could not be sent
+    TELLOC_COMMAND_FAILED = 4,
+    // cancelled by an emergency or by disconnecting
+    TELLOC_COMMAND_CANCELLED = 5
+} telloc_command_status;
+
+// handle to a queued command
+typedef struct telloc_command telloc_command;
+
+// function called on the library's I/O thread when a command finishes; keep it short, every connection's I/O waits for it
+typedef void (*telloc_command_callback)(telloc_command *command, void *user);
+
+// function called on the scheduler thread every period; keep it short, it holds up the other periodic tasks
+typedef void (*telloc_periodic_callback)(telloc_connection *connection, void *user);
+
+// pixel formats the decoded video can be delivered in
+typedef enum {
+    // packed 8-bit RGB, the default
+    TELLOC_FORMAT_RGB24 = 0,
+    // packed 8-bit BGR, the layout OpenCV and Windows bitmaps use
+    TELLOC_FORMAT_BGR24 = 1,
+    // the decoder's own planar Y, U and V planes; no conversion at all
+    TELLOC_FORMAT_YUV420P = 2,
+    // a Y plane followed by an interleaved UV plane
+    TELLOC_FORMAT_NV12 = 3,
+    // only the decoder's Y plane; no conversion at all
+    TELLOC_FORMAT_GRAY8 = 4,
+    // packed 8-bit BGR plus an opaque alpha byte; 32-bit Windows bitmaps and most textures take it as is
+    TELLOC_FORMAT_BGRA = 5
+} telloc_pixel_format;
+
+// how the h264 decoder spreads work over threads
+typedef enum {
+    TELLOC_THREADING_NONE = 0,
+    // threads decode slices of the same picture; adds no latency (the Tello sends one slice per picture)
+    TELLOC_THREADING_SLICE = 1,
+    // threads decode consecutive pictures; best throughput, but delays frames by thread_count - 1
+    TELLOC_THREADING_FRAME = 2
+} telloc_threading;
+
+// options for decoding the video stream
+typedef struct {
+    // number of decoder threads; 0 uses one per core
+    int thread_count;
+    telloc_threading threading;
+    // output every picture as soon as it is decoded; the decoder turns frame threading off with this
+    int low_delay;
+    // the format frames are delivered in
+    telloc_pixel_format format;
+    // threads the rows of an RGB24, BGR24 or BGRA conversion are spread over, counting the reader that converts;
+    // 1 converts on the reader alone
+    int convert_threads;
+} telloc_video_config;
+
+// options for receiving the video stream
+typedef struct {
+    // kernel receive buffer for the video socket in bytes (SO_RCVBUF), room for keyframe bursts; 0 keeps the system default
+    int buffer_size;
+    // microseconds to busy poll the network device before sleeping (SO_BUSY_POLL, unix only); 0 turns it off
+    int busy_poll;
+} telloc_receive_config;
+
+// options for the rc setpoint set with telloc_set_rc
+typedef struct {
+    // times per second the setpoint is sent to the drone; 20 to 50 flies smoothly
+    int rate;
+    // milliseconds after the last telloc_set_rc before the sticks fall back to zero
+    int stale_ms;
+} telloc_rc_config;
+
+// what the scheduler's periodic queries and watchdogs last found
+typedef struct {
+    // battery percent and wifi signal to noise ratio from the last battery? and wifi? replies; -1 until answered
+    int battery;
+    int wifi_snr;
+    // telloc_time of those replies
+    unsigned long long battery_time;
+    unsigned long long wifi_time;
+    // set while no state or no video has arrived for a second, once some had
+    int state_lost;
+    int video_lost;
+} telloc_health;
+
+// how fast a recording is replayed
+typedef enum {
+    // datagrams are fed to the pipeline as far apart as they were received
+    TELLOC_REPLAY_REALTIME = 0,
+    // datagrams are fed as fast as the pipeline takes them
+    TELLOC_REPLAY_FAST = 1
+} telloc_replay_pace;
+
+// options for replaying a recording instead of connecting to a drone
+typedef struct {
+    // an h264 recording made with telloc_start_recording, with its .idx and .state next to it; NULL connects to a drone
+    const char* path;
+    telloc_replay_pace pace;
+} telloc_replay_config;
+
+// local ports a connection receives on. every Tello sends state to 8890 and video to 11111 of the address that
+// sent it "command", so drones sharing a network (Tello EDU in station mode) need a set of ports per connection;
+// if state or video is not the default the drone is told with "port <state> <video>" (SDK 2.0)
+typedef struct {
+    // commands go out from this port and the replies come back to it
+    int command;
+    int state;
+    int video;
+} telloc_port_config;
+
+// options for connecting to a drone; fill with telloc_config_default and change what you need.
+// any number of connections can be open at once (21 on Windows). they share one I/O thread and up to a decoder thread
+// per core; each connection still starts its own scheduler thread, video.convert_threads - 1 conversion helpers, and
+// for telloc_connect_replay a replay thread
+typedef struct {
+    const char* interface_address;
+    const char* drone_address;
+    // 0 takes any free port, so a swarm can leave all three at 0
+    telloc_port_config ports;
+    telloc_video_config video;
+    telloc_receive_config receive;
+    telloc_rc_config rc;
+    telloc_replay_config replay;
+} telloc_config;
+
+// progress of a replay
+typedef struct {
+    // set once everything recorded has been fed to the pipeline and decoded
+    int finished;
+    unsigned long units;
+    unsigned long video_datagrams;
+    unsigned long states;
+    // telloc_time when the replay started and when it finished, 0 until then
+    unsigned long long start_time;
+    unsigned long long end_time;
+    // how much of the recording has been fed, in recorded nanoseconds
+    unsigned long long recorded_time;
+} telloc_replay_stats;
+
+// counters for the video socket since the connection was made
+typedef struct {
+    unsigned long datagrams_received;
+    unsigned long bytes_received;
+    // datagrams the kernel dropped because the receive buffer was full (unix only)
+    unsigned long datagrams_dropped;
+    // datagrams too large for the receive buffers; their tails were lost
+    unsigned long datagrams_truncated;
+    // receive calls that returned data; datagrams_received / batches is the average batch size
+    unsigned long batches;
+    // access units dropped because decoding fell behind, counting those skipped until the next keyframe
+    unsigned long units_dropped;
+    // partial access units thrown away because datagrams of them were lost
+    unsigned long units_discarded;
+    // the receive buffer size the system actually granted
+    int buffer_size;
+} telloc_receive_stats;
+
+// the stages of the pipeline whose latency every connection measures
+typedef enum {
+    // the I/O thread taking a batch of video datagrams off the socket and through reassembly
+    TELLOC_STAGE_RECEIVE = 0,
+    // from the first datagram of an access unit to the unit being complete
+    TELLOC_STAGE_ASSEMBLY = 1,
+    // from a complete access unit to its decoded picture, waiting for a decoder worker included
+    TELLOC_STAGE_DECODE = 2,
+    // converting a frame to the connection's pixel format when it is first read
+    TELLOC_STAGE_CONVERT = 3,
+    // from a decoded picture to a reader taking it
+    TELLOC_STAGE_HANDOFF = 4,
+    // from a reader taking a frame to handing it back
+    TELLOC_STAGE_READ = 5,
+    // from sending a command to its reply
+    TELLOC_STAGE_COMMAND = 6,
+    TELLOC_STAGE_COUNT = 7
+} telloc_stage;
+
+// a latency distribution in nanoseconds. percentiles come from a log-linear histogram and read up to 1/8 high
+typedef struct {
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long p50;
+    unsigned long long p90;
+    unsigned long long p99;
+    unsigned long long p999;
+    unsigned long long max;
+} telloc_latency;
+
+// counters and per-stage latencies since the connection was made. they are kept without locks and cost a few
+// atomic adds per frame, so they are always on
+typedef struct {
+    unsigned long long frames_decoded;
+    // frames replaced by a newer one before anyone read them
+    unsigned long long frames_overwritten;
+    // decoded frames dropped because readers held every frame buffer
+    unsigned long long frames_dropped;
+    // access units dropped because decoding fell behind, as in telloc_receive_stats
+    unsigned long long units_dropped;
+    // partial access units discarded on reassembly, as in telloc_receive_stats
+    unsigned long long units_discarded;
+    // access units the decoder rejected
+    unsigned long long decode_errors;
+    unsigned long long commands_sent;
+    unsigned long long command_timeouts;
+    unsigned long long state_packets;
+    telloc_latency stages[TELLOC_STAGE_COUNT];
+} telloc_stats;
+
+// containers a recording can be written in
+typedef enum {
+    // the access units exactly as the drone sent them, an Annex B elementary stream
+    TELLOC_RECORD_H264 = 0,
+    // the same units remuxed into an mp4 with their receive times, playable anywhere
+    TELLOC_RECORD_MP4 = 1
+} telloc_record_format;
+
+// a recording's index is written next to it as <path>.idx: a telloc_record_header, then one
+// telloc_record_entry per access unit, in the byte order of the machine that recorded it.
+// its state datagrams go to <path>.state: a header, then a telloc_record_entry followed by the datagram for each
+#define TELLOC_RECORD_MAGIC "TELLOIDX"
+#define TELLOC_RECORD_VERSION 1
+// telloc_record_header.format of a state log
+#define TELLOC_RECORD_STATE 2
+// set in telloc_record_entry.flags for IDR access units, where playback can start
+#define TELLOC_RECORD_KEYFRAME 1
+
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    // sizeof(telloc_record_entry) when written, so readers can skip fields they do not know
+    unsigned int entry_size;
+    unsigned int format;
+    unsigned int reserved;
+} telloc_record_header;
+
+typedef struct {
+    // byte offset of the unit in an h264 recording; its sample number in an mp4 recording or a state log
+    unsigned long long offset;
+    // when the unit's first datagram arrived, on the clock telloc_time reads
+    unsigned long long received_time;
+    unsigned int length;
+    unsigned int flags;
+} telloc_record_entry;
+
+// counters for the recording in progress, or the last one
+typedef struct {
+    int recording;
+    // access units written, and how many of them were keyframes
+    unsigned long units;
+    unsigned long keyframes;
+    unsigned long long bytes;
+    // units skipped while waiting for the first keyframe
+    unsigned long units_skipped;
+} telloc_record_stats;
+
+// a parsed Tello state sample; fields the drone did not send are 0
+typedef struct {
+    // counts samples from 1; compare with the last one you saw to tell if it is new
+    unsigned long long sequence;
+    // when the state datagram arrived, on the clock telloc_time reads
+    unsigned long long received_time;
+    // mission pad id (-1 or -2 when none is detected) and the drone's position (cm) and attitude relative to it (SDK 2.0)
+    int mid;
+    int x, y, z;
+    int mpry[3];
+    // attitude in degrees
+    int pitch, roll, yaw;
+    // speeds along the x, y and z axes
+    int vgx, vgy, vgz;
+    // lowest and highest temperature in degrees Celsius
+    int templ, temph;
+    // time of flight distance in cm
+    int tof;
+    // height in cm
+    int h;
+    // battery percentage
+    int bat;
+    // barometer height in cm
+    float baro;
+    // seconds the motors have been on
+    int time;
+    // accelerations along the x, y and z axes in thousandths of g
+    float agx, agy, agz;
+} telloc_state;
+
+// where a frame came from and where its latency went.
+// times are nanoseconds on the clock telloc_time reads (CLOCK_MONOTONIC on unix)
+typedef struct {
+    // counts decoded frames from 1; a gap between two frames you got means frames were skipped
+    unsigned long long sequence;
+    // when the first datagram of the frame's access unit arrived
+    unsigned long long received_time;
+    // when the access unit was complete and handed to the decoder
+    unsigned long long assembled_time;
+    // when the decoder returned the picture
+    unsigned long long decoded_time;
+    // when the picture was in the frame's pixel format; frames are converted when they are first read,
+    // so this includes the time the frame waited for a reader
+    unsigned long long converted_time;
+    // the frame is an IDR picture that decodes on its own
+    int keyframe;
+    // frames that replaced each other unread between the previous frame handed out and this one
+    unsigned int frames_overwritten;
+} telloc_frame_info;
+
+// a decoded video frame owned by the telloc library.
+// the data stays valid until the frame is handed back with telloc_release_frame.
+typedef struct {
+    // the first plane, and the size of all planes packed without row padding (what telloc_read_image copies)
+    unsigned char* data;
+    unsigned int bytes;
+    unsigned int width;
+    unsigned int height;
+    telloc_pixel_format format;
+    // the planes of the frame; rows can be padded, so step through them with strides
+    int plane_count;
+    unsigned char* planes[3];
+    unsigned int strides[3];
+    telloc_frame_info info;
+} telloc_frame;
+
+// function to read the monotonic clock frame timestamps use, in nanoseconds; e.g. telloc_time() - frame->info.received_time is a frame's age
+unsigned long long telloc_time(void);
+
 // function to connect to the Tello drone using the default address 192.168.10.1
 telloc_connection *telloc_connect(void);
 
 // function to connect to the Tello drone using a specified interface
 telloc_connection *telloc_connect_interface(const char *interface_address);
 
+// function to connect to a Tello drone at drone_address using a specified interface
+// (e.g. an emulator on loopback: telloc_connect_address("127.0.0.1", "127.0.0.2"))
+telloc_connection *telloc_connect_address(const char *interface_address, const char *drone_address);
+
+// function to replay a recording through the same reassembly, decoding, conversion and state parsing as a live drone.
+// frames and state are read with the usual functions; commands are not sent anywhere
+telloc_connection *telloc_connect_replay(const char *path, telloc_replay_pace pace);
+
+// function to fill a config with the defaults used by telloc_connect
+void telloc_config_default(telloc_config *config);
+
+// function to connect to a Tello drone with the given options. returns NULL when called from a command callback
+telloc_connection *telloc_connect_config(const telloc_config *config);
+
+// function to get the video options in effect; the decoder may not honor every requested option
+int telloc_get_video_config(telloc_connection *connection, telloc_video_config *config);
+
+// function to get the video socket counters
+int telloc_get_receive_stats(telloc_connection *connection, telloc_receive_stats *stats);
+
+// function to get the pipeline counters and stage latencies; never blocks the I/O or decoder threads
+int telloc_get_stats(telloc_connection *connection, telloc_stats *stats);
+
+// function to write the stats of count connections in the Prometheus text format, each labelled with its drone's address
+// ("replay" for a replay) and a connection id, so two connections to the same address don't collide.
+// writes up to length bytes of buffer, terminated, and sets written to the full length; returns 1 if it did not fit.
+// send the buffer on a socket to serve it yourself
+int telloc_format_stats(telloc_connection **connections, unsigned int count, char *buffer, unsigned int length, unsigned int *written);
+
+// function to write the stats like telloc_format_stats to a file, replacing it at once (e.g. for node_exporter's textfile collector)
+int telloc_write_stats(telloc_connection **connections, unsigned int count, const char *path);
+
+// function to start writing the video stream to path as it arrives, without decoding or encoding anything,
+// and its index to path.idx. the recording starts at the next keyframe; send streamon for there to be video
+int telloc_start_recording(telloc_connection *connection, const char *path, telloc_record_format format);
+
+// function to finish the recording and close its files
+int telloc_stop_recording(telloc_connection *connection);
+
+// function to get the recording counters
+int telloc_get_record_stats(telloc_connection *connection, telloc_record_stats *stats);
+
+// function to get the progress of a connection made with telloc_connect_replay
+int telloc_get_replay_stats(telloc_connection *connection, telloc_replay_stats *stats);
+
 // function to send a command to the Tello drone and receive a response
 // the response pointer can be NULL, resulting in no response being saved.
+// blocks until the reply, or until TELLOC_ACTION_TIMEOUT for commands that move the drone and TELLOC_RESPONSE_TIMEOUT
+// for the rest; telloc_send_command_async does not block. returns 1 when called from a command callback
 int telloc_send_command(telloc_connection *connection, const char* command, unsigned int length, char* response, unsigned int response_length);
 
+// function to queue a command for the I/O thread and return at once, without touching the network.
+// timeout_ms is how long to wait for the reply (0 for commands the drone does not answer). -1 waits TELLOC_ACTION_TIMEOUT
+// for takeoff, land, moves, turns, flips, go, curve and jump, which the drone answers when it is done, and
+// TELLOC_RESPONSE_TIMEOUT for the rest. a command that waits blocks the normal and high priority commands behind it.
+// callback, if not NULL, is called with user on the I/O thread when the command finishes. the I/O thread delivers every
+// reply, so the callback must not wait: it may call telloc_send_command_async, telloc_command_poll, telloc_set_rc and
+// other calls that return at once, and disconnect other drones. telloc_send_command and telloc_connect fail there,
+// telloc_command_wait only polls, and telloc_disconnect refuses the callback's own connection.
+// returns NULL if the queue is full. every handle must be released with telloc_command_release
+telloc_command *telloc_send_command_async(telloc_connection *connection, const char* command, unsigned int length, telloc_command_priority priority,
+                                          int timeout_ms, telloc_command_callback callback, void *user);
+
+// function to get where a queued command is without blocking
+telloc_command_status telloc_command_poll(telloc_connection *connection, telloc_command *command);
+
+// function to wait up to timeout_ms milliseconds (-1 waits forever) for a queued command to finish; returns its status.
+// from a command callback it only polls, since the I/O thread it runs on is the one that would finish the command
+telloc_command_status telloc_command_wait(telloc_connection *connection, telloc_command *command, int timeout_ms);
+
+// function to copy the reply of a finished command into response, terminated. returns 1 if it has no reply
+int telloc_command_response(telloc_connection *connection, telloc_command *command, char* response, unsigned int response_length);
+
+// function to hand back a command handle. a command released before it finishes is still sent
+void telloc_command_release(telloc_connection *connection, telloc_command *command);
+
+// function to set the sticks, each from -100 to 100: left/right, forward/back, up/down and yaw.
+// never blocks; the I/O thread sends the latest setpoint as "rc lr fb ud yaw" at config.rc.rate without
+// waiting for replies. if it is not set again within config.rc.stale_ms the drone is sent zero sticks, then nothing
+int telloc_set_rc(telloc_connection *connection, int lr, int fb, int ud, int yaw);
+
+// function to run callback with user every period_ms milliseconds on the scheduler thread, first after one period.
+// the callback must not disconnect its own connection, which would join the thread it runs on; telloc_disconnect refuses it.
+// returns an id for telloc_remove_periodic, or -1 if no more tasks fit
+int telloc_add_periodic(telloc_connection *connection, int period_ms, telloc_periodic_callback callback, void *user);
+
+// function to stop a periodic callback; once it returns the callback is not running and will not run again
+// returns 1 if id is not one telloc_add_periodic returned; the built-in keepalive and watchdogs can't be removed
+int telloc_remove_periodic(telloc_connection *connection, int id);
+
+// function to get what the periodic battery and wifi queries and the state and video watchdogs last found
+int telloc_get_health(telloc_connection *connection, telloc_health *health);
+
 // function to receive the most recent state of the Tello drone
 int telloc_read_state(telloc_connection *connection, char* state_buffer, unsigned int state_buffer_length);
 
-// function to receive an RGB format video frame from the Tello drone
+// function to get the most recently parsed state. Does not block the I/O thread or other readers,
+// and any number of readers can get the same sample. returns 1 if no state has arrived yet
+int telloc_get_state(telloc_connection *connection, telloc_state *state);
+
+// function to copy up to the last count parsed states, oldest first, into samples. copied is set to how many there were.
+// like telloc_get_state, this never blocks the I/O thread
+int telloc_get_state_history(telloc_connection *connection, telloc_state *samples, unsigned int count, unsigned int *copied);
+
+// function to copy the parsed states received from start_time to end_time (inclusive, telloc_time clock), oldest first,
+// up to capacity of them. if copied == capacity there may be more; ask again from the last one's received_time + 1
+int telloc_get_state_window(telloc_connection *connection, unsigned long long start_time, unsigned long long end_time, telloc_state *samples, unsigned int capacity, unsigned int *copied);
+
+// function to estimate the state at a telloc_time between the oldest and newest kept samples, interpolating the two around it.
+// returns 1 if the time is outside the history
+int telloc_interpolate_state(telloc_connection *connection, unsigned long long time, telloc_state *state);
+
+// function to wait up to timeout_ms milliseconds (-1 waits forever) for state newer than the last read, then read it.
+// returns 1 on timeout or disconnect
+int telloc_wait_state(telloc_connection *connection, int timeout_ms, char* state_buffer, unsigned int state_buffer_length);
+
+// function to get a file descriptor that is readable while unread state is waiting, for your own poll/epoll loop.
+// reading the state makes it unreadable again; do not read or close it yourself. returns -1 on Windows
+int telloc_get_state_fd(telloc_connection *connection);
+
+// function to receive a video frame from the Tello drone, packed in the connection's pixel format (RGB by default)
 int telloc_read_image(telloc_connection *connection, unsigned char* image, unsigned int image_buffer_size, unsigned int* image_bytes, unsigned int* image_width, unsigned int* image_height);
 
-// function to disconnect from the Tello drone
+// function to borrow the most recent video frame without copying it.
+// returns 1 if no new frame was decoded since the last acquire or read.
+// every acquired frame must be released; holding too many frames makes the decoder drop frames.
+int telloc_acquire_frame(telloc_connection *connection, const telloc_frame** frame);
+
+// function to wait up to timeout_ms milliseconds (-1 waits forever) for a frame newer than the last one
+// acquired or read, and borrow it. returns 1 on timeout or disconnect
+int telloc_wait_frame(telloc_connection *connection, int timeout_ms, const telloc_frame** frame);
+
+// function to wait like telloc_wait_frame, then copy the frame like telloc_read_image
+int telloc_wait_image(telloc_connection *connection, int timeout_ms, unsigned char* image, unsigned int image_buffer_size, unsigned int* image_bytes, unsigned int* image_width, unsigned int* image_height);
+
+// function to get a file descriptor that is readable while an unread frame is waiting, for your own poll/epoll loop.
+// acquiring or reading the frame makes it unreadable again; do not read or close it yourself. returns -1 on Windows
+int telloc_get_frame_fd(telloc_connection *connection);
+
+// function to hand an acquired frame back to the library
+int telloc_release_frame(telloc_connection *connection, const telloc_frame* frame);
+
+// function to get an acquired frame in another pixel format as well. each format is converted once per frame and kept
+// with it; converted stays valid until frame is released (release frame, not converted). call it from the thread holding the frame
+int telloc_convert_frame(telloc_connection *connection, const telloc_frame* frame, telloc_pixel_format format, const telloc_frame** converted);
+
+// function to start tracing every connection in the process: receive batches, decodes, conversions, reads, waits on
+// the video and command mutexes and commands are recorded into a ring of events_per_thread events per thread (0 for
+// 16384; threads that traced before keep their ring). costs a clock read or two per event while on, one check when off
+int telloc_trace_start(unsigned int events_per_thread);
+
+// function to stop tracing; the events recorded stay until the next telloc_trace_start
+int telloc_trace_stop(void);
+
+// function to write the events of the last telloc_trace_start as Chrome trace json, to open in ui.perfetto.dev or
+// chrome://tracing. frames are linked from their decode to their reader by flow arrows. can be called while tracing
+int telloc_trace_dump(const char *path);
+
+// function to disconnect from the Tello drone. returns 1 without disconnecting when called from one of the
+// connection's own command or periodic callbacks
 int telloc_disconnect(telloc_connection *connection_ptr_addr);
 
 #endif //TELLOC_TELLOC_H